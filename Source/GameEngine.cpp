@@ -4,7 +4,12 @@
 
 #include "GameEngine.h"
 #include "SystemMessage.h"
-#include <SDL_events.h>
+#ifndef DEDICATED_ONLY
+	#include <SDL_events.h>
+#endif
+#ifndef _WIN32
+	#include <fcntl.h>
+#endif
 
 // -----------------------------------------------
 // Legacy Declarations
@@ -12,10 +17,16 @@
 
 #include "../qcommon/shared/q_shared.h"
 void Qcommon_Init( int32_t argc, char **argv );
+cvar_t *Cvar_Get( const char *var_name, const char *value, int32_t flags );
 void Sys_Error( char *error, ... );
+#ifndef DEDICATED_ONLY
 void SDL_ProcEvent( SDL_Event *event, uint32_t time );
 extern SDL_bool Minimized;
+#endif
 extern cvar_t   *dedicated;
+#ifndef _WIN32
+extern cvar_t   *nostdout;
+#endif
 void Qcommon_Frame( int32_t msec );
 void CL_Shutdown( void );
 void Qcommon_Shutdown( void );
@@ -100,14 +111,22 @@ Game::Engine::~Engine()
 
 int Game::Engine::run()
 {	uint32_t lastFrame = timer.getCurrent(), thisFrame;
+#ifndef DEDICATED_ONLY
 	SDL_Event event;
+#endif
 	
 	while( !abortLoop )
-	{	while( SDL_PollEvent( &event ) )
+	{
+#ifdef DEDICATED_ONLY
+		// nothing to pump; SV_Frame blocks in NET_Sleep between server frames
+		System::Timer::Delay( 1 );
+#else
+		while( SDL_PollEvent( &event ) )
 			SDL_ProcEvent( &event, event.common.timestamp );
 			
 		if( Minimized || ( dedicated && dedicated->value ) )
 			System::Timer::Delay( 1 );
+#endif
 			
 		for( thisFrame = timer.getCurrent(); thisFrame <= lastFrame; thisFrame = timer.getCurrent() )
 			System::Timer::Delay();
@@ -1,5 +1,7 @@
 #include "GameEngine.h"
-#include <SDL_main.h>
+#ifndef DEDICATED_ONLY
+	#include <SDL_main.h>
+#endif
 
 int main( int argc, char *argv[] )
 {	Game::Engine game( argc, argv );
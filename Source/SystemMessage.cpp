@@ -1,23 +1,32 @@
 #include "SystemMessage.h"
-#include <SDL_messagebox.h>
+#ifndef DEDICATED_ONLY
+	#include <SDL_messagebox.h>
+#endif
 #include <iostream>
 
+// Headless builds have nowhere to pop up a message box.
+#ifdef DEDICATED_ONLY
+	#define ShowMessageBox( flags, title, message )
+#else
+	#define ShowMessageBox( flags, title, message ) SDL_ShowSimpleMessageBox( flags, title, message, nullptr )
+#endif
+
 void System::Message::Information( const std::string &message )
-{	SDL_ShowSimpleMessageBox( SDL_MESSAGEBOX_INFORMATION, "Information", message.c_str(), nullptr );
+{	ShowMessageBox( SDL_MESSAGEBOX_INFORMATION, "Information", message.c_str() );
 	std::cout << "[INFO] " << message;
 }
 
 void System::Message::Warning( const std::string &message )
-{	SDL_ShowSimpleMessageBox( SDL_MESSAGEBOX_WARNING, "Warning", message.c_str(), nullptr );
+{	ShowMessageBox( SDL_MESSAGEBOX_WARNING, "Warning", message.c_str() );
 	std::cout << "[WARN] " << message;
 }
 
 void System::Message::Error( const std::string &message )
-{	SDL_ShowSimpleMessageBox( SDL_MESSAGEBOX_ERROR, "Error", message.c_str(), nullptr );
+{	ShowMessageBox( SDL_MESSAGEBOX_ERROR, "Error", message.c_str() );
 	std::cerr << "[ERR] " << message;
 }
 
 void System::Message::Fatal( const std::string &message )
-{	SDL_ShowSimpleMessageBox( SDL_MESSAGEBOX_ERROR, "Fatal Error", message.c_str(), nullptr );
+{	ShowMessageBox( SDL_MESSAGEBOX_ERROR, "Fatal Error", message.c_str() );
 	std::cerr << "[FATAL] " << message;
 }
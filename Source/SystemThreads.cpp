@@ -0,0 +1,171 @@
+#include "SystemThreads.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+namespace
+{
+	struct Pool
+	{	std::vector<std::thread> threads;
+		std::mutex lock;
+		std::condition_variable wake;
+		std::condition_variable done;
+
+		System::Threads::Job job = nullptr;
+		void *data = nullptr;
+		int32_t count = 0;
+		std::atomic<int32_t> next{ 0 };
+
+		uint32_t generation = 0;	// bumped for every batch
+		uint32_t busy = 0;			// workers still inside the current batch
+		bool_t quit = false;
+
+		~Pool() { stop(); }
+
+		void stop()
+		{	{	std::lock_guard<std::mutex> guard( lock );
+				quit = true;
+			}
+			wake.notify_all();
+
+			for( auto &thread : threads )
+				thread.join();
+			threads.clear();
+			quit = false;
+		}
+	};
+
+	Pool pool;
+
+	void RunBatch( System::Threads::Job job, void *data, const int32_t count )
+	{	for( int32_t i = pool.next.fetch_add( 1 ); i < count; i = pool.next.fetch_add( 1 ) )
+			job( i, data );
+	}
+
+	// seen is the generation at spawn, so a batch issued before the
+	// thread first gets the lock still counts as new to it
+	void Worker( uint32_t seen )
+	{	std::unique_lock<std::mutex> guard( pool.lock );
+
+		for( ;; )
+		{	pool.wake.wait( guard, [&seen]() { return pool.quit || pool.generation != seen; } );
+			if( pool.quit )
+				return;
+
+			seen = pool.generation;
+			System::Threads::Job job = pool.job;
+			void *data = pool.data;
+			const int32_t count = pool.count;
+
+			guard.unlock();
+			RunBatch( job, data, count );
+			guard.lock();
+
+			if( --pool.busy == 0 )
+				pool.done.notify_one();
+		}
+	}
+}
+
+void System::Threads::Init( const uint32_t workers )
+{	if( workers == pool.threads.size() )
+		return;
+
+	pool.stop();
+
+	std::lock_guard<std::mutex> guard( pool.lock );
+	for( uint32_t i = 0; i < workers; i++ )
+		pool.threads.emplace_back( Worker, pool.generation );
+}
+
+void System::Threads::Shutdown()
+{	pool.stop();
+}
+
+uint32_t System::Threads::Workers()
+{	return static_cast<uint32_t>( pool.threads.size() );
+}
+
+void System::Threads::ParallelFor( const int32_t count, Job job, void *data )
+{	if( pool.threads.empty() || count <= 1 )
+	{	for( int32_t i = 0; i < count; i++ )
+			job( i, data );
+		return;
+	}
+
+	{	std::lock_guard<std::mutex> guard( pool.lock );
+		pool.job = job;
+		pool.data = data;
+		pool.count = count;
+		pool.next = 0;
+		pool.busy = static_cast<uint32_t>( pool.threads.size() );
+		pool.generation++;
+	}
+	pool.wake.notify_all();
+
+	// the caller takes indices too instead of idling
+	RunBatch( job, data, count );
+
+	std::unique_lock<std::mutex> guard( pool.lock );
+	pool.done.wait( guard, []() { return pool.busy == 0; } );
+}
+
+int32_t System::Threads::FetchAdd( int32_t *value, const int32_t amount )
+{
+#ifdef _MSC_VER
+	return _InterlockedExchangeAdd( reinterpret_cast<volatile long *>( value ), amount );
+#else
+	return __atomic_fetch_add( value, amount, __ATOMIC_RELAXED );
+#endif
+}
+
+
+int32_t System::Threads::Load( const int32_t *value )
+{
+#ifdef _MSC_VER
+	const int32_t result = *reinterpret_cast<const volatile long *>( value );
+	_ReadWriteBarrier();
+	return result;
+#else
+	return __atomic_load_n( value, __ATOMIC_ACQUIRE );
+#endif
+}
+
+void System::Threads::Store( int32_t *value, const int32_t amount )
+{
+#ifdef _MSC_VER
+	_ReadWriteBarrier();
+	*reinterpret_cast<volatile long *>( value ) = amount;
+#else
+	__atomic_store_n( value, amount, __ATOMIC_RELEASE );
+#endif
+}
+
+void System::Threads::Thread::Start( Job job, void *data )
+{	handle = std::thread( job, 0, data );
+}
+
+void System::Threads::Thread::Join()
+{	if( handle.joinable() )
+		handle.join();
+}
+
+void System::Threads::Event::Signal()
+{	{	std::lock_guard<std::mutex> guard( lock );
+		signalled = true;
+	}
+	wake.notify_one();
+}
+
+bool_t System::Threads::Event::Wait( const uint32_t ms )
+{	std::unique_lock<std::mutex> guard( lock );
+	const bool_t woken = wake.wait_for( guard, std::chrono::milliseconds( ms ), [this]() { return signalled; } );
+	signalled = false;
+	return woken;
+}
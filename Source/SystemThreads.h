@@ -0,0 +1,77 @@
+#ifndef SYSTEM_THREADS_H
+#define SYSTEM_THREADS_H 1
+
+#include "Shared.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Per thread storage for plain data, VS2013 has no thread_local.
+#ifdef _MSC_VER
+	#define THREAD_LOCAL __declspec( thread )
+#else
+	#define THREAD_LOCAL __thread
+#endif
+
+namespace System
+{
+	namespace Threads
+	{
+		typedef void ( *Job )( int32_t index, void *data );
+
+		// Resizes the worker pool, 0 joins every worker.
+		void Init( const uint32_t workers );
+		void Shutdown();
+		uint32_t Workers();
+
+		// Runs job( 0 .. count-1 ) across the workers and the calling
+		// thread, returning once every index has finished.
+		void ParallelFor( const int32_t count, Job job, void *data );
+
+		// Atomically adds amount to value and returns the previous value.
+		int32_t FetchAdd( int32_t *value, const int32_t amount );
+
+		// Reads value after everything written before the matching Store.
+		int32_t Load( const int32_t *value );
+
+		// Writes value once everything before it is visible to other threads.
+		void Store( int32_t *value, const int32_t amount );
+
+		// Plain lock for engine tables shared with the workers.
+		class Mutex
+		{	public:
+				void lock() { handle.lock(); }
+				void unlock() { handle.unlock(); }
+
+			private:
+				std::mutex handle;
+		};
+
+		// A thread of its own running job( 0, data ), outside the pool.
+		class Thread
+		{	public:
+				void Start( Job job, void *data );
+				void Join();
+
+			private:
+				std::thread handle;
+		};
+
+		// Auto resetting wakeup, a Signal with nobody waiting is kept
+		// for the next Wait.
+		class Event
+		{	public:
+				void Signal();
+
+				// Returns false if ms passed without a Signal.
+				bool_t Wait( const uint32_t ms );
+
+			private:
+				std::mutex lock;
+				std::condition_variable wake;
+				bool_t signalled = false;
+		};
+	}
+}
+
+#endif
@@ -1,30 +1,63 @@
 #include "SystemMessage.h"
 #include "SystemTimer.h"
-#include <SDL_hints.h>
-#include <SDL_timer.h>
+#include <chrono>
+#ifndef DEDICATED_ONLY
+	#include <SDL_hints.h>
+	#include <SDL_timer.h>
+#else
+	#include <thread>
+#endif
 
 bool_t System::Timer::tuned = false;
 
+#ifdef DEDICATED_ONLY
+static uint32_t GetTicks()
+{	return static_cast<uint32_t>( std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count() );
+}
+#else
+static uint32_t GetTicks()
+{	return SDL_GetTicks();
+}
+#endif
+
 System::Timer::Timer()
 	: timeStarted( 0 ), timeLast( 0 )
 {	Tune();
-	timeStarted = SDL_GetTicks();
+	timeStarted = GetTicks();
 }
 
 uint32_t System::Timer::getCurrent()
-{	return timeLast = ( SDL_GetTicks() - timeStarted );
+{	return timeLast = ( GetTicks() - timeStarted );
 }
 
 void System::Timer::Delay( const uint32_t ms )
-{	SDL_Delay( ms );
+{
+#ifdef DEDICATED_ONLY
+	if( ms )
+		std::this_thread::sleep_for( std::chrono::milliseconds( ms ) );
+	else std::this_thread::yield();
+#else
+	SDL_Delay( ms );
+#endif
+}
+
+// Free running, only good for measuring intervals.
+uint64_t System::Timer::Microseconds()
+{	return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count() );
 }
 
 bool_t System::Timer::Tune()
-{	if( !tuned )
+{
+#ifdef DEDICATED_ONLY
+	// steady_clock is already millisecond-accurate without any OS hints.
+	tuned = true;
+#else
+	if( !tuned )
 	{	if( !SDL_SetHintWithPriority( SDL_HINT_TIMER_RESOLUTION, "1", SDL_HINT_OVERRIDE ) )
 			System::Message::Warning( "Unable to set OS timer resolution." );
 		else tuned = true;
 	}
+#endif
 	
 	return tuned;
 }
@@ -13,6 +13,7 @@ namespace System
 			uint32_t getCurrent();
 			
 			static void Delay( const uint32_t ms = 0 );
+			static uint64_t Microseconds();
 			static bool_t Tune();
 			
 		private:
@@ -21,7 +21,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // cl_null.c -- this file can stub out the entire client system
 // for pure dedicated servers
 
-#include "../qcommon/qcommon.h"
+#include "../../qcommon/qcommon.h"
+
+// speed controls read by pmove, always the defaults without a client
+player_state_t *clientstate;
+
+// savegame screenshots are a client/renderer feature
+struct image_s *load_saveshot;
 
 void Key_Bind_Null_f(void)
 {
@@ -39,7 +45,7 @@ void CL_Shutdown (void)
 {
 }
 
-void CL_Frame (int msec)
+void CL_Frame (int32_t msec)
 {
 }
 
@@ -55,7 +61,7 @@ void Cmd_ForwardToServer (void)
 	Com_Printf ("Unknown command \"%s\"\n", cmd);
 }
 
-void SCR_DebugGraph (float value, int color)
+void SCR_DebugGraph (float value, int32_t color)
 {
 }
 
@@ -72,3 +78,31 @@ void Key_Init (void)
 	Cmd_AddCommand ("bind", Key_Bind_Null_f);
 }
 
+/*
+==================
+LegacyProtocol
+
+The server always uses the new protocol.
+==================
+*/
+qboolean LegacyProtocol (void)
+{
+	return false;
+}
+
+void R_GrabScreen (void)
+{
+}
+
+void R_ScaledScreenshot (char *name)
+{
+}
+
+void R_FreePic (char *name)
+{
+}
+
+struct image_s *R_DrawFindPic (char *name)
+{
+	return NULL;
+}
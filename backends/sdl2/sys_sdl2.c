@@ -217,7 +217,7 @@ void Sys_ConsoleOutput (char *string)
 #else
 
 qboolean stdin_active = true;
-static cvar_t *nostdout;
+cvar_t *nostdout;
 
 char *Sys_ConsoleInput(void)
 {
@@ -157,7 +157,7 @@ idnewt:28000
 192.246.40.70:28000
 =============
 */
-qboolean	NET_StringToSockaddr (char *s, struct sockaddr *sadr)
+qboolean	NET_StringToSockaddr (const char *s, struct sockaddr *sadr)
 {
 	struct hostent	*h;
 	char	*colon;
@@ -202,7 +202,7 @@ idnewt:28000
 192.246.40.70:28000
 =============
 */
-qboolean	NET_StringToAdr (char *s, netadr_t *a)
+qboolean	NET_StringToAdr (const char *s, netadr_t *a)
 {
 	struct sockaddr_in sadr;
 	
@@ -259,9 +259,9 @@ qboolean	NET_GetLoopPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_me
 }
 
 
-void NET_SendLoopPacket (netsrc_t sock, int length, void *data, netadr_t to)
+void NET_SendLoopPacket (netsrc_t sock, int numparts, const netbuf_t *parts, netadr_t to)
 {
-	int		i;
+	int		i, j, length;
 	loopback_t	*loop;
 
 	loop = &loopbacks[sock^1];
@@ -269,12 +269,143 @@ void NET_SendLoopPacket (netsrc_t sock, int length, void *data, netadr_t to)
 	i = loop->send & (MAX_LOOPBACK-1);
 	loop->send++;
 
-	memcpy (loop->msgs[i].data, data, length);
+	for (j=0, length=0 ; j<numparts ; j++)
+	{
+		memcpy (loop->msgs[i].data + length, parts[j].data, parts[j].length);
+		length += parts[j].length;
+	}
 	loop->msgs[i].datalen = length;
 }
 
 //=============================================================================
 
+/*
+=============================================================================
+
+BATCHED SOCKET IO
+
+On linux the sockets are drained with one recvmmsg into a ring of
+preallocated buffers, and the server queues a whole frame of client
+datagrams for a single sendmmsg.  net_batch 0, or a kernel without
+the calls, falls back to one recvfrom/sendto per packet.
+
+=============================================================================
+*/
+
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define	NET_MMSG
+#endif
+
+#define	NET_RECV_BATCH		16
+#define	NET_SEND_BATCH		64
+#define	NET_SEND_ARENA		0x40000
+
+cvar_t		*net_batch;
+
+#ifdef NET_MMSG
+typedef struct
+{
+	struct mmsghdr		msgs[NET_RECV_BATCH];
+	struct iovec		iov[NET_RECV_BATCH];
+	struct sockaddr_in	from[NET_RECV_BATCH];
+	byte				data[NET_RECV_BATCH][MAX_MSGLEN];
+	int					get, count;
+} recvring_t;
+
+typedef struct
+{
+	struct mmsghdr		msgs[NET_SEND_BATCH];
+	struct iovec		iov[NET_SEND_BATCH];
+	struct sockaddr_in	to[NET_SEND_BATCH];
+	netadr_t			adr[NET_SEND_BATCH];
+	byte				arena[NET_SEND_ARENA];
+	int					count, used;
+	int					socket;
+} sendqueue_t;
+
+static recvring_t	recvrings[2];
+static sendqueue_t	sendqueue;
+static qboolean		net_mmsg_failed;
+#endif
+
+static qboolean	net_batching[2];
+
+/*
+====================
+NET_UseBatch
+====================
+*/
+static qboolean NET_UseBatch (void)
+{
+#ifdef NET_MMSG
+	return net_batch && net_batch->value && !net_mmsg_failed;
+#else
+	return false;
+#endif
+}
+
+#ifdef NET_MMSG
+/*
+====================
+NET_MmsgFailed
+
+The kernel or libc doesn't have the call, stop trying
+====================
+*/
+static qboolean NET_MmsgFailed (int err)
+{
+	if (err != ENOSYS && err != EOPNOTSUPP)
+		return false;
+
+	Com_Printf ("NET: recvmmsg/sendmmsg unavailable, using single packet io\n");
+	net_mmsg_failed = true;
+	return true;
+}
+
+/*
+====================
+NET_FillRing
+
+Returns -1 when the batched call isn't usable and the caller
+should read the socket directly
+====================
+*/
+static int NET_FillRing (recvring_t *ring, int net_socket)
+{
+	int		i, ret;
+
+	for (i=0 ; i<NET_RECV_BATCH ; i++)
+	{
+		ring->iov[i].iov_base = ring->data[i];
+		ring->iov[i].iov_len = MAX_MSGLEN;
+		memset (&ring->msgs[i], 0, sizeof(ring->msgs[i]));
+		ring->msgs[i].msg_hdr.msg_name = &ring->from[i];
+		ring->msgs[i].msg_hdr.msg_namelen = sizeof(ring->from[i]);
+		ring->msgs[i].msg_hdr.msg_iov = &ring->iov[i];
+		ring->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ring->get = ring->count = 0;
+	ret = recvmmsg (net_socket, ring->msgs, NET_RECV_BATCH, MSG_DONTWAIT, NULL);
+	if (ret == -1)
+	{
+		if (NET_MmsgFailed (errno))
+			return -1;
+		if (errno != EWOULDBLOCK && errno != ECONNREFUSED)
+			Com_Printf ("NET_GetPacket: %s\n", NET_ErrorString());
+		return 0;
+	}
+
+	ring->count = ret;
+	return ret;
+}
+#endif
+
+/*
+====================
+NET_GetPacket
+====================
+*/
 qboolean	NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 {
 	int 	ret;
@@ -283,10 +414,45 @@ qboolean	NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_messag
 	int		net_socket;
 	int		protocol;
 	int		err;
+#ifdef NET_MMSG
+	recvring_t	*ring;
+	int			i;
+#endif
 
 	if (NET_GetLoopPacket (sock, net_from, net_message))
 		return true;
 
+#ifdef NET_MMSG
+	// ipx is never opened, so the ring only ever holds ip packets
+	ring = &recvrings[sock];
+	if (ip_sockets[sock] && NET_UseBatch ())
+	{
+		for ( ;; )
+		{
+			if (ring->get >= ring->count && NET_FillRing (ring, ip_sockets[sock]) <= 0)
+			{
+				if (!net_mmsg_failed)
+					return false;
+				break;
+			}
+
+			i = ring->get++;
+			SockadrToNetadr (&ring->from[i], net_from);
+
+			if ((int32_t)ring->msgs[i].msg_len >= net_message->maxsize
+				|| (ring->msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+			{
+				Com_Printf ("Oversize packet from %s\n", NET_AdrToString (*net_from));
+				continue;
+			}
+
+			memcpy (net_message->data, ring->data[i], ring->msgs[i].msg_len);
+			net_message->cursize = ring->msgs[i].msg_len;
+			return true;
+		}
+	}
+#endif
+
 	for (protocol = 0 ; protocol < 2 ; protocol++)
 	{
 		if (protocol == 0)
@@ -329,15 +495,101 @@ qboolean	NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_messag
 
 //=============================================================================
 
-void NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to)
+#ifdef NET_MMSG
+/*
+====================
+NET_SendQueue
+
+Sends everything queued with one sendmmsg, a packet the kernel refuses
+is reported and skipped so the rest still go out
+====================
+*/
+static void NET_SendQueue (void)
+{
+	sendqueue_t	*q = &sendqueue;
+	int			i, sent, ret;
+
+	for (i=0 ; i<q->count ; i++)
+	{
+		memset (&q->msgs[i], 0, sizeof(q->msgs[i]));
+		q->msgs[i].msg_hdr.msg_name = &q->to[i];
+		q->msgs[i].msg_hdr.msg_namelen = sizeof(q->to[i]);
+		q->msgs[i].msg_hdr.msg_iov = &q->iov[i];
+		q->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (sent = 0 ; sent < q->count ; )
+	{
+		ret = sendmmsg (q->socket, q->msgs + sent, q->count - sent, 0);
+		if (ret > 0)
+		{
+			sent += ret;
+			continue;
+		}
+
+		if (ret == -1 && NET_MmsgFailed (errno))
+		{
+			for ( ; sent < q->count ; sent++)
+				sendto (q->socket, q->iov[sent].iov_base, q->iov[sent].iov_len, 0,
+					(struct sockaddr *)&q->to[sent], sizeof(q->to[sent]));
+			break;
+		}
+
+		Com_Printf ("NET_SendPacket ERROR: %s to %s\n", NET_ErrorString(),
+				NET_AdrToString (q->adr[sent]));
+		sent++;
+	}
+
+	q->count = q->used = 0;
+}
+#endif
+
+/*
+====================
+NET_BeginBatch
+
+Holds NET_SendPacket on this socket until NET_FlushBatch
+====================
+*/
+void NET_BeginBatch (netsrc_t sock)
+{
+	NET_FlushBatch (sock);
+	net_batching[sock] = NET_UseBatch ();
+}
+
+/*
+====================
+NET_FlushBatch
+====================
+*/
+void NET_FlushBatch (netsrc_t sock)
+{
+	net_batching[sock] = false;
+#ifdef NET_MMSG
+	if (sendqueue.count)
+		NET_SendQueue ();
+#endif
+}
+
+/*
+====================
+NET_SendPacketv
+
+Sends the parts as one datagram, straight from the callers buffers
+unless it has to be held for a batch
+====================
+*/
+void NET_SendPacketv (netsrc_t sock, int32_t numparts, const netbuf_t *parts, netadr_t to)
 {
-	int		ret;
+	int		i, ret, length;
 	struct sockaddr_in	addr;
+	struct iovec	iov[NET_MAX_PARTS];
+	struct msghdr	msg;
 	int		net_socket;
 
 	if ( to.type == NA_LOOPBACK )
 	{
-		NET_SendLoopPacket (sock, length, data, to);
+		NET_SendLoopPacket (sock, numparts, parts, to);
 		return;
 	}
 
@@ -372,7 +624,45 @@ void NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to)
     
 	NetadrToSockadr (&to, &addr);
 
-	ret = sendto (net_socket, data, length, 0, (struct sockaddr *)&addr, sizeof(addr) );
+	for (i=0, length=0 ; i<numparts ; i++)
+	{
+		iov[i].iov_base = (void *)parts[i].data;
+		iov[i].iov_len = parts[i].length;
+		length += parts[i].length;
+	}
+
+#ifdef NET_MMSG
+	if (net_batching[sock] && length <= NET_SEND_ARENA)
+	{
+		sendqueue_t	*q = &sendqueue;
+
+		if (q->count && q->socket != net_socket)
+			NET_SendQueue ();
+		if (q->count == NET_SEND_BATCH || q->used + length > NET_SEND_ARENA)
+			NET_SendQueue ();
+
+		q->iov[q->count].iov_base = q->arena + q->used;
+		q->iov[q->count].iov_len = length;
+		for (i=0 ; i<numparts ; i++)
+		{
+			memcpy (q->arena + q->used, parts[i].data, parts[i].length);
+			q->used += parts[i].length;
+		}
+		q->to[q->count] = addr;
+		q->adr[q->count] = to;
+		q->socket = net_socket;
+		q->count++;
+		return;
+	}
+#endif
+
+	memset (&msg, 0, sizeof(msg));
+	msg.msg_name = &addr;
+	msg.msg_namelen = sizeof(addr);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = numparts;
+
+	ret = sendmsg (net_socket, &msg, 0);
 	if (ret == -1)
 	{
 		Com_Printf ("NET_SendPacket ERROR: %s to %s\n", NET_ErrorString(),
@@ -380,6 +670,15 @@ void NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to)
 	}
 }
 
+void NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to)
+{
+	netbuf_t	part;
+
+	part.data = data;
+	part.length = length;
+	NET_SendPacketv (sock, 1, &part, to);
+}
+
 
 //=============================================================================
 
@@ -429,6 +728,10 @@ void	NET_Config (qboolean multiplayer)
 	{	// shut down any existing sockets
 		for (i=0 ; i<2 ; i++)
 		{
+			NET_FlushBatch ((netsrc_t)i);
+#ifdef NET_MMSG
+			recvrings[i].get = recvrings[i].count = 0;
+#endif
 			if (ip_sockets[i])
 			{
 				close (ip_sockets[i]);
@@ -459,6 +762,7 @@ NET_Init
 */
 void NET_Init (void)
 {
+	net_batch = Cvar_Get ("net_batch", "1", CVAR_ARCHIVE);
 }
 
 
@@ -506,7 +810,7 @@ int NET_Socket (char *net_interface, int port)
 
 	address.sin_family = AF_INET;
 
-	if( bind (newsocket, (void *)&address, sizeof(address)) == -1)
+	if( bind (newsocket, (struct sockaddr *)&address, sizeof(address)) == -1)
 	{
 		Com_Printf ("ERROR: UDP_OpenSocket: bind: %s\n", NET_ErrorString());
 		close (newsocket);
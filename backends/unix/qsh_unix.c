@@ -29,8 +29,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <fcntl.h>
 #include <sys/time.h>
 #include <ctype.h>
+#include <signal.h>
+#include <stdint.h>
 
 #include "glob.h"
 
@@ -57,10 +60,10 @@ void *Hunk_Begin (int maxsize)
 	curhunksize = 0;
 
 #if (defined __FreeBSD__) || (defined __APPLE__)
-	membase = mmap(0, maxhunksize, PROT_READ|PROT_WRITE, 
+	membase = (byte *)mmap(0, maxhunksize, PROT_READ|PROT_WRITE, 
 		MAP_PRIVATE|MAP_ANON, -1, 0);
 #else
-	membase = mmap(0, maxhunksize, PROT_READ|PROT_WRITE, 
+	membase = (byte *)mmap(0, maxhunksize, PROT_READ|PROT_WRITE, 
 		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
 #endif
 
@@ -110,7 +113,7 @@ int Hunk_End (void)
 		n = munmap(unmap_base, unmap_len) + membase;
 	}
 #else
-	n = mremap(membase, maxhunksize, curhunksize + sizeof(int), 0);
+	n = (byte *)mremap(membase, maxhunksize, curhunksize + sizeof(int), 0);
 #endif
 	if (n != membase)
 		Sys_Error("Hunk_End:  Could not remap virtual block (%d)", errno);
@@ -130,6 +133,112 @@ void Hunk_Free (void *base)
 	}
 }
 
+/*
+=================
+Sys_MapFile
+
+A mapped file that gets truncated underneath us would raise SIGBUS on
+the next read past its new end.  The pages that went away are replaced
+with zeroes instead, so a download goes wrong rather than the server.
+=================
+*/
+#define	MAX_MAPPED_FILES	64
+
+typedef struct
+{
+	byte	*base;		// NULL if free
+	size_t	size;
+} mappedfile_t;
+
+static volatile mappedfile_t	sys_mapped[MAX_MAPPED_FILES];
+static struct sigaction	sys_oldsigbus;
+static size_t	sys_pagesize;
+
+static void Sys_SigBus (int sig, siginfo_t *info, void *context)
+{
+	byte		*addr = (byte *)info->si_addr;
+	byte		*base, *page, *end;
+	int			i;
+
+	for (i=0 ; i<MAX_MAPPED_FILES ; i++)
+	{
+		base = sys_mapped[i].base;
+		if (!base || addr < base || addr >= base + sys_mapped[i].size)
+			continue;
+
+		// the rest of the file is gone, so is the rest of the view
+		page = (byte *)((uintptr_t)addr & ~(uintptr_t)(sys_pagesize-1));
+		end = (byte *)(((uintptr_t)(base + sys_mapped[i].size) + sys_pagesize-1) & ~(uintptr_t)(sys_pagesize-1));
+		if (mmap (page, end - page, PROT_READ, MAP_PRIVATE|MAP_ANON|MAP_FIXED, -1, 0) != MAP_FAILED)
+			return;
+		break;
+	}
+
+	// not ours, fault again with whatever handled it before
+	sigaction (SIGBUS, &sys_oldsigbus, NULL);
+}
+
+void *Sys_MapFile (const char *path, int32_t size)
+{
+	struct sigaction	action;
+	void	*base;
+	int		fd, i;
+
+	if (size <= 0)
+		return NULL;
+
+	if (!sys_pagesize)
+	{
+		sys_pagesize = sysconf (_SC_PAGESIZE);
+		memset (&action, 0, sizeof(action));
+		action.sa_sigaction = Sys_SigBus;
+		action.sa_flags = SA_SIGINFO;
+		sigemptyset (&action.sa_mask);
+		sigaction (SIGBUS, &action, &sys_oldsigbus);
+	}
+
+	for (i=0 ; i<MAX_MAPPED_FILES ; i++)
+		if (!sys_mapped[i].base)
+			break;
+	if (i == MAX_MAPPED_FILES)
+		return NULL;	// the caller reads it instead
+
+	fd = open (path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	// the mapping keeps its own reference to the file
+	base = mmap (0, size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+
+	if (base == MAP_FAILED)
+		return NULL;
+
+	sys_mapped[i].size = size;
+	sys_mapped[i].base = (byte *)base;
+	return base;
+}
+
+/*
+=================
+Sys_UnmapFile
+=================
+*/
+void Sys_UnmapFile (void *base, int32_t size)
+{
+	int		i;
+
+	if (!base)
+		return;
+
+	for (i=0 ; i<MAX_MAPPED_FILES ; i++)
+	{
+		if (sys_mapped[i].base == base)
+			sys_mapped[i].base = NULL;
+	}
+	munmap (base, size);
+}
+
 //===============================================================================
 
 void Sys_Mkdir (char *path)
@@ -0,0 +1,340 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sys_ded.c -- system driver for the headless dedicated server, no SDL
+
+#include "../../Source/GameEngine.h"
+
+#include "../../qcommon/qcommon.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/select.h>
+#include <sys/utsname.h>
+
+uint32_t	sys_frame_time;
+uint32_t    sys_cacheline;
+
+qboolean stdin_active = true;
+cvar_t *nostdout;
+
+
+/*
+================
+Sys_Milliseconds
+================
+*/
+int32_t Sys_Milliseconds (void)
+{
+	return Game::Engine::NewTick();
+}
+
+/*
+===============================================================================
+
+DEDICATED CONSOLE
+
+===============================================================================
+*/
+
+char *Sys_ConsoleInput (void)
+{
+	static char text[256];
+	int     len;
+	fd_set	fdset;
+	struct timeval timeout;
+
+	if (!stdin_active)
+		return NULL;
+
+	FD_ZERO(&fdset);
+	FD_SET(0, &fdset); // stdin
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 0;
+	if (select (1, &fdset, NULL, NULL, &timeout) == -1 || !FD_ISSET(0, &fdset))
+		return NULL;
+
+	len = read (0, text, sizeof(text));
+	if (len == 0) { // eof!
+		stdin_active = false;
+		return NULL;
+	}
+
+	if (len < 1)
+		return NULL;
+	text[len-1] = 0;    // rip off the /n and terminate
+
+	return text;
+}
+
+void Sys_ConsoleOutput (char *string)
+{
+	if (nostdout && nostdout->value)
+		return;
+
+	fputs(string, stdout);
+}
+
+/*
+================
+Sys_SendKeyEvents
+
+No input devices, just grab the frame time
+================
+*/
+void Sys_SendKeyEvents (void)
+{
+	sys_frame_time = Sys_Milliseconds();
+}
+
+char *Sys_GetClipboardData( void )
+{
+	return NULL;
+}
+
+void Sys_AppActivate (void)
+{
+}
+
+void Sys_CopyProtect (void)
+{
+}
+
+/*
+===============================================================================
+
+SYSTEM IO
+
+===============================================================================
+*/
+
+void Sys_Error (char *error, ...)
+{
+	va_list		argptr;
+	char		text[1024];
+
+	CL_Shutdown ();
+	Qcommon_Shutdown ();
+
+	// change stdin back to blocking
+	fcntl (0, F_SETFL, fcntl (0, F_GETFL, 0) & ~FNDELAY);
+
+	va_start (argptr, error);
+	Q_vsnprintf (text, sizeof(text), error, argptr);
+	va_end (argptr);
+	fprintf (stderr, "Error: %s\n", text);
+
+	exit (1);
+}
+
+char *basepath = NULL;
+
+/*
+================
+Sys_GetBaseDir
+
+The directory holding the executable, same as SDL_GetBasePath
+================
+*/
+char *Sys_GetBaseDir (void)
+{
+	char	exe[MAX_OSPATH];
+	char	*slash;
+	int32_t	len;
+
+	if (basepath)
+		return basepath;
+
+	len = readlink ("/proc/self/exe", exe, sizeof(exe) - 1);
+	if (len > 0)
+	{
+		exe[len] = 0;
+		slash = strrchr (exe, '/');
+		if (slash && slash != exe)
+		{
+			*slash = 0;
+			basepath = (char*)Z_TagStrdup(exe, TAG_SYSTEM);
+		}
+	}
+	if (!basepath)
+		basepath = (char*)Z_TagStrdup(".", TAG_SYSTEM);
+
+	Com_Printf ("Using base path %s\n", basepath);
+	return basepath;
+}
+
+/*
+================
+Sys_Init
+================
+*/
+void Sys_Init (void)
+{
+	struct utsname	name;
+	char	string[64];
+	long	value;
+
+	if (uname (&name) == 0)
+		Cvar_Get("sys_os", name.sysname, CVAR_NOSET|CVAR_LATCH);
+
+	Com_sprintf (string, sizeof(string), "%li-core CPU", sysconf (_SC_NPROCESSORS_ONLN));
+	Cvar_Get("sys_cpu", string, CVAR_NOSET|CVAR_LATCH);
+
+#ifdef _SC_LEVEL1_DCACHE_LINESIZE
+	value = sysconf (_SC_LEVEL1_DCACHE_LINESIZE);
+#else
+	value = 0;
+#endif
+	sys_cacheline = (value > 0) ? value : 64;
+
+	// physical memory in megabytes, same as SDL_GetSystemRAM
+	value = sysconf (_SC_PHYS_PAGES) / (1024 * 1024 / sysconf (_SC_PAGESIZE));
+	Com_sprintf (string, sizeof(string), "%li", value);
+	Cvar_Get("sys_ram", string, CVAR_NOSET|CVAR_LATCH);
+}
+
+/*
+========================================================================
+
+GAME DLL
+
+========================================================================
+*/
+
+static void* game_library;
+
+/*
+=================
+Sys_UnloadGame
+=================
+*/
+void Sys_UnloadGame (void)
+{
+	if (game_library)
+		dlclose (game_library);
+	game_library = NULL;
+}
+
+/*
+=================
+Sys_FindLibrary
+
+Same search order as the SDL2 backend
+=================
+*/
+void* Sys_FindLibrary(const char *dllnames[])
+{
+	char	name[MAX_OSPATH];
+	char	*path;
+	char	cwd[MAX_OSPATH];
+	int32_t i = 0;
+	void	*library = NULL;
+
+#ifndef _DEBUG
+	const char *debugdir = "release";
+#else
+	const char *debugdir = "debug";
+#endif
+
+	// check the current debug directory first for development purposes
+	if (!getcwd (cwd, sizeof(cwd)))
+		cwd[0] = 0;
+
+	for (i = 0; (dllnames[i] != 0) && (library == NULL); i++)
+	{
+		Com_sprintf (name, sizeof(name), "%s/%s/%s.so", cwd, debugdir, dllnames[i]);
+		library = dlopen (name, RTLD_NOW);
+		if (!library)
+			Com_DPrintf("failed to load %s: %s\n", name, dlerror());
+	}
+	if (library)
+	{
+		Com_DPrintf ("dlopen (%s)\n", name);
+		return library;
+	}
+
+	// now run through the search paths
+	path = NULL;
+	while (1)
+	{
+		path = FS_NextPath (path);
+		if (!path)
+			return NULL;		// couldn't find one anywhere
+		for (i = 0; dllnames[i] != 0 && (library == NULL); i++)
+		{
+			Com_sprintf (name, sizeof(name), "%s/%s.so", path, dllnames[i]);
+			library = dlopen (name, RTLD_NOW);
+			if (!library)
+				Com_DPrintf("failed to load %s: %s\n", name, dlerror());
+		}
+		if (library)
+		{
+			Com_DPrintf ("dlopen (%s)\n", name);
+			return library;
+		}
+	}
+}
+
+/*
+=================
+Sys_GetGameAPI
+
+Loads the game dll
+=================
+*/
+void *Sys_GetGameAPI (void *parms)
+{
+	void	*(*GetGameAPI) (void *);
+#ifdef KMQUAKE2_ENGINE_MOD
+#	if defined(__x86_64__)
+#		ifdef _DEBUG
+			static const char * dllnames[] = { "Game_d_x86-64", "Game_x86-64", 0 };
+#		else
+			static const char * dllnames[] = { "Game_x86-64", "Game_d_x86-64", 0 };
+#		endif
+#	else
+#		ifdef _DEBUG
+			static const char * dllnames[] = { "Game_d_x86", "Game_x86", 0 };
+#		else
+			static const char * dllnames[] = { "Game_x86", "Game_d_x86", 0 };
+#		endif
+#	endif
+#else
+	static const char *dllnames[] = {"game", "gamex86",0};
+#endif
+
+	if (game_library)
+		Com_Error (ERR_FATAL, "Sys_GetGameAPI without Sys_UnloadingGame");
+
+	game_library = Sys_FindLibrary(dllnames);
+
+	if (!game_library)
+		return NULL;
+
+	GetGameAPI = (void *(*)(void*)) dlsym (game_library, "GetGameAPI");
+	if (!GetGameAPI)
+	{
+		Sys_UnloadGame ();
+		return NULL;
+	}
+
+	return GetGameAPI (parms);
+}
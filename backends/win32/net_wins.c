@@ -445,6 +445,44 @@ qboolean	NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_messag
 
 //=============================================================================
 
+/*
+====================
+NET_BeginBatch / NET_FlushBatch
+
+Winsock has no sendmmsg, packets always go out as they are sent
+====================
+*/
+void NET_BeginBatch (netsrc_t sock)
+{
+}
+
+void NET_FlushBatch (netsrc_t sock)
+{
+}
+
+/*
+====================
+NET_SendPacketv
+
+Gathers the parts and sends them as one datagram
+====================
+*/
+void NET_SendPacketv (netsrc_t sock, int32_t numparts, const netbuf_t *parts, netadr_t to)
+{
+	static byte	packet[MAX_MSGLEN];
+	int32_t		i, length;
+
+	for (i=0, length=0 ; i<numparts ; i++)
+	{
+		if (length + parts[i].length > sizeof(packet))
+			Com_Error (ERR_FATAL, "NET_SendPacketv: packet too big");
+		memcpy (packet + length, parts[i].data, parts[i].length);
+		length += parts[i].length;
+	}
+
+	NET_SendPacket (sock, length, packet, to);
+}
+
 void NET_SendPacket (netsrc_t sock, int32_t length, void *data, netadr_t to)
 {
 	int32_t		ret;
@@ -113,6 +113,45 @@ void Hunk_Free (void *base)
 	hunkcount--;
 }
 
+/*
+=================
+Sys_MapFile
+=================
+*/
+void *Sys_MapFile (const char *path, int32_t size)
+{
+	HANDLE	file, mapping;
+	void	*base;
+
+	if (size <= 0)
+		return NULL;
+
+	file = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	mapping = CreateFileMapping (file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle (file);
+	if (!mapping)
+		return NULL;
+
+	// the view keeps the mapping and the file open
+	base = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, size);
+	CloseHandle (mapping);
+	return base;
+}
+
+/*
+=================
+Sys_UnmapFile
+=================
+*/
+void Sys_UnmapFile (void *base, int32_t size)
+{
+	if (base)
+		UnmapViewOfFile (base);
+}
+
 //===============================================================================
 
 void Sys_Mkdir (char *path)
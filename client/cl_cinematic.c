@@ -188,30 +188,6 @@ void Q_strcat (char *dst, const char *src, int32_t dstSize)
 }
 
 
-/*
-=================
-Com_FileExtension
-
-Returns the extension, if any (does not include the .)
-=================
-*/
-void Com_FileExtension (const char *path, char *dst, int32_t dstSize)
-{
-	const char	*s, *last;
-
-	s = last = path + strlen(path);
-	while (*s != '/' && *s != '\\' && s != path){
-		if (*s == '.'){
-			last = s+1;
-			break;
-		}
-
-		s--;
-	}
-
-	Q_strncpyz(dst, last, dstSize);
-}
-
 /*
 =================
 Com_DefaultExtension
@@ -23,6 +23,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "client.h"
 
+#include "zlib.h"
+
 extern	cvar_t *allow_download;
 extern	cvar_t *allow_download_players;
 extern	cvar_t *allow_download_models;
@@ -843,12 +845,12 @@ qboolean CL_CheckOrDownloadFile (char *filename)
 		Com_Printf ("Resuming %s\n", cls.downloadname);
 		MSG_WriteByte (&cls.netchan.message, clc_stringcmd);
 		MSG_WriteString (&cls.netchan.message,
-			va("download %s %i", cls.downloadname, len));
+			va("download %s %i%s", cls.downloadname, len, cl_download_window->value ? " window" : ""));
 	} else {
 		Com_Printf ("Downloading %s\n", cls.downloadname);
 		MSG_WriteByte (&cls.netchan.message, clc_stringcmd);
 		MSG_WriteString (&cls.netchan.message,
-			va("download %s", cls.downloadname));
+			va("download %s%s", cls.downloadname, cl_download_window->value ? " 0 window" : ""));
 	}
 
 	cls.downloadnumber++;
@@ -897,11 +899,45 @@ void CL_Download_f (void)
 
 	MSG_WriteByte (&cls.netchan.message, clc_stringcmd);
 	MSG_WriteString (&cls.netchan.message,
-		va("download %s", cls.downloadname));
+		va("download %s%s", cls.downloadname, cl_download_window->value ? " 0 window" : ""));
 
 	cls.downloadnumber++;
 }
 
+/*
+=====================
+CL_DownloadComplete
+
+Renames the finished temp file and moves on to the next
+=====================
+*/
+static void CL_DownloadComplete (void)
+{
+	char	oldn[MAX_OSPATH];
+	char	newn[MAX_OSPATH];
+	int32_t		r;
+
+	fclose (cls.download);
+
+	// rename the temp file to it's final name
+	CL_DownloadFileName(oldn, sizeof(oldn), cls.downloadtempname);
+	CL_DownloadFileName(newn, sizeof(newn), cls.downloadname);
+	r = rename (oldn, newn);
+	if (r)
+		Com_Printf ("failed to rename.\n");
+
+	cls.download = NULL;
+	cls.downloadpercent = 0;
+
+	// add new pk3s to search paths, hack by Jay Dolan
+	if (strstr(newn, ".pk3")) 
+		FS_AddPK3File (newn);
+
+	// get another file if needed
+
+	CL_RequestNextDownload ();
+}
+
 /*
 =====================
 CL_ParseDownload
@@ -913,7 +949,6 @@ void CL_ParseDownload (void)
 {
 	int32_t		size, percent;
 	char	name[MAX_OSPATH];
-	int32_t		r;//, i;
 
 	// read the data
 	size = MSG_ReadShort (&net_message);
@@ -974,29 +1009,189 @@ void CL_ParseDownload (void)
 	}
 	else
 	{
-		char	oldn[MAX_OSPATH];
-		char	newn[MAX_OSPATH];
-
 //		Com_Printf ("100%%\n");
 
-		fclose (cls.download);
+		CL_DownloadComplete ();
+	}
+}
+
+/*
+=====================
+CL_StopDownloadWindow
+=====================
+*/
+void CL_StopDownloadWindow (void)
+{
+	if (cls.downloadchunks)
+	{
+		Z_Free (cls.downloadchunks);
+		cls.downloadchunks = NULL;
+	}
+	cls.downloadwindow = false;
+	cls.downloadack = false;
+}
+
+/*
+=====================
+CL_WriteDownloadAck
 
-		// rename the temp file to it's final name
-		CL_DownloadFileName(oldn, sizeof(oldn), cls.downloadtempname);
-		CL_DownloadFileName(newn, sizeof(newn), cls.downloadname);
-		r = rename (oldn, newn);
-		if (r)
-			Com_Printf ("failed to rename.\n");
+The first chunk still missing and a bit for each chunk after it
+=====================
+*/
+void CL_WriteDownloadAck (sizebuf_t *buf)
+{
+	int32_t		i, bytes, bits, chunk;
+
+	bytes = (cls.downloadnumchunks - cls.downloadfirstmissing - 1 + 7) / 8;
+	if (bytes > DOWNLOAD_MAXWINDOW/8)
+		bytes = DOWNLOAD_MAXWINDOW/8;
+	if (bytes < 0)
+		bytes = 0;
+
+	MSG_WriteByte (buf, clc_downloadack);
+	MSG_WriteLong (buf, cls.downloadfirstmissing);
+	MSG_WriteByte (buf, bytes);
+	for (i=0, bits=0 ; i<bytes*8 ; i++)
+	{
+		chunk = cls.downloadfirstmissing + 1 + i;
+		if (chunk < cls.downloadnumchunks && (cls.downloadchunks[chunk>>3] & (1<<(chunk&7))))
+			bits |= 1<<(i&7);
+		if ((i&7) == 7)
+		{
+			MSG_WriteByte (buf, bits);
+			bits = 0;
+		}
+	}
 
-		cls.download = NULL;
-		cls.downloadpercent = 0;
+	cls.downloadack = false;
+}
 
-		// add new pk3s to search paths, hack by Jay Dolan
-		if (strstr(newn, ".pk3")) 
-			FS_AddPK3File (newn);
+/*
+=====================
+CL_FinishDownloadWindow
+=====================
+*/
+static void CL_FinishDownloadWindow (void)
+{
+	// the last ack goes reliably so the server lets go of the file
+	CL_WriteDownloadAck (&cls.netchan.message);
+	CL_StopDownloadWindow ();
+	CL_DownloadComplete ();
+}
 
-		// get another file if needed
+/*
+=====================
+CL_ParseDownloadStart
 
-		CL_RequestNextDownload ();
+The server is sending the file as svc_downloadchunk datagrams
+=====================
+*/
+void CL_ParseDownloadStart (void)
+{
+	char	name[MAX_OSPATH];
+	int32_t		size, offset, chunk;
+
+	size = MSG_ReadLong (&net_message);
+	offset = MSG_ReadLong (&net_message);
+	chunk = MSG_ReadShort (&net_message);
+
+	if (chunk != DOWNLOAD_CHUNK || offset < 0 || offset > size)
+		Com_Error (ERR_DROP, "CL_ParseDownloadStart: bad download %i %i %i", size, offset, chunk);
+
+	// open the file if not opened yet
+	if (!cls.download)
+	{
+		CL_DownloadFileName(name, sizeof(name), cls.downloadtempname);
+
+		FS_CreatePath (name);
+
+		cls.download = fopen (name, "wb");
+		if (!cls.download)
+		{
+			Com_Printf ("Failed to open %s\n", cls.downloadtempname);
+
+			// nextdl tells the server to stop sending
+			MSG_WriteByte (&cls.netchan.message, clc_stringcmd);
+			SZ_Print (&cls.netchan.message, "nextdl");
+			CL_RequestNextDownload ();
+			return;
+		}
+	}
+
+	CL_StopDownloadWindow ();
+	cls.downloadwindow = true;
+	cls.downloadsize = size;
+	cls.downloadoffset = offset;
+	cls.downloadnumchunks = (size - offset + DOWNLOAD_CHUNK - 1) / DOWNLOAD_CHUNK;
+	cls.downloadfirstmissing = 0;
+	cls.downloadreceived = 0;
+	cls.downloadchunks = (byte *)Z_Malloc ((cls.downloadnumchunks + 7) / 8 + 1);
+
+	if (!cls.downloadnumchunks)
+		CL_FinishDownloadWindow ();
+}
+
+/*
+=====================
+CL_ParseDownloadChunk
+
+Chunks can come in any order, and more than once
+=====================
+*/
+void CL_ParseDownloadChunk (void)
+{
+	byte	buf[DOWNLOAD_CHUNK];
+	byte	*data;
+	uLongf	raw;
+	int32_t		chunk, wire, length, expected;
+
+	chunk = MSG_ReadLong (&net_message);
+	wire = MSG_ReadShort (&net_message) & 0xffff;
+	length = wire & ~DOWNLOAD_DEFLATED;
+	data = net_message.data + net_message.readcount;
+	net_message.readcount += length;
+
+	// a chunk left over from before, or from a demo
+	if (!cls.downloadwindow || !cls.download || chunk < 0 || chunk >= cls.downloadnumchunks
+		|| net_message.readcount > net_message.cursize)
+		return;
+
+	// acknowledge duplicates too, the ack that would have stopped them got lost
+	cls.downloadack = true;
+	if (cls.downloadchunks[chunk>>3] & (1<<(chunk&7)))
+		return;
+
+	expected = cls.downloadsize - cls.downloadoffset - chunk*DOWNLOAD_CHUNK;
+	if (expected > DOWNLOAD_CHUNK)
+		expected = DOWNLOAD_CHUNK;
+
+	if (wire & DOWNLOAD_DEFLATED)
+	{
+		raw = sizeof(buf);
+		if (uncompress (buf, &raw, data, length) != Z_OK || (int32_t)raw != expected)
+		{
+			Com_DPrintf ("Bad download chunk %i\n", chunk);
+			return;
+		}
+		data = buf;
+	}
+	else if (length != expected)
+		return;
+
+	fseek (cls.download, cls.downloadoffset + chunk*DOWNLOAD_CHUNK, SEEK_SET);
+	fwrite (data, 1, expected, cls.download);
+
+	cls.downloadchunks[chunk>>3] |= 1<<(chunk&7);
+	cls.downloadreceived++;
+	while (cls.downloadfirstmissing < cls.downloadnumchunks
+		&& (cls.downloadchunks[cls.downloadfirstmissing>>3] & (1<<(cls.downloadfirstmissing&7))))
+		cls.downloadfirstmissing++;
+
+	if (cls.downloadreceived == cls.downloadnumchunks)
+	{
+		CL_FinishDownloadWindow ();
+		return;
 	}
+
+	cls.downloadpercent = (int32_t)((cls.downloadoffset + (int64_t)cls.downloadreceived*DOWNLOAD_CHUNK) * 100 / cls.downloadsize);
 }
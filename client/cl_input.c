@@ -753,8 +753,14 @@ void CL_SendCmd (void)
 
 	if (cls.state == ca_connected)
 	{
-		if (cls.netchan.message.cursize || Game::Engine::GetTick() - cls.netchan.last_sent > 1000)
-			Netchan_Transmit (&cls.netchan, 0, buf.data);	
+		// download chunks are acknowledged every frame
+		if (cls.downloadack)
+		{
+			SZ_Init (&buf, data, sizeof(data));
+			CL_WriteDownloadAck (&buf);
+		}
+		if (buf.cursize || cls.netchan.message.cursize || Game::Engine::GetTick() - cls.netchan.last_sent > 1000)
+			Netchan_Transmit (&cls.netchan, buf.cursize, buf.data);	
 		return;
 	}
 
@@ -812,6 +818,9 @@ void CL_SendCmd (void)
 		buf.data + checksumIndex + 1, buf.cursize - checksumIndex - 1,
 		cls.netchan.outgoing_sequence);
 
+	if (cls.downloadack)
+		CL_WriteDownloadAck (&buf);
+
 	//
 	// deliver the message
 	//
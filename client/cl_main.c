@@ -104,6 +104,7 @@ cvar_t	*cl_add_entities;
 cvar_t	*cl_add_blend;
 
 cvar_t	*cl_shownet;
+cvar_t	*cl_download_window;
 cvar_t	*cl_showmiss;
 cvar_t	*cl_showclamp;
 
@@ -183,8 +184,8 @@ void CL_WriteDemoMessage (void)
 	// the first eight bytes are just packet sequencing stuff
 	len = net_message.cursize-8;
 	swlen = LittleLong(len);
-	fwrite (&swlen, 4, 1, cls.demofile);
-	fwrite (net_message.data+8,	len, 1, cls.demofile);
+	Demo_Write (cls.demofile, &swlen, 4);
+	Demo_Write (cls.demofile, net_message.data+8, len);
 }
 
 
@@ -207,13 +208,162 @@ void CL_Stop_f (void)
 
 // finish up
 	len = -1;
-	fwrite (&len, 4, 1, cls.demofile);
-	fclose (cls.demofile);
+	Demo_Write (cls.demofile, &len, 4);
+	Demo_FinishIndex (&cls.demoindex, cls.demofile);
+	Demo_CloseWriter (cls.demofile);
 	cls.demofile = NULL;
 	cls.demorecording = false;
 	Com_Printf ("Stopped demo.\n");
 }
 
+/*
+====================
+CL_FlushDemoBuffer
+
+Writes buf out as one demo message, or as part of a keyframe
+====================
+*/
+static void CL_FlushDemoBuffer (sizebuf_t *buf, qboolean keyframe)
+{
+	int32_t		len;
+
+	if (keyframe)
+	{
+		Demo_WriteKeyMessage (&cls.demoindex, buf);
+		return;
+	}
+
+	len = LittleLong (buf->cursize);
+	Demo_Write (cls.demofile, &len, 4);
+	Demo_Write (cls.demofile, buf->data, buf->cursize);
+	buf->cursize = 0;
+}
+
+/*
+====================
+CL_WriteDemoGamestate
+
+The configstrings and baselines, in as many messages as it takes.  A
+keyframe also clears the configstrings that have gone empty since.
+====================
+*/
+static void CL_WriteDemoGamestate (sizebuf_t *buf, qboolean keyframe)
+{
+	int32_t		i;
+	entity_state_t	*ent;
+	entity_state_t	nullstate;
+
+	// configstrings
+	for (i=0 ; i<MAX_CONFIGSTRINGS ; i++)
+	{
+		if (cl.configstrings[i][0] || (keyframe && (i < CS_MODELS || i >= CS_LIGHTS)))
+		{
+			if (buf->cursize + strlen (cl.configstrings[i]) + 32 > buf->maxsize)
+				CL_FlushDemoBuffer (buf, keyframe);	// write it out
+
+			MSG_WriteByte (buf, svc_configstring);
+			MSG_WriteShort (buf, i);
+			MSG_WriteString (buf, cl.configstrings[i]);
+		}
+
+	}
+
+	// baselines
+	memset (&nullstate, 0, sizeof(nullstate));
+	for (i=0; i<MAX_EDICTS ; i++)
+	{
+		ent = &cl_entities[i].baseline;
+		if (!ent->modelindex)
+			continue;
+
+		if (buf->cursize + 64 > buf->maxsize)
+			CL_FlushDemoBuffer (buf, keyframe);	// write it out
+
+		MSG_WriteByte (buf, svc_spawnbaseline);		
+		MSG_WriteDeltaEntity (&nullstate, &cl_entities[i].baseline, buf, true, true);
+	}
+}
+
+/*
+====================
+CL_WriteDemoFrame
+
+A frame from the client's history, uncompressed
+====================
+*/
+static void CL_WriteDemoFrame (sizebuf_t *buf, frame_t *frame)
+{
+	entity_state_t	state;
+	int32_t		i;
+
+	MSG_WriteByte (buf, svc_frame);
+	MSG_WriteLong (buf, frame->serverframe);
+	MSG_WriteLong (buf, -1);
+	MSG_WriteByte (buf, cl.surpressCount);
+	MSG_WriteByte (buf, sizeof(frame->areabits));
+	SZ_Write (buf, frame->areabits, sizeof(frame->areabits));
+
+	MSG_WriteDeltaPlayerstate (NULL, &frame->playerstate, buf);
+
+	MSG_WriteByte (buf, svc_packetentities);
+	for (i=0 ; i<frame->num_entities ; i++)
+	{
+		// events already went off when the frame was played
+		state = cl_parse_entities[(frame->parse_entities+i) & (MAX_PARSE_ENTITIES-1)];
+		state.event = 0;
+		MSG_WriteDeltaEntity (&cl_entities[state.number].baseline, &state, buf, true, true);
+	}
+	MSG_WriteShort (buf, 0);	// end of packetentities
+}
+
+/*
+====================
+CL_WriteDemoKeyframe
+
+Called after each recorded message.  Every demo_keyframes seconds the
+gamestate and the current frame, uncompressed, go into the keyframes
+so demo_seek can start playing from the next message.
+
+The frames recorded after it are deltas from whatever the client had
+acked when the server sent them, which can be a few frames back over a
+real connection.  Acks only move forward, so every frame from the one
+the current frame was delta'd from on goes in too.
+====================
+*/
+void CL_WriteDemoKeyframe (void)
+{
+	byte	buf_data[MAX_MSGLEN];
+	sizebuf_t	buf;
+	frame_t	*frame;
+	int32_t		i;
+
+	if (!cl.frame.valid || !Demo_KeyframeDue (&cls.demoindex, cl.frame.servertime))
+		return;
+
+	SZ_Init (&buf, buf_data, sizeof(buf_data));
+	CL_WriteDemoGamestate (&buf, true);
+	CL_FlushDemoBuffer (&buf, true);
+
+	// the history, oldest first, as far as the client still has it
+	i = cl.frame.serverframe - UPDATE_BACKUP + 1;
+	if (cl.frame.deltaframe > i)
+		i = cl.frame.deltaframe;
+	for ( ; i<cl.frame.serverframe ; i++)
+	{
+		frame = &cl.frames[i & UPDATE_MASK];
+		if (!frame->valid || frame->serverframe != i
+			|| cl.parse_entities - frame->parse_entities > MAX_PARSE_ENTITIES-128)
+			continue;
+		CL_WriteDemoFrame (&buf, frame);
+		CL_FlushDemoBuffer (&buf, true);
+	}
+
+	// and the current frame last, so it is the one playback ends up on
+	CL_WriteDemoFrame (&buf, &cl.frame);
+	CL_FlushDemoBuffer (&buf, true);
+	Demo_EndKeyframe (&cls.demoindex, Demo_WriterTell (cls.demofile));
+}
+
 /*
 ====================
 CL_Record_f
@@ -228,10 +378,6 @@ void CL_Record_f (void)
 	char	name[MAX_OSPATH];
 	byte	buf_data[MAX_MSGLEN];
 	sizebuf_t	buf;
-	int32_t		i;
-	int32_t		len;
-	entity_state_t	*ent;
-	entity_state_t	nullstate;
 
 	if (Cmd_Argc() != 2)
 	{
@@ -256,15 +402,16 @@ void CL_Record_f (void)
 	//
 	Com_sprintf (name, sizeof(name), "%s/demos/%s.dm2", FS_Gamedir(), Cmd_Argv(1));
 
-	Com_Printf ("recording to %s.\n", name);
 	FS_CreatePath (name);
-	cls.demofile = fopen (name, "wb");
+	cls.demofile = Demo_OpenWriter (name, true);
 	if (!cls.demofile)
 	{
-		Com_Printf ("ERROR: couldn't open.\n");
+		Com_Printf ("ERROR: couldn't open %s.\n", name);
 		return;
 	}
+	Com_Printf ("recording to %s.\n", name);
 	cls.demorecording = true;
+	Demo_BeginIndex (&cls.demoindex, name);
 
 	// don't start saving messages until a non-delta compressed message is received
 	cls.demowaiting = true;
@@ -284,54 +431,13 @@ void CL_Record_f (void)
 
 	MSG_WriteString (&buf, cl.configstrings[CS_NAME]);
 
-	// configstrings
-	for (i=0 ; i<MAX_CONFIGSTRINGS ; i++)
-	{
-		if (cl.configstrings[i][0])
-		{
-			if (buf.cursize + strlen (cl.configstrings[i]) + 32 > buf.maxsize)
-			{	// write it out
-				len = LittleLong (buf.cursize);
-				fwrite (&len, 4, 1, cls.demofile);
-				fwrite (buf.data, buf.cursize, 1, cls.demofile);
-				buf.cursize = 0;
-			}
-
-			MSG_WriteByte (&buf, svc_configstring);
-			MSG_WriteShort (&buf, i);
-			MSG_WriteString (&buf, cl.configstrings[i]);
-		}
-
-	}
-
-	// baselines
-	memset (&nullstate, 0, sizeof(nullstate));
-	for (i=0; i<MAX_EDICTS ; i++)
-	{
-		ent = &cl_entities[i].baseline;
-		if (!ent->modelindex)
-			continue;
-
-		if (buf.cursize + 64 > buf.maxsize)
-		{	// write it out
-			len = LittleLong (buf.cursize);
-			fwrite (&len, 4, 1, cls.demofile);
-			fwrite (buf.data, buf.cursize, 1, cls.demofile);
-			buf.cursize = 0;
-		}
-
-		MSG_WriteByte (&buf, svc_spawnbaseline);		
-		MSG_WriteDeltaEntity (&nullstate, &cl_entities[i].baseline, &buf, true, true);
-	}
+	CL_WriteDemoGamestate (&buf, false);
 
 	MSG_WriteByte (&buf, svc_stufftext);
 	MSG_WriteString (&buf, "precache\n");
 
 	// write it to the demo file
-
-	len = LittleLong (buf.cursize);
-	fwrite (&len, 4, 1, cls.demofile);
-	fwrite (buf.data, buf.cursize, 1, cls.demofile);
+	CL_FlushDemoBuffer (&buf, false);
 
 	// the rest of the demo file will be individual frames
 }
@@ -505,11 +611,11 @@ void CL_SendConnectPacket (void)
 	// if in compatibility mode, lie to server about this
 	// client's protocol, but exclude localhost for this.
 	if (cl_servertrick->value && strcmp(cls.servername, "localhost"))
-		Netchan_OutOfBandPrint (NS_CLIENT, adr, "connect %i %i %i \"%s\"\n",
-			OLD_PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo() );
+		Netchan_OutOfBandPrint (NS_CLIENT, adr, "connect %i %i %i \"%s\" %i\n",
+			OLD_PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo(), (int32_t)net_mtu->value );
 	else
-		Netchan_OutOfBandPrint (NS_CLIENT, adr, "connect %i %i %i \"%s\"\n",
-			PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo() );
+		Netchan_OutOfBandPrint (NS_CLIENT, adr, "connect %i %i %i \"%s\" %i\n",
+			PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo(), (int32_t)net_mtu->value );
 }
 
 /*
@@ -735,6 +841,7 @@ void CL_Disconnect (void)
 		fclose(cls.download);
 		cls.download = NULL;
 	}
+	CL_StopDownloadWindow ();
 
 	cls.state = ca_disconnected;
 
@@ -1110,6 +1217,8 @@ void CL_ConnectionlessPacket (void)
                 return;
             }
             Netchan_Setup (NS_CLIENT, &cls.netchan, net_from, cls.quakePort);
+            // servers that can fragment answer with the datagram size to use
+            cls.netchan.fragment_size = Netchan_FragmentSize (atoi (Cmd_Argv(1)));
             MSG_WriteChar (&cls.netchan.message, clc_stringcmd);
             MSG_WriteString (&cls.netchan.message, "new");
             cls.state = ca_connected;
@@ -1471,6 +1580,7 @@ void CL_InitLocal (void)
 	m_side = Cvar_Get ("m_side", "1", 0);
 
 	cl_shownet = Cvar_Get ("cl_shownet", "0", 0);
+	cl_download_window = Cvar_Get ("cl_download_window", "1", CVAR_ARCHIVE);
 	cl_showmiss = Cvar_Get ("cl_showmiss", "0", 0);
 	cl_showclamp = Cvar_Get ("showclamp", "0", 0);
 	cl_timeout = Cvar_Get ("cl_timeout", "120", 0);
@@ -45,7 +45,10 @@ char *svc_strings[256] =
 	"svc_playerinfo",
 	"svc_packetentities",
 	"svc_deltapacketentities",
-	"svc_frame"
+	"svc_frame",
+	"svc_fog",
+	"svc_downloadstart",
+	"svc_downloadchunk"
 };
 
 //=============================================================================
@@ -169,6 +172,10 @@ void CL_ParseServerData (void)
 	cl.servercount = MSG_ReadLong (&net_message);
 	cl.attractloop = MSG_ReadByte (&net_message) != 0;
 
+	// the demo goes on into a new level, keyframes can't seek across it
+	if (cls.demorecording)
+		Demo_NewLevel (&cls.demoindex);
+
 	// game directory
 	str = MSG_ReadString (&net_message);
 	strncpy (cl.gamedir, str, sizeof(cl.gamedir)-1);
@@ -806,6 +813,7 @@ void CL_ParseServerMessage (void)
 				fclose (cls.download);
 				cls.download = NULL;
 			}
+			CL_StopDownloadWindow ();
 			cls.state = ca_connecting;
 			cls.connect_time = -99999;	// CL_CheckForResend() will fire immediately
 			break;
@@ -866,6 +874,14 @@ void CL_ParseServerMessage (void)
 			CL_ParseDownload ();
 			break;
 
+		case svc_downloadstart:
+			CL_ParseDownloadStart ();
+			break;
+
+		case svc_downloadchunk:
+			CL_ParseDownloadChunk ();
+			break;
+
 		case svc_frame:
 			CL_ParseFrame ();
 			break;
@@ -898,7 +914,10 @@ void CL_ParseServerMessage (void)
 	// after we have parsed the frame
 	//
 	if (cls.demorecording && !cls.demowaiting)
+	{
 		CL_WriteDemoMessage ();
+		CL_WriteDemoKeyframe ();
+	}
 
 }
 
@@ -267,10 +267,21 @@ typedef struct
 	dltype_t	downloadtype;
 	int32_t			downloadpercent;
 
+	// windowed download, see CL_ParseDownloadStart
+	qboolean	downloadwindow;
+	byte		*downloadchunks;	// a bit for each chunk written
+	int32_t			downloadsize;
+	int32_t			downloadoffset;		// file position of chunk 0
+	int32_t			downloadnumchunks;
+	int32_t			downloadfirstmissing;
+	int32_t			downloadreceived;
+	qboolean	downloadack;		// chunks came in since the last clc_downloadack
+
 // demo recording info must be here, so it isn't cleared on level change
 	qboolean	demorecording;
 	qboolean	demowaiting;	// don't record until a non-delta message is received
-	FILE		*demofile;
+	demowriter_t	*demofile;
+	demoindex_t	demoindex;		// keyframes for demo_seek
 
 #ifdef	ROQ_SUPPORT
 	// Cinematic information
@@ -358,6 +369,7 @@ extern	cvar_t	*cl_run;
 extern	cvar_t	*cl_anglespeedkey;
 
 extern	cvar_t	*cl_shownet;
+extern	cvar_t	*cl_download_window;
 extern	cvar_t	*cl_showmiss;
 extern	cvar_t	*cl_showclamp;
 
@@ -742,6 +754,7 @@ char *Key_KeynumToString (int32_t keynum);
 // cl_demo.c
 //
 void CL_WriteDemoMessage (void);
+void CL_WriteDemoKeyframe (void);
 void CL_Stop_f (void);
 void CL_Record_f (void);
 
@@ -762,6 +775,10 @@ void CL_RequestNextDownload (void);
 qboolean CL_CheckOrDownloadFile (char *filename);
 void CL_Download_f (void);
 void CL_ParseDownload (void);
+void CL_ParseDownloadStart (void);
+void CL_ParseDownloadChunk (void);
+void CL_WriteDownloadAck (sizebuf_t *buf);
+void CL_StopDownloadWindow (void);
 
 //
 // cl_view.c
@@ -1799,11 +1799,10 @@ void R_MarkLeaves (void)
 	// may have to combine two clusters because of solid water boundaries
 	if (r_viewcluster2 != r_viewcluster)
 	{
-		memcpy (fatvis, vis, (r_worldmodel->numleafs+7)/8);
+		c = (r_worldmodel->numleafs+7)/8;
+		memcpy (fatvis, vis, c);
 		vis = Mod_ClusterPVS (r_viewcluster2, r_worldmodel);
-		c = (r_worldmodel->numleafs+31)/32;
-		for (i=0 ; i<c ; i++)
-			((int32_t *)fatvis)[i] |= ((int32_t *)vis)[i];
+		Vis_Or (fatvis, vis, c);
 		vis = fatvis;
 	}
 	
@@ -1812,7 +1811,7 @@ void R_MarkLeaves (void)
 		cluster = leaf->cluster;
 		if (cluster == -1)
 			continue;
-		if (vis[cluster>>3] & (1<<(cluster&7)))
+		if (VIS_TEST(vis, cluster))
 		{
 			node = (mnode_t *)leaf;
 			do
@@ -19,12 +19,34 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // cmodel.c -- model loading
 
+#include "../../Source/SystemThreads.h"
+#include "../../Source/SystemTimer.h"
+
 #include "qcommon.h"
 
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define CM_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define CM_TARGET(x)
+#else
+#define CM_TARGET(x)	__attribute__((target(x)))
+#endif
+#endif
+
+#ifdef _MSC_VER
+#define CM_ALIGN(x)		__declspec(align(x))
+#else
+#define CM_ALIGN(x)		__attribute__((aligned(x)))
+#endif
+
+// the plane is copied into the node so a descent reads one cache line
+// per level, two nodes share a line
 typedef struct
 {
-	cplane_t	*plane;
+	cplane_t	plane;
 	int32_t			children[2];		// negative numbers are leafs
+	int32_t			pad;
 } cnode_t;
 
 typedef struct
@@ -47,7 +69,6 @@ typedef struct
 	int32_t			contents;
 	int32_t			numsides;
 	int32_t			firstbrushside;
-	int32_t			checkcount;		// to avoid repeated testings
 } cbrush_t;
 
 typedef struct
@@ -58,13 +79,18 @@ typedef struct
 	int32_t		floodvalid;
 } carea_t;
 
-int32_t			checkcount;
-
 char		map_name[MAX_QPATH];
+uint32_t	map_checksum;
 
 int32_t			numbrushsides;
 cbrushside_t map_brushsides[MAX_MAP_BRUSHSIDES];
 
+// the side planes again as structure of arrays for the clipping kernels,
+// padded so a vector load can run past the last side
+#define	SIDE_PAD		8
+float		map_sidenormals[3][MAX_MAP_BRUSHSIDES+SIDE_PAD];
+float		map_sidedists[MAX_MAP_BRUSHSIDES+SIDE_PAD];
+
 int32_t			numtexinfo;
 mapsurface_t	map_surfaces[MAX_MAP_TEXINFO];
 
@@ -72,7 +98,7 @@ int32_t			numplanes;
 cplane_t	map_planes[MAX_MAP_PLANES+6];		// extra for box hull
 
 int32_t			numnodes;
-cnode_t		map_nodes[MAX_MAP_NODES+6];		// extra for box hull
+CM_ALIGN(64) cnode_t	map_nodes[MAX_MAP_NODES+6];		// extra for box hull
 
 int32_t			numleafs = 1;	// allow leaf funcs to be called without a map
 cleaf_t		map_leafs[MAX_MAP_LEAFS];
@@ -200,6 +226,143 @@ void CMod_LoadSurfaces (lump_t *l)
 }
 
 
+/*
+=================
+CMod_NodeHeight
+=================
+*/
+static int32_t CMod_NodeHeight (int32_t num)
+{
+	int32_t		h0, h1;
+
+	if (num < 0)
+		return 0;
+	h0 = CMod_NodeHeight (map_nodes[num].children[0]);
+	h1 = CMod_NodeHeight (map_nodes[num].children[1]);
+	return 1 + (h0 > h1 ? h0 : h1);
+}
+
+typedef struct
+{
+	int32_t		*order;		// new number -> loaded number
+	int32_t		*remap;		// loaded number -> new number, -1 until placed
+	int32_t		count;
+} nodeorder_t;
+
+static void CMod_LayoutNodes (nodeorder_t *no, int32_t num, int32_t height);
+
+/*
+=================
+CMod_LayoutFrontier
+
+Lays out every subtree hanging depth levels below num.
+=================
+*/
+static void CMod_LayoutFrontier (nodeorder_t *no, int32_t num, int32_t depth, int32_t height)
+{
+	if (num < 0)
+		return;
+	if (!depth)
+	{
+		CMod_LayoutNodes (no, num, height);
+		return;
+	}
+	CMod_LayoutFrontier (no, map_nodes[num].children[0], depth-1, height);
+	CMod_LayoutFrontier (no, map_nodes[num].children[1], depth-1, height);
+}
+
+/*
+=================
+CMod_LayoutNodes
+
+van Emde Boas order: the top half of the levels under num goes first,
+then each subtree below it, each laid out the same way.  Any path down
+the tree then crosses about log2 as many cache lines as levels.
+=================
+*/
+static void CMod_LayoutNodes (nodeorder_t *no, int32_t num, int32_t height)
+{
+	int32_t		top;
+
+	if (num < 0)
+		return;
+	if (height <= 1)
+	{
+		if (no->remap[num] == -1)
+		{
+			no->remap[num] = no->count;
+			no->order[no->count++] = num;
+		}
+		return;
+	}
+
+	top = height / 2;
+	CMod_LayoutNodes (no, num, top);
+	CMod_LayoutFrontier (no, num, top, height - top);
+}
+
+/*
+=================
+CMod_OrderNodes
+
+Renumbers the nodes of every model's tree so descents stay in as few
+cache lines as possible.  Node numbers only leave this file as
+headnodes and topnodes that come back in, so nothing else notices.
+=================
+*/
+void CMod_OrderNodes (void)
+{
+	nodeorder_t	no;
+	cnode_t		*copy;
+	int32_t		i, j, num;
+
+	no.order = (int32_t *)Z_Malloc (numnodes * sizeof(int32_t));
+	no.remap = (int32_t *)Z_Malloc (numnodes * sizeof(int32_t));
+	copy = (cnode_t *)Z_Malloc (numnodes * sizeof(cnode_t));
+	memset (no.remap, -1, numnodes * sizeof(int32_t));
+	no.count = 0;
+
+	for (i=0 ; i<numcmodels ; i++)
+	{
+		num = map_cmodels[i].headnode;
+		if (num >= 0 && num < numnodes)
+			CMod_LayoutNodes (&no, num, CMod_NodeHeight (num));
+	}
+
+	// anything no model reaches keeps its relative order at the end
+	for (i=0 ; i<numnodes ; i++)
+	{
+		if (no.remap[i] == -1)
+		{
+			no.remap[i] = no.count;
+			no.order[no.count++] = i;
+		}
+	}
+
+	memcpy (copy, map_nodes, numnodes * sizeof(cnode_t));
+	for (i=0 ; i<numnodes ; i++)
+	{
+		map_nodes[i] = copy[no.order[i]];
+		for (j=0 ; j<2 ; j++)
+		{
+			num = map_nodes[i].children[j];
+			if (num >= 0)
+				map_nodes[i].children[j] = no.remap[num];
+		}
+	}
+
+	for (i=0 ; i<numcmodels ; i++)
+	{
+		num = map_cmodels[i].headnode;
+		if (num >= 0 && num < numnodes)
+			map_cmodels[i].headnode = no.remap[num];
+	}
+
+	Z_Free (copy);
+	Z_Free (no.remap);
+	Z_Free (no.order);
+}
+
 /*
 =================
 CMod_LoadNodes
@@ -229,7 +392,8 @@ void CMod_LoadNodes (lump_t *l)
 
 	for (i=0 ; i<count ; i++, out++, in++)
 	{
-		out->plane = map_planes + LittleLong(in->planenum);
+		out->plane = map_planes[LittleLong(in->planenum)];
+		out->pad = 0;
 		for (j=0 ; j<2 ; j++)
 		{
 			child = LittleLong (in->children[j]);
@@ -237,6 +401,7 @@ void CMod_LoadNodes (lump_t *l)
 		}
 	}
 
+	CMod_OrderNodes ();
 }
 
 /*
@@ -400,6 +565,28 @@ void CMod_LoadLeafBrushes (lump_t *l)
 		*out = LittleShort (*in);
 }
 
+/*
+=================
+CMod_SetSidePlanes
+
+Copies the brush side planes out for the clipping kernels
+=================
+*/
+void CMod_SetSidePlanes (void)
+{
+	int32_t		i;
+	cplane_t	*plane;
+
+	for (i=0 ; i<numbrushsides ; i++)
+	{
+		plane = map_brushsides[i].plane;
+		map_sidenormals[0][i] = plane->normal[0];
+		map_sidenormals[1][i] = plane->normal[1];
+		map_sidenormals[2][i] = plane->normal[2];
+		map_sidedists[i] = plane->dist;
+	}
+}
+
 /*
 =================
 CMod_LoadBrushSides
@@ -434,6 +621,8 @@ void CMod_LoadBrushSides (lump_t *l)
 			Com_Error (ERR_DROP, "Bad brushside texinfo");
 		out->surface = &map_surfaces[j];
 	}
+
+	CMod_SetSidePlanes ();
 }
 
 /*
@@ -621,6 +810,7 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, uint32_t *checksum)
 		numclusters = 1;
 		numareas = 1;
 		*checksum = 0;
+		CM_ClearVisCache ();
 		return &map_cmodels[0];			// cinematic servers won't have anything at all
 	}
 
@@ -633,6 +823,7 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, uint32_t *checksum)
 
 	last_checksum = LittleLong (Com_BlockChecksum (buf, length));
 	*checksum = last_checksum;
+	map_checksum = last_checksum;
 
 	header = *(dheader_t *)buf;
 	for (i=0 ; i<sizeof(dheader_t)/4 ; i++)
@@ -689,6 +880,7 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, uint32_t *checksum)
 	FS_FreeFile (buf);
 
 	CM_InitBoxHull ();
+	CM_ClearVisCache ();
 
 	memset (portalopen, 0, sizeof(portalopen));
 	FloodAreaConnections ();
@@ -760,6 +952,14 @@ int32_t			box_headnode;
 cbrush_t	*box_brush;
 cleaf_t		*box_leaf;
 
+// CM_HeadnodeForBox fills in this thread's copy, so the shared box hull
+// nodes and brush sides are only ever read
+static THREAD_LOCAL cplane_t	box_planes_local[12];
+
+// planes reached through the box hull come from the calling thread
+#define	CM_NodePlane(num)	((num) >= box_headnode ? &box_planes_local[((num) - box_headnode)*2] : &map_nodes[num].plane)
+#define	CM_SidePlane(num)	((num) >= box_brush->firstbrushside ? &box_planes_local[map_brushsides[num].plane - box_planes] : map_brushsides[num].plane)
+
 /*
 ===================
 CM_InitBoxHull
@@ -808,7 +1008,7 @@ void CM_InitBoxHull (void)
 
 		// nodes
 		c = &map_nodes[box_headnode+i];
-		c->plane = map_planes + (numplanes+i*2);
+		c->pad = 0;
 		c->children[side] = -1 - emptyleaf;
 		if (i != 5)
 			c->children[side^1] = box_headnode+i + 1;
@@ -841,18 +1041,22 @@ BSP trees instead of being compared directly.
 */
 int32_t	CM_HeadnodeForBox (const vec3_t mins, const vec3_t maxs)
 {
-	box_planes[0].dist = maxs[0];
-	box_planes[1].dist = -maxs[0];
-	box_planes[2].dist = mins[0];
-	box_planes[3].dist = -mins[0];
-	box_planes[4].dist = maxs[1];
-	box_planes[5].dist = -maxs[1];
-	box_planes[6].dist = mins[1];
-	box_planes[7].dist = -mins[1];
-	box_planes[8].dist = maxs[2];
-	box_planes[9].dist = -maxs[2];
-	box_planes[10].dist = mins[2];
-	box_planes[11].dist = -mins[2];
+	cplane_t	*p = box_planes_local;
+
+	memcpy (p, box_planes, sizeof(box_planes_local));
+
+	p[0].dist = maxs[0];
+	p[1].dist = -maxs[0];
+	p[2].dist = mins[0];
+	p[3].dist = -mins[0];
+	p[4].dist = maxs[1];
+	p[5].dist = -maxs[1];
+	p[6].dist = mins[1];
+	p[7].dist = -mins[1];
+	p[8].dist = maxs[2];
+	p[9].dist = -maxs[2];
+	p[10].dist = mins[2];
+	p[11].dist = -mins[2];
 
 	return box_headnode;
 }
@@ -873,7 +1077,7 @@ int32_t CM_PointLeafnum_r (vec3_t p, int32_t num)
 	while (num >= 0)
 	{
 		node = map_nodes + num;
-		plane = node->plane;
+		plane = CM_NodePlane (num);
 		
 		if (plane->type < 3)
 			d = p[plane->type] - plane->dist;
@@ -885,7 +1089,7 @@ int32_t CM_PointLeafnum_r (vec3_t p, int32_t num)
 			num = node->children[0];
 	}
 
-	c_pointcontents++;		// optimize counter
+	System::Threads::FetchAdd (&c_pointcontents, 1);		// optimize counter, frames are built on the workers
 
 	return -1 - num;
 }
@@ -906,12 +1110,15 @@ CM_BoxLeafnums
 Fills in a list of all the leafs touched
 =============
 */
-int32_t		leaf_count, leaf_maxcount;
-int32_t		*leaf_list;
-float	*leaf_mins, *leaf_maxs;
-int32_t		leaf_topnode;
+typedef struct
+{
+	int32_t		count, maxcount;
+	int32_t		*list;
+	float		*mins, *maxs;
+	int32_t		topnode;
+} leaflist_t;	// kept on the caller's stack so box queries are reentrant
 
-void CM_BoxLeafnums_r (int32_t nodenum)
+void CM_BoxLeafnums_r (leaflist_t *ll, int32_t nodenum)
 {
 	cplane_t	*plane;
 	cnode_t		*node;
@@ -921,28 +1128,28 @@ void CM_BoxLeafnums_r (int32_t nodenum)
 	{
 		if (nodenum < 0)
 		{
-			if (leaf_count >= leaf_maxcount)
+			if (ll->count >= ll->maxcount)
 			{
 //				Com_Printf ("CM_BoxLeafnums_r: overflow\n");
 				return;
 			}
-			leaf_list[leaf_count++] = -1 - nodenum;
+			ll->list[ll->count++] = -1 - nodenum;
 			return;
 		}
 	
 		node = &map_nodes[nodenum];
-		plane = node->plane;
-//		s = BoxOnPlaneSide (leaf_mins, leaf_maxs, plane);
-		s = BOX_ON_PLANE_SIDE(leaf_mins, leaf_maxs, plane);
+		plane = CM_NodePlane (nodenum);
+//		s = BoxOnPlaneSide (ll->mins, ll->maxs, plane);
+		s = BOX_ON_PLANE_SIDE(ll->mins, ll->maxs, plane);
 		if (s == 1)
 			nodenum = node->children[0];
 		else if (s == 2)
 			nodenum = node->children[1];
 		else
 		{	// go down both
-			if (leaf_topnode == -1)
-				leaf_topnode = nodenum;
-			CM_BoxLeafnums_r (node->children[0]);
+			if (ll->topnode == -1)
+				ll->topnode = nodenum;
+			CM_BoxLeafnums_r (ll, node->children[0]);
 			nodenum = node->children[1];
 		}
 
@@ -951,20 +1158,22 @@ void CM_BoxLeafnums_r (int32_t nodenum)
 
 int32_t	CM_BoxLeafnums_headnode (vec3_t mins, vec3_t maxs, int32_t *list, int32_t listsize, int32_t headnode, int32_t *topnode)
 {
-	leaf_list = list;
-	leaf_count = 0;
-	leaf_maxcount = listsize;
-	leaf_mins = mins;
-	leaf_maxs = maxs;
+	leaflist_t	ll;
 
-	leaf_topnode = -1;
+	ll.list = list;
+	ll.count = 0;
+	ll.maxcount = listsize;
+	ll.mins = mins;
+	ll.maxs = maxs;
 
-	CM_BoxLeafnums_r (headnode);
+	ll.topnode = -1;
+
+	CM_BoxLeafnums_r (&ll, headnode);
 
 	if (topnode)
-		*topnode = leaf_topnode;
+		*topnode = ll.topnode;
 
-	return leaf_count;
+	return ll.count;
 }
 
 int32_t	CM_BoxLeafnums (vec3_t mins, vec3_t maxs, int32_t *list, int32_t listsize, int32_t *topnode)
@@ -1040,53 +1249,118 @@ BOX TRACING
 // 1/32 epsilon to keep floating point happy
 #define	DIST_EPSILON	(0.03125)
 
-vec3_t	trace_start, trace_end;
-vec3_t	trace_mins, trace_maxs;
-vec3_t	trace_extents;
+/*
+The whole state of one trace.  Traces on different threads each use
+their own context, so nothing below touches a global that changes.
+*/
+#define	TRACE_VISITED_WORDS	((MAX_MAP_BRUSHES+31)/32)
+#define	TRACE_MAX_DIRTY		64
+
+typedef struct
+{
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	vec3_t		extents;
+
+	trace_t		trace;
+	int32_t		contents;
+	qboolean	ispoint;		// optimized case
+
+	// brushes already clipped against, a brush can sit in several leafs
+	uint32_t	visited[TRACE_VISITED_WORDS];
+	int32_t		dirty[TRACE_MAX_DIRTY];		// visited words to clear for the next trace
+	int32_t		numdirty;					// TRACE_MAX_DIRTY+1 clears the lot
+
+	int32_t		brushtraces;	// added to c_brush_traces when the trace finishes
+} tracecontext_t;
 
-trace_t	trace_trace;
-int32_t		trace_contents;
-qboolean	trace_ispoint;		// optimized case
+static THREAD_LOCAL tracecontext_t	cm_tracecontext;
 
 /*
 ================
-CM_ClipBoxToBrush
+CM_ResetVisited
 ================
 */
-void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
-					  trace_t *trace, cbrush_t *brush)
+static void CM_ResetVisited (tracecontext_t *tc)
 {
-	int32_t			i, j;
-	cplane_t	*plane, *clipplane;
-	float		dist;
-	float		enterfrac, leavefrac;
-	vec3_t		ofs;
-	float		d1, d2;
-	qboolean	getout, startout;
-	float		f;
-	cbrushside_t	*side, *leadside;
+	int32_t		i;
 
-	enterfrac = -1;
-	leavefrac = 1;
-	clipplane = NULL;
+	if (tc->numdirty > TRACE_MAX_DIRTY)
+		memset (tc->visited, 0, sizeof(tc->visited));
+	else
+	{
+		for (i=0 ; i<tc->numdirty ; i++)
+			tc->visited[tc->dirty[i]] = 0;
+	}
+	tc->numdirty = 0;
+}
 
-	if (!brush->numsides)
-		return;
+/*
+================
+CM_VisitBrush
+
+Returns true if the brush was already checked by this trace
+================
+*/
+static qboolean CM_VisitBrush (tracecontext_t *tc, int32_t brushnum)
+{
+	uint32_t	*word = &tc->visited[brushnum >> 5];
+	uint32_t	bit = 1u << (brushnum & 31);
 
-	c_brush_traces++;
+	if (*word & bit)
+		return true;
 
-	getout = false;
-	startout = false;
-	leadside = NULL;
+	if (!*word)
+	{
+		if (tc->numdirty < TRACE_MAX_DIRTY)
+			tc->dirty[tc->numdirty] = brushnum >> 5;
+		if (tc->numdirty <= TRACE_MAX_DIRTY)
+			tc->numdirty++;
+	}
+	*word |= bit;
+	return false;
+}
 
-	for (i=0 ; i<brush->numsides ; i++)
+/*
+===============================================================================
+
+BRUSH SIDE KERNELS
+
+CM_ClipBoxToBrush measures the sweep against every side of a brush before
+it looks at any of the results.  The kernels below do the measuring, the
+SIMD ones 4 or 8 sides at a time from map_sidenormals and map_sidedists.
+They repeat the scalar arithmetic operation for operation, so all of them
+give the same distances to the bit.
+
+===============================================================================
+*/
+
+#define	KERNEL_SIDES	128		// sides measured per kernel call
+
+/*
+================
+CM_SideDistances_C
+
+Start and end distances from numsides sides from first, with the planes
+pushed out for the box.  Returns false as soon as the sweep is wholly in
+front of a side.  Reads the planes through CM_SidePlane, so this is the
+one that handles the box brush.
+================
+*/
+static qboolean CM_SideDistances_C (const tracecontext_t *tc, int32_t first, int32_t numsides, float *d1, float *d2)
+{
+	int32_t			i, j;
+	cplane_t	*plane;
+	float		dist;
+	vec3_t		ofs;
+
+	for (i=0 ; i<numsides ; i++)
 	{
-		side = &map_brushsides[brush->firstbrushside+i];
-		plane = side->plane;
+		plane = CM_SidePlane (first+i);
 
 		// FIXME: special case for axial
 
-		if (!trace_ispoint)
+		if (!tc->ispoint)
 		{	// general box case
 
 			// push the plane out apropriately for mins/maxs
@@ -1095,9 +1369,9 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 			for (j=0 ; j<3 ; j++)
 			{
 				if (plane->normal[j] < 0)
-					ofs[j] = maxs[j];
+					ofs[j] = tc->maxs[j];
 				else
-					ofs[j] = mins[j];
+					ofs[j] = tc->mins[j];
 			}
 			dist = DotProduct (ofs, plane->normal);
 			dist = plane->dist - dist;
@@ -1107,37 +1381,224 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 			dist = plane->dist;
 		}
 
-		d1 = DotProduct (p1, plane->normal) - dist;
-		d2 = DotProduct (p2, plane->normal) - dist;
-
-		if (d2 > 0)
-			getout = true;	// endpoint is not in solid
-		if (d1 > 0)
-			startout = true;
+		d1[i] = DotProduct (tc->start, plane->normal) - dist;
+		d2[i] = DotProduct (tc->end, plane->normal) - dist;
 
 		// if completely in front of face, no intersection
-		if (d1 > 0 && d2 >= d1)
-			return;
+		if (d1[i] > 0 && d2[i] >= d1[i])
+			return false;
+	}
+	return true;
+}
 
-		if (d1 <= 0 && d2 <= 0)
-			continue;
+#ifdef CM_X86
+/*
+================
+CM_SideDistances_SSE2
+================
+*/
+CM_TARGET("sse2") static qboolean CM_SideDistances_SSE2 (const tracecontext_t *tc, int32_t first, int32_t numsides, float *d1, float *d2)
+{
+	const float	*nx = map_sidenormals[0] + first;
+	const float	*ny = map_sidenormals[1] + first;
+	const float	*nz = map_sidenormals[2] + first;
+	const float	*pd = map_sidedists + first;
+	__m128		sx, sy, sz, ex, ey, ez;
+	__m128		lox, loy, loz, hix, hiy, hiz;
+	__m128		x, y, z, ox, oy, oz, dist, a, b, neg, zero;
+	int32_t		i, front;
+
+	zero = _mm_setzero_ps ();
+	sx = _mm_set1_ps (tc->start[0]);	sy = _mm_set1_ps (tc->start[1]);	sz = _mm_set1_ps (tc->start[2]);
+	ex = _mm_set1_ps (tc->end[0]);		ey = _mm_set1_ps (tc->end[1]);		ez = _mm_set1_ps (tc->end[2]);
+	lox = _mm_set1_ps (tc->mins[0]);	loy = _mm_set1_ps (tc->mins[1]);	loz = _mm_set1_ps (tc->mins[2]);
+	hix = _mm_set1_ps (tc->maxs[0]);	hiy = _mm_set1_ps (tc->maxs[1]);	hiz = _mm_set1_ps (tc->maxs[2]);
+
+	for (i=0 ; i<numsides ; i+=4)
+	{
+		x = _mm_loadu_ps (nx+i);
+		y = _mm_loadu_ps (ny+i);
+		z = _mm_loadu_ps (nz+i);
+		dist = _mm_loadu_ps (pd+i);
+
+		if (!tc->ispoint)
+		{	// maxs where the normal is negative, mins elsewhere
+			neg = _mm_cmplt_ps (x, zero);
+			ox = _mm_or_ps (_mm_and_ps (neg, hix), _mm_andnot_ps (neg, lox));
+			neg = _mm_cmplt_ps (y, zero);
+			oy = _mm_or_ps (_mm_and_ps (neg, hiy), _mm_andnot_ps (neg, loy));
+			neg = _mm_cmplt_ps (z, zero);
+			oz = _mm_or_ps (_mm_and_ps (neg, hiz), _mm_andnot_ps (neg, loz));
+			dist = _mm_sub_ps (dist, _mm_add_ps (_mm_add_ps (_mm_mul_ps (ox, x), _mm_mul_ps (oy, y)), _mm_mul_ps (oz, z)));
+		}
 
-		// crosses face
-		if (d1 > d2)
-		{	// enter
-			f = (d1-DIST_EPSILON) / (d1-d2);
-			if (f > enterfrac)
-			{
-				enterfrac = f;
-				clipplane = plane;
-				leadside = side;
-			}
+		a = _mm_sub_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (sx, x), _mm_mul_ps (sy, y)), _mm_mul_ps (sz, z)), dist);
+		b = _mm_sub_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (ex, x), _mm_mul_ps (ey, y)), _mm_mul_ps (ez, z)), dist);
+		_mm_storeu_ps (d1+i, a);
+		_mm_storeu_ps (d2+i, b);
+
+		// lanes past the last side belong to other brushes
+		front = _mm_movemask_ps (_mm_and_ps (_mm_cmpgt_ps (a, zero), _mm_cmpge_ps (b, a)));
+		if (front & ((1 << min(numsides - i, 4)) - 1))
+			return false;
+	}
+	return true;
+}
+
+/*
+================
+CM_SideDistances_AVX2
+================
+*/
+CM_TARGET("avx2") static qboolean CM_SideDistances_AVX2 (const tracecontext_t *tc, int32_t first, int32_t numsides, float *d1, float *d2)
+{
+	const float	*nx = map_sidenormals[0] + first;
+	const float	*ny = map_sidenormals[1] + first;
+	const float	*nz = map_sidenormals[2] + first;
+	const float	*pd = map_sidedists + first;
+	__m256		sx, sy, sz, ex, ey, ez;
+	__m256		lox, loy, loz, hix, hiy, hiz;
+	__m256		x, y, z, ox, oy, oz, dist, a, b, zero;
+	int32_t		i, front;
+
+	zero = _mm256_setzero_ps ();
+	sx = _mm256_set1_ps (tc->start[0]);	sy = _mm256_set1_ps (tc->start[1]);	sz = _mm256_set1_ps (tc->start[2]);
+	ex = _mm256_set1_ps (tc->end[0]);	ey = _mm256_set1_ps (tc->end[1]);	ez = _mm256_set1_ps (tc->end[2]);
+	lox = _mm256_set1_ps (tc->mins[0]);	loy = _mm256_set1_ps (tc->mins[1]);	loz = _mm256_set1_ps (tc->mins[2]);
+	hix = _mm256_set1_ps (tc->maxs[0]);	hiy = _mm256_set1_ps (tc->maxs[1]);	hiz = _mm256_set1_ps (tc->maxs[2]);
+
+	for (i=0 ; i<numsides ; i+=8)
+	{
+		x = _mm256_loadu_ps (nx+i);
+		y = _mm256_loadu_ps (ny+i);
+		z = _mm256_loadu_ps (nz+i);
+		dist = _mm256_loadu_ps (pd+i);
+
+		if (!tc->ispoint)
+		{	// maxs where the normal is negative, mins elsewhere
+			ox = _mm256_blendv_ps (lox, hix, _mm256_cmp_ps (x, zero, _CMP_LT_OQ));
+			oy = _mm256_blendv_ps (loy, hiy, _mm256_cmp_ps (y, zero, _CMP_LT_OQ));
+			oz = _mm256_blendv_ps (loz, hiz, _mm256_cmp_ps (z, zero, _CMP_LT_OQ));
+			dist = _mm256_sub_ps (dist, _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (ox, x), _mm256_mul_ps (oy, y)), _mm256_mul_ps (oz, z)));
 		}
-		else
-		{	// leave
-			f = (d1+DIST_EPSILON) / (d1-d2);
-			if (f < leavefrac)
-				leavefrac = f;
+
+		a = _mm256_sub_ps (_mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (sx, x), _mm256_mul_ps (sy, y)), _mm256_mul_ps (sz, z)), dist);
+		b = _mm256_sub_ps (_mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (ex, x), _mm256_mul_ps (ey, y)), _mm256_mul_ps (ez, z)), dist);
+		_mm256_storeu_ps (d1+i, a);
+		_mm256_storeu_ps (d2+i, b);
+
+		// lanes past the last side belong to other brushes
+		front = _mm256_movemask_ps (_mm256_and_ps (_mm256_cmp_ps (a, zero, _CMP_GT_OQ), _mm256_cmp_ps (b, a, _CMP_GE_OQ)));
+		if (front & ((1 << min(numsides - i, 8)) - 1))
+			return false;
+	}
+	return true;
+}
+#endif	// CM_X86
+
+static qboolean	(*CM_SideDistances) (const tracecontext_t *tc, int32_t first, int32_t numsides, float *d1, float *d2) = CM_SideDistances_C;
+
+/*
+================
+CM_InitKernels
+
+Picks the widest brush side kernel the cpu supports.  Set cm_simd 0
+before startup to force the scalar one.
+================
+*/
+void CM_InitKernels (void)
+{
+	cvar_t		*cm_simd;
+	const char	*name = "scalar";
+
+	cm_simd = Cvar_Get ("cm_simd", "1", CVAR_NOSET);
+
+	CM_SideDistances = CM_SideDistances_C;
+
+#ifdef CM_X86
+	if (!cm_simd->value)
+		;
+	else if (Com_CpuHasAVX2 ())
+	{
+		CM_SideDistances = CM_SideDistances_AVX2;
+		name = "AVX2";
+	}
+	else if (Com_CpuHasSSE2 ())
+	{
+		CM_SideDistances = CM_SideDistances_SSE2;
+		name = "SSE2";
+	}
+#endif
+
+	Com_DPrintf ("Brush side kernels: %s\n", name);
+}
+
+/*
+================
+CM_ClipBoxToBrush
+================
+*/
+static void CM_ClipBoxToBrush (tracecontext_t *tc, cbrush_t *brush)
+{
+	int32_t			i, first, num, sidenum, leadside;
+	float		d1[KERNEL_SIDES+SIDE_PAD], d2[KERNEL_SIDES+SIDE_PAD];
+	float		enterfrac, leavefrac;
+	qboolean	getout, startout;
+	float		f;
+	trace_t		*trace = &tc->trace;
+
+	enterfrac = -1;
+	leavefrac = 1;
+
+	if (!brush->numsides)
+		return;
+
+	tc->brushtraces++;
+
+	getout = false;
+	startout = false;
+	leadside = -1;
+
+	for (first=0 ; first<brush->numsides ; first+=KERNEL_SIDES)
+	{
+		num = min(brush->numsides - first, KERNEL_SIDES);
+		sidenum = brush->firstbrushside + first;
+
+		// the box brush planes are per thread, not in map_sidenormals
+		if (brush == box_brush)
+		{
+			if (!CM_SideDistances_C (tc, sidenum, num, d1, d2))
+				return;
+		}
+		else if (!CM_SideDistances (tc, sidenum, num, d1, d2))
+			return;
+
+		for (i=0 ; i<num ; i++)
+		{
+			if (d2[i] > 0)
+				getout = true;	// endpoint is not in solid
+			if (d1[i] > 0)
+				startout = true;
+
+			if (d1[i] <= 0 && d2[i] <= 0)
+				continue;
+
+			// crosses face
+			if (d1[i] > d2[i])
+			{	// enter
+				f = (d1[i]-DIST_EPSILON) / (d1[i]-d2[i]);
+				if (f > enterfrac)
+				{
+					enterfrac = f;
+					leadside = sidenum+i;
+				}
+			}
+			else
+			{	// leave
+				f = (d1[i]+DIST_EPSILON) / (d1[i]-d2[i]);
+				if (f < leavefrac)
+					leavefrac = f;
+			}
 		}
 	}
 
@@ -1155,8 +1616,8 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 			if (enterfrac < 0)
 				enterfrac = 0;
 			trace->fraction = enterfrac;
-			trace->plane = *clipplane;
-			trace->surface = &(leadside->surface->c);
+			trace->plane = *CM_SidePlane (leadside);
+			trace->surface = &(map_brushsides[leadside].surface->c);
 			trace->contents = brush->contents;
 		}
 	}
@@ -1167,23 +1628,21 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 CM_TestBoxInBrush
 ================
 */
-void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
-					  trace_t *trace, cbrush_t *brush)
+static void CM_TestBoxInBrush (tracecontext_t *tc, cbrush_t *brush)
 {
 	int32_t			i, j;
 	cplane_t	*plane;
 	float		dist;
 	vec3_t		ofs;
 	float		d1;
-	cbrushside_t	*side;
+	trace_t		*trace = &tc->trace;
 
 	if (!brush->numsides)
 		return;
 
 	for (i=0 ; i<brush->numsides ; i++)
 	{
-		side = &map_brushsides[brush->firstbrushside+i];
-		plane = side->plane;
+		plane = CM_SidePlane (brush->firstbrushside+i);
 
 		// FIXME: special case for axial
 
@@ -1195,14 +1654,14 @@ void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
 		for (j=0 ; j<3 ; j++)
 		{
 			if (plane->normal[j] < 0)
-				ofs[j] = maxs[j];
+				ofs[j] = tc->maxs[j];
 			else
-				ofs[j] = mins[j];
+				ofs[j] = tc->mins[j];
 		}
 		dist = DotProduct (ofs, plane->normal);
 		dist = plane->dist - dist;
 
-		d1 = DotProduct (p1, plane->normal) - dist;
+		d1 = DotProduct (tc->start, plane->normal) - dist;
 
 		// if completely in front of face, no intersection
 		if (d1 > 0)
@@ -1222,7 +1681,7 @@ void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
 CM_TraceToLeaf
 ================
 */
-void CM_TraceToLeaf (int32_t leafnum)
+static void CM_TraceToLeaf (tracecontext_t *tc, int32_t leafnum)
 {
 	int32_t			k;
 	int32_t			brushnum;
@@ -1230,21 +1689,20 @@ void CM_TraceToLeaf (int32_t leafnum)
 	cbrush_t	*b;
 
 	leaf = &map_leafs[leafnum];
-	if ( !(leaf->contents & trace_contents))
+	if ( !(leaf->contents & tc->contents))
 		return;
 	// trace line against all brushes in the leaf
 	for (k=0 ; k<leaf->numleafbrushes ; k++)
 	{
 		brushnum = map_leafbrushes[leaf->firstleafbrush+k];
 		b = &map_brushes[brushnum];
-		if (b->checkcount == checkcount)
+		if (CM_VisitBrush (tc, brushnum))
 			continue;	// already checked this brush in another leaf
-		b->checkcount = checkcount;
 
-		if ( !(b->contents & trace_contents))
+		if ( !(b->contents & tc->contents))
 			continue;
-		CM_ClipBoxToBrush (trace_mins, trace_maxs, trace_start, trace_end, &trace_trace, b);
-		if (!trace_trace.fraction)
+		CM_ClipBoxToBrush (tc, b);
+		if (!tc->trace.fraction)
 			return;
 	}
 
@@ -1256,7 +1714,7 @@ void CM_TraceToLeaf (int32_t leafnum)
 CM_TestInLeaf
 ================
 */
-void CM_TestInLeaf (int32_t leafnum)
+static void CM_TestInLeaf (tracecontext_t *tc, int32_t leafnum)
 {
 	int32_t			k;
 	int32_t			brushnum;
@@ -1264,21 +1722,20 @@ void CM_TestInLeaf (int32_t leafnum)
 	cbrush_t	*b;
 
 	leaf = &map_leafs[leafnum];
-	if ( !(leaf->contents & trace_contents))
+	if ( !(leaf->contents & tc->contents))
 		return;
 	// trace line against all brushes in the leaf
 	for (k=0 ; k<leaf->numleafbrushes ; k++)
 	{
 		brushnum = map_leafbrushes[leaf->firstleafbrush+k];
 		b = &map_brushes[brushnum];
-		if (b->checkcount == checkcount)
+		if (CM_VisitBrush (tc, brushnum))
 			continue;	// already checked this brush in another leaf
-		b->checkcount = checkcount;
 
-		if ( !(b->contents & trace_contents))
+		if ( !(b->contents & tc->contents))
 			continue;
-		CM_TestBoxInBrush (trace_mins, trace_maxs, trace_start, &trace_trace, b);
-		if (!trace_trace.fraction)
+		CM_TestBoxInBrush (tc, b);
+		if (!tc->trace.fraction)
 			return;
 	}
 
@@ -1287,29 +1744,101 @@ void CM_TestInLeaf (int32_t leafnum)
 
 /*
 ==================
-CM_RecursiveHullCheck
+CM_PlaneDistances
 
+Distances of p1 and p2 from the plane, returns the offset for the
+size of the box
 ==================
 */
-void CM_RecursiveHullCheck (int32_t num, float p1f, float p2f, vec3_t p1, vec3_t p2)
+static inline float CM_PlaneDistances (const tracecontext_t *tc, const cplane_t *plane, const vec3_t p1, const vec3_t p2, float *t1, float *t2)
 {
-	cnode_t		*node;
-	cplane_t	*plane;
-	float		t1, t2, offset;
-	float		frac, frac2;
-	float		idist;
-	int32_t			i;
-	vec3_t		mid;
-	int32_t			side;
-	float		midf;
-
-	if (trace_trace.fraction <= p1f)
-		return;		// already hit something nearer
+	if (plane->type < 3)
+	{
+		*t1 = p1[plane->type] - plane->dist;
+		*t2 = p2[plane->type] - plane->dist;
+		return tc->extents[plane->type];
+	}
+
+	*t1 = DotProduct (plane->normal, p1) - plane->dist;
+	*t2 = DotProduct (plane->normal, p2) - plane->dist;
+	if (tc->ispoint)
+		return 0;
+	return fabs(tc->extents[0]*plane->normal[0]) +
+		fabs(tc->extents[1]*plane->normal[1]) +
+		fabs(tc->extents[2]*plane->normal[2]);
+}
+
+/*
+==================
+CM_CrossFractions
+
+Where a sweep straddling a plane stops short of it and where it carries
+on past it, clamped to the sweep.  Returns the side the sweep starts on.
+==================
+*/
+static inline int32_t CM_CrossFractions (float t1, float t2, float offset, float *frac, float *frac2)
+{
+	float		idist;
+	int32_t		side;
+
+	// put the crosspoint DIST_EPSILON pixels on the near side
+	if (t1 < t2)
+	{
+		idist = 1.0/(t1-t2);
+		side = 1;
+		*frac2 = (t1 + offset + DIST_EPSILON)*idist;
+		*frac = (t1 - offset + DIST_EPSILON)*idist;
+	}
+	else if (t1 > t2)
+	{
+		idist = 1.0/(t1-t2);
+		side = 0;
+		*frac2 = (t1 - offset - DIST_EPSILON)*idist;
+		*frac = (t1 + offset + DIST_EPSILON)*idist;
+	}
+	else
+	{
+		side = 0;
+		*frac = 1;
+		*frac2 = 0;
+	}
+
+	if (*frac < 0)
+		*frac = 0;
+	if (*frac > 1)
+		*frac = 1;
+	if (*frac2 < 0)
+		*frac2 = 0;
+	if (*frac2 > 1)
+		*frac2 = 1;
+
+	return side;
+}
+
+/*
+==================
+CM_RecursiveHullCheck
+
+==================
+*/
+static void CM_RecursiveHullCheck (tracecontext_t *tc, int32_t num, float p1f, float p2f, vec3_t p1, vec3_t p2)
+{
+	cnode_t		*node;
+	cplane_t	*plane;
+	float		t1, t2, offset;
+	float		frac, frac2;
+	int32_t			i;
+	vec3_t		mid;
+	int32_t			side;
+	float		midf;
+
+	if (tc->trace.fraction <= p1f)
+		return;		// already hit something nearer
 
 	// if < 0, we are in a leaf node
 	if (num < 0)
 	{
-		CM_TraceToLeaf (-1-num);
+		CM_TraceToLeaf (tc, -1-num);
 		return;
 	}
 
@@ -1318,91 +1847,44 @@ void CM_RecursiveHullCheck (int32_t num, float p1f, float p2f, vec3_t p1, vec3_t
 	// and the offset for the size of the box
 	//
 	node = map_nodes + num;
-	plane = node->plane;
-
-	if (plane->type < 3)
-	{
-		t1 = p1[plane->type] - plane->dist;
-		t2 = p2[plane->type] - plane->dist;
-		offset = trace_extents[plane->type];
-	}
-	else
-	{
-		t1 = DotProduct (plane->normal, p1) - plane->dist;
-		t2 = DotProduct (plane->normal, p2) - plane->dist;
-		if (trace_ispoint)
-			offset = 0;
-		else
-			offset = fabs(trace_extents[0]*plane->normal[0]) +
-				fabs(trace_extents[1]*plane->normal[1]) +
-				fabs(trace_extents[2]*plane->normal[2]);
-	}
+	plane = CM_NodePlane (num);
+	offset = CM_PlaneDistances (tc, plane, p1, p2, &t1, &t2);
 
 
 #if 0
-CM_RecursiveHullCheck (node->children[0], p1f, p2f, p1, p2);
-CM_RecursiveHullCheck (node->children[1], p1f, p2f, p1, p2);
+CM_RecursiveHullCheck (tc, node->children[0], p1f, p2f, p1, p2);
+CM_RecursiveHullCheck (tc, node->children[1], p1f, p2f, p1, p2);
 return;
 #endif
 
 	// see which sides we need to consider
 	if (t1 >= offset && t2 >= offset)
 	{
-		CM_RecursiveHullCheck (node->children[0], p1f, p2f, p1, p2);
+		CM_RecursiveHullCheck (tc, node->children[0], p1f, p2f, p1, p2);
 		return;
 	}
 	if (t1 < -offset && t2 < -offset)
 	{
-		CM_RecursiveHullCheck (node->children[1], p1f, p2f, p1, p2);
+		CM_RecursiveHullCheck (tc, node->children[1], p1f, p2f, p1, p2);
 		return;
 	}
 
-	// put the crosspoint DIST_EPSILON pixels on the near side
-	if (t1 < t2)
-	{
-		idist = 1.0/(t1-t2);
-		side = 1;
-		frac2 = (t1 + offset + DIST_EPSILON)*idist;
-		frac = (t1 - offset + DIST_EPSILON)*idist;
-	}
-	else if (t1 > t2)
-	{
-		idist = 1.0/(t1-t2);
-		side = 0;
-		frac2 = (t1 - offset - DIST_EPSILON)*idist;
-		frac = (t1 + offset + DIST_EPSILON)*idist;
-	}
-	else
-	{
-		side = 0;
-		frac = 1;
-		frac2 = 0;
-	}
+	side = CM_CrossFractions (t1, t2, offset, &frac, &frac2);
 
 	// move up to the node
-	if (frac < 0)
-		frac = 0;
-	if (frac > 1)
-		frac = 1;
-		
 	midf = p1f + (p2f - p1f)*frac;
 	for (i=0 ; i<3 ; i++)
 		mid[i] = p1[i] + frac*(p2[i] - p1[i]);
 
-	CM_RecursiveHullCheck (node->children[side], p1f, midf, p1, mid);
+	CM_RecursiveHullCheck (tc, node->children[side], p1f, midf, p1, mid);
 
 
 	// go past the node
-	if (frac2 < 0)
-		frac2 = 0;
-	if (frac2 > 1)
-		frac2 = 1;
-		
 	midf = p1f + (p2f - p1f)*frac2;
 	for (i=0 ; i<3 ; i++)
 		mid[i] = p1[i] + frac2*(p2[i] - p1[i]);
 
-	CM_RecursiveHullCheck (node->children[side^1], midf, p2f, mid, p2);
+	CM_RecursiveHullCheck (tc, node->children[side^1], midf, p2f, mid, p2);
 }
 
 
@@ -1411,32 +1893,34 @@ return;
 
 /*
 ==================
-CM_BoxTrace
+CM_StartTrace
+
+Fills in the default trace and settles position tests on the spot.
+Returns true if tc still has to be swept from its headnode.
 ==================
 */
-trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
+static qboolean CM_StartTrace (tracecontext_t *tc, vec3_t start, vec3_t end,
 						  vec3_t mins, vec3_t maxs,
 						  int32_t headnode, int32_t brushmask)
 {
-	int32_t		i;
+	CM_ResetVisited (tc);		// for multi-check avoidance
 
-	checkcount++;		// for multi-check avoidance
-
-	c_traces++;			// for statistics, may be zeroed
+	System::Threads::FetchAdd (&c_traces, 1);		// for statistics, may be zeroed
+	tc->brushtraces = 0;
 
 	// fill in a default trace
-	memset (&trace_trace, 0, sizeof(trace_trace));
-	trace_trace.fraction = 1;
-	trace_trace.surface = &(nullsurface.c);
+	memset (&tc->trace, 0, sizeof(tc->trace));
+	tc->trace.fraction = 1;
+	tc->trace.surface = &(nullsurface.c);
 
 	if (!numnodes)	// map not loaded
-		return trace_trace;
+		return false;
 
-	trace_contents = brushmask;
-	VectorCopy (start, trace_start);
-	VectorCopy (end, trace_end);
-	VectorCopy (mins, trace_mins); //crashes here
-	VectorCopy (maxs, trace_maxs);
+	tc->contents = brushmask;
+	VectorCopy (start, tc->start);
+	VectorCopy (end, tc->end);
+	VectorCopy (mins, tc->mins);
+	VectorCopy (maxs, tc->maxs);
 
 	//
 	// check for position test special case
@@ -1459,12 +1943,12 @@ trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
 		numleafs = CM_BoxLeafnums_headnode (c1, c2, leafs, 1024, headnode, &topnode);
 		for (i=0 ; i<numleafs ; i++)
 		{
-			CM_TestInLeaf (leafs[i]);
-			if (trace_trace.allsolid)
+			CM_TestInLeaf (tc, leafs[i]);
+			if (tc->trace.allsolid)
 				break;
 		}
-		VectorCopy (start, trace_trace.endpos);
-		return trace_trace;
+		VectorCopy (start, tc->trace.endpos);
+		return false;
 	}
 
 	//
@@ -1473,32 +1957,483 @@ trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
 	if (mins[0] == 0 && mins[1] == 0 && mins[2] == 0
 		&& maxs[0] == 0 && maxs[1] == 0 && maxs[2] == 0)
 	{
-		trace_ispoint = true;
-		VectorClear (trace_extents);
+		tc->ispoint = true;
+		VectorClear (tc->extents);
 	}
 	else
 	{
-		trace_ispoint = false;
-		trace_extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
-		trace_extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
-		trace_extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
+		tc->ispoint = false;
+		tc->extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
+		tc->extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
+		tc->extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
 	}
 
+	return true;
+}
+
+/*
+==================
+CM_FinishTrace
+==================
+*/
+static void CM_FinishTrace (tracecontext_t *tc)
+{
+	int32_t		i;
+
+	// once per trace, batches finish theirs on the sv_threads workers
+	if (tc->brushtraces)
+		System::Threads::FetchAdd (&c_brush_traces, tc->brushtraces);
+
+	if (tc->trace.fraction == 1)
+	{
+		VectorCopy (tc->end, tc->trace.endpos);
+	}
+	else
+	{
+		for (i=0 ; i<3 ; i++)
+			tc->trace.endpos[i] = tc->start[i] + tc->trace.fraction * (tc->end[i] - tc->start[i]);
+	}
+}
+
+/*
+==================
+CM_TraceContext
+
+Runs one trace entirely inside tc
+==================
+*/
+static void CM_TraceContext (tracecontext_t *tc, vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  int32_t headnode, int32_t brushmask)
+{
+	if (!CM_StartTrace (tc, start, end, mins, maxs, headnode, brushmask))
+		return;
+
 	//
 	// general sweeping through world
 	//
-	CM_RecursiveHullCheck (headnode, 0, 1, start, end);
+	CM_RecursiveHullCheck (tc, headnode, 0, 1, start, end);
+	CM_FinishTrace (tc);
+}
+
+/*
+===============================================================================
+
+TRACE LOG
 
-	if (trace_trace.fraction == 1)
+cm_tracelog <name> records the arguments of every CM_BoxTrace into
+<gamedir>/tracelogs/<name>.trace while a game or demo runs, cm_tracelog on
+its own stops.  cm_tracebench <name> replays a log on the same map with
+each brush side kernel the cpu has and checks that they agree.  Sweeps
+through the box hull are left out, its planes are not in the log.
+
+===============================================================================
+*/
+
+#define	TRACELOG_MAGIC		(('G'<<24)+('L'<<16)+('R'<<8)+'T')		// "TRLG"
+#define	TRACELOG_VERSION	1
+
+typedef struct
+{
+	int32_t		magic;
+	int32_t		version;
+	uint32_t	checksum;		// map_checksum of the map traced
+	char		mapname[MAX_QPATH];
+} tracelogheader_t;
+
+typedef struct
+{
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	int32_t		headnode;
+	int32_t		brushmask;
+} tracelogentry_t;
+
+static FILE		*cm_tracelog;
+static System::Threads::Mutex	cm_tracelog_lock;
+
+/*
+==================
+CM_LogTrace
+==================
+*/
+static void CM_LogTrace (const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
+	int32_t headnode, int32_t brushmask)
+{
+	tracelogentry_t	entry;
+
+	VectorCopy (start, entry.start);
+	VectorCopy (end, entry.end);
+	VectorCopy (mins, entry.mins);
+	VectorCopy (maxs, entry.maxs);
+	entry.headnode = headnode;
+	entry.brushmask = brushmask;
+
+	cm_tracelog_lock.lock ();
+	if (cm_tracelog)
+		fwrite (&entry, sizeof(entry), 1, cm_tracelog);
+	cm_tracelog_lock.unlock ();
+}
+
+/*
+==================
+CM_TraceLogPath
+==================
+*/
+static void CM_TraceLogPath (char *path, int32_t size, const char *name)
+{
+	Com_sprintf (path, size, "%s/tracelogs/%s.trace", FS_Gamedir (), name);
+}
+
+/*
+==================
+CM_TraceLog_f
+==================
+*/
+void CM_TraceLog_f (void)
+{
+	tracelogheader_t	header;
+	char		path[MAX_OSPATH];
+	FILE		*f;
+
+	cm_tracelog_lock.lock ();
+	if (cm_tracelog)
 	{
-		VectorCopy (end, trace_trace.endpos);
+		fclose (cm_tracelog);
+		cm_tracelog = NULL;
+		Com_Printf ("Stopped trace log.\n");
 	}
-	else
+	cm_tracelog_lock.unlock ();
+
+	if (Cmd_Argc() < 2)
+		return;
+
+	if (!numnodes)
 	{
-		for (i=0 ; i<3 ; i++)
-			trace_trace.endpos[i] = start[i] + trace_trace.fraction * (end[i] - start[i]);
+		Com_Printf ("No map loaded.\n");
+		return;
+	}
+
+	CM_TraceLogPath (path, sizeof(path), Cmd_Argv(1));
+	FS_CreatePath (path);
+	f = fopen (path, "wb");
+	if (!f)
+	{
+		Com_Printf ("Couldn't open %s\n", path);
+		return;
+	}
+
+	memset (&header, 0, sizeof(header));
+	header.magic = TRACELOG_MAGIC;
+	header.version = TRACELOG_VERSION;
+	header.checksum = map_checksum;
+	Q_strncpyz (header.mapname, map_name, sizeof(header.mapname));
+	fwrite (&header, sizeof(header), 1, f);
+
+	cm_tracelog_lock.lock ();
+	cm_tracelog = f;
+	cm_tracelog_lock.unlock ();
+	Com_Printf ("Logging traces to %s\n", path);
+}
+
+/*
+==================
+CM_TraceBench_f
+==================
+*/
+void CM_TraceBench_f (void)
+{
+	static const char	*names[3] = { "scalar", "SSE2", "AVX2" };
+	qboolean	(*kernels[3]) (const tracecontext_t *tc, int32_t first, int32_t numsides, float *d1, float *d2);
+	qboolean	(*selected) (const tracecontext_t *tc, int32_t first, int32_t numsides, float *d1, float *d2);
+	tracelogheader_t	header;
+	tracelogentry_t	*entries, *e;
+	trace_t		*results, trace;
+	char		path[MAX_OSPATH];
+	FILE		*f;
+	int32_t		i, k, count, numkernels, mismatches;
+	uint64_t	start, elapsed;
+
+	if (Cmd_Argc() < 2)
+	{
+		Com_Printf ("usage: cm_tracebench <name>\n");
+		return;
+	}
+	if (cm_tracelog)
+	{
+		Com_Printf ("Stop cm_tracelog first.\n");
+		return;
+	}
+
+	CM_TraceLogPath (path, sizeof(path), Cmd_Argv(1));
+	f = fopen (path, "rb");
+	if (!f)
+	{
+		Com_Printf ("Couldn't open %s\n", path);
+		return;
+	}
+	if (fread (&header, sizeof(header), 1, f) != 1 || header.magic != TRACELOG_MAGIC
+		|| header.version != TRACELOG_VERSION)
+	{
+		Com_Printf ("%s is not a trace log\n", path);
+		fclose (f);
+		return;
+	}
+	header.mapname[sizeof(header.mapname)-1] = 0;
+	if (!numnodes || header.checksum != map_checksum)
+	{
+		Com_Printf ("%s was recorded on %s, load that map first\n", path, header.mapname);
+		fclose (f);
+		return;
+	}
+
+	fseek (f, 0, SEEK_END);
+	count = (ftell (f) - (long)sizeof(header)) / sizeof(tracelogentry_t);
+	fseek (f, sizeof(header), SEEK_SET);
+	if (count <= 0)
+	{
+		Com_Printf ("%s is empty\n", path);
+		fclose (f);
+		return;
+	}
+	entries = (tracelogentry_t *)Z_Malloc (count * sizeof(*entries));
+	results = (trace_t *)Z_Malloc (count * sizeof(*results));
+	count = fread (entries, sizeof(*entries), count, f);
+	fclose (f);
+
+	numkernels = 0;
+	kernels[numkernels++] = CM_SideDistances_C;
+#ifdef CM_X86
+	if (Com_CpuHasSSE2 ())
+		kernels[numkernels++] = CM_SideDistances_SSE2;
+	if (Com_CpuHasAVX2 ())
+		kernels[numkernels++] = CM_SideDistances_AVX2;
+#endif
+
+	Com_Printf ("%i traces on %s\n", count, header.mapname);
+
+	selected = CM_SideDistances;
+	for (k=0 ; k<numkernels ; k++)
+	{
+		CM_SideDistances = kernels[k];
+		mismatches = 0;
+
+		start = System::Timer::Microseconds();
+		for (i=0, e=entries ; i<count ; i++, e++)
+		{
+			trace = CM_BoxTrace (e->start, e->end, e->mins, e->maxs, e->headnode, e->brushmask);
+			if (!k)
+				results[i] = trace;
+			else if (memcmp (&trace, &results[i], sizeof(trace)))
+				mismatches++;
+		}
+		elapsed = System::Timer::Microseconds() - start;
+
+		Com_Printf ("  %-6s %8.3f ms, %9.0f traces/sec", names[k], elapsed / 1000.0,
+			elapsed ? count * 1000000.0 / elapsed : 0.0);
+		if (mismatches)
+			Com_Printf (", %i results differ from scalar", mismatches);
+		Com_Printf ("\n");
+	}
+	CM_SideDistances = selected;
+
+	Z_Free (results);
+	Z_Free (entries);
+}
+
+/*
+==================
+CM_BoxTrace
+
+Safe to call from any thread, each one traces in its own context
+==================
+*/
+trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  int32_t headnode, int32_t brushmask)
+{
+	tracecontext_t	*tc = &cm_tracecontext;
+
+	if (cm_tracelog && headnode != box_headnode)
+		CM_LogTrace (start, end, mins, maxs, headnode, brushmask);
+
+	CM_TraceContext (tc, start, end, mins, maxs, headnode, brushmask);
+	return tc->trace;
+}
+
+
+/*
+===============================================================================
+
+BATCHED TRACES
+
+Sweeps that start from the same headnode are walked down the tree as a
+group.  Each node is visited once for every sweep that reaches it, a
+sweep that straddles the plane is cut in two like CM_RecursiveHullCheck
+does and both pieces stay in the group, so the pellets of one shotgun
+blast share a single descent instead of one each.
+
+===============================================================================
+*/
+
+// the part of one sweep that reaches a node
+typedef struct
+{
+	tracecontext_t	*tc;
+	float		p1f, p2f;
+	vec3_t		p1, p2;
+} traceseg_t;
+
+static THREAD_LOCAL tracecontext_t	cm_batchcontexts[TRACE_BATCH];
+
+// the split sweeps of every node level, deeper levels go one sweep at a time
+#define	TRACE_BATCH_DEPTH	48
+
+static THREAD_LOCAL traceseg_t	cm_batchsegs[TRACE_BATCH_DEPTH][2][TRACE_BATCH];
+
+/*
+==================
+CM_BatchHullCheck
+
+Every sweep keeps the visiting order it would have on its own: the
+near side first, then the far side.  Sweeps starting in front go down
+children[0] and then children[1] with everything else, the far pieces
+of sweeps starting behind follow in a last pass down children[0].
+The pieces are kept in cm_batchsegs rather than on the stack, a level
+past TRACE_BATCH_DEPTH finishes each sweep with CM_RecursiveHullCheck.
+==================
+*/
+static void CM_BatchHullCheck (const traceseg_t *segs, int32_t count, int32_t num, int32_t depth)
+{
+	traceseg_t	*first;		// front pass from the start, last pass from the end
+	traceseg_t	*second;
+	traceseg_t	*near_, *far_;
+	const traceseg_t	*seg;
+	cnode_t		*node;
+	cplane_t	*plane;
+	float		t1, t2, offset;
+	float		frac, frac2;
+	int32_t		i, j, side;
+	int32_t		numfirst, lastpass, numsecond;
+
+	if (num < 0)
+	{
+		for (i=0 ; i<count ; i++)
+		{
+			if (segs[i].tc->trace.fraction > segs[i].p1f)
+				CM_TraceToLeaf (segs[i].tc, -1-num);
+		}
+		return;
+	}
+
+	if (depth == TRACE_BATCH_DEPTH)
+	{
+		for (i=0 ; i<count ; i++)
+			CM_RecursiveHullCheck (segs[i].tc, num, segs[i].p1f, segs[i].p2f, (float *)segs[i].p1, (float *)segs[i].p2);
+		return;
+	}
+
+	first = cm_batchsegs[depth][0];
+	second = cm_batchsegs[depth][1];
+	node = map_nodes + num;
+	plane = CM_NodePlane (num);
+
+	numfirst = numsecond = 0;
+	lastpass = TRACE_BATCH;
+	for (i=0 ; i<count ; i++)
+	{
+		seg = &segs[i];
+		if (seg->tc->trace.fraction <= seg->p1f)
+			continue;		// already hit something nearer
+
+		offset = CM_PlaneDistances (seg->tc, plane, seg->p1, seg->p2, &t1, &t2);
+		if (t1 >= offset && t2 >= offset)
+		{
+			first[numfirst++] = *seg;
+			continue;
+		}
+		if (t1 < -offset && t2 < -offset)
+		{
+			second[numsecond++] = *seg;
+			continue;
+		}
+
+		side = CM_CrossFractions (t1, t2, offset, &frac, &frac2);
+		if (side)
+		{
+			near_ = &second[numsecond++];
+			far_ = &first[--lastpass];
+		}
+		else
+		{
+			near_ = &first[numfirst++];
+			far_ = &second[numsecond++];
+		}
+
+		near_->tc = far_->tc = seg->tc;
+		near_->p1f = seg->p1f;
+		near_->p2f = seg->p1f + (seg->p2f - seg->p1f)*frac;
+		far_->p1f = seg->p1f + (seg->p2f - seg->p1f)*frac2;
+		far_->p2f = seg->p2f;
+		for (j=0 ; j<3 ; j++)
+		{
+			near_->p1[j] = seg->p1[j];
+			near_->p2[j] = seg->p1[j] + frac*(seg->p2[j] - seg->p1[j]);
+			far_->p1[j] = seg->p1[j] + frac2*(seg->p2[j] - seg->p1[j]);
+			far_->p2[j] = seg->p2[j];
+		}
+	}
+
+	if (numfirst)
+		CM_BatchHullCheck (first, numfirst, node->children[0], depth+1);
+	if (numsecond)
+		CM_BatchHullCheck (second, numsecond, node->children[1], depth+1);
+	if (lastpass < TRACE_BATCH)
+		CM_BatchHullCheck (first + lastpass, TRACE_BATCH - lastpass, node->children[0], depth+1);
+}
+
+/*
+==================
+CM_BoxTraceBatch
+
+Same results as calling CM_BoxTrace on every job in turn, each with its
+own contentmask.  passent is left alone.  Safe to call from any thread.
+==================
+*/
+void CM_BoxTraceBatch (tracejob_t *jobs, int32_t count, int32_t headnode)
+{
+	traceseg_t	group[TRACE_BATCH];
+	tracecontext_t	*tc;
+	int32_t		i, first, num, numgroup;
+
+	for (first=0 ; first<count ; first+=TRACE_BATCH)
+	{
+		num = min(count - first, TRACE_BATCH);
+
+		numgroup = 0;
+		for (i=0 ; i<num ; i++)
+		{
+			tc = &cm_batchcontexts[i];
+			if (!CM_StartTrace (tc, jobs[first+i].start, jobs[first+i].end, jobs[first+i].mins,
+				jobs[first+i].maxs, headnode, jobs[first+i].contentmask))
+				continue;
+
+			group[numgroup].tc = tc;
+			group[numgroup].p1f = 0;
+			group[numgroup].p2f = 1;
+			VectorCopy (tc->start, group[numgroup].p1);
+			VectorCopy (tc->end, group[numgroup].p2);
+			numgroup++;
+		}
+
+		if (numgroup)
+			CM_BatchHullCheck (group, numgroup, headnode, 0);
+
+		for (i=0 ; i<numgroup ; i++)
+			CM_FinishTrace (group[i].tc);
+		for (i=0 ; i<num ; i++)
+			jobs[first+i].trace = cm_batchcontexts[i].trace;
 	}
-	return trace_trace;
 }
 
 
@@ -1636,24 +2571,380 @@ void CM_DecompressVis (byte *in, byte *out)
 	} while (out_p - out < row);
 }
 
+/*
+===============================================================================
+
+VIS ROW CACHE
+
+Decompressed PVS/PHS rows are kept so the same clusters aren't run-length
+decoded again every frame.  Frames are built on several threads at once,
+so a row is filled in once by whoever needs it first and then published,
+and never changes again until the next map: readers only load an offset
+and copy.  When the cache memory runs out the rest of the rows are
+decoded every time.
+
+Merged rows for the server's fat PVS are memoized per thread, by the
+view origin and then by the cluster set.  Clients standing still, or
+standing together, then only pay for a lookup and a copy.
+
+===============================================================================
+*/
+
+#define	VIS_CACHE_BYTES		(8<<20)	// most maps fit every row in this
+#define	FAT_CACHE_ROWS		32		// merged fat PVS rows, per thread
+#define	FAT_CACHE_CLUSTERS	8		// larger cluster sets are merged every time
+
+typedef struct
+{
+	vec3_t		org;				// view origin last merged into this row
+	int32_t		numclusters;		// -1 if free
+	int32_t		clusters[FAT_CACHE_CLUSTERS];	// sorted, no duplicates
+	uint32_t	used;				// LRU stamp
+	byte		*row;
+} fatrow_t;
+
+typedef struct vismemo_s
+{
+	fatrow_t	rows[FAT_CACHE_ROWS];
+	uint32_t	stamp;
+	int32_t		c_vis_hits, c_vis_misses;	// written by the owner only
+	int32_t		c_fat_hits, c_fat_misses;
+	struct vismemo_s	*next;
+} vismemo_t;
+
+static System::Threads::Mutex	vis_lock;	// vis_memos only
+static int32_t		*vis_rowofs;		// [numclusters*2], 1 + offset into vis_cachemem once published
+static int32_t		*vis_rowclaim;		// [numclusters*2], the first to bump it decodes the row
+static byte		*vis_cachemem;
+static int32_t		vis_cachesize;
+static int32_t		vis_cacheused;
+static vismemo_t	*vis_memos;			// every thread's, freed with the map
+static int32_t		vis_generation;
+static int32_t		vis_statsbase[4];	// totals at the last cm_visstats reset
+
+static THREAD_LOCAL vismemo_t	*vis_memo;
+static THREAD_LOCAL int32_t		vis_memogeneration;
+
+/*
+===================
+CM_ClearVisCache
+
+Called whenever a new map is loaded, with no frames being built
+===================
+*/
+void CM_ClearVisCache (void)
+{
+	int32_t		i;
+	int64_t		size;
+	vismemo_t	*m, *next;
+
+	vis_lock.lock ();
+
+	if (vis_rowofs)
+		Z_Free (vis_rowofs);
+	if (vis_rowclaim)
+		Z_Free (vis_rowclaim);
+	if (vis_cachemem)
+		Z_Free (vis_cachemem);
+	vis_rowofs = NULL;
+	vis_rowclaim = NULL;
+	vis_cachemem = NULL;
+	vis_cachesize = vis_cacheused = 0;
+
+	for (m=vis_memos ; m ; m=next)
+	{
+		next = m->next;
+		free (m);
+	}
+	vis_memos = NULL;
+	vis_generation++;		// the threads' own pointers are stale now
+	memset (vis_statsbase, 0, sizeof(vis_statsbase));
+
+	if (numvisibility && numclusters > 0)
+	{
+		size = (int64_t)numclusters*2*((numclusters+7)>>3);
+		vis_cachesize = (size > VIS_CACHE_BYTES) ? VIS_CACHE_BYTES : (int32_t)size;
+		vis_rowofs = (int32_t*)Z_Malloc (sizeof(int32_t)*numclusters*2);
+		vis_rowclaim = (int32_t*)Z_Malloc (sizeof(int32_t)*numclusters*2);
+		vis_cachemem = (byte*)Z_Malloc (vis_cachesize);
+
+		for (i=0 ; i<numclusters*2 ; i++)
+		{
+			vis_rowofs[i] = 0;
+			vis_rowclaim[i] = 0;
+		}
+	}
+
+	vis_lock.unlock ();
+}
+
+/*
+===================
+CM_VisMemo
+
+The calling thread's fat PVS rows and counters, made on first use
+===================
+*/
+static vismemo_t *CM_VisMemo (void)
+{
+	vismemo_t	*m;
+	int32_t		i, rowbytes;
+
+	if (vis_memo && vis_memogeneration == vis_generation)
+		return vis_memo;
+
+	rowbytes = (numclusters+7)>>3;
+	m = (vismemo_t*)malloc (sizeof(vismemo_t) + FAT_CACHE_ROWS*rowbytes);
+	if (!m)
+		Com_Error (ERR_FATAL, "CM_VisMemo: out of memory");
+	memset (m, 0, sizeof(vismemo_t));
+	for (i=0 ; i<FAT_CACHE_ROWS ; i++)
+	{
+		m->rows[i].numclusters = -1;
+		m->rows[i].row = (byte *)(m+1) + i*rowbytes;
+	}
+
+	vis_lock.lock ();
+	m->next = vis_memos;
+	vis_memos = m;
+	vis_lock.unlock ();
+
+	vis_memo = m;
+	vis_memogeneration = vis_generation;
+	return m;
+}
+
+/*
+===================
+CM_CachedVisRow
+===================
+*/
+static void CM_CachedVisRow (int32_t cluster, int32_t vistype, byte *row)
+{
+	int32_t		key, ofs;
+	int32_t		rowbytes;
+	byte		*in;
+	vismemo_t	*m;
+
+	rowbytes = (numclusters+7)>>3;
+	if (cluster == -1)
+	{
+		memset (row, 0, rowbytes);
+		return;
+	}
+
+	in = map_visibility + map_vis->bitofs[cluster][vistype];
+	if (!vis_rowofs)
+	{	// no vis info, or no map
+		CM_DecompressVis (in, row);
+		return;
+	}
+
+	m = CM_VisMemo ();
+	key = cluster*2 + vistype;
+	ofs = System::Threads::Load (&vis_rowofs[key]);
+	if (ofs)
+	{
+		System::Threads::Store (&m->c_vis_hits, m->c_vis_hits + 1);
+		memcpy (row, vis_cachemem + ofs-1, rowbytes);
+		return;
+	}
+	System::Threads::Store (&m->c_vis_misses, m->c_vis_misses + 1);
+
+	// someone else is on it, or there's no room left
+	if (System::Threads::FetchAdd (&vis_rowclaim[key], 1)
+		|| System::Threads::Load (&vis_cacheused) + rowbytes > vis_cachesize)
+	{
+		CM_DecompressVis (in, row);
+		return;
+	}
+	ofs = System::Threads::FetchAdd (&vis_cacheused, rowbytes);
+	if (ofs + rowbytes > vis_cachesize)
+	{
+		CM_DecompressVis (in, row);
+		return;
+	}
+
+	CM_DecompressVis (in, vis_cachemem + ofs);
+	System::Threads::Store (&vis_rowofs[key], ofs+1);
+	memcpy (row, vis_cachemem + ofs, rowbytes);
+}
+
+/*
+===================
+CM_ClusterPVSRow
+
+Decompresses into a caller supplied row of at least (numclusters+7)>>3
+bytes, so it can be used from more than one thread
+===================
+*/
+void	CM_ClusterPVSRow (int32_t cluster, byte *row)
+{
+	CM_CachedVisRow (cluster, DVIS_PVS, row);
+}
+
+void	CM_ClusterPHSRow (int32_t cluster, byte *row)
+{
+	CM_CachedVisRow (cluster, DVIS_PHS, row);
+}
+
+/*
+===================
+CM_FatPVSRow
+
+ORs together the PVS rows of every cluster touched by a 16 unit box
+around org.  A view that hasn't moved is found without walking the
+tree, and small cluster sets are memoized in any order.
+===================
+*/
+void	CM_FatPVSRow (vec3_t org, byte *row)
+{
+	int32_t		leafs[64];
+	int32_t		set[64];
+	int32_t		count, numset;
+	int32_t		i, j, c;
+	int32_t		rowbytes;
+	vec3_t		mins, maxs;
+	byte		src[MAX_MAP_LEAFS/8];
+	vismemo_t	*m;
+	fatrow_t	*f;
+
+	rowbytes = (numclusters+7)>>3;
+	m = CM_VisMemo ();
+
+	for (i=0, f=m->rows ; i<FAT_CACHE_ROWS ; i++, f++)
+	{
+		if (f->numclusters == -1 || !VectorCompare (f->org, org))
+			continue;
+		System::Threads::Store (&m->c_fat_hits, m->c_fat_hits + 1);
+		f->used = ++m->stamp;
+		memcpy (row, f->row, rowbytes);
+		return;
+	}
+
+	for (i=0 ; i<3 ; i++)
+	{
+		mins[i] = org[i] - 8;
+		maxs[i] = org[i] + 8;
+	}
+
+	count = CM_BoxLeafnums (mins, maxs, leafs, 64, NULL);
+	if (count < 1)
+		Com_Error (ERR_FATAL, "CM_FatPVSRow: count < 1");
+
+	// sorted unique key, -1 adds nothing
+	numset = 0;
+	for (i=0 ; i<count ; i++)
+	{
+		c = CM_LeafCluster (leafs[i]);
+		if (c == -1)
+			continue;
+		for (j=numset ; j>0 && set[j-1] > c ; j--)
+			;
+		if (j>0 && set[j-1] == c)
+			continue;
+		memmove (set+j+1, set+j, (numset-j)*sizeof(int32_t));
+		set[j] = c;
+		numset++;
+	}
+
+	if (numset <= FAT_CACHE_CLUSTERS)
+	{
+		for (i=0, f=m->rows ; i<FAT_CACHE_ROWS ; i++, f++)
+		{
+			if (f->numclusters != numset
+				|| memcmp (f->clusters, set, numset*sizeof(int32_t)))
+				continue;
+			System::Threads::Store (&m->c_fat_hits, m->c_fat_hits + 1);
+			VectorCopy (org, f->org);
+			f->used = ++m->stamp;
+			memcpy (row, f->row, rowbytes);
+			return;
+		}
+	}
+	System::Threads::Store (&m->c_fat_misses, m->c_fat_misses + 1);
+
+	memset (row, 0, rowbytes);
+	for (i=0 ; i<numset ; i++)
+	{
+		CM_ClusterPVSRow (set[i], src);
+		Vis_Or (row, src, rowbytes);
+	}
+
+	if (numset > FAT_CACHE_CLUSTERS)
+		return;
+
+	f = m->rows;
+	for (i=1 ; i<FAT_CACHE_ROWS ; i++)
+		if (m->rows[i].used < f->used)
+			f = &m->rows[i];
+
+	VectorCopy (org, f->org);
+	f->numclusters = numset;
+	memcpy (f->clusters, set, numset*sizeof(int32_t));
+	f->used = ++m->stamp;
+	memcpy (f->row, row, rowbytes);
+}
+
+/*
+===================
+CM_VisStats_f
+
+Adds up every thread's counters
+===================
+*/
+void CM_VisStats_f (void)
+{
+	int32_t		total, rows, used, i;
+	int32_t		c[4];
+	vismemo_t	*m;
+
+	memset (c, 0, sizeof(c));
+	vis_lock.lock ();
+	for (m=vis_memos ; m ; m=m->next)
+	{
+		c[0] += System::Threads::Load (&m->c_vis_hits);
+		c[1] += System::Threads::Load (&m->c_vis_misses);
+		c[2] += System::Threads::Load (&m->c_fat_hits);
+		c[3] += System::Threads::Load (&m->c_fat_misses);
+	}
+	vis_lock.unlock ();
+
+	for (i=0 ; i<4 ; i++)
+		c[i] -= vis_statsbase[i];
+
+	rows = (numclusters+7)>>3;
+	if (rows)
+	{
+		used = System::Threads::Load (&vis_cacheused);
+		rows = ((used < vis_cachesize) ? used : vis_cachesize) / rows;
+	}
+	total = c[0] + c[1];
+	Com_Printf ("vis rows: %i hits, %i misses (%i%%), %i rows cached\n", c[0], c[1],
+		total ? (int32_t)(100.0*c[0]/total) : 0, rows);
+	total = c[2] + c[3];
+	Com_Printf ("fat pvs:  %i hits, %i misses (%i%%)\n", c[2], c[3],
+		total ? (int32_t)(100.0*c[2]/total) : 0);
+
+	if (Cmd_Argc() > 1 && !Q_strcasecmp (Cmd_Argv(1), "reset"))
+	{
+		for (i=0 ; i<4 ; i++)
+			vis_statsbase[i] += c[i];
+	}
+}
+
 byte	pvsrow[MAX_MAP_LEAFS/8];
 byte	phsrow[MAX_MAP_LEAFS/8];
 
 byte	*CM_ClusterPVS (int32_t cluster)
 {
-	if (cluster == -1)
-		memset (pvsrow, 0, (numclusters+7)>>3);
-	else
-		CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PVS], pvsrow);
+	CM_ClusterPVSRow (cluster, pvsrow);
 	return pvsrow;
 }
 
 byte	*CM_ClusterPHS (int32_t cluster)
 {
-	if (cluster == -1)
-		memset (phsrow, 0, (numclusters+7)>>3);
-	else
-		CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PHS], phsrow);
+	CM_ClusterPHSRow (cluster, phsrow);
 	return phsrow;
 }
 
@@ -1824,7 +3115,7 @@ qboolean CM_HeadnodeVisible (int32_t nodenum, byte *visbits)
 		cluster = map_leafs[leafnum].cluster;
 		if (cluster == -1)
 			return false;
-		if (visbits[cluster>>3] & (1<<(cluster&7)))
+		if (VIS_TEST(visbits, cluster))
 			return true;
 		return false;
 	}
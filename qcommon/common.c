@@ -24,7 +24,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "qcommon.h"
 #include <setjmp.h>
 
-#include "../backends/sdl2/sdl2quake.h"
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 #define	MAXPRINTMSG	8192 // was 4096, fix for nVidia 191.xx crash
 
@@ -78,14 +80,14 @@ static char	*rd_buffer;
 static int32_t	rd_buffersize;
 static void	(*rd_flush)(int32_t target, char *buffer);
 
-void Com_BeginRedirect (int32_t target, char *buffer, int32_t buffersize, void (*flush))
+void Com_BeginRedirect (int32_t target, char *buffer, int32_t buffersize, void (*flush)(int32_t target, char *buffer))
 {
 	if (!target || !buffer || !buffersize || !flush)
 		return;
 	rd_target = target;
 	rd_buffer = buffer;
 	rd_buffersize = buffersize;
-	rd_flush = (void(__cdecl *)(int32_t, char *))flush;
+	rd_flush = flush;
 
 	*rd_buffer = 0;
 }
@@ -866,6 +868,272 @@ void MSG_WriteDeltaEntity (entity_state_t *from, entity_state_t *to, sizebuf_t *
 }
 
 
+/*
+==================
+MSG_WriteDeltaPlayerstate
+
+Writes an svc_playerinfo, from NULL sends everything that isn't zero
+==================
+*/
+void MSG_WriteDeltaPlayerstate (player_state_t *from, player_state_t *to, sizebuf_t *msg)
+{
+	int32_t				i;
+	int32_t				pflags;
+	player_state_t	*ps, *ops;
+	player_state_t	dummy;
+	int32_t				statbits;
+
+	ps = to;
+	if (!from)
+	{
+		memset (&dummy, 0, sizeof(dummy));
+		ops = &dummy;
+	}
+	else
+		ops = from;
+
+	//
+	// determine what needs to be sent
+	//
+	pflags = 0;
+
+	if (ps->pmove.pm_type != ops->pmove.pm_type)
+		pflags |= PS_M_TYPE;
+
+	if (ps->pmove.origin[0] != ops->pmove.origin[0]
+		|| ps->pmove.origin[1] != ops->pmove.origin[1]
+		|| ps->pmove.origin[2] != ops->pmove.origin[2] )
+		pflags |= PS_M_ORIGIN;
+
+	if (ps->pmove.velocity[0] != ops->pmove.velocity[0]
+		|| ps->pmove.velocity[1] != ops->pmove.velocity[1]
+		|| ps->pmove.velocity[2] != ops->pmove.velocity[2] )
+		pflags |= PS_M_VELOCITY;
+
+	if (ps->pmove.pm_time != ops->pmove.pm_time)
+		pflags |= PS_M_TIME;
+
+	if (ps->pmove.pm_flags != ops->pmove.pm_flags)
+		pflags |= PS_M_FLAGS;
+
+	if (ps->pmove.gravity != ops->pmove.gravity)
+		pflags |= PS_M_GRAVITY;
+
+	if (ps->pmove.delta_angles[0] != ops->pmove.delta_angles[0]
+		|| ps->pmove.delta_angles[1] != ops->pmove.delta_angles[1]
+		|| ps->pmove.delta_angles[2] != ops->pmove.delta_angles[2] )
+		pflags |= PS_M_DELTA_ANGLES;
+
+
+	if (ps->viewoffset[0] != ops->viewoffset[0]
+		|| ps->viewoffset[1] != ops->viewoffset[1]
+		|| ps->viewoffset[2] != ops->viewoffset[2] )
+		pflags |= PS_VIEWOFFSET;
+
+	if (ps->viewangles[0] != ops->viewangles[0]
+		|| ps->viewangles[1] != ops->viewangles[1]
+		|| ps->viewangles[2] != ops->viewangles[2] )
+		pflags |= PS_VIEWANGLES;
+
+	if (ps->kick_angles[0] != ops->kick_angles[0]
+		|| ps->kick_angles[1] != ops->kick_angles[1]
+		|| ps->kick_angles[2] != ops->kick_angles[2] )
+		pflags |= PS_KICKANGLES;
+
+	if (ps->blend[0] != ops->blend[0]
+		|| ps->blend[1] != ops->blend[1]
+		|| ps->blend[2] != ops->blend[2]
+		|| ps->blend[3] != ops->blend[3] )
+		pflags |= PS_BLEND;
+
+	if (ps->fov != ops->fov)
+		pflags |= PS_FOV;
+
+	if (ps->rdflags != ops->rdflags)
+		pflags |= PS_RDFLAGS;
+
+	if (ps->gunframe != ops->gunframe)
+		pflags |= PS_WEAPONFRAME;
+
+#ifdef NEW_PLAYER_STATE_MEMBERS
+	//Knightmare added
+	if (ps->gunskin != ops->gunskin)
+		pflags |= PS_WEAPONSKIN;
+
+	if (ps->gunframe2 != ops->gunframe2)
+		pflags |= PS_WEAPONFRAME2;
+
+	if (ps->gunskin2 != ops->gunskin2)
+		pflags |= PS_WEAPONSKIN2;
+
+	// server-side speed control!
+	if (ps->maxspeed != ops->maxspeed)
+		pflags |= PS_MAXSPEED;
+
+	if (ps->duckspeed != ops->duckspeed)
+		pflags |= PS_DUCKSPEED;
+
+  	if (ps->waterspeed != ops->waterspeed)
+		pflags |= PS_WATERSPEED;
+
+  	if (ps->accel != ops->accel)
+		pflags |= PS_ACCEL;
+
+  	if (ps->stopspeed != ops->stopspeed)
+		pflags |= PS_STOPSPEED;
+#endif	//end Knightmare
+
+	pflags |= PS_WEAPONINDEX;
+	pflags |= PS_WEAPONINDEX2; //Knightmare added
+
+
+	//
+	// write it
+	//
+	MSG_WriteByte (msg, svc_playerinfo);
+	//MSG_WriteShort (msg, pflags);
+	MSG_WriteLong (msg, pflags); //Knightmare- write as long
+
+	//
+	// write the pmove_state_t
+	//
+	if (pflags & PS_M_TYPE)
+		MSG_WriteByte (msg, ps->pmove.pm_type);
+
+	if (pflags & PS_M_ORIGIN) // FIXME- map size
+	{
+#ifdef LARGE_MAP_SIZE
+		MSG_WritePMCoordNew (msg, ps->pmove.origin[0]);
+		MSG_WritePMCoordNew (msg, ps->pmove.origin[1]);
+		MSG_WritePMCoordNew (msg, ps->pmove.origin[2]);
+#else
+		MSG_WriteShort (msg, ps->pmove.origin[0]);
+		MSG_WriteShort (msg, ps->pmove.origin[1]);
+		MSG_WriteShort (msg, ps->pmove.origin[2]);
+#endif
+	}
+
+	if (pflags & PS_M_VELOCITY)
+	{
+		MSG_WriteShort (msg, ps->pmove.velocity[0]);
+		MSG_WriteShort (msg, ps->pmove.velocity[1]);
+		MSG_WriteShort (msg, ps->pmove.velocity[2]);
+	}
+
+	if (pflags & PS_M_TIME)
+		MSG_WriteByte (msg, ps->pmove.pm_time);
+
+	if (pflags & PS_M_FLAGS)
+		MSG_WriteByte (msg, ps->pmove.pm_flags);
+
+	if (pflags & PS_M_GRAVITY)
+		MSG_WriteShort (msg, ps->pmove.gravity);
+
+	if (pflags & PS_M_DELTA_ANGLES)
+	{
+		MSG_WriteShort (msg, ps->pmove.delta_angles[0]);
+		MSG_WriteShort (msg, ps->pmove.delta_angles[1]);
+		MSG_WriteShort (msg, ps->pmove.delta_angles[2]);
+	}
+
+	//
+	// write the rest of the player_state_t
+	//
+	if (pflags & PS_VIEWOFFSET)
+	{
+		MSG_WriteChar (msg, ps->viewoffset[0]*4);
+		MSG_WriteChar (msg, ps->viewoffset[1]*4);
+		MSG_WriteChar (msg, ps->viewoffset[2]*4);
+	}
+
+	if (pflags & PS_VIEWANGLES)
+	{
+		MSG_WriteAngle16 (msg, ps->viewangles[0]);
+		MSG_WriteAngle16 (msg, ps->viewangles[1]);
+		MSG_WriteAngle16 (msg, ps->viewangles[2]);
+	}
+
+	if (pflags & PS_KICKANGLES)
+	{
+		MSG_WriteChar (msg, ps->kick_angles[0]*4);
+		MSG_WriteChar (msg, ps->kick_angles[1]*4);
+		MSG_WriteChar (msg, ps->kick_angles[2]*4);
+	}
+
+	if (pflags & PS_WEAPONINDEX)	//Knightmare- 12/23/2001- send as int16_t
+		MSG_WriteShort (msg, ps->gunindex);
+
+#ifdef NEW_PLAYER_STATE_MEMBERS	//Knightmare added
+	if (pflags & PS_WEAPONINDEX2)
+		MSG_WriteShort (msg, ps->gunindex2); //Knightmare- gunindex2 support
+#endif		
+
+	if ((pflags & PS_WEAPONFRAME) || (pflags & PS_WEAPONFRAME2))
+	{
+		if (pflags & PS_WEAPONFRAME)
+			MSG_WriteByte (msg, ps->gunframe);
+
+#ifdef NEW_PLAYER_STATE_MEMBERS 	//Knightmare added
+		if (pflags & PS_WEAPONFRAME2)
+			MSG_WriteByte (msg, ps->gunframe2); //Knightmare- gunframe2 support
+#endif
+
+		MSG_WriteChar (msg, ps->gunoffset[0]*4);
+		MSG_WriteChar (msg, ps->gunoffset[1]*4);
+		MSG_WriteChar (msg, ps->gunoffset[2]*4);
+		MSG_WriteChar (msg, ps->gunangles[0]*4);
+		MSG_WriteChar (msg, ps->gunangles[1]*4);
+		MSG_WriteChar (msg, ps->gunangles[2]*4);
+	}
+
+#ifdef NEW_PLAYER_STATE_MEMBERS //Knightmare added
+	if (pflags & PS_WEAPONSKIN)
+		MSG_WriteShort (msg, ps->gunskin);
+
+	if (pflags & PS_WEAPONSKIN2)
+		MSG_WriteShort (msg, ps->gunskin2);
+
+	// server-side speed control!
+	if (pflags & PS_MAXSPEED)
+		MSG_WriteShort (msg, ps->maxspeed);
+
+	if (pflags & PS_DUCKSPEED)
+		MSG_WriteShort (msg, ps->duckspeed);
+
+	if (pflags & PS_WATERSPEED)
+		MSG_WriteShort (msg, ps->waterspeed);
+
+	if (pflags & PS_ACCEL)
+		MSG_WriteShort (msg, ps->accel);
+
+	if (pflags & PS_STOPSPEED)
+		MSG_WriteShort (msg, ps->stopspeed);
+#endif	//end Knightmare
+
+	if (pflags & PS_BLEND)
+	{
+		MSG_WriteByte (msg, ps->blend[0]*255);
+		MSG_WriteByte (msg, ps->blend[1]*255);
+		MSG_WriteByte (msg, ps->blend[2]*255);
+		MSG_WriteByte (msg, ps->blend[3]*255);
+	}
+	if (pflags & PS_FOV)
+		MSG_WriteByte (msg, ps->fov);
+	if (pflags & PS_RDFLAGS)
+		MSG_WriteByte (msg, ps->rdflags);
+
+	// send stats
+	statbits = 0;
+	for (i=0 ; i<MAX_STATS ; i++)
+		if (ps->stats[i] != ops->stats[i])
+			statbits |= 1<<i;
+	MSG_WriteLong (msg, statbits);
+	for (i=0 ; i<MAX_STATS ; i++)
+		if (statbits & (1<<i) )
+			MSG_WriteShort (msg, ps->stats[i]);
+}
+
+
 //============================================================
 
 //
@@ -1100,6 +1368,275 @@ void MSG_ReadDeltaUsercmd (sizebuf_t *msg_read, usercmd_t *from, usercmd_t *move
 	move->lightlevel = MSG_ReadByte (msg_read);
 }
 
+/*
+==================
+MSG_ReadEntityBits
+
+Reads the header MSG_WriteDeltaEntity starts with, returns the entity number
+==================
+*/
+int32_t MSG_ReadEntityBits (sizebuf_t *msg_read, uint32_t *bits)
+{
+	uint32_t	total;
+
+	total = MSG_ReadByte (msg_read);
+	if (total & U_MOREBITS1)
+		total |= MSG_ReadByte (msg_read) << 8;
+	if (total & U_MOREBITS2)
+		total |= MSG_ReadByte (msg_read) << 16;
+	if (total & U_MOREBITS3)
+		total |= (uint32_t)MSG_ReadByte (msg_read) << 24;
+
+	*bits = total;
+
+	if (total & U_NUMBER16)
+		return MSG_ReadShort (msg_read);
+	return MSG_ReadByte (msg_read);
+}
+
+/*
+==================
+MSG_ReadDeltaEntity
+
+The other half of MSG_WriteDeltaEntity, in the current protocol only.
+The client has its own in CL_ParseDelta, which also reads old demos.
+==================
+*/
+void MSG_ReadDeltaEntity (sizebuf_t *msg_read, entity_state_t *from, entity_state_t *to, int32_t number, uint32_t bits)
+{
+	*to = *from;
+	VectorCopy (from->origin, to->old_origin);
+	to->number = number;
+
+	if (bits & U_MODEL)
+		to->modelindex = MSG_ReadShort (msg_read);
+	if (bits & U_MODEL2)
+		to->modelindex2 = MSG_ReadShort (msg_read);
+	if (bits & U_MODEL3)
+		to->modelindex3 = MSG_ReadShort (msg_read);
+	if (bits & U_MODEL4)
+		to->modelindex4 = MSG_ReadShort (msg_read);
+
+#ifdef NEW_ENTITY_STATE_MEMBERS
+	if (bits & U_MODEL5)
+		to->modelindex5 = MSG_ReadShort (msg_read);
+	if (bits & U_MODEL6)
+		to->modelindex6 = MSG_ReadShort (msg_read);
+#ifndef LOOP_SOUND_ATTENUATION
+	if (bits & U_MODEL7_8) {
+		to->modelindex7 = MSG_ReadShort (msg_read);
+		to->modelindex8 = MSG_ReadShort (msg_read);
+	}
+#endif
+#endif
+
+	if (bits & U_FRAME8)
+		to->frame = MSG_ReadByte (msg_read);
+	if (bits & U_FRAME16)
+		to->frame = MSG_ReadShort (msg_read);
+
+	if ((bits & U_SKIN8) && (bits & U_SKIN16))
+		to->skinnum = MSG_ReadLong (msg_read);
+	else if (bits & U_SKIN8)
+		to->skinnum = MSG_ReadByte (msg_read);
+	else if (bits & U_SKIN16)
+		to->skinnum = MSG_ReadShort (msg_read);
+
+	if ( (bits & (U_EFFECTS8|U_EFFECTS16)) == (U_EFFECTS8|U_EFFECTS16) )
+		to->effects = MSG_ReadLong (msg_read);
+	else if (bits & U_EFFECTS8)
+		to->effects = MSG_ReadByte (msg_read);
+	else if (bits & U_EFFECTS16)
+		to->effects = MSG_ReadShort (msg_read);
+
+	if ( (bits & (U_RENDERFX8|U_RENDERFX16)) == (U_RENDERFX8|U_RENDERFX16) )
+		to->renderfx = MSG_ReadLong (msg_read);
+	else if (bits & U_RENDERFX8)
+		to->renderfx = MSG_ReadByte (msg_read);
+	else if (bits & U_RENDERFX16)
+		to->renderfx = MSG_ReadShort (msg_read);
+
+	if (bits & U_ORIGIN1)
+		to->origin[0] = MSG_ReadCoord (msg_read);
+	if (bits & U_ORIGIN2)
+		to->origin[1] = MSG_ReadCoord (msg_read);
+	if (bits & U_ORIGIN3)
+		to->origin[2] = MSG_ReadCoord (msg_read);
+
+	if (bits & U_ANGLE1)
+		to->angles[0] = MSG_ReadAngle (msg_read);
+	if (bits & U_ANGLE2)
+		to->angles[1] = MSG_ReadAngle (msg_read);
+	if (bits & U_ANGLE3)
+		to->angles[2] = MSG_ReadAngle (msg_read);
+
+	if (bits & U_OLDORIGIN)
+		MSG_ReadPos (msg_read, to->old_origin);
+
+#ifdef NEW_ENTITY_STATE_MEMBERS
+	if (bits & U_ALPHA)
+		to->alpha = (float)(MSG_ReadByte (msg_read) / 255.0);
+#endif
+
+	if (bits & U_SOUND)
+		to->sound = MSG_ReadShort (msg_read);
+
+#ifdef NEW_ENTITY_STATE_MEMBERS
+#ifdef LOOP_SOUND_ATTENUATION
+	if (bits & U_ATTENUAT)
+		to->attenuation = MSG_ReadByte (msg_read) / 64.0;
+#endif
+#endif
+
+	if (bits & U_EVENT)
+		to->event = MSG_ReadByte (msg_read);
+	else
+		to->event = 0;
+
+	if (bits & U_SOLID)
+		to->solid = MSG_ReadShort (msg_read);
+}
+
+/*
+==================
+MSG_ReadDeltaPlayerstate
+
+The other half of MSG_WriteDeltaPlayerstate, svc_playerinfo included.
+A NULL from reads from a cleared state.
+==================
+*/
+void MSG_ReadDeltaPlayerstate (sizebuf_t *msg_read, player_state_t *from, player_state_t *to)
+{
+	int32_t		flags, statbits;
+	int32_t		i;
+
+	if (from)
+		*to = *from;
+	else
+		memset (to, 0, sizeof(*to));
+
+	MSG_ReadByte (msg_read);	// svc_playerinfo
+	flags = MSG_ReadLong (msg_read);
+
+	if (flags & PS_M_TYPE)
+		to->pmove.pm_type = (pmtype_t)MSG_ReadByte (msg_read);
+
+	if (flags & PS_M_ORIGIN)
+	{
+#ifdef LARGE_MAP_SIZE
+		to->pmove.origin[0] = MSG_ReadPMCoordNew (msg_read);
+		to->pmove.origin[1] = MSG_ReadPMCoordNew (msg_read);
+		to->pmove.origin[2] = MSG_ReadPMCoordNew (msg_read);
+#else
+		to->pmove.origin[0] = MSG_ReadShort (msg_read);
+		to->pmove.origin[1] = MSG_ReadShort (msg_read);
+		to->pmove.origin[2] = MSG_ReadShort (msg_read);
+#endif
+	}
+
+	if (flags & PS_M_VELOCITY)
+	{
+		to->pmove.velocity[0] = MSG_ReadShort (msg_read);
+		to->pmove.velocity[1] = MSG_ReadShort (msg_read);
+		to->pmove.velocity[2] = MSG_ReadShort (msg_read);
+	}
+
+	if (flags & PS_M_TIME)
+		to->pmove.pm_time = MSG_ReadByte (msg_read);
+	if (flags & PS_M_FLAGS)
+		to->pmove.pm_flags = MSG_ReadByte (msg_read);
+	if (flags & PS_M_GRAVITY)
+		to->pmove.gravity = MSG_ReadShort (msg_read);
+
+	if (flags & PS_M_DELTA_ANGLES)
+	{
+		to->pmove.delta_angles[0] = MSG_ReadShort (msg_read);
+		to->pmove.delta_angles[1] = MSG_ReadShort (msg_read);
+		to->pmove.delta_angles[2] = MSG_ReadShort (msg_read);
+	}
+
+	if (flags & PS_VIEWOFFSET)
+	{
+		to->viewoffset[0] = MSG_ReadChar (msg_read) * 0.25;
+		to->viewoffset[1] = MSG_ReadChar (msg_read) * 0.25;
+		to->viewoffset[2] = MSG_ReadChar (msg_read) * 0.25;
+	}
+
+	if (flags & PS_VIEWANGLES)
+	{
+		to->viewangles[0] = MSG_ReadAngle16 (msg_read);
+		to->viewangles[1] = MSG_ReadAngle16 (msg_read);
+		to->viewangles[2] = MSG_ReadAngle16 (msg_read);
+	}
+
+	if (flags & PS_KICKANGLES)
+	{
+		to->kick_angles[0] = MSG_ReadChar (msg_read) * 0.25;
+		to->kick_angles[1] = MSG_ReadChar (msg_read) * 0.25;
+		to->kick_angles[2] = MSG_ReadChar (msg_read) * 0.25;
+	}
+
+	if (flags & PS_WEAPONINDEX)
+		to->gunindex = MSG_ReadShort (msg_read);
+
+#ifdef NEW_PLAYER_STATE_MEMBERS
+	if (flags & PS_WEAPONINDEX2)
+		to->gunindex2 = MSG_ReadShort (msg_read);
+#endif
+
+	if ((flags & PS_WEAPONFRAME) || (flags & PS_WEAPONFRAME2))
+	{
+		if (flags & PS_WEAPONFRAME)
+			to->gunframe = MSG_ReadByte (msg_read);
+#ifdef NEW_PLAYER_STATE_MEMBERS
+		if (flags & PS_WEAPONFRAME2)
+			to->gunframe2 = MSG_ReadByte (msg_read);
+#endif
+		to->gunoffset[0] = MSG_ReadChar (msg_read) * 0.25;
+		to->gunoffset[1] = MSG_ReadChar (msg_read) * 0.25;
+		to->gunoffset[2] = MSG_ReadChar (msg_read) * 0.25;
+		to->gunangles[0] = MSG_ReadChar (msg_read) * 0.25;
+		to->gunangles[1] = MSG_ReadChar (msg_read) * 0.25;
+		to->gunangles[2] = MSG_ReadChar (msg_read) * 0.25;
+	}
+
+#ifdef NEW_PLAYER_STATE_MEMBERS
+	if (flags & PS_WEAPONSKIN)
+		to->gunskin = MSG_ReadShort (msg_read);
+	if (flags & PS_WEAPONSKIN2)
+		to->gunskin2 = MSG_ReadShort (msg_read);
+
+	if (flags & PS_MAXSPEED)
+		to->maxspeed = MSG_ReadShort (msg_read);
+	if (flags & PS_DUCKSPEED)
+		to->duckspeed = MSG_ReadShort (msg_read);
+	if (flags & PS_WATERSPEED)
+		to->waterspeed = MSG_ReadShort (msg_read);
+	if (flags & PS_ACCEL)
+		to->accel = MSG_ReadShort (msg_read);
+	if (flags & PS_STOPSPEED)
+		to->stopspeed = MSG_ReadShort (msg_read);
+#endif
+
+	if (flags & PS_BLEND)
+	{
+		to->blend[0] = MSG_ReadByte (msg_read) / 255.0;
+		to->blend[1] = MSG_ReadByte (msg_read) / 255.0;
+		to->blend[2] = MSG_ReadByte (msg_read) / 255.0;
+		to->blend[3] = MSG_ReadByte (msg_read) / 255.0;
+	}
+
+	if (flags & PS_FOV)
+		to->fov = MSG_ReadByte (msg_read);
+	if (flags & PS_RDFLAGS)
+		to->rdflags = MSG_ReadByte (msg_read);
+
+	statbits = MSG_ReadLong (msg_read);
+	for (i=0 ; i<MAX_STATS ; i++)
+		if (statbits & (1<<i) )
+			to->stats[i] = MSG_ReadShort (msg_read);
+}
+
 
 void MSG_ReadData (sizebuf_t *msg_read, void *data, int32_t len)
 {
@@ -1853,6 +2390,9 @@ void Qcommon_Init (int32_t argc, char **argv)
 	//
     Cmd_AddCommand ("z_stats", Z_Stats_f);
     Cmd_AddCommand ("error", Com_Error_f);
+    Cmd_AddCommand ("cm_visstats", CM_VisStats_f);
+    Cmd_AddCommand ("cm_tracelog", CM_TraceLog_f);
+    Cmd_AddCommand ("cm_tracebench", CM_TraceBench_f);
 
 	host_speeds = Cvar_Get ("host_speeds", "0", 0);
 	log_stats = Cvar_Get ("log_stats", "0", 0);
@@ -1883,6 +2423,8 @@ void Qcommon_Init (int32_t argc, char **argv)
 		Cmd_AddCommand ("quit", Com_Quit);
 
 	Sys_Init ();
+	Vis_Init ();
+	CM_InitKernels ();
     
 	NET_Init ();
 	Netchan_Init ();
@@ -1958,11 +2500,19 @@ void Qcommon_Frame (int32_t msec)
 	{
 		extern	int32_t c_traces, c_brush_traces;
 		extern	int32_t	c_pointcontents;
+		extern	int32_t	c_memo_lookups, c_memo_hits, c_memo_worldhits;
 
-		Com_Printf ("%4i traces  %4i points\n", c_traces, c_pointcontents);
+		Com_Printf ("%4i traces  %4i points", c_traces, c_pointcontents);
+		if (c_memo_lookups)
+			Com_Printf ("  %4i memo lookups  %3i%% hits  %3i%% world hits", c_memo_lookups,
+				c_memo_hits * 100 / c_memo_lookups, c_memo_worldhits * 100 / c_memo_lookups);
+		Com_Printf ("\n");
 		c_traces = 0;
 		c_brush_traces = 0;
 		c_pointcontents = 0;
+		c_memo_lookups = 0;
+		c_memo_hits = 0;
+		c_memo_worldhits = 0;
 	}
 
 	do
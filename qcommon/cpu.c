@@ -0,0 +1,81 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// cpu.c -- instruction set checks for the SIMD kernel dispatch
+
+#include "qcommon.h"
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define CPU_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+#endif
+
+/*
+=================
+Com_CpuHasSSE2
+=================
+*/
+qboolean Com_CpuHasSSE2 (void)
+{
+#if !defined(CPU_X86)
+	return false;
+#elif defined(__x86_64__) || defined(_M_X64)
+	return true;
+#elif defined(_MSC_VER)
+	int32_t		regs[4];
+
+	__cpuid (regs, 1);
+	return (regs[3] & (1<<26)) != 0;
+#else
+	__builtin_cpu_init ();
+	return __builtin_cpu_supports ("sse2") != 0;
+#endif
+}
+
+/*
+=================
+Com_CpuHasAVX2
+=================
+*/
+qboolean Com_CpuHasAVX2 (void)
+{
+#if !defined(CPU_X86)
+	return false;
+#elif defined(_MSC_VER)
+	int32_t		regs[4];
+
+	__cpuid (regs, 0);
+	if (regs[0] < 7)
+		return false;
+	// the OS has to save the ymm registers too
+	__cpuid (regs, 1);
+	if (!(regs[2] & (1<<27)) || !(regs[2] & (1<<28)))
+		return false;
+	if ((_xgetbv (0) & 6) != 6)
+		return false;
+	__cpuidex (regs, 7, 0);
+	return (regs[1] & (1<<5)) != 0;
+#else
+	__builtin_cpu_init ();
+	return __builtin_cpu_supports ("avx2") != 0;
+#endif
+}
@@ -0,0 +1,288 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// demoindex.c -- keyframes and a seek index for recorded demos
+
+#include "qcommon.h"
+
+/*
+===============================================================================
+
+A demo is still the usual run of length prefixed server messages ended by
+-1, so any player can run it forward.  Every demo_keyframes seconds the
+recorder also builds a keyframe: the configstrings, the baselines and an
+uncompressed frame, everything a client needs to pick the stream up from
+the message after it.  Keyframes collect in a side file and are appended
+after the -1 when recording stops, each ending in its own -1, followed by
+
+	demokey_t	index[numkeys];
+	int32_t		indexstart, numkeys, DEMO_INDEXVERSION, DEMO_INDEXID;
+
+with all offsets from the start of the demo and all values little endian.
+A demo without the trailer, from an older build or a recording that never
+got stopped, just can't seek.
+
+===============================================================================
+*/
+
+static cvar_t	*demo_keyframes;
+
+/*
+=================
+Demo_BeginIndex
+
+Called once the demo file is open.  Without a side file for the keyframes
+the demo is recorded as before, just without an index.
+=================
+*/
+void Demo_BeginIndex (demoindex_t *di, const char *demopath)
+{
+	memset (di, 0, sizeof(*di));
+	di->keystart = -1;
+	di->lastservertime = -1;
+
+	if (!demo_keyframes)
+		demo_keyframes = Cvar_Get ("demo_keyframes", "10", CVAR_ARCHIVE);
+	if (demo_keyframes->value <= 0)
+		return;
+
+	Com_sprintf (di->keypath, sizeof(di->keypath), "%s.keys", demopath);
+	di->keys = Demo_OpenWriter (di->keypath, false);
+	if (!di->keys)
+		Com_Printf ("Couldn't open %s, recording without a seek index\n", di->keypath);
+}
+
+/*
+=================
+Demo_NewLevel
+
+A serverdata message went into the demo.  Keyframes only hold what a
+client keeps across frames, so they are never used to seek to another
+level, and the new one gets its first keyframe right away.
+=================
+*/
+void Demo_NewLevel (demoindex_t *di)
+{
+	di->level++;
+	di->lastservertime = -1;
+	di->nexttime = di->time;
+}
+
+/*
+=================
+Demo_KeyframeDue
+
+Advances the demo clock to the frame at servertime, true when it is time
+for another keyframe
+=================
+*/
+qboolean Demo_KeyframeDue (demoindex_t *di, int32_t servertime)
+{
+	if (!di->keys)
+		return false;
+
+	if (di->lastservertime != -1 && servertime > di->lastservertime)
+		di->time += servertime - di->lastservertime;
+	di->lastservertime = servertime;
+
+	return (di->time >= di->nexttime);
+}
+
+/*
+=================
+Demo_WriteKeyMessage
+
+Adds buf to the keyframe being written and clears it
+=================
+*/
+void Demo_WriteKeyMessage (demoindex_t *di, sizebuf_t *buf)
+{
+	int32_t		len;
+
+	if (!buf->cursize)
+		return;
+
+	if (di->keystart == -1)
+		di->keystart = (int32_t)Demo_WriterTell (di->keys);
+
+	len = LittleLong (buf->cursize);
+	Demo_Write (di->keys, &len, 4);
+	Demo_Write (di->keys, buf->data, buf->cursize);
+	SZ_Clear (buf);
+}
+
+/*
+=================
+Demo_EndKeyframe
+
+offset is where the demo continues after the keyframe.  The index
+only has 32 bits for it, Demo_FinishIndex leaves the index off a demo
+that gets past 2 GB.
+=================
+*/
+void Demo_EndKeyframe (demoindex_t *di, int64_t offset)
+{
+	demokey_t	*key;
+	int32_t		len;
+
+	if (di->keystart == -1)
+		return;
+
+	len = -1;
+	Demo_Write (di->keys, &len, 4);
+
+	if (di->numkeys == di->maxkeys)
+	{
+		di->maxkeys = di->maxkeys ? di->maxkeys*2 : 64;
+		key = (demokey_t *)Z_Malloc (di->maxkeys*sizeof(demokey_t));
+		if (di->index)
+		{
+			memcpy (key, di->index, di->numkeys*sizeof(demokey_t));
+			Z_Free (di->index);
+		}
+		di->index = key;
+	}
+
+	key = &di->index[di->numkeys++];
+	key->time = di->time;
+	key->level = di->level;
+	key->offset = (int32_t)offset;
+	key->keyframe = di->keystart;
+
+	di->keystart = -1;
+	di->nexttime = di->time + (int32_t)(demo_keyframes->value * 1000);
+}
+
+/*
+=================
+Demo_FinishIndex
+
+Called with demo just past its -1 terminator
+=================
+*/
+void Demo_FinishIndex (demoindex_t *di, demowriter_t *demo)
+{
+	byte		buf[32768];
+	FILE		*keys;
+	int64_t		end;
+	int32_t		base, trailer[4];
+	int32_t		i, r;
+	demokey_t	key;
+
+	if (!di->keys)
+		return;
+
+	// the offsets in the index are 32 bits
+	end = Demo_WriterTell (demo) + Demo_WriterTell (di->keys) + di->numkeys*(int64_t)sizeof(demokey_t) + (int64_t)sizeof(trailer);
+
+	keys = NULL;
+	if (Demo_CloseWriter (di->keys) && di->numkeys && end <= 0x7fffffff)
+		keys = fopen (di->keypath, "rb");
+	if (keys)
+	{
+		base = (int32_t)Demo_WriterTell (demo);
+
+		while ((r = fread (buf, 1, sizeof(buf), keys)) > 0)
+			Demo_Write (demo, buf, r);
+		fclose (keys);
+
+		trailer[0] = LittleLong ((int32_t)Demo_WriterTell (demo));
+		trailer[1] = LittleLong (di->numkeys);
+		trailer[2] = LittleLong (DEMO_INDEXVERSION);
+		trailer[3] = LittleLong (DEMO_INDEXID);
+
+		for (i=0 ; i<di->numkeys ; i++)
+		{
+			key.time = LittleLong (di->index[i].time);
+			key.level = LittleLong (di->index[i].level);
+			key.offset = LittleLong (di->index[i].offset);
+			key.keyframe = LittleLong (base + di->index[i].keyframe);
+			Demo_Write (demo, &key, sizeof(key));
+		}
+		Demo_Write (demo, trailer, sizeof(trailer));
+	}
+
+	remove (di->keypath);
+	if (di->index)
+		Z_Free (di->index);
+	memset (di, 0, sizeof(*di));
+}
+
+/*
+=================
+Demo_ReadIndex
+
+base is the position of the demo's first byte in f and size its length.
+Returns the number of keys, 0 if the demo has no index.  f is left where
+it was.
+=================
+*/
+int32_t Demo_ReadIndex (fileHandle_t f, int32_t base, int32_t size, demokey_t **index)
+{
+	int32_t		trailer[4];
+	int32_t		pos, start, count, i;
+	demokey_t	*keys;
+
+	*index = NULL;
+	if (size < (int32_t)sizeof(trailer))
+		return 0;
+
+	pos = FS_Tell (f);
+	count = 0;
+
+	FS_Seek (f, base + size - sizeof(trailer), FS_SEEK_SET);
+	if (FS_FRead (trailer, sizeof(trailer), 1, f) == sizeof(trailer)
+		&& LittleLong (trailer[3]) == DEMO_INDEXID
+		&& LittleLong (trailer[2]) == DEMO_INDEXVERSION)
+	{
+		start = LittleLong (trailer[0]);
+		count = LittleLong (trailer[1]);
+
+		// bound count before multiplying, a crafted one could wrap the size
+		if (start < 0 || start > size - (int32_t)sizeof(trailer)
+			|| count <= 0 || count > (size - (int32_t)sizeof(trailer) - start) / (int32_t)sizeof(demokey_t)
+			|| (int64_t)start + (int64_t)count*(int64_t)sizeof(demokey_t) + (int64_t)sizeof(trailer) != (int64_t)size)
+			count = 0;
+	}
+
+	if (count)
+	{
+		keys = (demokey_t *)Z_Malloc (count*sizeof(demokey_t));
+		FS_Seek (f, base + start, FS_SEEK_SET);
+		if (FS_FRead (keys, count*sizeof(demokey_t), 1, f) == count*(int32_t)sizeof(demokey_t))
+		{
+			for (i=0 ; i<count ; i++)
+			{
+				keys[i].time = LittleLong (keys[i].time);
+				keys[i].level = LittleLong (keys[i].level);
+				keys[i].offset = LittleLong (keys[i].offset);
+				keys[i].keyframe = LittleLong (keys[i].keyframe);
+			}
+			*index = keys;
+		}
+		else
+		{
+			Z_Free (keys);
+			count = 0;
+		}
+	}
+
+	FS_Seek (f, pos, FS_SEEK_SET);
+	return count;
+}
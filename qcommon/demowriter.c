@@ -0,0 +1,352 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// demowriter.c -- buffered, threaded and optionally gzipped demo output
+
+#include "../../Source/SystemThreads.h"
+#include "../../Source/SystemTimer.h"
+
+#include "qcommon.h"
+#include "zlib.h"
+
+/*
+===============================================================================
+
+Demo_Write only copies into a ring of demo_buffer kilobytes.  The frame
+loop is the only producer and a thread per demo the only consumer, so
+head and tail are plain counters that each side stores and the other
+loads, with no lock on the way.  The thread wakes when the ring gets a
+quarter full or every 50ms, and runs what it finds through deflate when
+demo_compress made the demo a .dm2.gz, the gzip stream the file system
+inflates again for playback.  The gzip header carries an extra field
+that is filled in with the inflated length when the demo is closed, so
+the file system can tell a finished demo from one still being recorded
+or cut short, whose gzip trailer isn't there yet.
+
+A full ring stalls the frame until the thread catches up, which is
+counted, and if the disk fails the rest of the demo is dropped, which is
+counted too.  Both are reported when the demo is closed.
+
+===============================================================================
+*/
+
+#define	DEMO_OUTBUF		65536
+
+struct demowriter_s
+{
+	char		path[MAX_OSPATH];
+	FILE		*file;
+	qboolean	compress;
+	z_stream	zs;
+	gz_header	gzhead;
+	byte		gzextra[12];	// "DL", 8, the length, see DEMO_GZLENGTHOFS
+
+	byte		*ring;
+	int32_t		size;			// power of two
+	int32_t		head;			// bytes ever written, as a wrapping uint32_t
+	int32_t		tail;			// bytes ever taken by the thread, likewise
+	int32_t		quit;
+	int32_t		failed;
+
+	System::Threads::Thread	thread;
+	System::Threads::Event	wake;		// for the thread
+	System::Threads::Event	drained;	// for a stalled Demo_Write
+
+	// main thread only
+	uint64_t	total;
+	uint32_t	stalls;
+	uint32_t	stalledbytes;
+	uint64_t	stalltime;
+	uint32_t	dropped;
+
+	// writer thread only
+	uint64_t	ondisk;
+};
+
+static cvar_t	*demo_buffer;
+static cvar_t	*demo_compress;
+
+/*
+=================
+Demo_WriterOutput
+
+Writer thread, returns false once the file can't be written
+=================
+*/
+static qboolean Demo_WriterOutput (demowriter_t *w, byte *data, int32_t len, int32_t flush)
+{
+	byte		out[DEMO_OUTBUF];
+	int32_t		count;
+
+	if (!w->compress)
+	{
+		if (fwrite (data, 1, len, w->file) != (size_t)len)
+			return false;
+		w->ondisk += len;
+		return true;
+	}
+
+	w->zs.next_in = data;
+	w->zs.avail_in = len;
+	do
+	{
+		w->zs.next_out = out;
+		w->zs.avail_out = sizeof(out);
+		if (deflate (&w->zs, flush) == Z_STREAM_ERROR)
+			return false;
+
+		count = sizeof(out) - w->zs.avail_out;
+		if (count && fwrite (out, 1, count, w->file) != (size_t)count)
+			return false;
+		w->ondisk += count;
+	} while (!w->zs.avail_out);
+
+	return true;
+}
+
+/*
+=================
+Demo_WriterThread
+=================
+*/
+static void Demo_WriterThread (int32_t index, void *data)
+{
+	demowriter_t	*w = (demowriter_t *)data;
+	uint32_t	head, tail;
+	int32_t		quit, start, len;
+	qboolean	ok;
+
+	ok = true;
+	tail = (uint32_t)w->tail;
+	while (1)
+	{
+		// quit before head, so the head seen is the final one
+		quit = System::Threads::Load (&w->quit);
+		head = (uint32_t)System::Threads::Load (&w->head);
+
+		if (head == tail)
+		{
+			if (quit)
+				break;
+			w->wake.Wait (50);
+			continue;
+		}
+
+		start = (int32_t)(tail & (w->size-1));
+		len = (int32_t)(head - tail);
+		if (len > w->size - start)
+			len = w->size - start;
+
+		// after a failure keep draining, so the frame never waits on it
+		if (ok && !Demo_WriterOutput (w, w->ring + start, len, Z_NO_FLUSH))
+		{
+			ok = false;
+			System::Threads::Store (&w->failed, 1);
+		}
+
+		tail += len;
+		System::Threads::Store (&w->tail, (int32_t)tail);
+		w->drained.Signal ();
+	}
+
+	if (ok && w->compress && !Demo_WriterOutput (w, NULL, 0, Z_FINISH))
+		ok = false;
+	if (ok && fflush (w->file))
+		ok = false;
+	if (!ok)
+		System::Threads::Store (&w->failed, 1);
+}
+
+/*
+=================
+Demo_OpenWriter
+
+path gets .gz added if the demo is compressed.  Returns NULL if the file
+can't be opened.
+=================
+*/
+demowriter_t *Demo_OpenWriter (char *path, qboolean compress)
+{
+	demowriter_t	*w;
+	int32_t		size;
+
+	if (!demo_buffer)
+	{
+		demo_buffer = Cvar_Get ("demo_buffer", "2048", CVAR_ARCHIVE);
+		demo_compress = Cvar_Get ("demo_compress", "0", CVAR_ARCHIVE);
+	}
+
+	compress = (compress && demo_compress->value);
+	if (compress)
+		Q_strncatz (path, ".gz", MAX_OSPATH);
+
+	w = new demowriter_t ();
+	Q_strncpyz (w->path, path, sizeof(w->path));
+	w->compress = compress;
+
+	w->file = fopen (path, "wb");
+	if (!w->file)
+	{
+		delete w;
+		return NULL;
+	}
+
+	// windowBits 15 + 16 for a gzip header
+	if (compress && deflateInit2 (&w->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		fclose (w->file);
+		delete w;
+		return NULL;
+	}
+	if (compress)
+	{
+		w->gzextra[0] = 'D';
+		w->gzextra[1] = 'L';
+		w->gzextra[2] = 8;
+		w->gzhead.extra = w->gzextra;
+		w->gzhead.extra_len = sizeof(w->gzextra);
+		w->gzhead.os = 255;
+		deflateSetHeader (&w->zs, &w->gzhead);
+	}
+
+	for (size = 65536 ; size < demo_buffer->value * 1024 && size < (1<<28) ; size <<= 1)
+		;
+	w->size = size;
+	w->ring = (byte *)Z_TagMalloc (size, TAG_SYSTEM);
+
+	w->thread.Start (Demo_WriterThread, w);
+	return w;
+}
+
+/*
+=================
+Demo_Write
+
+Main thread
+=================
+*/
+void Demo_Write (demowriter_t *w, const void *data, int32_t len)
+{
+	const byte	*in = (const byte *)data;
+	uint32_t	head;
+	int32_t		space, chunk, offset;
+	uint64_t	start;
+
+	w->total += len;
+	if (System::Threads::Load (&w->failed))
+	{
+		if (!w->dropped)
+			Com_Printf (S_COLOR_YELLOW"Couldn't write %s, dropping the rest of the demo\n", w->path);
+		w->dropped += len;
+		return;
+	}
+
+	head = (uint32_t)w->head;
+	start = 0;
+	while (len)
+	{
+		space = w->size - (int32_t)(head - (uint32_t)System::Threads::Load (&w->tail));
+		if (!space)
+		{
+			if (!start)
+			{
+				start = System::Timer::Microseconds ();
+				w->stalls++;
+				w->stalledbytes += len;
+			}
+			w->wake.Signal ();
+			w->drained.Wait (100);
+			continue;
+		}
+
+		offset = (int32_t)(head & (w->size-1));
+		chunk = len;
+		if (chunk > space)
+			chunk = space;
+		if (chunk > w->size - offset)
+			chunk = w->size - offset;
+
+		memcpy (w->ring + offset, in, chunk);
+		head += chunk;
+		in += chunk;
+		len -= chunk;
+		System::Threads::Store (&w->head, (int32_t)head);
+	}
+
+	if (start)
+		w->stalltime += System::Timer::Microseconds () - start;
+	if (head - (uint32_t)System::Threads::Load (&w->tail) >= (uint32_t)w->size / 4)
+		w->wake.Signal ();
+}
+
+/*
+=================
+Demo_WriterTell
+
+Bytes written so far, before compression
+=================
+*/
+int64_t Demo_WriterTell (demowriter_t *w)
+{
+	return (int64_t)w->total;
+}
+
+/*
+=================
+Demo_CloseWriter
+
+Waits for the thread to write out the rest, false if anything got lost
+=================
+*/
+qboolean Demo_CloseWriter (demowriter_t *w)
+{
+	byte		length[8];
+	int32_t		i;
+	qboolean	ok;
+
+	System::Threads::Store (&w->quit, 1);
+	w->wake.Signal ();
+	w->thread.Join ();
+
+	if (w->compress)
+	{
+		deflateEnd (&w->zs);
+
+		// the stream is complete, so the length can go in the header
+		for (i=0 ; i<8 ; i++)
+			length[i] = (byte)(w->total >> (i*8));
+		if (!w->failed && (fseek (w->file, DEMO_GZLENGTHOFS, SEEK_SET)
+			|| fwrite (length, 1, sizeof(length), w->file) != sizeof(length)))
+			w->failed = 1;
+	}
+	if (fclose (w->file))
+		w->failed = 1;
+
+	if (w->failed && !w->dropped)
+		Com_Printf (S_COLOR_YELLOW"Couldn't write all of %s\n", w->path);
+	if (w->stalls || w->dropped || w->compress)
+		Com_Printf ("%s: %llu bytes, %llu on disk, %u stalls for %u bytes and %.1f ms, %u bytes dropped\n",
+			w->path, (unsigned long long)w->total, (unsigned long long)w->ondisk,
+			w->stalls, w->stalledbytes, w->stalltime / 1000.0, w->dropped);
+
+	ok = !w->failed;
+	Z_Free (w->ring);
+	delete w;
+	return ok;
+}
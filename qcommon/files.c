@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "qcommon.h"
 #include "minizip/unzip.h"
+#include "zlib.h"
 
 // enables faster binary pak searck, still experimental
 #define BINARY_PACK_SEARCH
@@ -78,8 +79,10 @@ instruct clients to write files over areas they shouldn't.
 typedef struct {
 	char			name[MAX_QPATH];
 	fsMode_t		mode;
-	FILE			*file;				// Only one of file or
-	unzFile			*zip;				// zip will be used
+	FILE			*file;				// Only one of file,
+	unzFile			*zip;				// zip
+	gzFile			gz;					// or gz will be used
+	int64_t			gzlength;			// inflated
 } fsHandle_t;
 
 typedef struct fsLink_s {
@@ -132,7 +135,29 @@ cvar_t	*fs_gamedirvar;
 cvar_t	*fs_debug;
 
 
-void Com_FileExtension (const char *path, char *dst, int32_t dstSize);
+/*
+=================
+Com_FileExtension
+
+Returns the extension, if any (does not include the .)
+=================
+*/
+void Com_FileExtension (const char *path, char *dst, int32_t dstSize)
+{
+	const char	*s, *last;
+
+	s = last = path + strlen(path);
+	while (*s != '/' && *s != '\\' && s != path){
+		if (*s == '.'){
+			last = s+1;
+			break;
+		}
+
+		s--;
+	}
+
+	Q_strncpyz(dst, last, dstSize);
+}
 
 /*
 =================
@@ -375,6 +400,9 @@ FILE *FS_FileForHandle (fileHandle_t f)
 	if (handle->zip)
 		Com_Error(ERR_DROP, "FS_FileForHandle: can't get FILE on zip file");
 
+	if (handle->gz)
+		Com_Error(ERR_DROP, "FS_FileForHandle: can't get FILE on gzip file");
+
 	if (!handle->file)
 		Com_Error(ERR_DROP, "FS_FileForHandle: NULL");
 
@@ -397,7 +425,7 @@ fsHandle_t *FS_HandleForFile (const char *path, fileHandle_t *f)
 	handle = fs_handles;
 	for (i = 0; i < MAX_HANDLES; i++, handle++)
 	{
-		if (!handle->file && !handle->zip)
+		if (!handle->file && !handle->zip && !handle->gz)
 		{
 			strcpy(handle->name, path);
 			*f = i + 1;
@@ -541,6 +569,81 @@ int32_t FS_FOpenFileWrite (fsHandle_t *handle)
 }
 
 
+/*
+=================
+FS_Inflated
+
+Loose demos recorded with demo_compress are gzip files, read back inflated
+=================
+*/
+static qboolean FS_Inflated (const char *name)
+{
+	int32_t		len;
+
+	len = strlen(name);
+	return (len > 7 && !Q_strcasecmp(name + len - 7, ".dm2.gz"))
+		|| (len > 8 && !Q_strcasecmp(name + len - 8, ".mvd2.gz"));
+}
+
+/*
+=================
+FS_OpenInflated
+
+Swaps the FILE of a gzip file found at path for a gzFile.  A demo the
+demo writer has finished has its length in the gzip header, checked
+against the ISIZE trailer.  Anything else, a demo still being recorded,
+one cut short by a crash or one gzipped elsewhere, is inflated through
+once to count it, which also gives the readable part of a cut short one.
+File sizes are 32 bits, so a demo past 2 GB reports 2 GB and can still
+be read to its end.
+=================
+*/
+static int32_t FS_OpenInflated (fsHandle_t *handle, const char *path)
+{
+	byte		buf[16384];
+	byte		*p;
+	int32_t		r;
+	uint64_t	length;
+	uint32_t	isize;
+
+	length = 0;
+	if (fread(buf, 1, DEMO_GZLENGTHOFS + 8, handle->file) == DEMO_GZLENGTHOFS + 8
+		&& buf[0] == 0x1f && buf[1] == 0x8b && (buf[3] & 4)
+		&& buf[12] == 'D' && buf[13] == 'L' && buf[14] == 8 && buf[15] == 0)
+	{
+		p = buf + DEMO_GZLENGTHOFS;
+		for (r=7 ; r>=0 ; r--)
+			length = (length << 8) | p[r];
+		if (length && fseek(handle->file, -4, SEEK_END) == 0 && fread(buf, 1, 4, handle->file) == 4)
+		{
+			isize = buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+			if (isize != (uint32_t)length)
+				length = 0;
+		}
+		else
+			length = 0;
+	}
+
+	fclose(handle->file);
+	handle->file = NULL;
+
+	handle->gz = gzopen(path, "rb");
+	if (!handle->gz)
+		return -1;
+
+	handle->gzlength = (int64_t)length;
+	if (!length)
+	{
+		while ((r = gzread(handle->gz, buf, sizeof(buf))) > 0)
+			handle->gzlength += r;
+		gzrewind(handle->gz);
+	}
+
+	if (handle->gzlength > 0x7fffffff)
+		return 0x7fffffff;
+	return (int32_t)handle->gzlength;
+}
+
 /*
 =================
 FS_FOpenFileRead
@@ -651,6 +754,9 @@ int32_t FS_FOpenFileRead (fsHandle_t *handle)
 				if (fs_debug->value)
 					Com_Printf("FS_FOpenFileRead: %s (found in %s)\n", handle->name, search->path);
 
+				if (FS_Inflated(handle->name))
+					return FS_OpenInflated(handle, path);
+
 				return FS_FileLength(handle->file);
 			}
 		}
@@ -729,6 +835,8 @@ void FS_FCloseFile (fileHandle_t f)
 		unzCloseCurrentFile(handle->zip);
 		unzClose(handle->zip);
 	}
+	else if (handle->gz)
+		gzclose(handle->gz);
 
 	memset(handle, 0, sizeof(*handle));
 }
@@ -758,6 +866,8 @@ int32_t FS_Read (void *buffer, int32_t size, fileHandle_t f)
 			r = fread(buf, 1, remaining, handle->file);
 		else if (handle->zip)
 			r = unzReadCurrentFile(handle->zip, buf, remaining);
+		else if (handle->gz)
+			r = gzread(handle->gz, buf, remaining);
 		else
 			return 0;
 
@@ -808,6 +918,8 @@ int32_t FS_FRead (void *buffer, int32_t size, int32_t count, fileHandle_t f)
 				r = fread(buf, 1, remaining, handle->file);
 			else if (handle->zip)
 				r = unzReadCurrentFile(handle->zip, buf, remaining);
+			else if (handle->gz)
+				r = gzread(handle->gz, buf, remaining);
 			else
 				return 0;
 
@@ -852,6 +964,8 @@ int32_t FS_Write (const void *buffer, int32_t size, fileHandle_t f){
 			w = fwrite(buf, 1, remaining, handle->file);
 		else if (handle->zip)
 			Com_Error(ERR_FATAL, "FS_Write: can't write to zip file %s", handle->name);
+		else if (handle->gz)
+			Com_Error(ERR_FATAL, "FS_Write: can't write to gzip file %s", handle->name);
 		else
 			return 0;
 
@@ -886,6 +1000,8 @@ int32_t FS_FTell (fileHandle_t f)
 		return ftell(handle->file);
 	else if (handle->zip)
 		return unztell(handle->zip);
+	else if (handle->gz)
+		return gztell(handle->gz);
 
 	return 0;
 }
@@ -1016,6 +1132,24 @@ void FS_Seek (fileHandle_t f, int32_t offset, fsOrigin_t origin)
 			remaining -= r;
 		}
 	}
+	else if (handle->gz)
+	{
+		// backwards is a rewind and inflating up to offset again
+		switch (origin)
+		{
+		case FS_SEEK_SET:
+			gzseek(handle->gz, offset, SEEK_SET);
+			break;
+		case FS_SEEK_CUR:
+			gzseek(handle->gz, offset, SEEK_CUR);
+			break;
+		case FS_SEEK_END:
+			gzseek(handle->gz, offset + handle->gzlength, SEEK_SET);
+			break;
+		default:
+			Com_Error(ERR_FATAL, "FS_Seek: bad origin (%i)", origin);
+		}
+	}
 }
 
 /*
@@ -1035,6 +1169,8 @@ int32_t FS_Tell (fileHandle_t f)
 		return ftell(handle->file);
 	else if (handle->zip)
 		return unztell(handle->zip);
+	else if (handle->gz)
+		return gztell(handle->gz);
     return -1;
 }
 
@@ -1121,6 +1257,55 @@ int32_t FS_LoadFile (char *path, void **buffer)
 	return size;
 }
 
+/*
+=================
+FS_MapFile
+
+Like FS_LoadFile, but loose files are mapped read only instead of copied.
+Files inside paks and pk3s are read (and inflated) into a zone buffer, in
+which case mapped is set false and the buffer goes back with FS_FreeFile.
+Mapped buffers are released with Sys_UnmapFile.  An empty file still gets
+a buffer, so a NULL one always means the file wasn't found.
+=================
+*/
+int32_t FS_MapFile (char *path, void **buffer, qboolean *mapped)
+{
+	fileHandle_t	f;
+	char			ospath[MAX_OSPATH];
+	byte			*buf;
+	int32_t			size;
+
+	*buffer = NULL;
+	*mapped = false;
+
+	size = FS_FOpenFile(path, &f, FS_READ);
+	if (size == -1)
+		return size;
+
+	if (size > 0 && !fs_fileInPack && !FS_Inflated(path))
+	{
+		Com_sprintf(ospath, sizeof(ospath), "%s/%s", fs_fileInPath, path);
+		buf = (byte*)Sys_MapFile(ospath, size);
+		if (buf)
+		{
+			FS_FCloseFile(f);
+			*buffer = buf;
+			*mapped = true;
+			return size;
+		}
+	}
+
+	buf = (byte*)Z_TagMalloc(size ? size : 1, TAG_SYSTEM);
+	*buffer = buf;
+
+	if (size)
+		FS_Read(buf, size, f);
+
+	FS_FCloseFile(f);
+
+	return size;
+}
+
 /*
 =================
 FS_FreeFile
@@ -1643,7 +1828,7 @@ void FS_Path_f (void)
 
 	for (i = 0, handle = fs_handles; i < MAX_HANDLES; i++, handle++)
 	{
-		if (handle->file || handle->zip)
+		if (handle->file || handle->zip || handle->gz)
 			Com_Printf("Handle %i: %s\n", i + 1, handle->name);
 	}
 
@@ -1785,6 +1970,8 @@ void FS_Shutdown (void)
 			unzCloseCurrentFile(handle->zip);
 			unzClose(handle->zip);
 		}
+		if (handle->gz)
+			gzclose(handle->gz);
 	}
 
 	// Free the search paths
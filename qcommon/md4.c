@@ -1,7 +1,7 @@
 /* GLOBAL.H - RSAREF types and constants */
 
 #include <string.h>
-#include <SDL_stdinc.h>
+#include <stdint.h>
 
 /* POINTER defines a generic pointer type */
 typedef uint8_t *POINTER;
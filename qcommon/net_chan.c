@@ -74,16 +74,57 @@ If there is no information that needs to be transfered on a given frame,
 such as during the connection stage while waiting for the client to load,
 then a packet only needs to be delivered if there is something in the
 unacknowledged reliable
+
+
+Fragmentation is agreed on when connecting: the client appends its net_mtu
+to the connect string and the server answers client_connect with the
+smaller of the two.  A message that would make a bigger datagram is split
+up and every piece goes out under the same sequence number with bit 30 of
+the sequence set, followed by
+
+16	offset of this piece into the message
+8	1 on the last piece
+
+The receiver only accepts the pieces in order, a gap or a newer sequence
+throws away what it had.  Once the last piece is in, the message is
+processed as if it had arrived whole.
 */
 
+#define	FRAGMENT_BIT	(1<<30)
+#define	FRAGMENT_HEADER	3			// offset and last flag
+
 cvar_t		*showpackets;
 cvar_t		*showdrop;
 cvar_t		*qport;
+cvar_t		*net_mtu;
+
+// totals over every channel, for net_fragstats
+static int32_t	net_fragments_sent;
+static int32_t	net_fragments_received;
+static int32_t	net_fragments_dropped;
 
 netadr_t	net_from;
 sizebuf_t	net_message;
 byte		net_message_buffer[MAX_MSGLEN];
 
+/*
+===============
+Netchan_FragStats_f
+===============
+*/
+static void Netchan_FragStats_f (void)
+{
+	if (Cmd_Argc() > 1 && !Q_strcasecmp (Cmd_Argv(1), "reset"))
+	{
+		net_fragments_sent = net_fragments_received = net_fragments_dropped = 0;
+		return;
+	}
+
+	Com_Printf ("fragments sent:     %i\n", net_fragments_sent);
+	Com_Printf ("fragments received: %i\n", net_fragments_received);
+	Com_Printf ("fragments dropped:  %i\n", net_fragments_dropped);
+}
+
 /*
 ===============
 Netchan_Init
@@ -100,6 +141,29 @@ void Netchan_Init (void)
 	showpackets = Cvar_Get ("showpackets", "0", 0);
 	showdrop = Cvar_Get ("showdrop", "0", 0);
 	qport = Cvar_Get ("qport", va("%i", port), CVAR_NOSET);
+	net_mtu = Cvar_Get ("net_mtu", "1400", CVAR_ARCHIVE);
+
+	Cmd_AddCommand ("net_fragstats", Netchan_FragStats_f);
+}
+
+/*
+===============
+Netchan_FragmentSize
+
+The datagram size to use with a peer that offered remote, 0 if
+either side doesn't want fragmentation
+===============
+*/
+int32_t Netchan_FragmentSize (int32_t remote)
+{
+	int32_t		size;
+
+	size = (int32_t)net_mtu->value;
+	if (size <= 0 || remote <= 0)
+		return 0;
+
+	size = min(size, remote);
+	return max(size, 256);
 }
 
 /*
@@ -111,17 +175,16 @@ Sends an out-of-band datagram
 */
 void Netchan_OutOfBand (int32_t net_socket, netadr_t adr, int32_t length, byte *data)
 {
-	sizebuf_t	send;
-	byte		send_buf[MAX_MSGLEN];
+	static const int32_t	oob = -1;	// -1 sequence means out of band, same in any byte order
+	netbuf_t	parts[2];
 
-// write the packet header
-	SZ_Init (&send, send_buf, sizeof(send_buf));
-	
-	MSG_WriteLong (&send, -1);	// -1 sequence means out of band
-	SZ_Write (&send, data, length);
+	parts[0].data = &oob;
+	parts[0].length = 4;
+	parts[1].data = data;
+	parts[1].length = length;
 
 // send the datagram
-	NET_SendPacket ((netsrc_t)net_socket, send.cursize, send.data, adr);
+	NET_SendPacketv ((netsrc_t)net_socket, 2, parts, adr);
 }
 
 /*
@@ -162,9 +225,11 @@ void Netchan_Setup (netsrc_t sock, netchan_t *chan, netadr_t adr, int32_t qport)
 	chan->last_received = Game::Engine::GetTick();
 	chan->incoming_sequence = 0;
 	chan->outgoing_sequence = 1;
+	chan->fragment_sequence = -1;
 
 	SZ_Init (&chan->message, chan->message_buf, sizeof(chan->message_buf));
 	chan->message.allowoverflow = true;
+	chan->reliable_data = chan->reliable_buf;
 }
 
 
@@ -203,6 +268,77 @@ qboolean Netchan_NeedReliable (netchan_t *chan)
 	return send_reliable;
 }
 
+/*
+===============
+Netchan_SliceParts
+
+Fills out with the stretch [offset, offset+length) of the parts laid
+end to end, returns how many pieces that took
+================
+*/
+static int32_t Netchan_SliceParts (const netbuf_t *parts, int32_t numparts, int32_t offset, int32_t length, netbuf_t *out)
+{
+	int32_t		i, count, take;
+
+	for (i=0, count=0 ; i<numparts && length > 0 ; i++)
+	{
+		if (offset >= parts[i].length)
+		{
+			offset -= parts[i].length;
+			continue;
+		}
+
+		take = min(parts[i].length - offset, length);
+		out[count].data = (const byte *)parts[i].data + offset;
+		out[count].length = take;
+		count++;
+
+		length -= take;
+		offset = 0;
+	}
+
+	return count;
+}
+
+/*
+===============
+Netchan_TransmitFragments
+
+Splits the payload parts into datagrams of at most fragment_size
+================
+*/
+static void Netchan_TransmitFragments (netchan_t *chan, const netbuf_t *payload, int32_t numpayload, int32_t total, uint32_t w1, uint32_t w2)
+{
+	sizebuf_t	send;
+	byte		header[16];
+	netbuf_t	parts[NET_MAX_PARTS];
+	int32_t		chunk, offset, length, numparts;
+
+	chunk = chan->fragment_size - ((chan->sock == NS_CLIENT) ? 10 : 8) - FRAGMENT_HEADER;
+
+	for (offset = 0 ; offset < total ; offset += length)
+	{
+		length = min(chunk, total - offset);
+
+		SZ_Init (&send, header, sizeof(header));
+		MSG_WriteLong (&send, w1 | FRAGMENT_BIT);
+		MSG_WriteLong (&send, w2);
+		if (chan->sock == NS_CLIENT)
+			MSG_WriteShort (&send, qport->value);
+		MSG_WriteShort (&send, offset);
+		MSG_WriteByte (&send, (offset + length == total));
+
+		parts[0].data = header;
+		parts[0].length = send.cursize;
+		numparts = 1 + Netchan_SliceParts (payload, numpayload, offset, length, parts + 1);
+
+		NET_SendPacketv (chan->sock, numparts, parts, chan->remote_address);
+
+		chan->fragments_sent++;
+		net_fragments_sent++;
+	}
+}
+
 /*
 ===============
 Netchan_Transmit
@@ -216,7 +352,9 @@ A 0 length will still generate a packet and deal with the reliable messages.
 void Netchan_Transmit (netchan_t *chan, int32_t length, byte *data)
 {
 	sizebuf_t	send;
-	byte		send_buf[MAX_MSGLEN];
+	byte		header[10];
+	netbuf_t	parts[3];
+	int32_t		numparts, total;
 	qboolean	send_reliable;
 	uint32_t	w1, w2;
 
@@ -233,15 +371,18 @@ void Netchan_Transmit (netchan_t *chan, int32_t length, byte *data)
 
 	if (!chan->reliable_length && chan->message.cursize)
 	{
-		memcpy (chan->reliable_buf, chan->message_buf, chan->message.cursize);
+		// trade buffers instead of copying the message over
+		chan->reliable_data = chan->message.data;
 		chan->reliable_length = chan->message.cursize;
-		chan->message.cursize = 0;
+		SZ_Init (&chan->message, (chan->reliable_data == chan->message_buf) ? chan->reliable_buf : chan->message_buf,
+			sizeof(chan->message_buf));
+		chan->message.allowoverflow = true;
 		chan->reliable_sequence ^= 1;
 	}
 
 
 // write the packet header
-	SZ_Init (&send, send_buf, sizeof(send_buf));
+	SZ_Init (&send, header, sizeof(header));
 
 	w1 = ( chan->outgoing_sequence & ~(1<<31) ) | (send_reliable<<31);
 	w2 = ( chan->incoming_sequence & ~(1<<31) ) | (chan->incoming_reliable_sequence<<31);
@@ -256,40 +397,127 @@ void Netchan_Transmit (netchan_t *chan, int32_t length, byte *data)
 	if (chan->sock == NS_CLIENT)
 		MSG_WriteShort (&send, qport->value);
 
+	// the payload goes out straight from the reliable and caller buffers
+	parts[0].data = header;
+	parts[0].length = send.cursize;
+	numparts = 1;
+	total = send.cursize;
+
 // copy the reliable message to the packet first
 	if (send_reliable)
 	{
-		SZ_Write (&send, chan->reliable_buf, chan->reliable_length);
+		parts[numparts].data = chan->reliable_data;
+		parts[numparts].length = chan->reliable_length;
+		numparts++;
+		total += chan->reliable_length;
 		chan->last_reliable_sequence = chan->outgoing_sequence;
 	}
 	
 // add the unreliable part if space is available
-	if (send.maxsize - send.cursize >= length)
-		SZ_Write (&send, data, length);
+	if (MAX_MSGLEN - total >= length)
+	{
+		if (length)
+		{
+			parts[numparts].data = data;
+			parts[numparts].length = length;
+			numparts++;
+			total += length;
+		}
+	}
 	else
 		Com_Printf ("Netchan_Transmit: dumped unreliable\n");
 
 // send the datagram
-	NET_SendPacket (chan->sock, send.cursize, send.data, chan->remote_address);
+	if (chan->fragment_size && total > chan->fragment_size)
+		Netchan_TransmitFragments (chan, parts + 1, numparts - 1, total - send.cursize, w1, w2);
+	else
+		NET_SendPacketv (chan->sock, numparts, parts, chan->remote_address);
 
 	if (showpackets->value)
 	{
 		if (send_reliable)
 			Com_Printf ("send %4i : s=%i reliable=%i ack=%i rack=%i\n"
-				, send.cursize
+				, total
 				, chan->outgoing_sequence - 1
 				, chan->reliable_sequence
 				, chan->incoming_sequence
 				, chan->incoming_reliable_sequence);
 		else
 			Com_Printf ("send %4i : s=%i ack=%i rack=%i\n"
-				, send.cursize
+				, total
 				, chan->outgoing_sequence - 1
 				, chan->incoming_sequence
 				, chan->incoming_reliable_sequence);
 	}
 }
 
+/*
+=================
+Netchan_Reassemble
+
+Adds the piece in msg to the message being put back together.  Once the
+last piece is in, msg is rewritten to hold the whole message behind
+the header of that piece and true is returned.
+=================
+*/
+static qboolean Netchan_Reassemble (netchan_t *chan, sizebuf_t *msg, int32_t sequence)
+{
+	int32_t		header, offset, last, length;
+
+	header = msg->readcount;
+	offset = MSG_ReadShort (msg) & 0xffff;
+	last = MSG_ReadByte (msg);
+	length = msg->cursize - msg->readcount;
+
+	if (msg->readcount > msg->cursize)
+	{
+		if (showdrop->value)
+			Com_Printf ("%s:Short fragment at %i\n", NET_AdrToString (chan->remote_address), sequence);
+		return false;
+	}
+
+	// a newer message abandons the one in progress
+	if (sequence != chan->fragment_sequence)
+	{
+		if (chan->fragment_length)
+		{
+			chan->fragments_dropped++;
+			net_fragments_dropped++;
+		}
+		chan->fragment_sequence = sequence;
+		chan->fragment_length = 0;
+	}
+
+	if (offset != chan->fragment_length || header + offset + length > msg->maxsize)
+	{
+		if (showdrop->value)
+			Com_Printf ("%s:Out of order fragment %i at %i\n"
+				, NET_AdrToString (chan->remote_address), offset, sequence);
+		chan->fragments_dropped++;
+		net_fragments_dropped++;
+		chan->fragment_sequence = -1;
+		chan->fragment_length = 0;
+		return false;
+	}
+
+	memcpy (chan->fragment_buf + offset, msg->data + msg->readcount, length);
+	chan->fragment_length += length;
+	chan->fragments_received++;
+	net_fragments_received++;
+
+	if (!last)
+		return false;
+
+	// keep the header in front for anyone who skips it by size, like demos
+	memcpy (msg->data + header, chan->fragment_buf, chan->fragment_length);
+	msg->cursize = header + chan->fragment_length;
+	msg->readcount = header;
+
+	chan->fragment_sequence = -1;
+	chan->fragment_length = 0;
+	return true;
+}
+
 /*
 =================
 Netchan_Process
@@ -303,6 +531,7 @@ qboolean Netchan_Process (netchan_t *chan, sizebuf_t *msg)
 	uint32_t	sequence, sequence_ack;
 	uint32_t	reliable_ack, reliable_message;
 	int32_t			qport;
+	qboolean	fragmented;
 
 // get sequence numbers		
 	MSG_BeginReading (msg);
@@ -315,9 +544,12 @@ qboolean Netchan_Process (netchan_t *chan, sizebuf_t *msg)
 
 	reliable_message = sequence >> 31;
 	reliable_ack = sequence_ack >> 31;
+	fragmented = chan->fragment_size && (sequence & FRAGMENT_BIT);
 
 	sequence &= ~(1<<31);
 	sequence_ack &= ~(1<<31);	
+	if (chan->fragment_size)
+		sequence &= ~FRAGMENT_BIT;
 
 	if (showpackets->value)
 	{
@@ -349,6 +581,12 @@ qboolean Netchan_Process (netchan_t *chan, sizebuf_t *msg)
 		return false;
 	}
 
+//
+// hold on to pieces until the whole message is here
+//
+	if (fragmented && !Netchan_Reassemble (chan, msg, sequence))
+		return false;
+
 //
 // dropped packets don't keep the message from being used
 //
@@ -24,6 +24,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "shared/q_shared.h"
 #include "glob.h"
+#include "visbits.h"
 
 #define	VERSION	"4.2" //was 3.21
 #define VR_VER "1.9.3-pre"
@@ -87,6 +88,7 @@ void MSG_WriteAngle (sizebuf_t *sb, float f);
 void MSG_WriteAngle16 (sizebuf_t *sb, float f);
 void MSG_WriteDeltaUsercmd (sizebuf_t *sb, struct usercmd_s *from, struct usercmd_s *cmd);
 void MSG_WriteDeltaEntity (struct entity_state_s *from, struct entity_state_s *to, sizebuf_t *msg, qboolean force, qboolean newentity);
+void MSG_WriteDeltaPlayerstate (player_state_t *from, player_state_t *to, sizebuf_t *msg);
 void MSG_WriteDir (sizebuf_t *sb, vec3_t vector);
 
 
@@ -105,6 +107,9 @@ void	MSG_ReadPos (sizebuf_t *sb, vec3_t pos);
 float	MSG_ReadAngle (sizebuf_t *sb);
 float	MSG_ReadAngle16 (sizebuf_t *sb);
 void	MSG_ReadDeltaUsercmd (sizebuf_t *sb, struct usercmd_s *from, struct usercmd_s *cmd);
+int32_t		MSG_ReadEntityBits (sizebuf_t *sb, uint32_t *bits);
+void	MSG_ReadDeltaEntity (sizebuf_t *sb, struct entity_state_s *from, struct entity_state_s *to, int32_t number, uint32_t bits);
+void	MSG_ReadDeltaPlayerstate (sizebuf_t *sb, player_state_t *from, player_state_t *to);
 
 void	MSG_ReadDir (sizebuf_t *sb, vec3_t vector);
 
@@ -226,7 +231,11 @@ enum svc_ops_e
 	svc_packetentities,			// [...]
 	svc_deltapacketentities,	// [...]
 	svc_frame,
-	svc_fog						// = 21 Knightmare added
+	svc_fog,					// = 21 Knightmare added
+
+	// windowed downloads, only sent to clients that asked with "download <name> <offset> window"
+	svc_downloadstart,			// [long] size [long] offset [int16_t] chunk size
+	svc_downloadchunk			// [long] chunk [int16_t] length, DOWNLOAD_DEFLATED if zlib [length bytes]
 };
 
 //==============================================
@@ -240,9 +249,14 @@ enum clc_ops_e
 	clc_nop, 		
 	clc_move,				// [[usercmd_t]
 	clc_userinfo,			// [[userinfo string]
-	clc_stringcmd			// [string] message
+	clc_stringcmd,			// [string] message
+	clc_downloadack			// [long] first missing chunk [byte] n [n bytes] bits for the chunks after it
 };
 
+#define	DOWNLOAD_CHUNK		1024		// bytes of the file in each svc_downloadchunk
+#define	DOWNLOAD_MAXWINDOW	256			// chunks in flight, and bits a clc_downloadack can carry
+#define	DOWNLOAD_DEFLATED	0x8000
+
 //==============================================
 
 // plyer_state_t communication
@@ -600,6 +614,19 @@ void		NET_Config (qboolean multiplayer);
 qboolean	NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message);
 void		NET_SendPacket (netsrc_t sock, int32_t length, void *data, netadr_t to);
 
+// one piece of a datagram gathered from several buffers
+#define	NET_MAX_PARTS	4
+
+typedef struct
+{
+	const void	*data;
+	int32_t		length;
+} netbuf_t;
+
+void		NET_SendPacketv (netsrc_t sock, int32_t numparts, const netbuf_t *parts, netadr_t to);
+void		NET_BeginBatch (netsrc_t sock);	// queue sends on sock until NET_FlushBatch
+void		NET_FlushBatch (netsrc_t sock);
+
 qboolean	NET_CompareAdr (netadr_t a, netadr_t b);
 qboolean	NET_CompareBaseAdr (netadr_t a, netadr_t b);
 qboolean	NET_IsLocalAddress (netadr_t adr);
@@ -642,11 +669,25 @@ typedef struct
 	sizebuf_t	message;		// writing buffer to send to server
 	byte		message_buf[MAX_MSGLEN-16];		// leave space for header
 
-// message is copied to this buffer when it is first transfered
+// when the message is first transfered the two buffers trade places,
+// reliable_data points at whichever holds the unacked reliable message
 	int32_t			reliable_length;
-	byte		reliable_buf[MAX_MSGLEN-16];	// unacked reliable message
+	byte		*reliable_data;
+	byte		reliable_buf[MAX_MSGLEN-16];
+
+// fragmentation, agreed on at connect time, 0 sends every message whole
+	int32_t			fragment_size;		// largest datagram to put on the wire
+	int32_t			fragment_sequence;	// sequence being reassembled
+	int32_t			fragment_length;
+	byte		fragment_buf[MAX_MSGLEN];
+
+	int32_t			fragments_sent;
+	int32_t			fragments_received;
+	int32_t			fragments_dropped;	// fragments of messages that never completed
 } netchan_t;
 
+extern	cvar_t		*net_mtu;
+
 extern	netadr_t	net_from;
 extern	sizebuf_t	net_message;
 extern	byte		net_message_buffer[MAX_MSGLEN];
@@ -662,6 +703,7 @@ void Netchan_OutOfBandPrint (int32_t net_socket, netadr_t adr, char *format, ...
 qboolean Netchan_Process (netchan_t *chan, sizebuf_t *msg);
 
 qboolean Netchan_CanReliable (netchan_t *chan);
+int32_t Netchan_FragmentSize (int32_t remote);
 
 
 /*
@@ -675,6 +717,7 @@ CMODEL
 
 #include "../qcommon/qfiles.h"
 
+void		CM_InitKernels (void);
 cmodel_t	*CM_LoadMap (char *name, qboolean clientload, unsigned *checksum);
 cmodel_t	*CM_InlineModel (char *name);	// *1, *2, etc
 
@@ -698,8 +741,19 @@ trace_t		CM_TransformedBoxTrace (vec3_t start, vec3_t end,
 						  int32_t headnode, int32_t brushmask,
 						  vec3_t origin, vec3_t angles);
 
+// sweeps walked down the tree together, longer batches are split up
+#define	TRACE_BATCH		32
+void		CM_BoxTraceBatch (tracejob_t *jobs, int32_t count, int32_t headnode);
+
 byte		*CM_ClusterPVS (int32_t cluster);
 byte		*CM_ClusterPHS (int32_t cluster);
+void		CM_ClusterPVSRow (int32_t cluster, byte *row);
+void		CM_ClusterPHSRow (int32_t cluster, byte *row);
+void		CM_FatPVSRow (vec3_t org, byte *row);
+void		CM_ClearVisCache (void);
+void		CM_VisStats_f (void);
+void		CM_TraceLog_f (void);
+void		CM_TraceBench_f (void);
 
 int32_t			CM_PointLeafnum (vec3_t p);
 
@@ -808,12 +862,83 @@ void		FS_ExecAutoexec (void);
 int32_t			FS_GetFileList (const char *path, const char *extension, char *buffer, int32_t size, fsSearchType_t searchType);
 
 int32_t			FS_LoadFile (char *path, void **buffer);
+int32_t			FS_MapFile (char *path, void **buffer, qboolean *mapped);
 void		FS_AddPK3File (const char *packPath); // add pk3 file function
 char		**FS_ListPak (char *find, int32_t *num); // pak list function
 void		FS_SetGamedir (char *dir);
 char		*FS_Gamedir (void);
 void		FS_FreeFile (void *buffer);
 
+void		Com_FileExtension (const char *path, char *dst, int32_t dstSize);
+
+
+/*
+==============================================================
+
+DEMO WRITER
+
+Demo output goes through a ring buffer to a writer thread, optionally
+gzipped, see demowriter.c.
+
+==============================================================
+*/
+
+typedef struct demowriter_s demowriter_t;
+
+// a gzipped demo has a "DL" gzip extra field that holds its 64 bit
+// inflated length once the writer has finished it, zero until then
+#define	DEMO_GZLENGTHOFS	16		// 10 byte header, XLEN, SI1 SI2 LEN
+
+demowriter_t	*Demo_OpenWriter (char *path, qboolean compress);
+void		Demo_Write (demowriter_t *w, const void *data, int32_t len);
+int64_t		Demo_WriterTell (demowriter_t *w);
+qboolean	Demo_CloseWriter (demowriter_t *w);
+
+
+/*
+==============================================================
+
+DEMO INDEX
+
+A finished .dm2 may carry keyframes and a seek index after its -1
+terminator, see demoindex.c.  Players that stop at the -1 never see them.
+
+==============================================================
+*/
+
+#define	DEMO_INDEXID		(('X'<<24)+('D'<<16)+('M'<<8)+'D')		// little-endian "DMDX"
+#define	DEMO_INDEXVERSION	1
+
+typedef struct
+{
+	int32_t		time;			// ms of frames since the start of the demo
+	int32_t		level;			// serverdata messages seen before it
+	int32_t		offset;			// where the message stream carries on
+	int32_t		keyframe;		// first keyframe message, ends with -1
+} demokey_t;
+
+typedef struct
+{
+	demowriter_t	*keys;		// keyframe messages until the demo is closed
+	char		keypath[MAX_OSPATH];
+	int32_t		keystart;		// of the keyframe being written, -1 if none
+	demokey_t	*index;
+	int32_t		numkeys;
+	int32_t		maxkeys;
+	int32_t		level;
+	int32_t		time;
+	int32_t		lastservertime;	// -1 before the first frame of a level
+	int32_t		nexttime;
+} demoindex_t;
+
+void		Demo_BeginIndex (demoindex_t *di, const char *demopath);
+void		Demo_NewLevel (demoindex_t *di);
+qboolean	Demo_KeyframeDue (demoindex_t *di, int32_t servertime);
+void		Demo_WriteKeyMessage (demoindex_t *di, sizebuf_t *buf);
+void		Demo_EndKeyframe (demoindex_t *di, int64_t offset);
+void		Demo_FinishIndex (demoindex_t *di, demowriter_t *demo);
+int32_t		Demo_ReadIndex (fileHandle_t f, int32_t base, int32_t size, demokey_t **index);
+
 
 /*
 ==============================================================
@@ -835,7 +960,7 @@ MISC
 #define	PRINT_ALL		0
 #define PRINT_DEVELOPER	1	// only print when "developer 1"
 
-void		Com_BeginRedirect (int32_t target, char *buffer, int32_t buffersize, void (*flush));
+void		Com_BeginRedirect (int32_t target, char *buffer, int32_t buffersize, void (*flush)(int32_t target, char *buffer));
 void		Com_EndRedirect (void);
 void 		Com_Printf (char *fmt, ...);
 void 		Com_DPrintf (char *fmt, ...);
@@ -851,6 +976,10 @@ byte		COM_BlockSequenceCRCByte (byte *base, int32_t length, int32_t sequence);
 float	frand(void);	// 0 ti 1
 float	crand(void);	// -1 to 1
 
+// instruction sets the SIMD kernels may dispatch to
+qboolean	Com_CpuHasSSE2 (void);
+qboolean	Com_CpuHasAVX2 (void);
+
 extern	cvar_t	*developer;
 extern	cvar_t	*dedicated;
 extern	cvar_t	*host_speeds;
@@ -212,6 +212,8 @@ typedef struct
     
 #endif
 
+	// trace on every job at once, sweeps close together share the work
+	void	(*TraceBatch) (tracejob_t *jobs, int32_t count);
 } game_import_t;
 
 //
@@ -483,6 +483,10 @@ void	*Hunk_Alloc (int32_t size);
 void	Hunk_Free (void *buf);
 int32_t		Hunk_End (void);
 
+// read only view of a whole file, NULL if it can't be mapped
+void	*Sys_MapFile (const char *path, int32_t size);
+void	Sys_UnmapFile (void *base, int32_t size);
+
 // directory searching
 #define SFF_ARCH    0x01
 #define SFF_HIDDEN  0x02
@@ -702,6 +706,16 @@ typedef struct
 	struct edict_s	*ent;		// not set by CM_*() functions
 } trace_t;
 
+// one sweep of a batched trace, the engine fills in trace
+typedef struct
+{
+	vec3_t		start, end;
+	float		*mins, *maxs;	// NULL for a point trace, like trace ()
+	struct edict_s	*passent;	// not used by CM_*() functions
+	int32_t			contentmask;
+	trace_t		trace;
+} tracejob_t;
+
 
 
 // pmove_state_t is the information necessary for client side movement
@@ -0,0 +1,180 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// visbits.c -- OR/any-set over cluster visibility rows
+
+#include "qcommon.h"
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define VIS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define VIS_TARGET(x)
+#else
+#define VIS_TARGET(x)	__attribute__((target(x)))
+#endif
+#endif
+
+/*
+===============================================================================
+
+SCALAR
+
+===============================================================================
+*/
+
+static void Vis_Or_C (byte *out, const byte *in, int32_t bytes)
+{
+	int32_t		i;
+
+	for (i=0 ; i+4<=bytes ; i+=4)
+		*(uint32_t *)(out+i) |= *(const uint32_t *)(in+i);
+	for ( ; i<bytes ; i++)
+		out[i] |= in[i];
+}
+
+static qboolean Vis_AnySet_C (const byte *row, int32_t bytes)
+{
+	int32_t		i;
+
+	for (i=0 ; i+4<=bytes ; i+=4)
+		if (*(const uint32_t *)(row+i))
+			return true;
+	for ( ; i<bytes ; i++)
+		if (row[i])
+			return true;
+	return false;
+}
+
+#ifdef VIS_X86
+/*
+===============================================================================
+
+SSE2
+
+===============================================================================
+*/
+
+VIS_TARGET("sse2") static void Vis_Or_SSE2 (byte *out, const byte *in, int32_t bytes)
+{
+	int32_t		i;
+	__m128i		a, b;
+
+	for (i=0 ; i+16<=bytes ; i+=16)
+	{
+		a = _mm_loadu_si128 ((const __m128i *)(out+i));
+		b = _mm_loadu_si128 ((const __m128i *)(in+i));
+		_mm_storeu_si128 ((__m128i *)(out+i), _mm_or_si128 (a, b));
+	}
+	Vis_Or_C (out+i, in+i, bytes-i);
+}
+
+VIS_TARGET("sse2") static qboolean Vis_AnySet_SSE2 (const byte *row, int32_t bytes)
+{
+	int32_t		i;
+	__m128i		a;
+	__m128i		zero = _mm_setzero_si128 ();
+
+	for (i=0 ; i+16<=bytes ; i+=16)
+	{
+		a = _mm_loadu_si128 ((const __m128i *)(row+i));
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (a, zero)) != 0xffff)
+			return true;
+	}
+	return Vis_AnySet_C (row+i, bytes-i);
+}
+
+/*
+===============================================================================
+
+AVX2
+
+===============================================================================
+*/
+
+VIS_TARGET("avx2") static void Vis_Or_AVX2 (byte *out, const byte *in, int32_t bytes)
+{
+	int32_t		i;
+	__m256i		a, b;
+
+	for (i=0 ; i+32<=bytes ; i+=32)
+	{
+		a = _mm256_loadu_si256 ((const __m256i *)(out+i));
+		b = _mm256_loadu_si256 ((const __m256i *)(in+i));
+		_mm256_storeu_si256 ((__m256i *)(out+i), _mm256_or_si256 (a, b));
+	}
+	Vis_Or_C (out+i, in+i, bytes-i);
+}
+
+VIS_TARGET("avx2") static qboolean Vis_AnySet_AVX2 (const byte *row, int32_t bytes)
+{
+	int32_t		i;
+	__m256i		a;
+
+	for (i=0 ; i+32<=bytes ; i+=32)
+	{
+		a = _mm256_loadu_si256 ((const __m256i *)(row+i));
+		if (!_mm256_testz_si256 (a, a))
+			return true;
+	}
+	return Vis_AnySet_C (row+i, bytes-i);
+}
+
+#endif	// VIS_X86
+
+void		(*Vis_Or) (byte *out, const byte *in, int32_t bytes) = Vis_Or_C;
+qboolean	(*Vis_AnySet) (const byte *row, int32_t bytes) = Vis_AnySet_C;
+
+/*
+=================
+Vis_Init
+
+Picks the widest kernels the cpu supports.  Set vis_simd 0 before
+startup to force the scalar versions.
+=================
+*/
+void Vis_Init (void)
+{
+	cvar_t		*vis_simd;
+	const char	*name = "scalar";
+
+	vis_simd = Cvar_Get ("vis_simd", "1", CVAR_NOSET);
+
+	Vis_Or = Vis_Or_C;
+	Vis_AnySet = Vis_AnySet_C;
+
+#ifdef VIS_X86
+	if (!vis_simd->value)
+		;
+	else if (Com_CpuHasAVX2 ())
+	{
+		Vis_Or = Vis_Or_AVX2;
+		Vis_AnySet = Vis_AnySet_AVX2;
+		name = "AVX2";
+	}
+	else if (Com_CpuHasSSE2 ())
+	{
+		Vis_Or = Vis_Or_SSE2;
+		Vis_AnySet = Vis_AnySet_SSE2;
+		name = "SSE2";
+	}
+#endif
+
+	Com_DPrintf ("Vis bit kernels: %s\n", name);
+}
@@ -0,0 +1,35 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// visbits.h -- cluster visibility rows, one bit per cluster
+
+#ifndef VISBITS_H
+#define VISBITS_H
+
+#define	VIS_TEST(row,bit)	((row)[(bit)>>3] & (1<<((bit)&7)))
+#define	VIS_SET(row,bit)	((row)[(bit)>>3] |= (1<<((bit)&7)))
+
+void		Vis_Init (void);
+
+// whole row kernels, Vis_Init points these at the best of the
+// scalar, SSE2 and AVX2 versions this cpu can run
+extern void		(*Vis_Or) (byte *out, const byte *in, int32_t bytes);
+extern qboolean	(*Vis_AnySet) (const byte *row, int32_t bytes);
+
+#endif
@@ -49,7 +49,7 @@
 /*                                                                  */
 
 #include <stdio.h>
-#include <SDL_stdinc.h>
+#include <stdint.h>
 
 #include "wildcard.h"
 
@@ -65,6 +65,12 @@ typedef struct
 
 	// demo server information
 	fileHandle_t demofile;
+	int32_t		demobase;		// file position of the demo's first byte
+	int32_t		demosize;
+	int32_t		demoresume;		// where the stream goes on after a keyframe, 0 if not in one
+	demokey_t	*demokeys;		// seek index, read on the first demo_seek
+	int32_t		numdemokeys;	// -1 if the demo has none
+	qboolean	mvd;			// a multiview demo, played through sv_mvd.c
 	qboolean	timedemo;		// don't time sync
 } server_t;
 
@@ -89,11 +95,82 @@ typedef struct
 	int32_t					num_entities;
 	int32_t					first_entity;		// into the circular sv_packet_entities[]
 	int32_t					senttime;			// for ping calculations
+	int32_t					framenum;			// sv.framenum it was built for
 } client_frame_t;
 
 #define	LATENCY_COUNTS	16
 #define	RATE_MESSAGES	10
 
+// what sv_netstats watches, written while the client's frame is built
+// and sent, so it stays private to the client like the frame itself
+typedef struct
+{
+	// the last frame sent
+	int32_t			bytes;				// whole datagram
+	int32_t			playerstate;		// bytes of svc_playerinfo
+	int32_t			entitybytes;		// bytes of svc_packetentities
+	int32_t			entities;			// entities in the frame
+	int32_t			fullstates;			// entities forced out from their baseline
+	int32_t			deferred;			// entity updates held back for a later frame
+	int32_t			biggest;			// largest single entity delta
+	int32_t			biggestmodel;		// and its modelindex
+	qboolean		nodelta;			// no frame to delta from
+	int32_t			reliable;			// reliable bytes still waiting
+
+	// totals since sv_netstats reset
+	int32_t			frames;
+	uint32_t		totalbytes;
+	uint32_t		totalplayerstate;
+	uint32_t		totalentitybytes;
+	uint32_t		totalentities;
+	uint32_t		totalfullstates;
+	uint32_t		totaldeferred;
+	int32_t			maxbytes;
+	int32_t			maxbiggest;
+	int32_t			maxbiggestmodel;
+	int32_t			maxreliable;
+	int32_t			nodeltas;
+	int32_t			overbudget;			// datagrams past NETSTATS_BUDGET
+	int32_t			ratedrops;
+} netstats_t;
+
+#define	NETSTATS_BUDGET	1400			// a datagram that has to fit one legacy packet
+
+// a file being downloaded, shared by every client fetching it
+typedef struct dlfile_s
+{
+	char			name[MAX_QPATH];
+	byte			*data;
+	int32_t			size;
+	int32_t			refcount;
+	qboolean		mapped;				// Sys_MapFile view, else a zone copy
+	qboolean		frompak;
+	struct dlfile_s	*next;
+} dlfile_t;
+
+// a windowed download, see sv_download.c
+typedef struct
+{
+	int32_t			offset;				// file position of chunk 0
+	int32_t			chunks;
+	int32_t			window;				// chunks allowed past base
+	int32_t			base;				// first chunk the client is missing
+	int32_t			highest;			// one past the highest chunk it has
+	int32_t			next;				// one past the highest chunk sent
+	int32_t			sent[DOWNLOAD_MAXWINDOW];	// ms each chunk last went out, 0 if not yet
+	byte			acked[DOWNLOAD_MAXWINDOW];	// both by chunk % DOWNLOAD_MAXWINDOW
+
+	// the last chunk deflated, in case it didn't fit the packet
+	int32_t			deflated;
+	int32_t			deflatedlength;
+	byte			deflatebuf[DOWNLOAD_CHUNK+64];
+
+	int32_t			starttime;
+	int32_t			packets;
+	int32_t			resent;
+	int32_t			wirebytes;
+} dlwindow_t;
+
 typedef struct client_s
 {
 	client_state_t	state;
@@ -110,6 +187,7 @@ typedef struct client_s
 	int32_t				ping;
 
 	int32_t				message_size[RATE_MESSAGES];	// used to rate drop packets
+	int32_t				download_size[RATE_MESSAGES];	// download chunks, against sv_download_rate
 	int32_t				rate;
 	int32_t				surpressCount;		// number of messages rate supressed
 
@@ -125,9 +203,11 @@ typedef struct client_s
 
 	client_frame_t	frames[UPDATE_BACKUP];	// updates can be delta'd from here
 
-	byte			*download;			// file being downloaded
+	dlfile_t		*downloadfile;		// NULL when not downloading
+	byte			*download;			// downloadfile->data
 	int32_t				downloadsize;		// total bytes (can't use EOF because of paks)
 	int32_t				downloadcount;		// bytes sent
+	dlwindow_t		*dlwindow;			// NULL for a legacy download
 
 	int32_t				lastmessage;		// sv.framenum when packet was last received
 	int32_t				lastconnect;
@@ -135,8 +215,51 @@ typedef struct client_s
 	int32_t				challenge;			// challenge of this user, randomly generated
 
 	netchan_t		netchan;
+
+	netstats_t		netstats;
+
+	// low 16 bits of the sv.framenum each entity's state last reached the
+	// client, so sv_entitypriority can favour the updates held back longest
+	uint16_t		entity_sent[MAX_EDICTS];
+
+	struct client_s	*hashnext;			// svs.client_hash chain
+	struct client_s	*adrnext;			// svs.client_adrhash chain
 } client_t;
 
+// packets from connected clients are queued by SV_ReadPackets, parsed
+// on the worker pool, then executed in client order on the main thread
+#define	MAX_QUEUED_PACKETS	256
+#define	PACKET_QUEUE_BYTES	0x40000		// room for the data and its strings
+#define	MAX_PACKET_COMMANDS	32
+
+// parse failures, executed like commands so the drop happens in order
+#define	PACKET_BADREAD		-2
+#define	PACKET_BADCOMMAND	-3
+
+typedef struct
+{
+	int32_t		type;				// clc_* or PACKET_*
+	int32_t		text;				// offset in the packet's text for strings
+} packetcmd_t;
+
+typedef struct clientpacket_s
+{
+	client_t	*client;
+	int32_t		sequence;			// netchan state when it arrived
+	int32_t		dropped;
+	byte		*data;				// past the netchan header
+	int32_t		length;
+	char		*text;				// strings read out of data
+	struct clientpacket_s	*next;	// this client's next packet
+
+	// filled in by SV_ParseClientMessage
+	int32_t		numcmds;
+	packetcmd_t	cmds[MAX_PACKET_COMMANDS];
+	int32_t		lastframe;
+	int32_t		checksum, calculatedChecksum;
+	usercmd_t	oldest, oldcmd, newcmd;
+} clientpacket_t;
+
 // a client can leave the server in one of four ways:
 // dropping properly by quiting or disconnecting
 // timing out if no valid messages are received for timeout.value seconds
@@ -150,6 +273,9 @@ typedef struct client_s
 // out before legitimate users connected
 #define	MAX_CHALLENGES	1024
 
+// power of two, twice MAX_CLIENTS to keep the chains short
+#define	CLIENT_HASH_SIZE	512
+
 typedef struct
 {
 	netadr_t	adr;
@@ -172,13 +298,24 @@ typedef struct
 	int32_t			num_client_entities;		// maxclients->value*UPDATE_BACKUP*MAX_PACKET_ENTITIES
 	int32_t			next_client_entities;		// next client_entity to use
 	entity_state_t	*client_entities;		// [num_client_entities]
+	byte		*frame_msg_buf;				// [maxclients->value*MAX_MSGLEN], for threaded frame building
+
+	clientpacket_t	*packets;				// [MAX_QUEUED_PACKETS], waiting to be parsed
+	int32_t			numpackets;
+	byte		*packet_buf;				// [PACKET_QUEUE_BYTES]
+	int32_t			packet_bytes;
+
+	// connected and zombie clients, for packet dispatch
+	client_t	*client_hash[CLIENT_HASH_SIZE];		// by base address and qport
+	client_t	*client_adrhash[CLIENT_HASH_SIZE];	// by base address alone
 
 	int32_t			last_heartbeat;
 
 	challenge_t	challenges[MAX_CHALLENGES];	// to prevent invalid IPs from connecting
 
 	// serverrecord values
-	FILE		*demofile;
+	demowriter_t	*demofile;
+	demoindex_t	demoindex;
 	sizebuf_t	demo_multicast;
 	byte		demo_multicast_buf[MAX_MSGLEN];
 } server_static_t;
@@ -199,11 +336,16 @@ extern	cvar_t		*sv_noreload;			// don't reload level state when reentering
 extern	cvar_t		*sv_airaccelerate;		// don't reload level state when reentering
 											// development tool
 extern	cvar_t		*sv_enforcetime;
+extern	cvar_t		*sv_threads;			// worker threads for building client frames
+extern	cvar_t		*sv_tracecache;			// remember SV_Trace results within a frame
+extern	cvar_t		*sv_entitypriority;		// fit frames to the client rate by entity priority
 
 extern	client_t	*sv_client;
 extern	edict_t		*sv_player;
 
 extern	cvar_t *allow_download;
+extern	cvar_t *sv_download_window;
+extern	cvar_t *sv_download_rate;
 extern	cvar_t *allow_download_players;
 extern	cvar_t *allow_download_models;
 extern	cvar_t *allow_download_sounds;
@@ -219,6 +361,9 @@ extern	cvar_t *allow_download_textures_24bit;	// whether to allow downloading 24
 //
 void SV_FinalMessage (char *message, qboolean reconnect);
 client_t *GetClientFromAdr (netadr_t address); //Knightmare added
+void SV_HashClient (client_t *cl);
+void SV_UnhashClient (client_t *cl);
+client_t *SV_ClientForPacket (netadr_t adr, int32_t qport);
 void SV_DropClient (client_t *drop);
 void SV_DropClientFromAdr (netadr_t address); // Knightmare added
 
@@ -260,10 +405,18 @@ extern	char	sv_outputbuf[SV_OUTPUTBUF_LENGTH];
 
 void SV_FlushRedirect (int32_t sv_redirected, char *outputbuf);
 
+// with sv_entitypriority a rate limited client still gets a frame as
+// long as its rate leaves this much, the entities are thinned to fit
+#define	FRAME_MIN_BYTES	96
+
+void SV_CloseDemo (void);
 void SV_DemoCompleted (void);
 void SV_SendClientMessages (void);
+int32_t SV_FrameBudget (client_t *c);
 
 void SV_Multicast (vec3_t origin, multicast_t to);
+void SV_MulticastClientsChanged (void);
+void SV_MulticastBench_f (void);
 void SV_StartSound (vec3_t origin, edict_t *entity, int32_t channel,
 					int32_t soundindex, float volume,
 					float attenuation, float timeofs);
@@ -276,13 +429,70 @@ void SV_BroadcastCommand (char *fmt, ...);
 //
 void SV_InitClientCommands(void);
 void SV_Nextserver (void);
-void SV_ExecuteClientMessage (client_t *cl);
+void SV_ParseClientMessage (clientpacket_t *packet);
+void SV_ExecuteClientMessage (clientpacket_t *packet);
+
+//
+// sv_profile.c
+//
+typedef enum
+{
+	PROF_FRAME,			// whole SV_Frame, only when a game frame ran
+	PROF_READPACKETS,
+	PROF_GAMEFRAME,
+	PROF_BUILDFRAME,
+	PROF_WRITEFRAME,
+	PROF_TRANSMIT,
+	PROF_NETFLUSH,
+	PROF_NUMPHASES
+} profphase_t;
+
+extern	qboolean	sv_profiling;
+
+uint64_t SV_ProfileBegin (void);
+void SV_ProfileEnd (profphase_t phase, uint64_t start);
+void SV_Profile_f (void);
+
+//
+// sv_netstats.c
+//
+void SV_NetstatsFrame (client_t *cl);
+void SV_NetstatsEvent (client_t *cl, const char *event);
+void SV_Netstats_f (void);
+void SV_NetstatsShutdown (void);
+
+//
+// sv_download.c
+//
+dlfile_t *SV_OpenDownloadFile (char *name);
+void SV_ReleaseDownloadFile (dlfile_t *file);
+void SV_BeginWindowedDownload (client_t *cl);
+void SV_SendDownloadChunks (client_t *cl);
+void SV_DownloadAck (client_t *cl, byte *data, int32_t length);
+void SV_EndDownload (client_t *cl);
+void SV_DownloadBench_f (void);
 
 //
 // sv_ccmds.c
 //
 void SV_ReadLevelFile (void);
 void SV_Status_f (void);
+void SV_ServerStop_f (void);
+
+//
+// sv_mvd.c
+//
+void SV_MvdRecord_f (void);
+void SV_MvdStop_f (void);
+void SV_MvdPov_f (void);
+void SV_MvdShutdown (void);
+void SV_MvdRecordFrame (void);
+void SV_MvdMulticast (void);
+void SV_MvdUnicast (client_t *cl);
+void SV_MvdPrint (client_t *cl, int32_t level, char *string);
+void SV_MvdBeginPlayback (void);
+void SV_MvdEndPlayback (void);
+int32_t SV_MvdDemoMessage (byte *msgbuf);
 
 //
 // sv_ents.c
@@ -290,6 +500,8 @@ void SV_Status_f (void);
 void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg);
 void SV_RecordDemoMessage (void);
 void SV_BuildClientFrame (client_t *client);
+void SV_PrepClientFrames (void);
+void SV_WriteRemoveEntity (sizebuf_t *msg, int32_t number);
 
 
 void SV_Error (char *error, ...);
@@ -314,6 +526,8 @@ void SV_InitEdict (edict_t *e);
 void SV_ClearWorld (void);
 // called after the world model has been loaded, before linking any entities
 
+void SV_AreaBench_f (void);
+
 void SV_UnlinkEdict (edict_t *ent);
 // call before removing an entity, and before trying to move one,
 // so it doesn't clip against itself
@@ -325,6 +539,10 @@ void SV_LinkEdict (edict_t *ent);
 // sets ent->leafnums[] for pvs determination even if the entity
 // is not solid
 
+void SV_MarkClusterEdicts (byte *visbits, byte *edictbits);
+// sets the bit for each entity that may touch a cluster in visbits,
+// callers still have to check the entity's own clusternums
+
 int32_t SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list, int32_t maxcount, int32_t areatype);
 // fills in a table of edict pointers with edicts that have bounding boxes
 // that intersect the given area.  It is possible for a non-axial bmodel
@@ -344,6 +562,11 @@ int32_t SV_PointContents (vec3_t p);
 
 
 trace_t SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *passedict, int32_t contentmask);
+void SV_TraceMemoFrame (void);
+// forgets every remembered trace, called as each game frame starts
+
+void SV_TraceBatch (tracejob_t *jobs, int32_t count);
+// SV_Trace on every job, groups of jobs share the world traversal
 
 // mins and maxs are relative
 
@@ -516,6 +516,80 @@ void SV_DemoMap_f (void)
 	SV_Map (true, Cmd_Argv(1), false );
 }
 
+/*
+==================
+SV_DemoSeek_f
+
+demo_seek [mm:]ss jumps to the last keyframe at or before that time
+==================
+*/
+void SV_DemoSeek_f (void)
+{
+	demokey_t	*keys, *key;
+	char		*s;
+	int32_t		i, time, pos, level, first, last;
+
+	if (sv.state != ss_demo || !sv.demofile)
+	{
+		Com_Printf ("Not playing a demo.\n");
+		return;
+	}
+
+	if (sv.mvd)
+	{
+		Com_Printf ("Multiview demos can't seek.\n");
+		return;
+	}
+
+	if (!sv.numdemokeys)
+	{
+		sv.numdemokeys = Demo_ReadIndex (sv.demofile, sv.demobase, sv.demosize, &sv.demokeys);
+		if (!sv.numdemokeys)
+			sv.numdemokeys = -1;
+	}
+	if (sv.numdemokeys == -1)
+	{
+		Com_Printf ("%s has no seek index.\n", sv.name);
+		return;
+	}
+	keys = sv.demokeys;
+
+	if (Cmd_Argc() != 2)
+	{
+		time = keys[sv.numdemokeys-1].time / 1000;
+		Com_Printf ("usage: demo_seek <[mm:]ss>, %i keyframes up to %i:%02i\n",
+			sv.numdemokeys, time / 60, time % 60);
+		return;
+	}
+
+	s = Cmd_Argv(1);
+	if (strchr (s, ':'))
+		time = atoi (s) * 60000 + (int32_t)(atof (strchr (s, ':') + 1) * 1000);
+	else
+		time = (int32_t)(atof (s) * 1000);
+
+	// keyframes can't bring in another map, so stay within the level playing
+	pos = (sv.demoresume ? sv.demoresume : FS_Tell (sv.demofile)) - sv.demobase;
+	for (i=0 ; i<sv.numdemokeys-1 && keys[i+1].offset <= pos ; i++)
+		;
+	level = keys[i].level;
+	for (first=i ; first>0 && keys[first-1].level == level ; first--)
+		;
+	for (last=i ; last<sv.numdemokeys-1 && keys[last+1].level == level ; last++)
+		;
+
+	if (time < keys[first].time || (last < sv.numdemokeys-1 && time >= keys[last+1].time))
+		Com_Printf ("%i:%02i is on another level of the demo.\n", time / 60000, (time / 1000) % 60);
+
+	for (i=first ; i<last && keys[i+1].time <= time ; i++)
+		;
+	key = &keys[i];
+
+	FS_Seek (sv.demofile, sv.demobase + key->keyframe, FS_SEEK_SET);
+	sv.demoresume = sv.demobase + key->offset;
+	Com_Printf ("Seeking to %i:%02i\n", key->time / 60000, (key->time / 1000) % 60);
+}
+
 /*
 ==================
 SV_GameMap_f
@@ -1036,14 +1110,16 @@ void SV_ServerRecord_f (void)
 	//
 	Com_sprintf (name, sizeof(name), "%s/demos/%s.dm2", FS_Gamedir(), Cmd_Argv(1));
 
-	Com_Printf ("recording to %s.\n", name);
 	FS_CreatePath (name);
-	svs.demofile = fopen (name, "wb");
+	svs.demofile = Demo_OpenWriter (name, true);
 	if (!svs.demofile)
 	{
-		Com_Printf ("ERROR: couldn't open.\n");
+		Com_Printf ("ERROR: couldn't open %s.\n", name);
 		return;
 	}
+	Com_Printf ("recording to %s.\n", name);
+
+	Demo_BeginIndex (&svs.demoindex, name);
 
 	// setup a buffer to catch all multicasts
 	SZ_Init (&svs.demo_multicast, svs.demo_multicast_buf, sizeof(svs.demo_multicast_buf));
@@ -1079,8 +1155,8 @@ void SV_ServerRecord_f (void)
 	// write it to the demo file
 	Com_DPrintf ("signon message length: %i\n", buf.cursize);
 	len = LittleLong (buf.cursize);
-	fwrite (&len, 4, 1, svs.demofile);
-	fwrite (buf.data, buf.cursize, 1, svs.demofile);
+	Demo_Write (svs.demofile, &len, 4);
+	Demo_Write (svs.demofile, buf.data, buf.cursize);
 
 	// the rest of the demo file will be individual frames
 }
@@ -1095,12 +1171,17 @@ Ends server demo recording
 */
 void SV_ServerStop_f (void)
 {
+	int32_t		len;
+
 	if (!svs.demofile)
 	{
 		Com_Printf ("Not doing a serverrecord.\n");
 		return;
 	}
-	fclose (svs.demofile);
+	len = -1;
+	Demo_Write (svs.demofile, &len, 4);
+	Demo_FinishIndex (&svs.demoindex, svs.demofile);
+	Demo_CloseWriter (svs.demofile);
 	svs.demofile = NULL;
 	Com_Printf ("Recording completed.\n");
 }
@@ -1160,6 +1241,7 @@ void SV_InitOperatorCommands (void)
 
 	Cmd_AddCommand ("map", SV_Map_f);
 	Cmd_AddCommand ("demomap", SV_DemoMap_f);
+	Cmd_AddCommand ("demo_seek", SV_DemoSeek_f);
 	Cmd_AddCommand ("gamemap", SV_GameMap_f);
 	Cmd_AddCommand ("setmaster", SV_SetMaster_f);
 
@@ -1168,11 +1250,19 @@ void SV_InitOperatorCommands (void)
 
 	Cmd_AddCommand ("serverrecord", SV_ServerRecord_f);
 	Cmd_AddCommand ("serverstop", SV_ServerStop_f);
+	Cmd_AddCommand ("mvdrecord", SV_MvdRecord_f);
+	Cmd_AddCommand ("mvdstop", SV_MvdStop_f);
+	Cmd_AddCommand ("mvd_pov", SV_MvdPov_f);
 
 	Cmd_AddCommand ("save", SV_Savegame_f);
 	Cmd_AddCommand ("load", SV_Loadgame_f);
 
 	Cmd_AddCommand ("killserver", SV_KillServer_f);
+	Cmd_AddCommand ("sv_multicastbench", SV_MulticastBench_f);
+	Cmd_AddCommand ("sv_areabench", SV_AreaBench_f);
+	Cmd_AddCommand ("sv_profile", SV_Profile_f);
+	Cmd_AddCommand ("sv_netstats", SV_Netstats_f);
+	Cmd_AddCommand ("sv_downloadbench", SV_DownloadBench_f);
 
 	Cmd_AddCommand ("sv", SV_ServerCommand_f);
 }
@@ -0,0 +1,730 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_download.c -- windowed file downloads
+
+#include "../../Source/GameEngine.h"
+#include "../../Source/SystemTimer.h"
+
+#include "zlib.h"
+
+#include "server.h"
+
+/*
+===============================================================================
+
+The legacy download puts 1k in the reliable stream and waits for the
+client's nextdl before the next, one chunk per round trip and server
+frame.  A client that asks with "download <name> <offset> window" gets
+svc_downloadstart on the reliable channel instead, then the file as
+deflated svc_downloadchunk messages in plain datagrams, up to
+sv_download_window chunks past the first one it is missing.  Its
+clc_downloadack names that chunk and has a bit for each one after it,
+so only what was lost goes again.  New chunks go out as the acks come
+in, SV_SendClientMessages resends the ones that are late.  Chunks are
+paced by sv_download_rate rather than the client's gameplay rate, so a
+window that it doesn't cover waits for the next server frame.
+
+Either way the file comes from SV_OpenDownloadFile, so any number of
+clients fetching the same file share one copy: loose files are mapped,
+files in paks and pk3s are read and inflated once.  The file is let go
+when its last downloader finishes or drops.
+
+===============================================================================
+*/
+
+#define	DOWNLOAD_PACKET		1400		// datagrams that fit one legacy packet
+#define	DOWNLOAD_RESEND		300			// ms before an unacknowledged chunk goes again
+#define	DOWNLOAD_FASTRESEND	100			// or this soon if chunks after it got through
+
+/*
+=================
+SV_InitDownloadWindow
+=================
+*/
+static void SV_InitDownloadWindow (dlwindow_t *dl, int32_t offset, int32_t size, int32_t window, int32_t time)
+{
+	memset (dl, 0, sizeof(*dl));
+	dl->offset = offset;
+	dl->chunks = (size - offset + DOWNLOAD_CHUNK - 1) / DOWNLOAD_CHUNK;
+	dl->window = window;
+	if (dl->window < 1)
+		dl->window = 1;
+	if (dl->window > DOWNLOAD_MAXWINDOW)
+		dl->window = DOWNLOAD_MAXWINDOW;
+	dl->deflated = -1;
+	dl->starttime = time;
+}
+
+/*
+=================
+SV_DeflateChunk
+
+Returns the chunk as it goes on the wire, stored if zlib can't shrink it
+=================
+*/
+static byte *SV_DeflateChunk (client_t *cl, int32_t chunk, int32_t *length)
+{
+	dlwindow_t	*dl = cl->dlwindow;
+	byte		*data;
+	uLongf		deflated;
+	int32_t		start, raw;
+
+	if (dl->deflated == chunk)
+	{
+		*length = dl->deflatedlength;
+		return (*length & DOWNLOAD_DEFLATED) ? dl->deflatebuf : cl->download + dl->offset + chunk*DOWNLOAD_CHUNK;
+	}
+
+	start = dl->offset + chunk*DOWNLOAD_CHUNK;
+	raw = cl->downloadsize - start;
+	if (raw > DOWNLOAD_CHUNK)
+		raw = DOWNLOAD_CHUNK;
+	data = cl->download + start;
+
+	deflated = sizeof(dl->deflatebuf);
+	if (compress2 (dl->deflatebuf, &deflated, data, raw, Z_BEST_SPEED) == Z_OK && (int32_t)deflated < raw)
+	{
+		*length = (int32_t)deflated | DOWNLOAD_DEFLATED;
+		data = dl->deflatebuf;
+	}
+	else
+		*length = raw;
+
+	dl->deflated = chunk;
+	dl->deflatedlength = *length;
+	return data;
+}
+
+/*
+=================
+SV_WriteDownloadChunks
+
+Fills msg with the chunks that are due, returns how many
+=================
+*/
+static int32_t SV_WriteDownloadChunks (client_t *cl, sizebuf_t *msg, int32_t time)
+{
+	dlwindow_t	*dl = cl->dlwindow;
+	byte		*data;
+	int32_t		chunk, end, slot;
+	int32_t		length, age, count;
+
+	end = dl->base + dl->window;
+	if (end > dl->chunks)
+		end = dl->chunks;
+
+	count = 0;
+	for (chunk=dl->base ; chunk<end ; chunk++)
+	{
+		slot = chunk % DOWNLOAD_MAXWINDOW;
+		if (dl->acked[slot])
+			continue;
+		if (dl->sent[slot])
+		{
+			age = time - dl->sent[slot];
+			if (age < DOWNLOAD_FASTRESEND || (age < DOWNLOAD_RESEND && chunk >= dl->highest))
+				continue;
+		}
+
+		data = SV_DeflateChunk (cl, chunk, &length);
+		if (msg->cursize + 7 + (length & ~DOWNLOAD_DEFLATED) > msg->maxsize)
+			break;
+
+		MSG_WriteByte (msg, svc_downloadchunk);
+		MSG_WriteLong (msg, chunk);
+		MSG_WriteShort (msg, length);
+		SZ_Write (msg, data, length & ~DOWNLOAD_DEFLATED);
+
+		if (dl->sent[slot])
+			dl->resent++;
+		dl->sent[slot] = time;
+		if (chunk >= dl->next)
+			dl->next = chunk + 1;
+		count++;
+	}
+
+	return count;
+}
+
+/*
+=================
+SV_ReadDownloadAck
+=================
+*/
+static void SV_ReadDownloadAck (dlwindow_t *dl, sizebuf_t *msg)
+{
+	int32_t		base, bytes, bits;
+	int32_t		chunk, slot;
+	int32_t		i, j;
+
+	base = MSG_ReadLong (msg);
+	bytes = MSG_ReadByte (msg);
+
+	// one left over from the client's previous download
+	if (base > dl->next)
+		return;
+
+	// everything before base is in, free the slots for the chunks coming up
+	for ( ; dl->base < base ; dl->base++)
+	{
+		slot = dl->base % DOWNLOAD_MAXWINDOW;
+		dl->sent[slot] = 0;
+		dl->acked[slot] = 0;
+	}
+	if (dl->highest < dl->base)
+		dl->highest = dl->base;
+
+	for (i=0 ; i<bytes ; i++)
+	{
+		bits = MSG_ReadByte (msg);
+		for (j=0 ; j<8 ; j++)
+		{
+			if (!(bits & (1<<j)))
+				continue;
+
+			// an old ack may name chunks that have left the window
+			chunk = base + 1 + i*8 + j;
+			if (chunk < dl->base || chunk >= dl->next)
+				continue;
+			dl->acked[chunk % DOWNLOAD_MAXWINDOW] = 1;
+			if (chunk >= dl->highest)
+				dl->highest = chunk + 1;
+		}
+	}
+}
+
+/*
+=================
+SV_DownloadAllowance
+
+Bytes sv_download_rate leaves the client's chunks in this server frame:
+no more than twice its share of the rate, and nothing once the last
+second's chunks have used it up.  The gameplay rate, which the client
+caps at 15000, only paces its frames.
+=================
+*/
+static int32_t SV_DownloadAllowance (client_t *cl, int32_t framenum)
+{
+	int32_t		rate, total, share, allow;
+	int32_t		i;
+
+	// never held back over the loopback or without a limit
+	rate = (int32_t)sv_download_rate->value;
+	if (cl->netchan.remote_address.type == NA_LOOPBACK || rate <= 0)
+		return 0x7fffffff;
+	if (rate < cl->rate)
+		rate = cl->rate;
+
+	total = 0;
+	for (i=0 ; i<RATE_MESSAGES ; i++)
+		total += cl->download_size[i];
+
+	share = rate / RATE_MESSAGES;
+	allow = 2*share - cl->download_size[framenum % RATE_MESSAGES];
+	if (allow > rate - total)
+		allow = rate - total;
+	return allow;
+}
+
+/*
+=================
+SV_SendDownloadChunks
+
+Sends what the window and the download rate allow, as many datagrams
+as that takes
+=================
+*/
+void SV_SendDownloadChunks (client_t *cl)
+{
+	byte		buf[DOWNLOAD_PACKET];
+	sizebuf_t	msg;
+	int32_t		time, allow;
+
+	if (!cl->dlwindow)
+		return;
+
+	time = Game::Engine::GetTick();
+	allow = SV_DownloadAllowance (cl, sv.framenum);
+	while (allow > 0)
+	{
+		SZ_Init (&msg, buf, DOWNLOAD_PACKET - PACKET_HEADER);
+		if (!SV_WriteDownloadChunks (cl, &msg, time))
+			break;
+
+		Netchan_Transmit (&cl->netchan, msg.cursize, msg.data);
+		cl->download_size[sv.framenum % RATE_MESSAGES] += msg.cursize;
+		allow -= msg.cursize;
+		cl->dlwindow->packets++;
+		cl->dlwindow->wirebytes += msg.cursize;
+	}
+}
+
+static dlfile_t	*sv_dlfiles;
+
+/*
+=================
+SV_OpenDownloadFile
+
+Returns a reference to name, NULL if it can't be found
+=================
+*/
+dlfile_t *SV_OpenDownloadFile (char *name)
+{
+	dlfile_t	*file;
+	void		*data;
+	qboolean	mapped;
+	int32_t		size;
+
+	for (file=sv_dlfiles ; file ; file=file->next)
+	{
+		if (!Q_strcasecmp (file->name, name))
+		{
+			file->refcount++;
+			return file;
+		}
+	}
+
+	size = FS_MapFile (name, &data, &mapped);
+	if (!data)
+		return NULL;
+
+	file = (dlfile_t *)Z_Malloc (sizeof(dlfile_t));
+	Q_strncpyz (file->name, name, sizeof(file->name));
+	file->data = (byte *)data;
+	file->size = size;
+	file->refcount = 1;
+	file->mapped = mapped;
+	file->frompak = (file_from_pak != 0);
+	file->next = sv_dlfiles;
+	sv_dlfiles = file;
+
+	Com_DPrintf ("Download file %s: %i bytes, %s\n", name, size, mapped ? "mapped" : "loaded");
+	return file;
+}
+
+/*
+=================
+SV_ReleaseDownloadFile
+=================
+*/
+void SV_ReleaseDownloadFile (dlfile_t *file)
+{
+	dlfile_t	**prev;
+
+	if (--file->refcount > 0)
+		return;
+
+	for (prev=&sv_dlfiles ; *prev ; prev=&(*prev)->next)
+	{
+		if (*prev == file)
+		{
+			*prev = file->next;
+			break;
+		}
+	}
+
+	if (file->mapped)
+		Sys_UnmapFile (file->data, file->size);
+	else
+		FS_FreeFile (file->data);
+	Z_Free (file);
+}
+
+/*
+=================
+SV_BeginWindowedDownload
+
+cl->downloadfile is open and downloadcount is the offset to start from
+=================
+*/
+void SV_BeginWindowedDownload (client_t *cl)
+{
+	if (!cl->dlwindow)
+		cl->dlwindow = (dlwindow_t *)Z_Malloc (sizeof(dlwindow_t));
+	SV_InitDownloadWindow (cl->dlwindow, cl->downloadcount, cl->downloadsize,
+		(int32_t)sv_download_window->value, Game::Engine::GetTick());
+
+	MSG_WriteByte (&cl->netchan.message, svc_downloadstart);
+	MSG_WriteLong (&cl->netchan.message, cl->downloadsize);
+	MSG_WriteLong (&cl->netchan.message, cl->downloadcount);
+	MSG_WriteShort (&cl->netchan.message, DOWNLOAD_CHUNK);
+
+	// nothing left to send, the client finishes on svc_downloadstart
+	if (!cl->dlwindow->chunks)
+	{
+		SV_EndDownload (cl);
+		return;
+	}
+
+	// the reliable start goes out ahead of the first chunks in this datagram
+	SV_SendDownloadChunks (cl);
+}
+
+/*
+=================
+SV_DownloadAck
+
+A clc_downloadack from the client, data is past the op
+=================
+*/
+void SV_DownloadAck (client_t *cl, byte *data, int32_t length)
+{
+	dlwindow_t	*dl = cl->dlwindow;
+	sizebuf_t	msg;
+
+	if (!dl)
+		return;		// a late ack for a finished download
+
+	SZ_Init (&msg, data, length);
+	msg.cursize = length;
+	SV_ReadDownloadAck (dl, &msg);
+
+	if (dl->base < dl->chunks)
+	{
+		SV_SendDownloadChunks (cl);
+		return;
+	}
+
+	Com_DPrintf ("Download to %s done: %i bytes in %i ms, %i packets, %i chunks resent\n", cl->name,
+		cl->downloadsize - dl->offset, Game::Engine::GetTick() - dl->starttime, dl->packets, dl->resent);
+	SV_EndDownload (cl);
+}
+
+/*
+=================
+SV_EndDownload
+=================
+*/
+void SV_EndDownload (client_t *cl)
+{
+	if (cl->downloadfile)
+	{
+		SV_ReleaseDownloadFile (cl->downloadfile);
+		cl->downloadfile = NULL;
+		cl->download = NULL;
+	}
+	if (cl->dlwindow)
+	{
+		Z_Free (cl->dlwindow);
+		cl->dlwindow = NULL;
+	}
+}
+
+/*
+===============================================================================
+
+BENCHMARK
+
+sv_downloadbench runs the windowed sender against an in memory client
+over a simulated link with the given round trip time and loss, one
+millisecond at a time.  The client acks once per 10ms frame like a real
+one.  The server sends when an ack arrives and on every 100ms frame,
+within the same sv_download_rate allowance as a real client.  The time
+is simulated, the deflate and inflate cost is measured for real.
+
+===============================================================================
+*/
+
+#define	BENCH_QUEUE		1024
+#define	BENCH_CLFRAME	10
+#define	BENCH_SVFRAME	100
+
+typedef struct
+{
+	int32_t		arrival;
+	int32_t		length;
+	byte		data[DOWNLOAD_PACKET];
+} benchpacket_t;
+
+typedef struct
+{
+	benchpacket_t	packets[BENCH_QUEUE];
+	int32_t		head, tail;			// tail - head in flight
+	int32_t		latency;
+	int32_t		loss;				// percent
+	int32_t		lost;
+} benchlink_t;
+
+typedef struct
+{
+	byte		*file;
+	byte		*chunkbits;
+	int32_t		chunks;
+	int32_t		firstmissing;
+	int32_t		received;
+	int32_t		duplicates;
+	qboolean	ackpending;
+} benchclient_t;
+
+/*
+=================
+SV_BenchSend
+=================
+*/
+static void SV_BenchSend (benchlink_t *link, byte *data, int32_t length, int32_t time)
+{
+	benchpacket_t	*p;
+
+	if ((rand() % 100) < link->loss || link->tail - link->head == BENCH_QUEUE)
+	{
+		link->lost++;
+		return;
+	}
+
+	p = &link->packets[link->tail++ % BENCH_QUEUE];
+	p->arrival = time + link->latency;
+	p->length = length;
+	memcpy (p->data, data, length);
+}
+
+/*
+=================
+SV_BenchReceive
+
+What CL_ParseDownloadChunk does, minus the file
+=================
+*/
+static qboolean SV_BenchReceive (benchclient_t *bc, byte *data, int32_t length, int32_t size)
+{
+	sizebuf_t	msg;
+	uLongf		raw;
+	int32_t		chunk, wire, expected;
+
+	SZ_Init (&msg, data, length);
+	msg.cursize = length;
+
+	while (msg.readcount < msg.cursize)
+	{
+		if (MSG_ReadByte (&msg) != svc_downloadchunk)
+			return false;
+		chunk = MSG_ReadLong (&msg);
+		wire = MSG_ReadShort (&msg) & 0xffff;
+		if (chunk < 0 || chunk >= bc->chunks || msg.readcount + (wire & ~DOWNLOAD_DEFLATED) > msg.cursize)
+			return false;
+
+		expected = size - chunk*DOWNLOAD_CHUNK;
+		if (expected > DOWNLOAD_CHUNK)
+			expected = DOWNLOAD_CHUNK;
+
+		if (bc->chunkbits[chunk>>3] & (1<<(chunk&7)))
+			bc->duplicates++;
+		else if (wire & DOWNLOAD_DEFLATED)
+		{
+			raw = DOWNLOAD_CHUNK;
+			if (uncompress (bc->file + chunk*DOWNLOAD_CHUNK, &raw, msg.data + msg.readcount, wire & ~DOWNLOAD_DEFLATED) != Z_OK
+				|| (int32_t)raw != expected)
+				return false;
+		}
+		else if (wire != expected)
+			return false;
+		else
+			memcpy (bc->file + chunk*DOWNLOAD_CHUNK, msg.data + msg.readcount, wire);
+
+		if (!(bc->chunkbits[chunk>>3] & (1<<(chunk&7))))
+		{
+			bc->chunkbits[chunk>>3] |= 1<<(chunk&7);
+			bc->received++;
+			while (bc->firstmissing < bc->chunks && (bc->chunkbits[bc->firstmissing>>3] & (1<<(bc->firstmissing&7))))
+				bc->firstmissing++;
+		}
+		bc->ackpending = true;
+		msg.readcount += wire & ~DOWNLOAD_DEFLATED;
+	}
+
+	return true;
+}
+
+/*
+=================
+SV_BenchWriteAck
+
+What CL_WriteDownloadAck does
+=================
+*/
+static int32_t SV_BenchWriteAck (benchclient_t *bc, byte *data)
+{
+	sizebuf_t	msg;
+	int32_t		i, bytes, bits, chunk;
+
+	SZ_Init (&msg, data, DOWNLOAD_PACKET);
+
+	bytes = (bc->chunks - bc->firstmissing - 1 + 7) / 8;
+	if (bytes > DOWNLOAD_MAXWINDOW/8)
+		bytes = DOWNLOAD_MAXWINDOW/8;
+	if (bytes < 0)
+		bytes = 0;
+
+	MSG_WriteLong (&msg, bc->firstmissing);
+	MSG_WriteByte (&msg, bytes);
+	for (i=0 ; i<bytes*8 ; i++)
+	{
+		if (!(i&7))
+			bits = 0;
+		chunk = bc->firstmissing + 1 + i;
+		if (chunk < bc->chunks && (bc->chunkbits[chunk>>3] & (1<<(chunk&7))))
+			bits |= 1<<(i&7);
+		if ((i&7) == 7)
+			MSG_WriteByte (&msg, bits);
+	}
+
+	bc->ackpending = false;
+	return msg.cursize;
+}
+
+/*
+=================
+SV_BenchSendChunks
+
+What SV_SendDownloadChunks does, onto the simulated link
+=================
+*/
+static void SV_BenchSendChunks (client_t *cl, benchlink_t *link, int32_t time, int32_t framenum)
+{
+	byte		buf[DOWNLOAD_PACKET];
+	sizebuf_t	msg;
+	int32_t		allow;
+
+	allow = SV_DownloadAllowance (cl, framenum);
+	while (allow > 0)
+	{
+		SZ_Init (&msg, buf, DOWNLOAD_PACKET - PACKET_HEADER);
+		if (!SV_WriteDownloadChunks (cl, &msg, time))
+			break;
+
+		SV_BenchSend (link, msg.data, msg.cursize, time);
+		cl->download_size[framenum % RATE_MESSAGES] += msg.cursize;
+		allow -= msg.cursize;
+		cl->dlwindow->packets++;
+		cl->dlwindow->wirebytes += msg.cursize;
+	}
+}
+
+/*
+=================
+SV_DownloadBench_f
+
+sv_downloadbench <file> [window] [loss%] [rtt ms]
+=================
+*/
+void SV_DownloadBench_f (void)
+{
+	static client_t	cl;
+	static benchlink_t	down, up;
+	benchclient_t	bc;
+	benchpacket_t	*p;
+	dlwindow_t		dl;
+	byte			buf[DOWNLOAD_PACKET];
+	sizebuf_t		msg;
+	uint64_t		start, usec;
+	int32_t			time, framenum, rtt, legacy;
+	qboolean		ok, acked;
+
+	if (Cmd_Argc() < 2)
+	{
+		Com_Printf ("usage: sv_downloadbench <file> [window] [loss%%] [rtt ms]\n");
+		return;
+	}
+
+	memset (&cl, 0, sizeof(cl));
+	cl.downloadfile = SV_OpenDownloadFile (Cmd_Argv(1));
+	if (!cl.downloadfile)
+	{
+		Com_Printf ("Couldn't load %s\n", Cmd_Argv(1));
+		return;
+	}
+	cl.download = cl.downloadfile->data;
+	cl.downloadsize = cl.downloadfile->size;
+	cl.netchan.remote_address.type = NA_IP;
+	cl.rate = 15000;
+
+	memset (&down, 0, sizeof(down));
+	memset (&up, 0, sizeof(up));
+	rtt = (Cmd_Argc() > 4) ? atoi (Cmd_Argv(4)) : 1;
+	down.loss = up.loss = (Cmd_Argc() > 3) ? atoi (Cmd_Argv(3)) : 0;
+	down.latency = rtt / 2;
+	up.latency = rtt - down.latency;
+
+	cl.dlwindow = &dl;
+	SV_InitDownloadWindow (&dl, 0, cl.downloadsize,
+		(Cmd_Argc() > 2) ? atoi (Cmd_Argv(2)) : (int32_t)sv_download_window->value, 1);
+
+	memset (&bc, 0, sizeof(bc));
+	bc.chunks = dl.chunks;
+	bc.file = (byte *)Z_Malloc (cl.downloadsize + 1);
+	bc.chunkbits = (byte *)Z_Malloc ((bc.chunks+7)/8 + 1);
+
+	srand (1);
+	ok = true;
+	start = System::Timer::Microseconds();
+	for (time=1 ; bc.received < bc.chunks && time < 3600*1000 ; time++)
+	{
+		// client side
+		for ( ; down.head < down.tail && down.packets[down.head % BENCH_QUEUE].arrival <= time ; down.head++)
+		{
+			p = &down.packets[down.head % BENCH_QUEUE];
+			if (!SV_BenchReceive (&bc, p->data, p->length, cl.downloadsize))
+				ok = false;
+		}
+		if (bc.ackpending && !(time % BENCH_CLFRAME))
+			SV_BenchSend (&up, buf, SV_BenchWriteAck (&bc, buf), time);
+
+		// server side, a new rate slot every frame
+		framenum = time / BENCH_SVFRAME;
+		if (!(time % BENCH_SVFRAME))
+			cl.download_size[framenum % RATE_MESSAGES] = 0;
+
+		// chunks go out as acks come in and on every frame
+		acked = false;
+		for ( ; up.head < up.tail && up.packets[up.head % BENCH_QUEUE].arrival <= time ; up.head++)
+		{
+			p = &up.packets[up.head % BENCH_QUEUE];
+			SZ_Init (&msg, p->data, p->length);
+			msg.cursize = p->length;
+			SV_ReadDownloadAck (&dl, &msg);
+			acked = true;
+		}
+		if (acked || time == 1 || !(time % BENCH_SVFRAME))
+			SV_BenchSendChunks (&cl, &down, time, framenum);
+	}
+	usec = System::Timer::Microseconds() - start;
+
+	if (ok && bc.received == bc.chunks && memcmp (bc.file, cl.download, cl.downloadsize))
+		ok = false;
+
+	// the legacy path moves a chunk per server frame, or per round trip past that
+	legacy = ((cl.downloadsize + 1023) / 1024) * (BENCH_SVFRAME * ((rtt + BENCH_CLFRAME + BENCH_SVFRAME - 1) / BENCH_SVFRAME));
+
+	Com_Printf ("%s: %i bytes, window %i, %i%% loss, %i ms rtt, sv_download_rate %i\n", Cmd_Argv(1), cl.downloadsize,
+		dl.window, down.loss, rtt, (int32_t)sv_download_rate->value);
+	if (bc.received < bc.chunks)
+		Com_Printf ("gave up after an hour with %i of %i chunks\n", bc.received, bc.chunks);
+	else
+		Com_Printf ("windowed: %.2f s, %.1f KB/s\n", time / 1000.0, cl.downloadsize / 1.024 / time);
+	Com_Printf ("legacy:   %.2f s, %.1f KB/s\n", legacy / 1000.0, cl.downloadsize / 1.024 / legacy);
+	Com_Printf ("%i packets, %i lost, %i chunks resent, %i duplicates, %.1f%% of the file on the wire\n",
+		dl.packets, down.lost + up.lost, dl.resent, bc.duplicates, 100.0 * dl.wirebytes / cl.downloadsize);
+	Com_Printf ("cpu: %.1f ms, %.1f MB/s deflate + inflate\n", usec / 1000.0, usec ? cl.downloadsize / (double)usec : 0.0);
+	if (!ok)
+		Com_Printf (S_COLOR_RED"received file doesn't match\n");
+
+	Z_Free (bc.file);
+	Z_Free (bc.chunkbits);
+	SV_ReleaseDownloadFile (cl.downloadfile);
+}
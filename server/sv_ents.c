@@ -18,6 +18,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#include "../../Source/SystemThreads.h"
+
 #include "server.h"
 
 /*
@@ -115,20 +117,315 @@ void SV_EmitProjectileUpdate (sizebuf_t *msg)
 }
 #endif
 
+/*
+=============
+SV_WriteRemoveEntity
+=============
+*/
+void SV_WriteRemoveEntity (sizebuf_t *msg, int32_t number)
+{
+	int32_t		bits;
+
+	bits = U_REMOVE;
+	if (number >= 256)
+		bits |= U_NUMBER16 | U_MOREBITS1;
+
+	MSG_WriteByte (msg,	bits&255 );
+	if (bits & 0x0000ff00)
+		MSG_WriteByte (msg,	(bits>>8)&255 );
+
+	if (bits & U_NUMBER16)
+		MSG_WriteShort (msg, number);
+	else
+		MSG_WriteByte (msg, number);
+}
+
+/*
+=============================================================================
+
+With sv_entitypriority set, a frame that won't fit in what the client's
+rate leaves is thinned out instead of being dropped or overflowing.
+Every changed entity is sized and ranked by distance, whether it is in
+front of the view and how many frames its update has been held back.
+The budget is filled in rank order and the rest wait: the frame keeps
+the state the client already has for a held back delta, and leaves out
+a held back new entity, so the next frame deltas from what the client
+really saw and the skipped changes carry over.
+
+=============================================================================
+*/
+
+typedef struct
+{
+	entity_state_t	*oldent;
+	entity_state_t	*newent;		// NULL when removing oldent
+	int32_t		bytes;
+	qboolean	fullstate;			// new entity, sent from its baseline
+	qboolean	send;
+} entityupdate_t;
+
+typedef struct
+{
+	float		priority;
+	int32_t		update;
+} entityrank_t;
+
+// frames are written on the worker pool, and these are too big for the stack
+static THREAD_LOCAL entityupdate_t	sv_entityupdates[MAX_EDICTS];
+static THREAD_LOCAL entityrank_t	sv_entityranks[MAX_EDICTS];
+
+/*
+=============
+SV_EntityRankCompare
+
+Highest priority first
+=============
+*/
+static int SV_EntityRankCompare (const void *a, const void *b)
+{
+	float	pa = ((const entityrank_t *)a)->priority;
+	float	pb = ((const entityrank_t *)b)->priority;
+
+	if (pa > pb)
+		return -1;
+	if (pa < pb)
+		return 1;
+	return ((const entityrank_t *)a)->update - ((const entityrank_t *)b)->update;
+}
+
+/*
+=============
+SV_EntityPriority
+=============
+*/
+static float SV_EntityPriority (client_t *client, entityupdate_t *update, vec3_t vieworg, vec3_t forward)
+{
+	entity_state_t	*ent = update->newent;
+	edict_t		*edict = EDICT_NUM(ent->number);
+	vec3_t		center, delta;
+	float		priority;
+	int32_t		age;
+
+	// brush models have their origin at the world origin, so use the bounds
+	VectorAdd (edict->absmin, edict->absmax, center);
+	VectorScale (center, 0.5, center);
+	VectorSubtract (center, vieworg, delta);
+
+	priority = 256.0f / (256.0f + VectorLength (delta));
+	if (DotProduct (delta, forward) > 0)
+		priority *= 2;
+	if (ent->number <= maxclients->value)
+		priority *= 2;
+	// events are only sent once, and new entities would pop in late
+	if (ent->event || update->fullstate)
+		priority *= 4;
+
+	age = (uint16_t)(sv.framenum - client->entity_sent[ent->number]);
+	if (age > 255)
+		age = 255;
+	return priority * (1 + age);
+}
+
+/*
+=============
+SV_EmitPrioritizedEntities
+
+Like SV_EmitPacketEntities, but only writes what fits in budget bytes,
+and fixes up the to frame for what was held back
+=============
+*/
+static void SV_EmitPrioritizedEntities (client_t *client, client_frame_t *from, client_frame_t *to,
+	sizebuf_t *msg, netstats_t *stats, int32_t budget)
+{
+	entity_state_t	*oldent, *newent, *dest;
+	entityupdate_t	*update;
+	int32_t		oldindex, newindex;
+	int32_t		oldnum, newnum;
+	int32_t		from_num_entities;
+	int32_t		numupdates, numranks;
+	int32_t		i, start;
+	sizebuf_t	sizer;
+	byte		sizer_buf[256];
+	vec3_t		vieworg, forward;
+
+	MSG_WriteByte (msg, svc_packetentities);
+
+	if (!from)
+		from_num_entities = 0;
+	else
+		from_num_entities = from->num_entities;
+
+	SZ_Init (&sizer, sizer_buf, sizeof(sizer_buf));
+	sizer.allowoverflow = true;
+
+	// size every update, in entity number order
+	numupdates = 0;
+	newindex = 0;
+	oldindex = 0;
+	while (newindex < to->num_entities || oldindex < from_num_entities)
+	{
+		if (newindex >= to->num_entities)
+			newnum = 9999;
+		else
+		{
+			newent = &svs.client_entities[(to->first_entity+newindex)%svs.num_client_entities];
+			newnum = newent->number;
+		}
+
+		if (oldindex >= from_num_entities)
+			oldnum = 9999;
+		else
+		{
+			oldent = &svs.client_entities[(from->first_entity+oldindex)%svs.num_client_entities];
+			oldnum = oldent->number;
+		}
+
+		update = &sv_entityupdates[numupdates++];
+		update->send = false;
+		if (newnum > oldnum)
+		{	// removes are small and always go out
+			update->oldent = oldent;
+			update->newent = NULL;
+			update->fullstate = false;
+			update->bytes = (oldnum >= 256) ? 4 : 2;
+			oldindex++;
+			continue;
+		}
+
+		if (newnum == oldnum)
+		{
+			update->oldent = oldent;
+			update->fullstate = false;
+			oldindex++;
+		}
+		else
+		{
+			update->oldent = &sv.baselines[newnum];
+			update->fullstate = true;
+		}
+		update->newent = newent;
+		newindex++;
+
+		SZ_Clear (&sizer);
+		MSG_WriteDeltaEntity (update->oldent, newent, &sizer, update->fullstate,
+			update->fullstate || newnum <= maxclients->value);
+		update->bytes = sizer.overflowed ? sizeof(sizer_buf) : sizer.cursize;
+	}
+
+	// removes and unchanged entities are free picks, rank the rest
+	for (i=0 ; i<3 ; i++)
+		vieworg[i] = to->ps.pmove.origin[i]*0.125 + to->ps.viewoffset[i];
+	AngleVectors (to->ps.viewangles, forward, NULL, NULL);
+
+	numranks = 0;
+	for (i=0, update=sv_entityupdates ; i<numupdates ; i++, update++)
+	{
+		if (!update->newent || !update->bytes)
+		{
+			update->send = true;
+			budget -= update->bytes;
+			continue;
+		}
+		sv_entityranks[numranks].priority = SV_EntityPriority (client, update, vieworg, forward);
+		sv_entityranks[numranks].update = i;
+		numranks++;
+	}
+
+	qsort (sv_entityranks, numranks, sizeof(entityrank_t), SV_EntityRankCompare);
+
+	// smaller updates further down may still fit after a big one doesn't
+	stats->deferred = 0;
+	for (i=0 ; i<numranks ; i++)
+	{
+		update = &sv_entityupdates[sv_entityranks[i].update];
+		if (update->bytes <= budget)
+		{
+			update->send = true;
+			budget -= update->bytes;
+		}
+		else
+			stats->deferred++;
+	}
+
+	// the protocol wants ascending entity numbers
+	for (i=0, update=sv_entityupdates ; i<numupdates ; i++, update++)
+	{
+		if (!update->send)
+			continue;
+
+		if (!update->newent)
+		{
+			SV_WriteRemoveEntity (msg, update->oldent->number);
+			continue;
+		}
+
+		newent = update->newent;
+		start = msg->cursize;
+		MSG_WriteDeltaEntity (update->oldent, newent, msg, update->fullstate,
+			update->fullstate || newent->number <= maxclients->value);
+		if (update->fullstate)
+			stats->fullstates++;
+		if (msg->cursize - start > stats->biggest)
+		{
+			stats->biggest = msg->cursize - start;
+			stats->biggestmodel = newent->modelindex;
+		}
+		client->entity_sent[newent->number] = (uint16_t)sv.framenum;
+	}
+
+	MSG_WriteShort (msg, 0);	// end of packetentities
+
+	if (!stats->deferred)
+		return;
+
+	// record what the client will actually have once this frame arrives
+	newindex = 0;
+	for (i=0, update=sv_entityupdates ; i<numupdates ; i++, update++)
+	{
+		if (!update->newent)
+			continue;
+		if (!update->send && update->fullstate)
+			continue;		// not there yet, comes from the baseline again later
+
+		dest = &svs.client_entities[(to->first_entity+newindex)%svs.num_client_entities];
+		if (!update->send)
+			*dest = *update->oldent;
+		else if (dest != update->newent)
+			*dest = *update->newent;
+		newindex++;
+	}
+	to->num_entities = newindex;
+}
+
 /*
 =============
 SV_EmitPacketEntities
 
 Writes a delta update of an entity_state_t list to the message.
+Baseline sends and the biggest delta are noted in stats.  A budget
+of -1 writes every entity, anything else is left to
+SV_EmitPrioritizedEntities.
 =============
 */
-void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
+void SV_EmitPacketEntities (client_t *client, client_frame_t *from, client_frame_t *to, sizebuf_t *msg,
+	netstats_t *stats, int32_t budget)
 {
 	entity_state_t	*oldent, *newent;
 	int32_t		oldindex, newindex;
 	int32_t		oldnum, newnum;
 	int32_t		from_num_entities;
-	int32_t		bits;
+	int32_t		start;
+
+	stats->fullstates = 0;
+	stats->deferred = 0;
+	stats->biggest = 0;
+	stats->biggestmodel = 0;
+
+	if (budget >= 0)
+	{
+		SV_EmitPrioritizedEntities (client, from, to, msg, stats, budget);
+		return;
+	}
 
 #if 0
 	if (numprojs)
@@ -168,7 +465,13 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 			// in any bytes being emited if the entity has not changed at all
 			// note that players are always 'newentities', this updates their oldorigin always
 			// and prevents warping
+			start = msg->cursize;
 			MSG_WriteDeltaEntity (oldent, newent, msg, false, newent->number <= maxclients->value);
+			if (msg->cursize - start > stats->biggest)
+			{
+				stats->biggest = msg->cursize - start;
+				stats->biggestmodel = newent->modelindex;
+			}
 			oldindex++;
 			newindex++;
 			continue;
@@ -176,26 +479,21 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 
 		if (newnum < oldnum)
 		{	// this is a new entity, send it from the baseline
+			start = msg->cursize;
 			MSG_WriteDeltaEntity (&sv.baselines[newnum], newent, msg, true, true);
+			stats->fullstates++;
+			if (msg->cursize - start > stats->biggest)
+			{
+				stats->biggest = msg->cursize - start;
+				stats->biggestmodel = newent->modelindex;
+			}
 			newindex++;
 			continue;
 		}
 
 		if (newnum > oldnum)
 		{	// the old entity isn't present in the new message
-			bits = U_REMOVE;
-			if (oldnum >= 256)
-				bits |= U_NUMBER16 | U_MOREBITS1;
-
-			MSG_WriteByte (msg,	bits&255 );
-			if (bits & 0x0000ff00)
-				MSG_WriteByte (msg,	(bits>>8)&255 );
-
-			if (bits & U_NUMBER16)
-				MSG_WriteShort (msg, oldnum);
-			else
-				MSG_WriteByte (msg, oldnum);
-
+			SV_WriteRemoveEntity (msg, oldnum);
 			oldindex++;
 			continue;
 		}
@@ -219,260 +517,7 @@ SV_WritePlayerstateToClient
 */
 void SV_WritePlayerstateToClient (client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
 {
-	int32_t				i;
-	int32_t				pflags;
-	player_state_t	*ps, *ops;
-	player_state_t	dummy;
-	int32_t				statbits;
-
-	ps = &to->ps;
-	if (!from)
-	{
-		memset (&dummy, 0, sizeof(dummy));
-		ops = &dummy;
-	}
-	else
-		ops = &from->ps;
-
-	//
-	// determine what needs to be sent
-	//
-	pflags = 0;
-
-	if (ps->pmove.pm_type != ops->pmove.pm_type)
-		pflags |= PS_M_TYPE;
-
-	if (ps->pmove.origin[0] != ops->pmove.origin[0]
-		|| ps->pmove.origin[1] != ops->pmove.origin[1]
-		|| ps->pmove.origin[2] != ops->pmove.origin[2] )
-		pflags |= PS_M_ORIGIN;
-
-	if (ps->pmove.velocity[0] != ops->pmove.velocity[0]
-		|| ps->pmove.velocity[1] != ops->pmove.velocity[1]
-		|| ps->pmove.velocity[2] != ops->pmove.velocity[2] )
-		pflags |= PS_M_VELOCITY;
-
-	if (ps->pmove.pm_time != ops->pmove.pm_time)
-		pflags |= PS_M_TIME;
-
-	if (ps->pmove.pm_flags != ops->pmove.pm_flags)
-		pflags |= PS_M_FLAGS;
-
-	if (ps->pmove.gravity != ops->pmove.gravity)
-		pflags |= PS_M_GRAVITY;
-
-	if (ps->pmove.delta_angles[0] != ops->pmove.delta_angles[0]
-		|| ps->pmove.delta_angles[1] != ops->pmove.delta_angles[1]
-		|| ps->pmove.delta_angles[2] != ops->pmove.delta_angles[2] )
-		pflags |= PS_M_DELTA_ANGLES;
-
-
-	if (ps->viewoffset[0] != ops->viewoffset[0]
-		|| ps->viewoffset[1] != ops->viewoffset[1]
-		|| ps->viewoffset[2] != ops->viewoffset[2] )
-		pflags |= PS_VIEWOFFSET;
-
-	if (ps->viewangles[0] != ops->viewangles[0]
-		|| ps->viewangles[1] != ops->viewangles[1]
-		|| ps->viewangles[2] != ops->viewangles[2] )
-		pflags |= PS_VIEWANGLES;
-
-	if (ps->kick_angles[0] != ops->kick_angles[0]
-		|| ps->kick_angles[1] != ops->kick_angles[1]
-		|| ps->kick_angles[2] != ops->kick_angles[2] )
-		pflags |= PS_KICKANGLES;
-
-	if (ps->blend[0] != ops->blend[0]
-		|| ps->blend[1] != ops->blend[1]
-		|| ps->blend[2] != ops->blend[2]
-		|| ps->blend[3] != ops->blend[3] )
-		pflags |= PS_BLEND;
-
-	if (ps->fov != ops->fov)
-		pflags |= PS_FOV;
-
-	if (ps->rdflags != ops->rdflags)
-		pflags |= PS_RDFLAGS;
-
-	if (ps->gunframe != ops->gunframe)
-		pflags |= PS_WEAPONFRAME;
-
-#ifdef NEW_PLAYER_STATE_MEMBERS
-	//Knightmare added
-	if (ps->gunskin != ops->gunskin)
-		pflags |= PS_WEAPONSKIN;
-
-	if (ps->gunframe2 != ops->gunframe2)
-		pflags |= PS_WEAPONFRAME2;
-
-	if (ps->gunskin2 != ops->gunskin2)
-		pflags |= PS_WEAPONSKIN2;
-
-	// server-side speed control!
-	if (ps->maxspeed != ops->maxspeed)
-		pflags |= PS_MAXSPEED;
-
-	if (ps->duckspeed != ops->duckspeed)
-		pflags |= PS_DUCKSPEED;
-
-  	if (ps->waterspeed != ops->waterspeed)
-		pflags |= PS_WATERSPEED;
-
-  	if (ps->accel != ops->accel)
-		pflags |= PS_ACCEL;
-
-  	if (ps->stopspeed != ops->stopspeed)
-		pflags |= PS_STOPSPEED;
-#endif	//end Knightmare
-
-	pflags |= PS_WEAPONINDEX;
-	pflags |= PS_WEAPONINDEX2; //Knightmare added
-
-
-	//
-	// write it
-	//
-	MSG_WriteByte (msg, svc_playerinfo);
-	//MSG_WriteShort (msg, pflags);
-	MSG_WriteLong (msg, pflags); //Knightmare- write as long
-
-	//
-	// write the pmove_state_t
-	//
-	if (pflags & PS_M_TYPE)
-		MSG_WriteByte (msg, ps->pmove.pm_type);
-
-	if (pflags & PS_M_ORIGIN) // FIXME- map size
-	{
-#ifdef LARGE_MAP_SIZE
-		MSG_WritePMCoordNew (msg, ps->pmove.origin[0]);
-		MSG_WritePMCoordNew (msg, ps->pmove.origin[1]);
-		MSG_WritePMCoordNew (msg, ps->pmove.origin[2]);
-#else
-		MSG_WriteShort (msg, ps->pmove.origin[0]);
-		MSG_WriteShort (msg, ps->pmove.origin[1]);
-		MSG_WriteShort (msg, ps->pmove.origin[2]);
-#endif
-	}
-
-	if (pflags & PS_M_VELOCITY)
-	{
-		MSG_WriteShort (msg, ps->pmove.velocity[0]);
-		MSG_WriteShort (msg, ps->pmove.velocity[1]);
-		MSG_WriteShort (msg, ps->pmove.velocity[2]);
-	}
-
-	if (pflags & PS_M_TIME)
-		MSG_WriteByte (msg, ps->pmove.pm_time);
-
-	if (pflags & PS_M_FLAGS)
-		MSG_WriteByte (msg, ps->pmove.pm_flags);
-
-	if (pflags & PS_M_GRAVITY)
-		MSG_WriteShort (msg, ps->pmove.gravity);
-
-	if (pflags & PS_M_DELTA_ANGLES)
-	{
-		MSG_WriteShort (msg, ps->pmove.delta_angles[0]);
-		MSG_WriteShort (msg, ps->pmove.delta_angles[1]);
-		MSG_WriteShort (msg, ps->pmove.delta_angles[2]);
-	}
-
-	//
-	// write the rest of the player_state_t
-	//
-	if (pflags & PS_VIEWOFFSET)
-	{
-		MSG_WriteChar (msg, ps->viewoffset[0]*4);
-		MSG_WriteChar (msg, ps->viewoffset[1]*4);
-		MSG_WriteChar (msg, ps->viewoffset[2]*4);
-	}
-
-	if (pflags & PS_VIEWANGLES)
-	{
-		MSG_WriteAngle16 (msg, ps->viewangles[0]);
-		MSG_WriteAngle16 (msg, ps->viewangles[1]);
-		MSG_WriteAngle16 (msg, ps->viewangles[2]);
-	}
-
-	if (pflags & PS_KICKANGLES)
-	{
-		MSG_WriteChar (msg, ps->kick_angles[0]*4);
-		MSG_WriteChar (msg, ps->kick_angles[1]*4);
-		MSG_WriteChar (msg, ps->kick_angles[2]*4);
-	}
-
-	if (pflags & PS_WEAPONINDEX)	//Knightmare- 12/23/2001- send as int16_t
-		MSG_WriteShort (msg, ps->gunindex);
-
-#ifdef NEW_PLAYER_STATE_MEMBERS	//Knightmare added
-	if (pflags & PS_WEAPONINDEX2)
-		MSG_WriteShort (msg, ps->gunindex2); //Knightmare- gunindex2 support
-#endif		
-
-	if ((pflags & PS_WEAPONFRAME) || (pflags & PS_WEAPONFRAME2))
-	{
-		if (pflags & PS_WEAPONFRAME)
-			MSG_WriteByte (msg, ps->gunframe);
-
-#ifdef NEW_PLAYER_STATE_MEMBERS 	//Knightmare added
-		if (pflags & PS_WEAPONFRAME2)
-			MSG_WriteByte (msg, ps->gunframe2); //Knightmare- gunframe2 support
-#endif
-
-		MSG_WriteChar (msg, ps->gunoffset[0]*4);
-		MSG_WriteChar (msg, ps->gunoffset[1]*4);
-		MSG_WriteChar (msg, ps->gunoffset[2]*4);
-		MSG_WriteChar (msg, ps->gunangles[0]*4);
-		MSG_WriteChar (msg, ps->gunangles[1]*4);
-		MSG_WriteChar (msg, ps->gunangles[2]*4);
-	}
-
-#ifdef NEW_PLAYER_STATE_MEMBERS //Knightmare added
-	if (pflags & PS_WEAPONSKIN)
-		MSG_WriteShort (msg, ps->gunskin);
-
-	if (pflags & PS_WEAPONSKIN2)
-		MSG_WriteShort (msg, ps->gunskin2);
-
-	// server-side speed control!
-	if (pflags & PS_MAXSPEED)
-		MSG_WriteShort (msg, ps->maxspeed);
-
-	if (pflags & PS_DUCKSPEED)
-		MSG_WriteShort (msg, ps->duckspeed);
-
-	if (pflags & PS_WATERSPEED)
-		MSG_WriteShort (msg, ps->waterspeed);
-
-	if (pflags & PS_ACCEL)
-		MSG_WriteShort (msg, ps->accel);
-
-	if (pflags & PS_STOPSPEED)
-		MSG_WriteShort (msg, ps->stopspeed);
-#endif	//end Knightmare
-
-	if (pflags & PS_BLEND)
-	{
-		MSG_WriteByte (msg, ps->blend[0]*255);
-		MSG_WriteByte (msg, ps->blend[1]*255);
-		MSG_WriteByte (msg, ps->blend[2]*255);
-		MSG_WriteByte (msg, ps->blend[3]*255);
-	}
-	if (pflags & PS_FOV)
-		MSG_WriteByte (msg, ps->fov);
-	if (pflags & PS_RDFLAGS)
-		MSG_WriteByte (msg, ps->rdflags);
-
-	// send stats
-	statbits = 0;
-	for (i=0 ; i<MAX_STATS ; i++)
-		if (ps->stats[i] != ops->stats[i])
-			statbits |= 1<<i;
-	MSG_WriteLong (msg, statbits);
-	for (i=0 ; i<MAX_STATS ; i++)
-		if (statbits & (1<<i) )
-			MSG_WriteShort (msg, ps->stats[i]);
+	MSG_WriteDeltaPlayerstate (from ? &from->ps : NULL, &to->ps, msg);
 }
 
 
@@ -485,6 +530,9 @@ void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
 {
 	client_frame_t		*frame, *oldframe;
 	int32_t					lastframe;
+	netstats_t			*stats = &client->netstats;
+	int32_t					start;
+	int32_t					budget;
 
 	//Com_Printf ("%i -> %i\n", client->lastframe, sv.framenum);
 	// this is the frame we are creating
@@ -518,10 +566,28 @@ void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
 	SZ_Write (msg, frame->areabits, frame->areabytes);
 
 	// delta encode the playerstate
+	start = msg->cursize;
 	SV_WritePlayerstateToClient (oldframe, frame, msg);
+	stats->playerstate = msg->cursize - start;
+
+	// whatever the rate leaves once the header, playerstate, multicast
+	// datagram and packetentities framing are in goes to the entities
+	budget = SV_FrameBudget (client);
+	if (budget >= 0)
+	{
+		if (budget > msg->maxsize - PACKET_HEADER - client->netchan.message.cursize)
+			budget = msg->maxsize - PACKET_HEADER - client->netchan.message.cursize;
+		budget -= msg->cursize + client->datagram.cursize + 3;
+		if (budget < 0)
+			budget = 0;
+	}
 
 	// delta encode the entities
-	SV_EmitPacketEntities (oldframe, frame, msg);
+	start = msg->cursize;
+	SV_EmitPacketEntities (client, oldframe, frame, msg, stats, budget);
+	stats->entitybytes = msg->cursize - start;
+	stats->entities = frame->num_entities;
+	stats->nodelta = !oldframe;
 }
 
 
@@ -533,7 +599,10 @@ Build a client frame structure
 =============================================================================
 */
 
-byte		fatpvs[65536/8];	// 32767 is MAX_MAP_LEAFS
+// beams are checked against the PHS instead of the PVS, so they can't
+// be found through the cluster index, see SV_PrepClientFrames
+static int32_t	sv_beams[MAX_EDICTS];
+static int32_t	sv_numbeams;
 
 /*
 ============
@@ -543,42 +612,11 @@ The client will interpolate the view position,
 so we can't use a single PVS point
 ===========
 */
-void SV_FatPVS (vec3_t org)
+void SV_FatPVS (vec3_t org, byte *fatpvs)
 {
-	int32_t		leafs[64];
-	int32_t		i, j, count;
-	int32_t		longs;
-	byte	*src;
-	vec3_t	mins, maxs;
-
-	for (i=0 ; i<3 ; i++)
-	{
-		mins[i] = org[i] - 8;
-		maxs[i] = org[i] + 8;
-	}
-
-	count = CM_BoxLeafnums (mins, maxs, leafs, 64, NULL);
-	if (count < 1)
-		Com_Error (ERR_FATAL, "SV_FatPVS: count < 1");
-	longs = (CM_NumClusters()+31)>>5;
-
-	// convert leafs to clusters
-	for (i=0 ; i<count ; i++)
-		leafs[i] = CM_LeafCluster(leafs[i]);
-
-	memcpy (fatpvs, CM_ClusterPVS(leafs[0]), longs<<2);
-	// or in all the other leaf bits
-	for (i=1 ; i<count ; i++)
-	{
-		for (j=0 ; j<i ; j++)
-			if (leafs[i] == leafs[j])
-				break;
-		if (j != i)
-			continue;		// already have the cluster we want
-		src = CM_ClusterPVS(leafs[i]);
-		for (j=0 ; j<longs ; j++)
-			((int32_t *)fatpvs)[j] |= ((int32_t *)src)[j];
-	}
+	// or in the bits of every leaf within 8 units, memoized by origin
+	// and by cluster set
+	CM_FatPVSRow (org, fatpvs);
 }
 
 
@@ -588,6 +626,10 @@ SV_BuildClientFrame
 
 Decides which entities are going to be visible to the client, and
 copies off the playerstat and areabits.
+
+Frames for several clients may be built at once by the worker pool,
+so everything here is either read-only or private to this client.
+SV_PrepClientFrames has to run first.
 =============
 */
 void SV_BuildClientFrame (client_t *client)
@@ -602,8 +644,12 @@ void SV_BuildClientFrame (client_t *client)
 	int32_t		clientarea, clientcluster;
 	int32_t		leafnum;
 	int32_t		c_fullsend;
-	byte	*clientphs;
+	byte	fatpvs[65536/8];	// 32767 is MAX_MAP_LEAFS
+	byte	clientphs[MAX_MAP_LEAFS/8];
 	byte	*bitvector;
+	int32_t		visible[MAX_EDICTS];
+	int32_t		num_visible;
+	byte	edictbits[MAX_EDICTS/8];
 
 	clent = client->edict;
 	if (!clent->client)
@@ -617,6 +663,7 @@ void SV_BuildClientFrame (client_t *client)
 	frame = &client->frames[sv.framenum & UPDATE_MASK];
 
 	frame->senttime = svs.realtime; // save it for ping calc later
+	frame->framenum = sv.framenum;
 
 	// find the client's PVS
 	for (i=0 ; i<3 ; i++)
@@ -633,17 +680,33 @@ void SV_BuildClientFrame (client_t *client)
 	frame->ps = clent->client->ps;
 
 
-	SV_FatPVS (org);
-	clientphs = CM_ClusterPHS (clientcluster);
+	SV_FatPVS (org, fatpvs);
+	CM_ClusterPHSRow (clientcluster, clientphs);
+
+	// only look at entities in a visible cluster, plus the ones
+	// that can't be found that way
+	memset (edictbits, 0, sizeof(edictbits));
+	SV_MarkClusterEdicts (fatpvs, edictbits);
+	for (i=0 ; i<sv_numbeams ; i++)
+		VIS_SET(edictbits, sv_beams[i]);
+	e = NUM_FOR_EDICT(clent);
+	VIS_SET(edictbits, e);
 
 	// build up the list of visible entities
-	frame->num_entities = 0;
-	frame->first_entity = svs.next_client_entities;
+	num_visible = 0;
 
 	c_fullsend = 0;
 
 	for (e=1 ; e<ge->num_edicts ; e++)
 	{
+		if (!edictbits[e>>3])
+		{
+			e |= 7;		// skip the rest of this byte
+			continue;
+		}
+		if (!VIS_TEST(edictbits, e))
+			continue;
+
 		ent = EDICT_NUM(e);
 
 		// ignore ents without visible models
@@ -671,7 +734,7 @@ void SV_BuildClientFrame (client_t *client)
 			if (ent->s.renderfx & RF_BEAM)
 			{
 				l = ent->clusternums[0];
-				if ( !(clientphs[l >> 3] & (1 << (l&7) )) )
+				if (!VIS_TEST(clientphs, l))
 					continue;
 			}
 			else
@@ -696,7 +759,7 @@ void SV_BuildClientFrame (client_t *client)
 					for (i=0 ; i < ent->num_clusters ; i++)
 					{
 						l = ent->clusternums[i];
-						if (bitvector[l >> 3] & (1 << (l&7) ))
+						if (VIS_TEST(bitvector, l))
 							break;
 					}
 					if (i == ent->num_clusters)
@@ -728,25 +791,98 @@ void SV_BuildClientFrame (client_t *client)
 			continue; // added as a special projectile
 #endif
 
-		// add it to the circular client_entities array
-		state = &svs.client_entities[svs.next_client_entities%svs.num_client_entities];
-		if (ent->s.number != e)
-		{
-			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
-			ent->s.number = e;
-		}
+		visible[num_visible++] = e;
+	}
+
+	// reserve our range of the circular client_entities array, other
+	// clients may be doing the same on another thread
+	frame->num_entities = num_visible;
+	frame->first_entity = System::Threads::FetchAdd (&svs.next_client_entities, num_visible);
+
+	for (i=0 ; i<num_visible ; i++)
+	{
+		ent = EDICT_NUM(visible[i]);
+		state = &svs.client_entities[(frame->first_entity+i)%svs.num_client_entities];
 		*state = ent->s;
 
 		// don't mark players missiles as solid
 		if (ent->owner == client->edict)
 			state->solid = 0;
+	}
+}
+
+
+/*
+=============
+SV_PrepClientFrames
+
+Serial fixups that SV_BuildClientFrame used to make on the fly,
+done once up front so frames can be built in parallel.  Also
+collects the beams for this frame.
+=============
+*/
+void SV_PrepClientFrames (void)
+{
+	int32_t		e;
+	edict_t	*ent;
 
-		svs.next_client_entities++;
-		frame->num_entities++;
+	sv_numbeams = 0;
+	for (e=1 ; e<ge->num_edicts ; e++)
+	{
+		ent = EDICT_NUM(e);
+
+		if (ent->svflags & SVF_NOCLIENT)
+			continue;
+		if (!ent->s.modelindex && !ent->s.effects && !ent->s.sound
+			&& !ent->s.event)
+			continue;
+
+		if (ent->s.number != e)
+		{
+			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
+			ent->s.number = e;
+		}
+
+		if (ent->s.renderfx & RF_BEAM)
+			sv_beams[sv_numbeams++] = e;
 	}
 }
 
 
+/*
+==================
+SV_RecordDemoKeyframe
+
+Every serverrecord frame already has all the entities, so a keyframe
+only has to bring the configstrings back to this point
+==================
+*/
+static void SV_RecordDemoKeyframe (void)
+{
+	sizebuf_t	buf;
+	byte		buf_data[32768];
+	int32_t		i;
+
+	SZ_Init (&buf, buf_data, sizeof(buf_data));
+
+	for (i=0 ; i<MAX_CONFIGSTRINGS ; i++)
+	{
+		// models, sounds and images are only ever added during a level
+		if (!sv.configstrings[i][0] && i >= CS_MODELS && i < CS_LIGHTS)
+			continue;
+
+		if (buf.cursize + (int32_t)strlen (sv.configstrings[i]) + 32 > buf.maxsize)
+			Demo_WriteKeyMessage (&svs.demoindex, &buf);
+
+		MSG_WriteByte (&buf, svc_configstring);
+		MSG_WriteShort (&buf, i);
+		MSG_WriteString (&buf, sv.configstrings[i]);
+	}
+
+	Demo_WriteKeyMessage (&svs.demoindex, &buf);
+	Demo_EndKeyframe (&svs.demoindex, Demo_WriterTell (svs.demofile));
+}
+
 /*
 ==================
 SV_RecordDemoMessage
@@ -799,7 +935,10 @@ void SV_RecordDemoMessage (void)
 
 	// now write the entire message to the file, prefixed by the length
 	len = LittleLong (buf.cursize);
-	fwrite (&len, 4, 1, svs.demofile);
-	fwrite (buf.data, buf.cursize, 1, svs.demofile);
+	Demo_Write (svs.demofile, &len, 4);
+	Demo_Write (svs.demofile, buf.data, buf.cursize);
+
+	if (Demo_KeyframeDue (&svs.demoindex, sv.framenum*100))
+		SV_RecordDemoKeyframe ();
 }
 
@@ -50,6 +50,7 @@ void PF_Unicast (edict_t *ent, qboolean reliable)
 	else
 		SZ_Write (&client->datagram, sv.multicast.data, sv.multicast.cursize);
 
+	SV_MvdUnicast (client);
 	SZ_Clear (&sv.multicast);
 }
 
@@ -251,7 +252,7 @@ qboolean PF_inPVS (vec3_t p1, vec3_t p2)
 	leafnum = CM_PointLeafnum (p2);
 	cluster = CM_LeafCluster (leafnum);
 	area2 = CM_LeafArea (leafnum);
-	if ( mask && (!(mask[cluster>>3] & (1<<(cluster&7)) ) ) )
+	if ( mask && !VIS_TEST(mask, cluster) )
 		return false;
 	if (!CM_AreasConnected (area1, area2))
 		return false;		// a door blocks sight
@@ -281,7 +282,7 @@ qboolean PF_inPHS (vec3_t p1, vec3_t p2)
 	leafnum = CM_PointLeafnum (p2);
 	cluster = CM_LeafCluster (leafnum);
 	area2 = CM_LeafArea (leafnum);
-	if ( mask && (!(mask[cluster>>3] & (1<<(cluster&7)) ) ) )
+	if ( mask && !VIS_TEST(mask, cluster) )
 		return false;		// more than one bounce away
 	if (!CM_AreasConnected (area1, area2))
 		return false;		// a door blocks hearing
@@ -346,6 +347,7 @@ void SV_InitGameProgs (void)
 	import.unlinkentity = SV_UnlinkEdict;
 	import.BoxEdicts = SV_AreaEdicts;
 	import.trace = SV_Trace;
+	import.TraceBatch = SV_TraceBatch;
 	import.pointcontents = SV_PointContents;
 	import.setmodel = PF_setmodel;
 	import.inPVS = PF_inPVS;
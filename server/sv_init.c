@@ -183,7 +183,7 @@ clients along with it.
 */
 void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate, qboolean attractloop, qboolean loadgame)
 {
-	int32_t			i;
+	int32_t			i, j;
 	uint32_t	checksum;
 	fileHandle_t	f;
 
@@ -193,8 +193,7 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
 	Com_Printf ("\n------- Server Initialization -------\n");
 
 	Com_DPrintf ("SpawnServer: %s\n",server);
-	if (sv.demofile)
-		FS_FCloseFile (sv.demofile);
+	SV_CloseDemo ();
 
 	svs.spawncount++;		// any partially connected client will be
 							// restarted
@@ -235,6 +234,10 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
 		if (svs.clients[i].state > cs_connected)
 			svs.clients[i].state = cs_connected;
 		svs.clients[i].lastframe = -1;
+
+		// keep frames of the last level from passing for this one's
+		for (j=0 ; j<UPDATE_BACKUP ; j++)
+			svs.clients[i].frames[j].framenum = -1;
 	}
 
 	sv.time = 1000;
@@ -373,6 +376,8 @@ void SV_InitGame (void)
 
 	svs.spawncount = rand();
 	svs.clients = (client_t*)Z_TagMalloc (sizeof(client_t)*maxclients->value, TAG_SERVER);
+	memset (svs.client_hash, 0, sizeof(svs.client_hash));
+	memset (svs.client_adrhash, 0, sizeof(svs.client_adrhash));
 	svs.num_client_entities = maxclients->value*UPDATE_BACKUP*64;
 	svs.client_entities = (entity_state_t*)Z_TagMalloc (sizeof(entity_state_t)*svs.num_client_entities, TAG_SERVER);
 
@@ -405,7 +410,7 @@ SV_Map
   map [*]<map>$<startspot>+<nextserver>
 
 command from the console or progs.
-Map can also be a.cin, .pcx, or .dm2 file
+Map can also be a.cin, .pcx, .dm2, .dm2.gz, .mvd2 or .mvd2.gz file
 Nextserver is used to allow a cinematic to play, then proceed to
 another level:
 
@@ -469,7 +474,8 @@ void SV_Map (qboolean attractloop, char *levelstring, qboolean loadgame)
 		SV_BroadcastCommand ("changing\n");
 		SV_SpawnServer (level, spawnpoint, ss_cinematic, attractloop, loadgame);
 	}
-	else if (l > 4 && !strcmp (level+l-4, ".dm2") )
+	else if ((l > 4 && !strcmp (level+l-4, ".dm2")) || (l > 7 && !strcmp (level+l-7, ".dm2.gz"))
+		|| (l > 5 && !strcmp (level+l-5, ".mvd2")) || (l > 8 && !strcmp (level+l-8, ".mvd2.gz")))
 	{
 		if (!dedicated->value)
 			SCR_BeginLoadingPlaque ();			// for local system
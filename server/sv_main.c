@@ -19,6 +19,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "../../Source/GameEngine.h"
+#include "../../Source/SystemThreads.h"
 
 #include "server.h"
 
@@ -30,6 +31,9 @@ cvar_t	*sv_paused;
 cvar_t	*sv_timedemo;
 
 cvar_t	*sv_enforcetime;
+cvar_t	*sv_threads;
+cvar_t	*sv_tracecache;
+cvar_t	*sv_entitypriority;
 
 cvar_t	*timeout;				// seconds without any message
 cvar_t	*zombietime;			// seconds to sink messages after disconnect
@@ -37,6 +41,8 @@ cvar_t	*zombietime;			// seconds to sink messages after disconnect
 cvar_t	*rcon_password;			// password for remote server commands
 
 cvar_t	*allow_download;
+cvar_t	*sv_download_window;
+cvar_t	*sv_download_rate;		// bytes per second for each client's downloads, 0 for no limit
 cvar_t	*allow_download_players;
 cvar_t	*allow_download_models;
 cvar_t	*allow_download_sounds;
@@ -89,11 +95,7 @@ void SV_DropClient (client_t *drop)
 		ge->ClientDisconnect (drop->edict);
 	}
 
-	if (drop->download)
-	{
-		FS_FreeFile (drop->download);
-		drop->download = NULL;
-	}
+	SV_EndDownload (drop);
 
 	// r1ch: fix for mods that don't clean score
 	if (drop->edict && drop->edict->client)
@@ -105,6 +107,125 @@ void SV_DropClient (client_t *drop)
 
 
 //Knightmare added
+/*
+=====================
+SV_AdrHash
+
+Only the base address goes in, translating routers change the port.
+=====================
+*/
+static uint32_t SV_AdrHash (netadr_t *adr)
+{
+	uint32_t	h;
+	int32_t		i;
+
+	switch (adr->type)
+	{
+	case NA_IP:
+		h = adr->ip[0] | (adr->ip[1]<<8) | (adr->ip[2]<<16) | ((uint32_t)adr->ip[3]<<24);
+		break;
+	case NA_IPX:
+		for (i=0, h=0 ; i<10 ; i++)
+			h = h*31 + adr->ipx[i];
+		break;
+	default:
+		h = 0;
+		break;
+	}
+
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return h;
+}
+
+static client_t **SV_ClientHashBucket (netadr_t *adr, int32_t qport)
+{
+	uint32_t	h = SV_AdrHash (adr) ^ ((uint32_t)qport * 0x9e3779b1);
+
+	return &svs.client_hash[(h ^ (h >> 16)) & (CLIENT_HASH_SIZE-1)];
+}
+
+static client_t **SV_ClientAdrBucket (netadr_t *adr)
+{
+	return &svs.client_adrhash[SV_AdrHash (adr) & (CLIENT_HASH_SIZE-1)];
+}
+
+/*
+=====================
+SV_HashClient
+
+Called once the netchan is set up.  The translated port fixup in
+SV_ReadPackets only changes the port, which isn't part of either key.
+=====================
+*/
+void SV_HashClient (client_t *cl)
+{
+	client_t	**bucket;
+
+	SV_UnhashClient (cl);
+
+	bucket = SV_ClientHashBucket (&cl->netchan.remote_address, cl->netchan.qport);
+	cl->hashnext = *bucket;
+	*bucket = cl;
+
+	bucket = SV_ClientAdrBucket (&cl->netchan.remote_address);
+	cl->adrnext = *bucket;
+	*bucket = cl;
+}
+
+/*
+=====================
+SV_UnhashClient
+
+Called whenever a slot goes back to cs_free, safe on unhashed slots.
+=====================
+*/
+void SV_UnhashClient (client_t *cl)
+{
+	client_t	**link;
+
+	for (link = SV_ClientHashBucket (&cl->netchan.remote_address, cl->netchan.qport) ; *link ; link = &(*link)->hashnext)
+	{
+		if (*link == cl)
+		{
+			*link = cl->hashnext;
+			break;
+		}
+	}
+
+	for (link = SV_ClientAdrBucket (&cl->netchan.remote_address) ; *link ; link = &(*link)->adrnext)
+	{
+		if (*link == cl)
+		{
+			*link = cl->adrnext;
+			break;
+		}
+	}
+
+	cl->hashnext = cl->adrnext = NULL;
+}
+
+/*
+=====================
+SV_ClientForPacket
+
+The connected or zombie client a sequenced packet belongs to.
+=====================
+*/
+client_t *SV_ClientForPacket (netadr_t adr, int32_t qport)
+{
+	client_t	*cl;
+
+	for (cl = *SV_ClientHashBucket (&adr, qport) ; cl ; cl = cl->hashnext)
+	{
+		if (cl->netchan.qport == qport && NET_CompareBaseAdr (adr, cl->netchan.remote_address))
+			return cl;
+	}
+
+	return NULL;
+}
+
 /*
 =====================
 GetClientFromAdr
@@ -115,19 +236,15 @@ Given an netadr_t, returns the matching client.
 client_t *GetClientFromAdr (netadr_t address)
 {
 	client_t	*cl;
-	int32_t			i;
-	qboolean	found = false;
 
-	for (i = 0; i < maxclients->value; i++)
+	for (cl = *SV_ClientAdrBucket (&address) ; cl ; cl = cl->adrnext)
 	{
-		cl = &svs.clients[i];
-		if (NET_CompareBaseAdr(cl->netchan.remote_address, address)) {
-			found = true; break; }
+		if (NET_CompareBaseAdr (cl->netchan.remote_address, address))
+			return cl;
 	}
-	if (found)
-		return cl;
-	else // don't return non-matching client
-		return NULL;
+
+	// don't return non-matching client
+	return NULL;
 }
 
 
@@ -149,6 +266,7 @@ void SV_DropClientFromAdr (netadr_t address)
 	SV_DropClient (drop);
 
 	drop->state = cs_free;   // don't bother with zombie state 
+	SV_UnhashClient (drop);
 }
 // end Knightmare
 
@@ -180,11 +298,7 @@ r1ch: this does the final cleaning up of a client after zombie state.
 */
 void SV_CleanClient (client_t *drop)
 {
-	if (drop->download)
-	{
-		Z_Free (drop->download);
-		drop->download = NULL;
-	}
+	SV_EndDownload (drop);
 }
 
 /*
@@ -376,6 +490,7 @@ void SVC_DirectConnect (void)
 	int32_t			qport;
 	int32_t			challenge;
 	int32_t			previousclients;	// rich: connection limit per IP
+	int32_t			fragment_size;
 
 	adr = net_from;
 
@@ -512,6 +627,8 @@ gotnewcl:
 	// build a new connection
 	// accept the new client
 	// this is the only place a client_t is ever initialized
+	SV_UnhashClient (newcl);
+	SV_EndDownload (newcl);		// whatever the slot still holds goes with it
 	*newcl = temp;
 	sv_client = newcl;
 	edictnum = (newcl-svs.clients)+1;
@@ -535,12 +652,21 @@ gotnewcl:
 	strncpy (newcl->userinfo, userinfo, sizeof(newcl->userinfo)-1);
 	SV_UserinfoChanged (newcl);
 
+	// clients that can fragment put their net_mtu after the userinfo
+	fragment_size = NET_IsLocalAddress (adr) ? 0 : Netchan_FragmentSize (atoi (Cmd_Argv(5)));
+
 	// send the connect packet to the client
-	Netchan_OutOfBandPrint (NS_SERVER, adr, "client_connect");
+	if (fragment_size)
+		Netchan_OutOfBandPrint (NS_SERVER, adr, "client_connect %i", fragment_size);
+	else
+		Netchan_OutOfBandPrint (NS_SERVER, adr, "client_connect");
 
 	Netchan_Setup (NS_SERVER, &newcl->netchan , adr, qport);
+	newcl->netchan.fragment_size = fragment_size;
 
 	newcl->state = cs_connected;
+	SV_HashClient (newcl);
+	SV_MulticastClientsChanged ();
 	
 	SZ_Init (&newcl->datagram, newcl->datagram_buf, sizeof(newcl->datagram_buf) );
 	newcl->datagram.allowoverflow = true;
@@ -748,14 +874,113 @@ void SV_GiveMsec (void)
 }
 
 
+/*
+=================
+SV_ParseClientMessageJob
+=================
+*/
+static void SV_ParseClientMessageJob (int32_t index, void *data)
+{
+	SV_ParseClientMessage ((clientpacket_t *)data + index);
+}
+
+/*
+=================
+SV_FlushClientPackets
+
+Parses every queued packet at once, then executes them a client at a
+time in client number order, each client's packets in arrival order.
+=================
+*/
+void SV_FlushClientPackets (void)
+{
+	clientpacket_t	*first[MAX_CLIENTS], *last[MAX_CLIENTS];
+	clientpacket_t	*packet;
+	client_t	*cl;
+	int32_t		i, count;
+
+	count = svs.numpackets;
+	if (!count)
+		return;
+
+	// empty before executing, a command may drop the server
+	svs.numpackets = 0;
+	svs.packet_bytes = 0;
+
+	System::Threads::ParallelFor (count, SV_ParseClientMessageJob, svs.packets);
+
+	memset (first, 0, sizeof(first));
+	for (i=0, packet=svs.packets ; i<count ; i++, packet++)
+	{
+		cl = packet->client;
+		packet->next = NULL;
+		if (first[cl - svs.clients])
+			last[cl - svs.clients]->next = packet;
+		else
+			first[cl - svs.clients] = packet;
+		last[cl - svs.clients] = packet;
+	}
+
+	for (i=0, cl=svs.clients ; i<maxclients->value ; i++, cl++)
+	{
+		for (packet=first[i] ; packet ; packet=packet->next)
+		{
+			// an earlier command may have dropped this client
+			if (cl->state == cs_free || cl->state == cs_zombie)
+				break;
+			SV_ExecuteClientMessage (packet);
+		}
+	}
+}
+
+/*
+=================
+SV_QueueClientPacket
+
+Copies the rest of net_message for SV_FlushClientPackets
+=================
+*/
+void SV_QueueClientPacket (client_t *cl)
+{
+	clientpacket_t	*packet;
+	int32_t		length;
+
+	length = net_message.cursize - net_message.readcount;
+	if (length < 0)
+		length = 0;
+
+	if (!svs.packets)
+	{
+		svs.packets = (clientpacket_t*)Z_TagMalloc (MAX_QUEUED_PACKETS*sizeof(clientpacket_t), TAG_SERVER);
+		svs.packet_buf = (byte*)Z_TagMalloc (PACKET_QUEUE_BYTES, TAG_SERVER);
+	}
+	if (svs.numpackets == MAX_QUEUED_PACKETS || svs.packet_bytes + 2*length + 1 > PACKET_QUEUE_BYTES)
+		SV_FlushClientPackets ();
+
+	packet = &svs.packets[svs.numpackets++];
+	packet->client = cl;
+	packet->sequence = cl->netchan.incoming_sequence;
+	packet->dropped = cl->netchan.dropped;
+	packet->length = length;
+
+	// the strings never take more room than the data they came from
+	packet->data = svs.packet_buf + svs.packet_bytes;
+	packet->text = (char *)packet->data + length;
+	svs.packet_bytes += 2*length + 1;
+	memcpy (packet->data, net_message.data + net_message.readcount, length);
+}
+
 /*
 =================
 SV_ReadPackets
+
+Packets from connected clients are queued and parsed together, anything
+connectionless runs at once, after the queue is flushed so connects and
+drops still happen in arrival order.
 =================
 */
 void SV_ReadPackets (void)
 {
-	int32_t			i;
 	client_t	*cl;
 	int32_t			qport;
 
@@ -764,6 +989,7 @@ void SV_ReadPackets (void)
 		// check for connectionless packet (0xffffffff) first
 		if (*(int32_t *)net_message.data == -1)
 		{
+			SV_FlushClientPackets ();
 			SV_ConnectionlessPacket ();
 			continue;
 		}
@@ -776,14 +1002,9 @@ void SV_ReadPackets (void)
 		qport = MSG_ReadShort (&net_message) & 0xffff;
 
 		// check for packets from connected clients
-		for (i=0, cl=svs.clients ; i<maxclients->value ; i++,cl++)
+		cl = SV_ClientForPacket (net_from, qport);
+		if (cl)
 		{
-			if (cl->state == cs_free)
-				continue;
-			if (!NET_CompareBaseAdr (net_from, cl->netchan.remote_address))
-				continue;
-			if (cl->netchan.qport != qport)
-				continue;
 			if (cl->netchan.remote_address.port != net_from.port)
 			{
 				Com_Printf ("SV_ReadPackets: fixing up a translated port\n");
@@ -795,15 +1016,13 @@ void SV_ReadPackets (void)
 				if (cl->state != cs_zombie)
 				{
 					cl->lastmessage = svs.realtime;	// don't timeout
-					SV_ExecuteClientMessage (cl);
+					SV_QueueClientPacket (cl);
 				}
 			}
-			break;
 		}
-		
-		if (i != maxclients->value)
-			continue;
 	}
+
+	SV_FlushClientPackets ();
 }
 
 /*
@@ -840,6 +1059,7 @@ void SV_CheckTimeouts (void)
 		{
 			SV_CleanClient (cl); // r1ch fix: make sure client is cleaned up
 			cl->state = cs_free;	// can now be reused
+			SV_UnhashClient (cl);
 			continue;
 		}
 		if ( (cl->state == cs_connected || cl->state == cs_spawned) 
@@ -850,6 +1070,7 @@ void SV_CheckTimeouts (void)
 				SV_BroadcastPrintf (PRINT_HIGH, "%s timed out\n", cl->name);
 			SV_DropClient (cl); 
 			cl->state = cs_free;	// don't bother with zombie state
+			SV_UnhashClient (cl);
 		}
 	}
 }
@@ -884,6 +1105,8 @@ SV_RunGameFrame
 */
 void SV_RunGameFrame (void)
 {
+	int32_t		i;
+
 	if (host_speeds->value)
 		time_before_game = Sys_Milliseconds ();
 
@@ -894,6 +1117,15 @@ void SV_RunGameFrame (void)
 	sv.framenum++;
 	sv.time = sv.framenum*100;
 
+	// new slots for rate estimation, whatever goes out this frame adds to them
+	for (i=0 ; i<maxclients->value ; i++)
+	{
+		svs.clients[i].message_size[sv.framenum % RATE_MESSAGES] = 0;
+		svs.clients[i].download_size[sv.framenum % RATE_MESSAGES] = 0;
+	}
+
+	SV_TraceMemoFrame ();
+
 	// don't run if paused
 	if (!sv_paused->value || maxclients->value > 1)
 	{
@@ -921,6 +1153,8 @@ SV_Frame
 */
 void SV_Frame (int32_t msec)
 {
+	uint64_t	framestart, start;
+
 	time_before_game = time_after_game = 0;
 
 	// if server is not active, do nothing
@@ -932,11 +1166,15 @@ void SV_Frame (int32_t msec)
 	// keep the random time dependent
 	rand ();
 
+	framestart = SV_ProfileBegin ();
+
 	// check timeouts
 	SV_CheckTimeouts ();
 
 	// get packets from clients
+	start = SV_ProfileBegin ();
 	SV_ReadPackets ();
+	SV_ProfileEnd (PROF_READPACKETS, start);
 
 	// move autonomous things around if enough time has passed
 	if (!sv_timedemo->value && svs.realtime < sv.time)
@@ -959,13 +1197,16 @@ void SV_Frame (int32_t msec)
 	SV_GiveMsec ();
 
 	// let everything in the world think and move
+	start = SV_ProfileBegin ();
 	SV_RunGameFrame ();
+	SV_ProfileEnd (PROF_GAMEFRAME, start);
 
 	// send messages back to the clients that had packets read this frame
 	SV_SendClientMessages ();
 
 	// save the entire world state if recording a serverdemo
 	SV_RecordDemoMessage ();
+	SV_MvdRecordFrame ();
 
 	// send a heartbeat to the master if needed
 	Master_Heartbeat ();
@@ -973,6 +1214,8 @@ void SV_Frame (int32_t msec)
 	// clear teleport flags, etc for next frame
 	SV_PrepWorldFrame ();
 
+	SV_ProfileEnd (PROF_FRAME, framestart);
+
 }
 
 //============================================================================
@@ -1138,7 +1381,12 @@ void SV_Init (void)
 	sv_paused = Cvar_Get ("paused", "0", 0);
 	sv_timedemo = Cvar_Get ("timedemo", "0", 0);
 	sv_enforcetime = Cvar_Get ("sv_enforcetime", "0", 0);
+	sv_threads = Cvar_Get ("sv_threads", "0", CVAR_ARCHIVE);
+	sv_tracecache = Cvar_Get ("sv_tracecache", "0", 0);
+	sv_entitypriority = Cvar_Get ("sv_entitypriority", "0", CVAR_ARCHIVE);
 	allow_download = Cvar_Get ("allow_download", "1", CVAR_ARCHIVE);
+	sv_download_window = Cvar_Get ("sv_download_window", "64", CVAR_ARCHIVE);
+	sv_download_rate = Cvar_Get ("sv_download_rate", "100000", CVAR_ARCHIVE);
 	allow_download_players  = Cvar_Get ("allow_download_players", "0", CVAR_ARCHIVE);
 	allow_download_models = Cvar_Get ("allow_download_models", "1", CVAR_ARCHIVE);
 	allow_download_sounds = Cvar_Get ("allow_download_sounds", "1", CVAR_ARCHIVE);
@@ -1216,6 +1464,11 @@ before Sys_Quit or Sys_Error
 */
 void SV_Shutdown (char *finalmsg, qboolean reconnect)
 {
+	int32_t		i;
+
+	// a Com_Error in the middle of SV_SendClientMessages leaves sends held
+	NET_FlushBatch (NS_SERVER);
+
 	if (svs.clients)
 		SV_FinalMessage (finalmsg, reconnect);
 
@@ -1223,18 +1476,29 @@ void SV_Shutdown (char *finalmsg, qboolean reconnect)
 	SV_ShutdownGameProgs ();
 
 	// free current level
-	if (sv.demofile)
-		FS_FCloseFile (sv.demofile);
+	SV_CloseDemo ();
 	memset (&sv, 0, sizeof(sv));
 	Com_SetServerState (sv.state);
 
 	// free server static data
 	if (svs.clients)
+	{
+		for (i=0 ; i<maxclients->value ; i++)
+			SV_EndDownload (&svs.clients[i]);
 		Z_Free (svs.clients);
+	}
 	if (svs.client_entities)
 		Z_Free (svs.client_entities);
+	if (svs.frame_msg_buf)
+		Z_Free (svs.frame_msg_buf);
+	if (svs.packets)
+		Z_Free (svs.packets);
+	if (svs.packet_buf)
+		Z_Free (svs.packet_buf);
 	if (svs.demofile)
-		fclose (svs.demofile);
+		SV_ServerStop_f ();
+	SV_MvdShutdown ();
+	SV_NetstatsShutdown ();
 	memset (&svs, 0, sizeof(svs));
 }
 
@@ -0,0 +1,1124 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_mvd.c -- multiview server demos
+
+#include "server.h"
+
+/*
+===============================================================================
+
+A multiview demo (.mvd2) is made from the frames the clients were just
+sent.  Every entity any player could see goes in once, delta compressed
+against the last frame of the demo, and each player only adds what
+changed of its own view: the playerstate delta, the areabits and the
+entities that came into or went out of its sight.  Multicasts, and what
+was unicast or printed to a single player, go in as they happen.
+
+Played with map or demomap, the demo server turns the stream back into a
+client demo seen through the eyes of one player, and mvd_pov switches
+to another.
+
+The file is the usual run of length prefixed messages ended by -1, each
+message a run of
+
+	mvd_serverdata		MVD_ID, protocol, spawncount, gamedir, maxclients
+	mvd_configstring	index, string
+	mvd_baseline		entity delta from a cleared state
+	mvd_multicast		length, data sent to every player
+	mvd_unicast			client, length, data sent to that client alone
+	mvd_player			client, MVDP_* bits, [areabytes, areabits],
+						[playerstate delta], [entity numbers toggling
+						in or out of sight, ended by 0]
+	mvd_frame			framenum, entity deltas ended by 0
+
+where a frame's mvd_player ops come before its mvd_frame, which ends it.
+
+===============================================================================
+*/
+
+#define	MVD_ID			(('2'<<24)+('D'<<16)+('V'<<8)+'M')	// "MVD2"
+#define	MVD_MSGLEN		0x40000		// holds the biggest frame a level can make
+#define	MVD_OPLEN		0x4000		// anything but a frame or a game message fits
+
+typedef enum
+{
+	mvd_bad,
+	mvd_serverdata,
+	mvd_configstring,
+	mvd_baseline,
+	mvd_multicast,
+	mvd_unicast,
+	mvd_player,
+	mvd_frame
+} mvdop_t;
+
+// mvd_player bits
+#define	MVDP_GONE			1		// out of the game, nothing else follows
+#define	MVDP_AREABITS		2
+#define	MVDP_PLAYERSTATE	4
+#define	MVDP_VISIBLE		8
+
+typedef struct
+{
+	qboolean		active;
+	int32_t			areabytes;
+	byte			areabits[MAX_MAP_AREAS/8];
+	player_state_t	ps;
+	byte			visible[MAX_EDICTS/8];	// entities in its own frame
+} mvdplayer_t;
+
+// the world as the last frame of the demo left it
+typedef struct
+{
+	int32_t			framenum;
+	entity_state_t	entities[MAX_EDICTS];	// by number
+	byte			present[MAX_EDICTS/8];	// seen by any player
+	mvdplayer_t		players[MAX_CLIENTS];
+} mvdframe_t;
+
+typedef struct
+{
+	demowriter_t	*file;
+	char			name[MAX_OSPATH];
+	int32_t			spawncount;		// level the last gamestate was written for
+	int32_t			frames;
+	sizebuf_t		buf;
+	byte			buf_data[MVD_MSGLEN];
+	mvdframe_t		frame;
+} mvdrecord_t;
+
+typedef struct
+{
+	sizebuf_t		msg;			// being parsed
+	byte			msg_data[MVD_MSGLEN];
+
+	int32_t			spawncount;
+	int32_t			maxclients;
+	char			gamedir[MAX_QPATH];
+	mvdframe_t		frame;
+	qboolean		framepending;	// read, but not sent yet
+
+	// what goes out with the next frame
+	sizebuf_t		datagram;
+	byte			datagram_buf[MAX_MSGLEN];
+
+	// what the viewer has
+	int32_t			pov;			// player seen through, -1 if the demo has none
+	int32_t			gamestate;		// next configstring or baseline to send, -1 once sent
+	int32_t			lastframe;		// -1 to send the next frame uncompressed
+	player_state_t	lastps;
+	entity_state_t	sent[MAX_EDICTS];
+	byte			sentbits[MAX_EDICTS/8];
+} mvdplay_t;
+
+static mvdrecord_t	*sv_mvdrecord;
+static mvdplay_t	*sv_mvdplay;
+static int32_t		sv_mvdpov = -1;	// player asked for with mvd_pov, kept across restarts
+
+/*
+===============================================================================
+
+RECORDING
+
+===============================================================================
+*/
+
+/*
+=================
+SV_MvdFlush
+=================
+*/
+static void SV_MvdFlush (void)
+{
+	mvdrecord_t	*rec = sv_mvdrecord;
+	int32_t		len;
+
+	if (!rec->buf.cursize)
+		return;
+
+	len = LittleLong (rec->buf.cursize);
+	Demo_Write (rec->file, &len, 4);
+	Demo_Write (rec->file, rec->buf.data, rec->buf.cursize);
+	SZ_Clear (&rec->buf);
+}
+
+/*
+=================
+SV_MvdSpace
+
+The message buffer, flushed first if size bytes wouldn't fit
+=================
+*/
+static sizebuf_t *SV_MvdSpace (int32_t size)
+{
+	if (sv_mvdrecord->buf.cursize + size > sv_mvdrecord->buf.maxsize)
+		SV_MvdFlush ();
+	return &sv_mvdrecord->buf;
+}
+
+/*
+=================
+SV_MvdWriteGamestate
+
+Everything a player gets on connecting, written whenever a new level
+starts.  The frame after it goes out whole.
+=================
+*/
+static void SV_MvdWriteGamestate (void)
+{
+	mvdrecord_t	*rec = sv_mvdrecord;
+	sizebuf_t	*buf;
+	entity_state_t	nullstate;
+	int32_t		i;
+
+	buf = SV_MvdSpace (MVD_OPLEN);
+	MSG_WriteByte (buf, mvd_serverdata);
+	MSG_WriteLong (buf, MVD_ID);
+	MSG_WriteLong (buf, PROTOCOL_VERSION);
+	MSG_WriteLong (buf, svs.spawncount);
+	MSG_WriteString (buf, Cvar_VariableString ("gamedir"));
+	MSG_WriteShort (buf, (int32_t)maxclients->value);
+
+	for (i=0 ; i<MAX_CONFIGSTRINGS ; i++)
+	{
+		if (!sv.configstrings[i][0])
+			continue;
+		buf = SV_MvdSpace (MVD_OPLEN);
+		MSG_WriteByte (buf, mvd_configstring);
+		MSG_WriteShort (buf, i);
+		MSG_WriteString (buf, sv.configstrings[i]);
+	}
+
+	memset (&nullstate, 0, sizeof(nullstate));
+	for (i=1 ; i<MAX_EDICTS ; i++)
+	{
+		if (!sv.baselines[i].modelindex && !sv.baselines[i].sound && !sv.baselines[i].effects)
+			continue;
+		buf = SV_MvdSpace (MVD_OPLEN);
+		MSG_WriteByte (buf, mvd_baseline);
+		MSG_WriteDeltaEntity (&nullstate, &sv.baselines[i], buf, true, true);
+	}
+
+	memset (&rec->frame, 0, sizeof(rec->frame));
+	rec->spawncount = svs.spawncount;
+}
+
+/*
+=================
+SV_MvdRecording
+
+True if game data goes into the demo now, which starts the gamestate of
+a new level first
+=================
+*/
+static qboolean SV_MvdRecording (void)
+{
+	if (!sv_mvdrecord || sv.state != ss_game)
+		return false;
+
+	if (sv_mvdrecord->spawncount != svs.spawncount)
+		SV_MvdWriteGamestate ();
+	return true;
+}
+
+/*
+=================
+SV_MvdWriteData
+
+A game message for everyone, or for clientnum alone.  Stufftext would
+run on whoever watches the demo, reconnects and all, so it stays out.
+=================
+*/
+static void SV_MvdWriteData (int32_t clientnum, byte *data, int32_t len)
+{
+	sizebuf_t	*buf;
+
+	if (!len || data[0] == svc_stufftext || !SV_MvdRecording ())
+		return;
+
+	buf = SV_MvdSpace (len + 6);
+	if (clientnum == -1)
+		MSG_WriteByte (buf, mvd_multicast);
+	else
+	{
+		MSG_WriteByte (buf, mvd_unicast);
+		MSG_WriteByte (buf, clientnum);
+	}
+	MSG_WriteLong (buf, len);
+	SZ_Write (buf, data, len);
+}
+
+/*
+=================
+SV_MvdMulticast
+
+Called with sv.multicast about to go out
+=================
+*/
+void SV_MvdMulticast (void)
+{
+	SV_MvdWriteData (-1, sv.multicast.data, sv.multicast.cursize);
+}
+
+/*
+=================
+SV_MvdUnicast
+
+Called with sv.multicast just sent to cl alone
+=================
+*/
+void SV_MvdUnicast (client_t *cl)
+{
+	SV_MvdWriteData (cl - svs.clients, sv.multicast.data, sv.multicast.cursize);
+}
+
+/*
+=================
+SV_MvdPrint
+
+A print to cl, or to everyone if cl is NULL
+=================
+*/
+void SV_MvdPrint (client_t *cl, int32_t level, char *string)
+{
+	sizebuf_t	msg;
+	byte		msg_buf[2048+8];
+
+	if (!sv_mvdrecord)
+		return;
+
+	SZ_Init (&msg, msg_buf, sizeof(msg_buf));
+	MSG_WriteByte (&msg, svc_print);
+	MSG_WriteByte (&msg, level);
+	MSG_WriteString (&msg, string);
+
+	SV_MvdWriteData (cl ? cl - svs.clients : -1, msg.data, msg.cursize);
+}
+
+/*
+=================
+SV_MvdWritePlayer
+
+Only what changed since the player's last frame in the demo, and
+nothing at all if that is nothing
+=================
+*/
+static void SV_MvdWritePlayer (int32_t clientnum, client_frame_t *frame, byte *visible)
+{
+	mvdplayer_t	*player = &sv_mvdrecord->frame.players[clientnum];
+	sizebuf_t	*buf;
+	int32_t		bits, e;
+
+	bits = 0;
+	if (frame->areabytes != player->areabytes || memcmp (frame->areabits, player->areabits, frame->areabytes))
+		bits |= MVDP_AREABITS;
+	if (memcmp (&frame->ps, &player->ps, sizeof(player_state_t)))
+		bits |= MVDP_PLAYERSTATE;
+	if (memcmp (visible, player->visible, MAX_EDICTS/8))
+		bits |= MVDP_VISIBLE;
+	if (!bits && player->active)
+		return;
+
+	buf = SV_MvdSpace (MVD_OPLEN);
+	MSG_WriteByte (buf, mvd_player);
+	MSG_WriteByte (buf, clientnum);
+	MSG_WriteByte (buf, bits);
+
+	if (bits & MVDP_AREABITS)
+	{
+		MSG_WriteByte (buf, frame->areabytes);
+		SZ_Write (buf, frame->areabits, frame->areabytes);
+		player->areabytes = frame->areabytes;
+		memcpy (player->areabits, frame->areabits, frame->areabytes);
+	}
+
+	if (bits & MVDP_PLAYERSTATE)
+	{
+		MSG_WriteDeltaPlayerstate (&player->ps, &frame->ps, buf);
+		player->ps = frame->ps;
+	}
+
+	if (bits & MVDP_VISIBLE)
+	{
+		for (e=1 ; e<MAX_EDICTS ; e++)
+		{
+			if ((visible[e>>3] ^ player->visible[e>>3]) & (1<<(e&7)))
+				MSG_WriteShort (buf, e);
+		}
+		MSG_WriteShort (buf, 0);
+		memcpy (player->visible, visible, MAX_EDICTS/8);
+	}
+
+	player->active = true;
+}
+
+/*
+=================
+SV_MvdRecordFrame
+
+Called once the clients have been sent this frame.  A player that was
+rate dropped gets its frame built here.  Only what each player sees
+comes from its frame, which sv_entitypriority may have thinned down to
+older states; the states themselves are taken from the edicts.
+=================
+*/
+void SV_MvdRecordFrame (void)
+{
+	mvdrecord_t	*rec = sv_mvdrecord;
+	mvdframe_t	*mframe;
+	client_t	*cl;
+	client_frame_t	*frame;
+	entity_state_t	*state;
+	byte		present[MAX_EDICTS/8];
+	byte		visible[MAX_EDICTS/8];
+	sizebuf_t	*buf;
+	int32_t		i, j, e;
+
+	if (!SV_MvdRecording ())
+		return;
+	mframe = &rec->frame;
+
+	// the union of every player's entities, and each player's own
+	memset (present, 0, sizeof(present));
+	for (i=0, cl=svs.clients ; i<maxclients->value ; i++, cl++)
+	{
+		frame = &cl->frames[sv.framenum & UPDATE_MASK];
+		if (cl->state == cs_spawned && cl->edict && cl->edict->client && frame->framenum != sv.framenum)
+			SV_BuildClientFrame (cl);
+
+		if (cl->state != cs_spawned || frame->framenum != sv.framenum)
+		{
+			if (mframe->players[i].active)
+			{
+				buf = SV_MvdSpace (MVD_OPLEN);
+				MSG_WriteByte (buf, mvd_player);
+				MSG_WriteByte (buf, i);
+				MSG_WriteByte (buf, MVDP_GONE);
+				memset (&mframe->players[i], 0, sizeof(mframe->players[i]));
+			}
+			continue;
+		}
+
+		memset (visible, 0, sizeof(visible));
+		for (j=0 ; j<frame->num_entities ; j++)
+		{
+			state = &svs.client_entities[(frame->first_entity+j)%svs.num_client_entities];
+			e = state->number;
+			VIS_SET(visible, e);
+			VIS_SET(present, e);
+		}
+
+		SV_MvdWritePlayer (i, frame, visible);
+	}
+
+	// one delta for the lot
+	buf = SV_MvdSpace (MVD_MSGLEN/2);
+	MSG_WriteByte (buf, mvd_frame);
+	MSG_WriteLong (buf, sv.framenum);
+
+	for (e=1 ; e<MAX_EDICTS ; e++)
+	{
+		if (!present[e>>3] && !mframe->present[e>>3])
+		{
+			e |= 7;		// skip the rest of this byte
+			continue;
+		}
+
+		if (VIS_TEST(present, e))
+		{
+			state = &EDICT_NUM(e)->s;
+			if (VIS_TEST(mframe->present, e))
+				MSG_WriteDeltaEntity (&mframe->entities[e], state, buf, false, e <= maxclients->value);
+			else
+				MSG_WriteDeltaEntity (&sv.baselines[e], state, buf, true, true);
+			mframe->entities[e] = *state;
+		}
+		else if (VIS_TEST(mframe->present, e))
+			SV_WriteRemoveEntity (buf, e);
+	}
+	MSG_WriteShort (buf, 0);
+
+	memcpy (mframe->present, present, sizeof(present));
+	mframe->framenum = sv.framenum;
+	rec->frames++;
+
+	SV_MvdFlush ();
+}
+
+/*
+==============
+SV_MvdRecord_f
+
+mvdrecord <demoname>
+==============
+*/
+void SV_MvdRecord_f (void)
+{
+	char	name[MAX_OSPATH];
+
+	if (Cmd_Argc() != 2)
+	{
+		Com_Printf ("mvdrecord <demoname>\n");
+		return;
+	}
+
+	if (sv_mvdrecord)
+	{
+		Com_Printf ("Already recording.\n");
+		return;
+	}
+
+	if (sv.state != ss_game)
+	{
+		Com_Printf ("You must be in a level to record.\n");
+		return;
+	}
+
+	Com_sprintf (name, sizeof(name), "%s/demos/%s.mvd2", FS_Gamedir(), Cmd_Argv(1));
+	FS_CreatePath (name);
+
+	sv_mvdrecord = (mvdrecord_t *)Z_Malloc (sizeof(mvdrecord_t));
+	sv_mvdrecord->file = Demo_OpenWriter (name, true);
+	if (!sv_mvdrecord->file)
+	{
+		Com_Printf ("ERROR: couldn't open %s.\n", name);
+		Z_Free (sv_mvdrecord);
+		sv_mvdrecord = NULL;
+		return;
+	}
+	Com_Printf ("recording to %s.\n", name);
+
+	Q_strncpyz (sv_mvdrecord->name, name, sizeof(sv_mvdrecord->name));
+	SZ_Init (&sv_mvdrecord->buf, sv_mvdrecord->buf_data, sizeof(sv_mvdrecord->buf_data));
+	sv_mvdrecord->spawncount = -1;		// gamestate on the first frame
+}
+
+/*
+==============
+SV_MvdStop_f
+==============
+*/
+void SV_MvdStop_f (void)
+{
+	int32_t		len;
+	int64_t		size;
+
+	if (!sv_mvdrecord)
+	{
+		Com_Printf ("Not doing an mvdrecord.\n");
+		return;
+	}
+
+	SV_MvdFlush ();
+	len = -1;
+	Demo_Write (sv_mvdrecord->file, &len, 4);
+	size = Demo_WriterTell (sv_mvdrecord->file);
+	Demo_CloseWriter (sv_mvdrecord->file);
+
+	Com_Printf ("Recording completed, %i frames in %lli bytes.\n", sv_mvdrecord->frames, (long long)size);
+	Z_Free (sv_mvdrecord);
+	sv_mvdrecord = NULL;
+}
+
+/*
+==============
+SV_MvdShutdown
+==============
+*/
+void SV_MvdShutdown (void)
+{
+	if (sv_mvdrecord)
+		SV_MvdStop_f ();
+	SV_MvdEndPlayback ();
+}
+
+/*
+===============================================================================
+
+PLAYBACK
+
+===============================================================================
+*/
+
+/*
+=================
+SV_MvdBeginPlayback
+
+Called with the demo just opened for a viewer
+=================
+*/
+void SV_MvdBeginPlayback (void)
+{
+	int32_t		len;
+
+	len = strlen (sv.name);
+	sv.mvd = (len > 5 && !Q_strcasecmp (sv.name + len - 5, ".mvd2"))
+		|| (len > 8 && !Q_strcasecmp (sv.name + len - 8, ".mvd2.gz"));
+	if (!sv.mvd)
+		return;
+
+	if (!sv_mvdplay)
+		sv_mvdplay = (mvdplay_t *)Z_Malloc (sizeof(mvdplay_t));
+	memset (sv_mvdplay, 0, sizeof(*sv_mvdplay));
+
+	SZ_Init (&sv_mvdplay->msg, sv_mvdplay->msg_data, sizeof(sv_mvdplay->msg_data));
+	SZ_Init (&sv_mvdplay->datagram, sv_mvdplay->datagram_buf, sizeof(sv_mvdplay->datagram_buf));
+	sv_mvdplay->pov = -1;
+	sv_mvdplay->gamestate = -1;
+	sv_mvdplay->lastframe = -1;
+}
+
+/*
+=================
+SV_MvdEndPlayback
+=================
+*/
+void SV_MvdEndPlayback (void)
+{
+	if (sv_mvdplay)
+		Z_Free (sv_mvdplay);
+	sv_mvdplay = NULL;
+	sv.mvd = false;
+}
+
+/*
+=================
+SV_MvdReadMessage
+=================
+*/
+static qboolean SV_MvdReadMessage (mvdplay_t *mvd)
+{
+	int32_t		len;
+
+	if (FS_FRead (&len, 4, 1, sv.demofile) != 4)
+		return false;
+	len = LittleLong (len);
+	if (len == -1)
+		return false;
+	if (len < 0 || len > mvd->msg.maxsize)
+		Com_Error (ERR_DROP, "SV_MvdReadMessage: bad message length %i", len);
+
+	SZ_Clear (&mvd->msg);
+	if (FS_FRead (mvd->msg.data, len, 1, sv.demofile) != len)
+		return false;
+	mvd->msg.cursize = len;
+	mvd->msg.readcount = 0;
+	return true;
+}
+
+/*
+=================
+SV_MvdParseServerdata
+=================
+*/
+static void SV_MvdParseServerdata (mvdplay_t *mvd)
+{
+	int32_t		protocol;
+
+	if (MSG_ReadLong (&mvd->msg) != MVD_ID)
+		Com_Error (ERR_DROP, "%s is not a multiview demo", sv.name);
+	protocol = MSG_ReadLong (&mvd->msg);
+	if (protocol != PROTOCOL_VERSION)
+		Com_Error (ERR_DROP, "%s is protocol %i, not %i", sv.name, protocol, PROTOCOL_VERSION);
+
+	mvd->spawncount = MSG_ReadLong (&mvd->msg);
+	Q_strncpyz (mvd->gamedir, MSG_ReadString (&mvd->msg), sizeof(mvd->gamedir));
+	mvd->maxclients = MSG_ReadShort (&mvd->msg);
+
+	memset (sv.configstrings, 0, sizeof(sv.configstrings));
+	memset (sv.baselines, 0, sizeof(sv.baselines));
+	memset (&mvd->frame, 0, sizeof(mvd->frame));
+	SZ_Clear (&mvd->datagram);
+
+	mvd->pov = -1;
+	mvd->gamestate = 0;
+}
+
+/*
+=================
+SV_MvdSetConfigstring
+
+Long strings run on into the next configstrings, as on the client
+=================
+*/
+static void SV_MvdSetConfigstring (int32_t index, char *s)
+{
+	if (index < 0 || index >= MAX_CONFIGSTRINGS)
+		Com_Error (ERR_DROP, "SV_MvdSetConfigstring: bad index %i", index);
+	Q_strncpyz (sv.configstrings[index], s, sizeof(sv.configstrings) - index*sizeof(sv.configstrings[0]));
+}
+
+/*
+=================
+SV_MvdParseData
+
+Game messages for the viewer's player end up in the next frame's
+datagram.  Configstring changes are kept whoever sees them.
+=================
+*/
+static void SV_MvdParseData (mvdplay_t *mvd, int32_t clientnum)
+{
+	sizebuf_t	data;
+	int32_t		len;
+
+	len = MSG_ReadLong (&mvd->msg);
+	if (len <= 0 || mvd->msg.readcount + len > mvd->msg.cursize)
+		Com_Error (ERR_DROP, "SV_MvdParseData: bad length %i", len);
+
+	SZ_Init (&data, mvd->msg.data + mvd->msg.readcount, len);
+	data.cursize = len;
+	mvd->msg.readcount += len;
+
+	if (clientnum == -1 && data.data[0] == svc_configstring)
+	{
+		MSG_ReadByte (&data);
+		len = MSG_ReadShort (&data);
+		SV_MvdSetConfigstring (len, MSG_ReadString (&data));
+	}
+
+	if ((clientnum == -1 || clientnum == mvd->pov) && mvd->datagram.cursize + data.cursize <= mvd->datagram.maxsize)
+		SZ_Write (&mvd->datagram, data.data, data.cursize);
+}
+
+/*
+=================
+SV_MvdParsePlayer
+=================
+*/
+static void SV_MvdParsePlayer (mvdplay_t *mvd)
+{
+	mvdplayer_t	*player;
+	player_state_t	ps;
+	int32_t		clientnum, bits, e;
+
+	clientnum = MSG_ReadByte (&mvd->msg);
+	bits = MSG_ReadByte (&mvd->msg);
+	if (clientnum < 0 || clientnum >= MAX_CLIENTS)
+		Com_Error (ERR_DROP, "SV_MvdParsePlayer: bad client %i", clientnum);
+	player = &mvd->frame.players[clientnum];
+
+	if (bits & MVDP_GONE)
+	{
+		memset (player, 0, sizeof(*player));
+		return;
+	}
+	player->active = true;
+
+	if (bits & MVDP_AREABITS)
+	{
+		player->areabytes = MSG_ReadByte (&mvd->msg);
+		if (player->areabytes > (int32_t)sizeof(player->areabits))
+			Com_Error (ERR_DROP, "SV_MvdParsePlayer: %i areabytes", player->areabytes);
+		MSG_ReadData (&mvd->msg, player->areabits, player->areabytes);
+	}
+
+	if (bits & MVDP_PLAYERSTATE)
+	{
+		ps = player->ps;
+		MSG_ReadDeltaPlayerstate (&mvd->msg, &ps, &player->ps);
+	}
+
+	if (bits & MVDP_VISIBLE)
+	{
+		while ((e = MSG_ReadShort (&mvd->msg)) > 0 && e < MAX_EDICTS)
+			player->visible[e>>3] ^= 1<<(e&7);
+	}
+}
+
+/*
+=================
+SV_MvdParseFrame
+
+Entities left out of the delta are unchanged, which to a client means
+their event is over and they haven't moved since
+=================
+*/
+static void SV_MvdParseFrame (mvdplay_t *mvd)
+{
+	mvdframe_t	*frame = &mvd->frame;
+	entity_state_t	from;
+	uint32_t	bits;
+	int32_t		e;
+
+	frame->framenum = MSG_ReadLong (&mvd->msg);
+
+	for (e=1 ; e<MAX_EDICTS ; e++)
+	{
+		if (VIS_TEST(frame->present, e))
+		{
+			frame->entities[e].event = 0;
+			VectorCopy (frame->entities[e].origin, frame->entities[e].old_origin);
+		}
+	}
+
+	while (1)
+	{
+		e = MSG_ReadEntityBits (&mvd->msg, &bits);
+		if (mvd->msg.readcount > mvd->msg.cursize)
+			Com_Error (ERR_DROP, "SV_MvdParseFrame: end of message");
+		if (e < 0 || e >= MAX_EDICTS)
+			Com_Error (ERR_DROP, "SV_MvdParseFrame: bad entity %i", e);
+		if (!e)
+			break;
+
+		if (bits & U_REMOVE)
+		{
+			frame->present[e>>3] &= ~(1<<(e&7));
+			continue;
+		}
+
+		from = VIS_TEST(frame->present, e) ? frame->entities[e] : sv.baselines[e];
+		MSG_ReadDeltaEntity (&mvd->msg, &from, &frame->entities[e], e, bits);
+		VIS_SET(frame->present, e);
+	}
+}
+
+/*
+=================
+SV_MvdReadFrame
+
+Runs the demo up to the end of its next frame, false at the end
+=================
+*/
+static qboolean SV_MvdReadFrame (mvdplay_t *mvd)
+{
+	entity_state_t	nullstate;
+	uint32_t	bits;
+	int32_t		op, e;
+
+	while (1)
+	{
+		if (mvd->msg.readcount >= mvd->msg.cursize)
+		{
+			if (!SV_MvdReadMessage (mvd))
+				return false;
+			continue;
+		}
+
+		op = MSG_ReadByte (&mvd->msg);
+		switch (op)
+		{
+		case mvd_serverdata:
+			SV_MvdParseServerdata (mvd);
+			break;
+
+		case mvd_configstring:
+			e = MSG_ReadShort (&mvd->msg);
+			SV_MvdSetConfigstring (e, MSG_ReadString (&mvd->msg));
+			break;
+
+		case mvd_baseline:
+			memset (&nullstate, 0, sizeof(nullstate));
+			e = MSG_ReadEntityBits (&mvd->msg, &bits);
+			if (e <= 0 || e >= MAX_EDICTS)
+				Com_Error (ERR_DROP, "SV_MvdReadFrame: bad baseline %i", e);
+			MSG_ReadDeltaEntity (&mvd->msg, &nullstate, &sv.baselines[e], e, bits);
+			break;
+
+		case mvd_multicast:
+			SV_MvdParseData (mvd, -1);
+			break;
+
+		case mvd_unicast:
+			SV_MvdParseData (mvd, MSG_ReadByte (&mvd->msg));
+			break;
+
+		case mvd_player:
+			SV_MvdParsePlayer (mvd);
+			break;
+
+		case mvd_frame:
+			SV_MvdParseFrame (mvd);
+			return true;
+
+		default:
+			Com_Error (ERR_DROP, "SV_MvdReadFrame: bad op %i", op);
+		}
+	}
+}
+
+/*
+=================
+SV_MvdChoosePov
+
+Sticks to the player asked for while it is in the game, or else to the
+lowest numbered one.  A new point of view starts over with the gamestate.
+=================
+*/
+static void SV_MvdChoosePov (mvdplay_t *mvd)
+{
+	int32_t		i, pov;
+
+	pov = -1;
+	if (sv_mvdpov >= 0 && sv_mvdpov < MAX_CLIENTS && mvd->frame.players[sv_mvdpov].active)
+		pov = sv_mvdpov;
+	else if (mvd->pov >= 0 && mvd->frame.players[mvd->pov].active)
+		pov = mvd->pov;
+	else
+	{
+		for (i=0 ; i<MAX_CLIENTS ; i++)
+		{
+			if (mvd->frame.players[i].active)
+			{
+				pov = i;
+				break;
+			}
+		}
+	}
+
+	if (pov != mvd->pov)
+	{
+		mvd->pov = pov;
+		mvd->gamestate = 0;
+	}
+}
+
+/*
+=================
+SV_MvdWriteGamestate
+
+As much of the gamestate as fits, the rest goes next time
+=================
+*/
+static void SV_MvdWriteGamestate (mvdplay_t *mvd, sizebuf_t *msg)
+{
+	entity_state_t	nullstate;
+	entity_state_t	*base;
+	int32_t		i;
+
+	if (!mvd->gamestate)
+	{
+		MSG_WriteByte (msg, svc_serverdata);
+		MSG_WriteLong (msg, PROTOCOL_VERSION);
+		MSG_WriteLong (msg, 0x10000 + mvd->spawncount);
+		MSG_WriteByte (msg, 1);	// demos are always attract loops
+		MSG_WriteString (msg, mvd->gamedir);
+		// a playernum of -1 would start a cinematic; with nobody in the
+		// game the first slot is free, and its entity never comes
+		MSG_WriteShort (msg, (mvd->pov >= 0) ? mvd->pov : 0);
+		MSG_WriteString (msg, sv.configstrings[CS_NAME]);
+	}
+
+	memset (&nullstate, 0, sizeof(nullstate));
+	for ( ; mvd->gamestate < MAX_CONFIGSTRINGS + MAX_EDICTS ; mvd->gamestate++)
+	{
+		if (msg->cursize > MAX_MSGLEN/2)
+			return;
+
+		i = mvd->gamestate;
+		if (i < MAX_CONFIGSTRINGS)
+		{
+			if (!sv.configstrings[i][0])
+				continue;
+			MSG_WriteByte (msg, svc_configstring);
+			MSG_WriteShort (msg, i);
+			MSG_WriteString (msg, sv.configstrings[i]);
+		}
+		else
+		{
+			base = &sv.baselines[i - MAX_CONFIGSTRINGS];
+			if (!base->modelindex && !base->sound && !base->effects)
+				continue;
+			MSG_WriteByte (msg, svc_spawnbaseline);
+			MSG_WriteDeltaEntity (&nullstate, base, msg, true, true);
+		}
+	}
+
+	MSG_WriteByte (msg, svc_stufftext);
+	MSG_WriteString (msg, "precache\n");
+
+	mvd->gamestate = -1;
+	mvd->lastframe = -1;
+}
+
+/*
+=================
+SV_MvdWriteFrame
+
+The frame as the viewer's player got it.  Without any player in the
+demo the viewer sees everything there is.
+=================
+*/
+static void SV_MvdWriteFrame (mvdplay_t *mvd, sizebuf_t *msg)
+{
+	mvdframe_t	*frame = &mvd->frame;
+	mvdplayer_t	*pov;
+	player_state_t	nullps;
+	player_state_t	*ps;
+	int32_t		is, was, e;
+
+	pov = (mvd->pov >= 0) ? &frame->players[mvd->pov] : NULL;
+	if (mvd->lastframe == -1)
+		memset (mvd->sentbits, 0, sizeof(mvd->sentbits));
+
+	MSG_WriteByte (msg, svc_frame);
+	MSG_WriteLong (msg, frame->framenum);
+	MSG_WriteLong (msg, mvd->lastframe);
+	MSG_WriteByte (msg, 0);		// rate dropped packets
+
+	if (pov)
+	{
+		MSG_WriteByte (msg, pov->areabytes);
+		SZ_Write (msg, pov->areabits, pov->areabytes);
+		ps = &pov->ps;
+	}
+	else
+	{
+		MSG_WriteByte (msg, MAX_MAP_AREAS/8);
+		memset (SZ_GetSpace (msg, MAX_MAP_AREAS/8), 0xff, MAX_MAP_AREAS/8);
+		memset (&nullps, 0, sizeof(nullps));
+		ps = &nullps;
+	}
+
+	MSG_WriteDeltaPlayerstate ((mvd->lastframe == -1) ? NULL : &mvd->lastps, ps, msg);
+	mvd->lastps = *ps;
+
+	MSG_WriteByte (msg, svc_packetentities);
+	for (e=1 ; e<MAX_EDICTS ; e++)
+	{
+		is = VIS_TEST(frame->present, e) && (!pov || VIS_TEST(pov->visible, e));
+		was = VIS_TEST(mvd->sentbits, e);
+
+		if (is && was)
+			MSG_WriteDeltaEntity (&mvd->sent[e], &frame->entities[e], msg, false, e <= mvd->maxclients);
+		else if (is)
+			MSG_WriteDeltaEntity (&sv.baselines[e], &frame->entities[e], msg, true, true);
+		else if (was)
+			SV_WriteRemoveEntity (msg, e);
+
+		if (is)
+		{
+			mvd->sent[e] = frame->entities[e];
+			VIS_SET(mvd->sentbits, e);
+		}
+		else
+			mvd->sentbits[e>>3] &= ~(1<<(e&7));
+	}
+	MSG_WriteShort (msg, 0);
+
+	if (msg->cursize + mvd->datagram.cursize <= msg->maxsize)
+		SZ_Write (msg, mvd->datagram.data, mvd->datagram.cursize);
+	SZ_Clear (&mvd->datagram);
+
+	mvd->lastframe = frame->framenum;
+}
+
+/*
+=================
+SV_MvdDemoMessage
+
+What SV_ReadDemoMessage is for other demos: the next message for the
+viewer in msgbuf, its length or -1 at the end of the demo
+=================
+*/
+int32_t SV_MvdDemoMessage (byte *msgbuf)
+{
+	mvdplay_t	*mvd = sv_mvdplay;
+	sizebuf_t	msg;
+
+	if (!mvd->framepending)
+	{
+		if (!SV_MvdReadFrame (mvd))
+			return -1;
+		SV_MvdChoosePov (mvd);
+		mvd->framepending = true;
+	}
+
+	SZ_Init (&msg, msgbuf, MAX_MSGLEN);
+	msg.allowoverflow = true;
+
+	if (mvd->gamestate != -1)
+		SV_MvdWriteGamestate (mvd, &msg);
+	else
+	{
+		SV_MvdWriteFrame (mvd, &msg);
+		mvd->framepending = false;
+	}
+
+	if (msg.overflowed)
+	{
+		Com_Printf (S_COLOR_YELLOW"SV_MvdDemoMessage: frame %i overflowed\n", mvd->frame.framenum);
+		mvd->lastframe = -1;
+		return 0;
+	}
+	return msg.cursize;
+}
+
+/*
+==============
+SV_MvdPov_f
+
+mvd_pov [<client>|next], lists the players without one
+==============
+*/
+void SV_MvdPov_f (void)
+{
+	mvdplay_t	*mvd = sv_mvdplay;
+	char		name[MAX_QPATH], *s;
+	int32_t		i, pov;
+
+	if (sv.state != ss_demo || !sv.mvd || !mvd)
+	{
+		Com_Printf ("Not playing a multiview demo.\n");
+		return;
+	}
+
+	if (Cmd_Argc() != 2)
+	{
+		Com_Printf ("usage: mvd_pov [<client>|next]\n");
+		for (i=0 ; i<MAX_CLIENTS ; i++)
+		{
+			if (!mvd->frame.players[i].active)
+				continue;
+			Q_strncpyz (name, sv.configstrings[CS_PLAYERSKINS+i], sizeof(name));
+			s = strchr (name, '\\');
+			if (s)
+				*s = 0;
+			Com_Printf ("%c%3i %s\n", (i == mvd->pov) ? '*' : ' ', i, name);
+		}
+		return;
+	}
+
+	if (!Q_strcasecmp (Cmd_Argv(1), "next"))
+	{
+		pov = mvd->pov;
+		for (i=0 ; i<MAX_CLIENTS ; i++)
+		{
+			pov = (pov + 1) % MAX_CLIENTS;
+			if (mvd->frame.players[pov].active)
+				break;
+		}
+	}
+	else
+		pov = atoi (Cmd_Argv(1));
+
+	if (pov < 0 || pov >= MAX_CLIENTS || !mvd->frame.players[pov].active)
+	{
+		Com_Printf ("No player %s in the demo.\n", Cmd_Argv(1));
+		return;
+	}
+
+	sv_mvdpov = pov;
+	if (pov != mvd->pov)
+	{
+		mvd->pov = pov;
+		mvd->gamestate = 0;
+	}
+}
@@ -0,0 +1,279 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_netstats.c -- per client bandwidth and entity delta accounting
+
+#include "server.h"
+
+/*
+===============================================================================
+
+SV_WriteFrameToClient fills in the sizes of each frame as it writes it,
+SV_TransmitClientDatagram adds them to the client's totals here.  With
+sv_netstats log running every frame, rate drop and overflow of every
+client also goes to a csv file that is rolled over once it passes
+sv_netstats_logsize megabytes.
+
+===============================================================================
+*/
+
+static FILE		*sv_netlog;
+static char		sv_netlogpath[MAX_OSPATH];
+static cvar_t	*sv_netstats_logsize;
+
+/*
+=================
+SV_NetstatsModel
+=================
+*/
+static const char *SV_NetstatsModel (int32_t modelindex)
+{
+	static char	name[16];
+
+	if (modelindex > 0 && modelindex < MAX_MODELS && sv.configstrings[CS_MODELS+modelindex][0])
+		return sv.configstrings[CS_MODELS+modelindex];
+	Com_sprintf (name, sizeof(name), "#%i", modelindex);
+	return name;
+}
+
+/*
+=================
+SV_NetlogOpen
+=================
+*/
+static qboolean SV_NetlogOpen (void)
+{
+	sv_netlog = fopen (sv_netlogpath, "w");
+	if (!sv_netlog)
+	{
+		Com_Printf ("Couldn't open %s\n", sv_netlogpath);
+		return false;
+	}
+
+	fprintf (sv_netlog, "map,frame,client,name,event,bytes,playerstate,entitybytes,entities,fullstates,deferred,nodelta,reliable,biggest,biggestmodel\n");
+	return true;
+}
+
+/*
+=================
+SV_NetlogClose
+=================
+*/
+static void SV_NetlogClose (void)
+{
+	if (!sv_netlog)
+		return;
+	fclose (sv_netlog);
+	sv_netlog = NULL;
+	Com_Printf ("Closed %s\n", sv_netlogpath);
+}
+
+/*
+=================
+SV_NetlogRoll
+
+Keeps one previous file as <name>.1.csv
+=================
+*/
+static void SV_NetlogRoll (void)
+{
+	char	old[MAX_OSPATH];
+	int32_t	len;
+
+	if (ftell (sv_netlog) < sv_netstats_logsize->value * 1024 * 1024)
+		return;
+
+	fclose (sv_netlog);
+
+	len = strlen (sv_netlogpath) - 4;		// ".csv"
+	Com_sprintf (old, sizeof(old), "%.*s.1.csv", len, sv_netlogpath);
+	remove (old);
+	rename (sv_netlogpath, old);
+
+	SV_NetlogOpen ();
+}
+
+/*
+=================
+SV_NetlogWrite
+=================
+*/
+static void SV_NetlogWrite (client_t *cl, const char *event)
+{
+	netstats_t	*stats = &cl->netstats;
+
+	fprintf (sv_netlog, "%s,%i,%i,\"%s\",%s,%i,%i,%i,%i,%i,%i,%i,%i,%i,\"%s\"\n",
+		sv.name, sv.framenum, (int32_t)(cl - svs.clients), cl->name, event,
+		stats->bytes, stats->playerstate, stats->entitybytes, stats->entities, stats->fullstates, stats->deferred,
+		stats->nodelta, stats->reliable, stats->biggest, SV_NetstatsModel (stats->biggestmodel));
+
+	SV_NetlogRoll ();
+}
+
+/*
+=================
+SV_NetstatsFrame
+
+Called with the sizes of the datagram about to go out
+=================
+*/
+void SV_NetstatsFrame (client_t *cl)
+{
+	netstats_t	*stats = &cl->netstats;
+
+	stats->frames++;
+	stats->totalbytes += stats->bytes;
+	stats->totalplayerstate += stats->playerstate;
+	stats->totalentitybytes += stats->entitybytes;
+	stats->totalentities += stats->entities;
+	stats->totalfullstates += stats->fullstates;
+	stats->totaldeferred += stats->deferred;
+	if (stats->nodelta)
+		stats->nodeltas++;
+	if (stats->bytes + PACKET_HEADER > NETSTATS_BUDGET)
+		stats->overbudget++;
+
+	if (stats->bytes > stats->maxbytes)
+		stats->maxbytes = stats->bytes;
+	if (stats->reliable > stats->maxreliable)
+		stats->maxreliable = stats->reliable;
+	if (stats->biggest > stats->maxbiggest)
+	{
+		stats->maxbiggest = stats->biggest;
+		stats->maxbiggestmodel = stats->biggestmodel;
+	}
+
+	if (sv_netlog)
+		SV_NetlogWrite (cl, "frame");
+}
+
+/*
+=================
+SV_NetstatsEvent
+
+Rate drops and overflows, logged with the last frame's sizes
+=================
+*/
+void SV_NetstatsEvent (client_t *cl, const char *event)
+{
+	if (sv_netlog)
+		SV_NetlogWrite (cl, event);
+}
+
+/*
+=================
+SV_NetstatsReset
+=================
+*/
+static void SV_NetstatsReset (void)
+{
+	client_t	*cl;
+	int32_t		i;
+
+	if (!svs.clients)
+		return;
+	for (i=0, cl=svs.clients ; i<maxclients->value ; i++, cl++)
+		memset (&cl->netstats, 0, sizeof(cl->netstats));
+}
+
+/*
+=================
+SV_NetstatsPrint
+=================
+*/
+static void SV_NetstatsPrint (void)
+{
+	client_t	*cl;
+	netstats_t	*stats;
+	int32_t		i, frames;
+
+	if (!svs.clients)
+	{
+		Com_Printf ("No server running.\n");
+		return;
+	}
+
+	Com_Printf ("num name            frames  avg  max   ps  ent ents full%% defer nodelta >%i drops  rel biggest\n", NETSTATS_BUDGET);
+	for (i=0, cl=svs.clients ; i<maxclients->value ; i++, cl++)
+	{
+		if (cl->state < cs_connected)
+			continue;
+
+		stats = &cl->netstats;
+		frames = stats->frames ? stats->frames : 1;
+		Com_Printf ("%3i %-15.15s %6i %4u %4i %4u %4u %4u %5.1f %5u %7i %5i %5i %4i %i %s\n", i, cl->name,
+			stats->frames, stats->totalbytes / frames, stats->maxbytes,
+			stats->totalplayerstate / frames, stats->totalentitybytes / frames, stats->totalentities / frames,
+			stats->totalentities ? 100.0 * stats->totalfullstates / stats->totalentities : 0.0,
+			stats->totaldeferred / frames,
+			stats->nodeltas, stats->overbudget, stats->ratedrops, stats->maxreliable,
+			stats->maxbiggest, SV_NetstatsModel (stats->maxbiggestmodel));
+	}
+}
+
+/*
+=================
+SV_Netstats_f
+
+sv_netstats [reset|log [name]]
+=================
+*/
+void SV_Netstats_f (void)
+{
+	char	*cmd;
+
+	if (Cmd_Argc() < 2)
+	{
+		SV_NetstatsPrint ();
+		return;
+	}
+
+	cmd = Cmd_Argv(1);
+	if (!Q_strcasecmp (cmd, "reset"))
+		SV_NetstatsReset ();
+	else if (!Q_strcasecmp (cmd, "log"))
+	{
+		SV_NetlogClose ();
+		if (Cmd_Argc() < 3)
+			return;
+
+		if (!sv_netstats_logsize)
+			sv_netstats_logsize = Cvar_Get ("sv_netstats_logsize", "8", 0);
+
+		Com_sprintf (sv_netlogpath, sizeof(sv_netlogpath), "%s/netstats/%s.csv", FS_Gamedir (), Cmd_Argv(2));
+		FS_CreatePath (sv_netlogpath);
+		if (SV_NetlogOpen ())
+			Com_Printf ("Logging client frames to %s\n", sv_netlogpath);
+	}
+	else
+		Com_Printf ("usage: sv_netstats [reset|log [name]]\n");
+}
+
+/*
+=================
+SV_NetstatsShutdown
+
+Closes the log, a new server starts without one
+=================
+*/
+void SV_NetstatsShutdown (void)
+{
+	SV_NetlogClose ();
+	sv_netlogpath[0] = 0;
+}
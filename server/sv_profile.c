@@ -0,0 +1,392 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_profile.c -- microsecond timings of the server frame phases
+
+#include "../../Source/SystemThreads.h"
+#include "../../Source/SystemTimer.h"
+
+#include "server.h"
+
+/*
+===============================================================================
+
+Every timed phase adds to a log-linear histogram: exact below 32us, then
+16 buckets per power of two, so any percentile is read to within 1/16 of
+its value.  Frames and client work may run on the worker pool, so the
+counts are bumped atomically and each timing also goes into a ring of
+recent events for the Chrome trace export.
+
+===============================================================================
+*/
+
+#define	PROFILE_SUBBITS		4
+#define	PROFILE_BUCKETS		((31-PROFILE_SUBBITS+1)<<PROFILE_SUBBITS)
+#define	PROFILE_EVENTS		65536		// power of two
+
+typedef struct
+{
+	int32_t		phase;
+	int32_t		thread;
+	uint32_t	start;			// microseconds since profiling started
+	uint32_t	length;
+} profileevent_t;
+
+static const char *sv_profile_names[PROF_NUMPHASES] =
+{
+	"frame",
+	"readpackets",
+	"gameframe",
+	"buildframe",
+	"writeframe",
+	"transmit",
+	"netflush"
+};
+
+qboolean		sv_profiling;
+
+static uint64_t	sv_profile_start;
+static int32_t	sv_profile_counts[PROF_NUMPHASES][PROFILE_BUCKETS];
+static profileevent_t	*sv_profile_events;
+static int32_t	sv_profile_nextevent;
+static int32_t	sv_profile_threads;
+
+static THREAD_LOCAL int32_t	sv_profile_thread = -1;
+
+/*
+=================
+SV_ProfileBucket
+=================
+*/
+static int32_t SV_ProfileBucket (uint64_t usec)
+{
+	int32_t		shift;
+
+	if (usec > 0x7fffffff)
+		usec = 0x7fffffff;
+
+	for (shift=0 ; (usec >> shift) >= (2<<PROFILE_SUBBITS) ; shift++)
+		;
+	return (shift<<PROFILE_SUBBITS) + (int32_t)(usec >> shift);
+}
+
+/*
+=================
+SV_ProfileBucketLow
+
+Smallest time that lands in bucket
+=================
+*/
+static uint64_t SV_ProfileBucketLow (int32_t bucket)
+{
+	int32_t		shift;
+
+	if (bucket < (2<<PROFILE_SUBBITS))
+		return bucket;
+	shift = (bucket >> PROFILE_SUBBITS) - 1;
+	return (uint64_t)((bucket & ((1<<PROFILE_SUBBITS)-1)) + (1<<PROFILE_SUBBITS)) << shift;
+}
+
+/*
+=================
+SV_ProfileBegin
+
+Returns 0 when not profiling, so SV_ProfileEnd can skip the clock too
+=================
+*/
+uint64_t SV_ProfileBegin (void)
+{
+	if (!sv_profiling)
+		return 0;
+	return System::Timer::Microseconds();
+}
+
+/*
+=================
+SV_ProfileEnd
+=================
+*/
+void SV_ProfileEnd (profphase_t phase, uint64_t start)
+{
+	profileevent_t	*event;
+	uint64_t	end;
+
+	if (!start || !sv_profiling)
+		return;
+
+	end = System::Timer::Microseconds();
+	System::Threads::FetchAdd (&sv_profile_counts[phase][SV_ProfileBucket (end - start)], 1);
+
+	if (sv_profile_thread == -1)
+		sv_profile_thread = System::Threads::FetchAdd (&sv_profile_threads, 1);
+
+	event = &sv_profile_events[System::Threads::FetchAdd (&sv_profile_nextevent, 1) & (PROFILE_EVENTS-1)];
+	event->phase = phase;
+	event->thread = sv_profile_thread;
+	event->start = (uint32_t)(start - sv_profile_start);
+	event->length = (uint32_t)(end - start);
+}
+
+/*
+=================
+SV_ProfileReset
+=================
+*/
+static void SV_ProfileReset (void)
+{
+	memset (sv_profile_counts, 0, sizeof(sv_profile_counts));
+	sv_profile_nextevent = 0;
+	sv_profile_start = System::Timer::Microseconds();
+}
+
+/*
+=================
+SV_ProfileTotal
+=================
+*/
+static int32_t SV_ProfileTotal (int32_t phase)
+{
+	int32_t		i, total;
+
+	for (i=0, total=0 ; i<PROFILE_BUCKETS ; i++)
+		total += sv_profile_counts[phase][i];
+	return total;
+}
+
+/*
+=================
+SV_ProfilePercentile
+
+Lower edge of the bucket holding the given fraction of the samples
+=================
+*/
+static double SV_ProfilePercentile (int32_t phase, int32_t total, double fraction)
+{
+	int32_t		i, count, want;
+
+	want = (int32_t)ceil (total * fraction);
+	if (want < 1)
+		want = 1;
+	for (i=0, count=0 ; i<PROFILE_BUCKETS ; i++)
+	{
+		count += sv_profile_counts[phase][i];
+		if (count >= want)
+			return (double)SV_ProfileBucketLow (i);
+	}
+	return 0;
+}
+
+/*
+=================
+SV_ProfileMean
+
+From the bucket midpoints, off by at most 1/32
+=================
+*/
+static double SV_ProfileMean (int32_t phase, int32_t total)
+{
+	int32_t		i;
+	double		sum, low;
+
+	if (!total)
+		return 0;
+	for (i=0, sum=0 ; i<PROFILE_BUCKETS ; i++)
+	{
+		if (!sv_profile_counts[phase][i])
+			continue;
+		low = (double)SV_ProfileBucketLow (i);
+		sum += sv_profile_counts[phase][i] * (low + (SV_ProfileBucketLow (i+1) - low) * 0.5);
+	}
+	return sum / total;
+}
+
+/*
+=================
+SV_ProfilePrint
+=================
+*/
+static void SV_ProfilePrint (void)
+{
+	int32_t		i, total;
+
+	Com_Printf ("%s for %.1f seconds, times in ms\n", sv_profiling ? "profiling" : "profiled",
+		(System::Timer::Microseconds() - sv_profile_start) / 1000000.0);
+	Com_Printf ("phase          count     mean      p50      p90      p99    p99.9      max\n");
+	for (i=0 ; i<PROF_NUMPHASES ; i++)
+	{
+		total = SV_ProfileTotal (i);
+		if (!total)
+			continue;
+		Com_Printf ("%-11s %8i %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", sv_profile_names[i], total,
+			SV_ProfileMean (i, total) / 1000.0,
+			SV_ProfilePercentile (i, total, 0.5) / 1000.0,
+			SV_ProfilePercentile (i, total, 0.9) / 1000.0,
+			SV_ProfilePercentile (i, total, 0.99) / 1000.0,
+			SV_ProfilePercentile (i, total, 0.999) / 1000.0,
+			SV_ProfilePercentile (i, total, 1.0) / 1000.0);
+	}
+}
+
+/*
+=================
+SV_ProfileOpen
+=================
+*/
+static FILE *SV_ProfileOpen (const char *name, const char *extension, char *path, int32_t size)
+{
+	FILE	*f;
+
+	Com_sprintf (path, size, "%s/profiles/%s.%s", FS_Gamedir (), name, extension);
+	FS_CreatePath (path);
+	f = fopen (path, "w");
+	if (!f)
+		Com_Printf ("Couldn't open %s\n", path);
+	return f;
+}
+
+/*
+=================
+SV_ProfileWriteCSV
+
+One row per non-empty bucket, with the running fraction so any
+percentile can be read straight off the sheet
+=================
+*/
+static void SV_ProfileWriteCSV (const char *name)
+{
+	char		path[MAX_OSPATH];
+	FILE		*f;
+	int32_t		i, j, total, count;
+
+	f = SV_ProfileOpen (name, "csv", path, sizeof(path));
+	if (!f)
+		return;
+
+	fprintf (f, "phase,low_us,high_us,count,cumulative\n");
+	for (i=0 ; i<PROF_NUMPHASES ; i++)
+	{
+		total = SV_ProfileTotal (i);
+		for (j=0, count=0 ; j<PROFILE_BUCKETS ; j++)
+		{
+			if (!sv_profile_counts[i][j])
+				continue;
+			count += sv_profile_counts[i][j];
+			fprintf (f, "%s,%llu,%llu,%i,%.6f\n", sv_profile_names[i],
+				(unsigned long long)SV_ProfileBucketLow (j), (unsigned long long)SV_ProfileBucketLow (j+1) - 1,
+				sv_profile_counts[i][j], (double)count / total);
+		}
+	}
+
+	fclose (f);
+	Com_Printf ("Wrote %s\n", path);
+}
+
+/*
+=================
+SV_ProfileWriteTrace
+
+The recent event ring as Chrome trace json, for chrome://tracing or Perfetto
+=================
+*/
+static void SV_ProfileWriteTrace (const char *name)
+{
+	char		path[MAX_OSPATH];
+	FILE		*f;
+	profileevent_t	*event;
+	int32_t		i, first, count;
+
+	f = SV_ProfileOpen (name, "json", path, sizeof(path));
+	if (!f)
+		return;
+
+	count = sv_profile_nextevent;
+	first = 0;
+	if (count > PROFILE_EVENTS)
+	{
+		first = count - PROFILE_EVENTS;
+		count = PROFILE_EVENTS;
+	}
+
+	fprintf (f, "{\"traceEvents\":[\n");
+	for (i=0 ; i<count ; i++)
+	{
+		event = &sv_profile_events[(first + i) & (PROFILE_EVENTS-1)];
+		fprintf (f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%u,\"dur\":%u}%s\n",
+			sv_profile_names[event->phase], event->thread, event->start, event->length,
+			(i < count-1) ? "," : "");
+	}
+	fprintf (f, "],\"displayTimeUnit\":\"ms\"}\n");
+
+	fclose (f);
+	Com_Printf ("Wrote %s, %i events\n", path, count);
+}
+
+/*
+=================
+SV_Profile_f
+
+sv_profile [on|off|reset|csv <name>|trace <name>]
+=================
+*/
+void SV_Profile_f (void)
+{
+	char	*cmd;
+
+	if (Cmd_Argc() < 2)
+	{
+		if (!sv_profile_start)
+		{
+			Com_Printf ("usage: sv_profile [on|off|reset|csv <name>|trace <name>]\n");
+			return;
+		}
+		SV_ProfilePrint ();
+		return;
+	}
+
+	cmd = Cmd_Argv(1);
+	if (!Q_strcasecmp (cmd, "on"))
+	{
+		if (!sv_profile_events)
+			sv_profile_events = (profileevent_t*)Z_Malloc (PROFILE_EVENTS*sizeof(profileevent_t));
+		SV_ProfileReset ();
+		sv_profiling = true;
+		Com_Printf ("Profiling server frames.\n");
+	}
+	else if (!Q_strcasecmp (cmd, "off"))
+	{
+		sv_profiling = false;
+		if (sv_profile_start)
+			SV_ProfilePrint ();
+	}
+	else if (!Q_strcasecmp (cmd, "reset"))
+	{
+		if (sv_profile_events)
+			SV_ProfileReset ();
+	}
+	else if (!sv_profile_start)
+		Com_Printf ("Nothing profiled yet, use sv_profile on.\n");
+	else if (Cmd_Argc() < 3)
+		Com_Printf ("usage: sv_profile %s <name>\n", cmd);
+	else if (!Q_strcasecmp (cmd, "csv"))
+		SV_ProfileWriteCSV (Cmd_Argv(2));
+	else if (!Q_strcasecmp (cmd, "trace"))
+		SV_ProfileWriteTrace (Cmd_Argv(2));
+	else
+		Com_Printf ("unknown sv_profile command %s\n", cmd);
+}
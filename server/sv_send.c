@@ -20,6 +20,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // sv_main.c -- server main program
 
 #include "../../Source/GameEngine.h"
+#include "../../Source/SystemThreads.h"
+#include "../../Source/SystemTimer.h"
 
 #include "server.h"
 
@@ -80,6 +82,8 @@ void SV_ClientPrintf (client_t *cl, int32_t level, char *fmt, ...)
 	MSG_WriteByte (&cl->netchan.message, svc_print);
 	MSG_WriteByte (&cl->netchan.message, level);
 	MSG_WriteString (&cl->netchan.message, string);
+
+	SV_MvdPrint (cl, level, string);
 }
 
 /*
@@ -124,6 +128,8 @@ void SV_BroadcastPrintf (int32_t level, char *fmt, ...)
 		MSG_WriteByte (&cl->netchan.message, level);
 		MSG_WriteString (&cl->netchan.message, string);
 	}
+
+	SV_MvdPrint (NULL, level, string);
 }
 
 /*
@@ -151,6 +157,112 @@ void SV_BroadcastCommand (char *fmt, ...)
 }
 
 
+/*
+===============================================================================
+
+MULTICAST
+
+Every temp entity and positioned sound is a multicast, and a busy frame
+does hundreds of them.  Rather than descend the bsp for every client on
+every call, each client slot remembers the leaf it was last found in and
+only looks it up again once the client has moved.
+
+===============================================================================
+*/
+
+typedef struct
+{
+	qboolean	valid;
+	vec3_t		origin;			// where cluster and area were looked up
+	int32_t		cluster;
+	int32_t		area;
+} mcastleaf_t;
+
+static mcastleaf_t	sv_mcastleafs[MAX_CLIENTS];
+static int32_t		sv_mcastlist[MAX_CLIENTS];	// occupied client slots, ascending
+static int32_t		sv_nummcast;
+static int32_t		sv_mcastframe = -1;
+static int32_t		sv_mcastspawncount;
+static qboolean		sv_mcastdirty = true;
+
+// multicast origins from the last frame that had any, for sv_multicastbench
+#define	MAX_MCAST_RECORD	1024
+
+typedef struct
+{
+	vec3_t		origin;
+	multicast_t	to;
+} mcastrecord_t;
+
+static mcastrecord_t	sv_mcastrecord[MAX_MCAST_RECORD];
+static int32_t			sv_nummcastrecord;
+static int32_t			sv_mcastrecordframe = -1;
+
+/*
+=================
+SV_MulticastClientsChanged
+
+A slot went from free to connected, so the slot list has to be rebuilt
+before the next multicast.
+=================
+*/
+void SV_MulticastClientsChanged (void)
+{
+	sv_mcastdirty = true;
+}
+
+/*
+=================
+SV_MulticastLocate
+=================
+*/
+static void SV_MulticastLocate (mcastleaf_t *leaf, vec3_t origin)
+{
+	int32_t		leafnum;
+
+	if (leaf->valid && VectorCompare (origin, leaf->origin))
+		return;
+
+	leafnum = CM_PointLeafnum (origin);
+	leaf->cluster = CM_LeafCluster (leafnum);
+	leaf->area = CM_LeafArea (leafnum);
+	VectorCopy (origin, leaf->origin);
+	leaf->valid = true;
+}
+
+/*
+=================
+SV_MulticastClients
+
+Rebuilds the list of occupied slots once a frame, dropped clients are
+filtered out by state while sending.
+=================
+*/
+static void SV_MulticastClients (void)
+{
+	int32_t		i;
+
+	if (sv_mcastspawncount != svs.spawncount)
+	{
+		memset (sv_mcastleafs, 0, sizeof(sv_mcastleafs));
+		sv_mcastspawncount = svs.spawncount;
+		sv_mcastdirty = true;
+	}
+
+	if (!sv_mcastdirty && sv_mcastframe == sv.framenum)
+		return;
+
+	sv_nummcast = 0;
+	for (i=0 ; i<maxclients->value ; i++)
+	{
+		if (svs.clients[i].state == cs_free || svs.clients[i].state == cs_zombie)
+			continue;
+		sv_mcastlist[sv_nummcast++] = i;
+	}
+	sv_mcastframe = sv.framenum;
+	sv_mcastdirty = false;
+}
+
 /*
 =================
 SV_Multicast
@@ -166,51 +278,61 @@ MULTICAST_PHS	send to clients potentially hearable from org
 void SV_Multicast (vec3_t origin, multicast_t to)
 {
 	client_t	*client;
+	mcastleaf_t	*leaf;
 	byte		*mask;
 	int32_t			leafnum, cluster;
-	int32_t			j;
+	int32_t			i, j;
 	qboolean	reliable;
-	int32_t			area1, area2;
+	int32_t			area1;
 
 	reliable = false;
 
 	if (to != MULTICAST_ALL_R && to != MULTICAST_ALL)
 	{
 		leafnum = CM_PointLeafnum (origin);
+		cluster = CM_LeafCluster (leafnum);
 		area1 = CM_LeafArea (leafnum);
+
+		if (sv_mcastrecordframe != sv.framenum)
+		{
+			sv_mcastrecordframe = sv.framenum;
+			sv_nummcastrecord = 0;
+		}
+		if (sv_nummcastrecord < MAX_MCAST_RECORD)
+		{
+			VectorCopy (origin, sv_mcastrecord[sv_nummcastrecord].origin);
+			sv_mcastrecord[sv_nummcastrecord].to = to;
+			sv_nummcastrecord++;
+		}
 	}
 	else
 	{
-		leafnum = 0;	// just to avoid compiler warnings
+		cluster = 0;	// just to avoid compiler warnings
 		area1 = 0;
 	}
 
 	// if doing a serverrecord, store everything
 	if (svs.demofile)
 		SZ_Write (&svs.demo_multicast, sv.multicast.data, sv.multicast.cursize);
+	SV_MvdMulticast ();
 	
 	switch (to)
 	{
 	case MULTICAST_ALL_R:
 		reliable = true;	// intentional fallthrough
 	case MULTICAST_ALL:
-		leafnum = 0;
 		mask = NULL;
 		break;
 
 	case MULTICAST_PHS_R:
 		reliable = true;	// intentional fallthrough
 	case MULTICAST_PHS:
-		leafnum = CM_PointLeafnum (origin);
-		cluster = CM_LeafCluster (leafnum);
 		mask = CM_ClusterPHS (cluster);
 		break;
 
 	case MULTICAST_PVS_R:
 		reliable = true;	// intentional fallthrough
 	case MULTICAST_PVS:
-		leafnum = CM_PointLeafnum (origin);
-		cluster = CM_LeafCluster (leafnum);
 		mask = CM_ClusterPVS (cluster);
 		break;
 
@@ -219,9 +341,14 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 		Com_Error (ERR_FATAL, "SV_Multicast: bad to:%i", to);
 	}
 
+	SV_MulticastClients ();
+
 	// send the data to all relevent clients
-	for (j = 0, client = svs.clients; j < maxclients->value; j++, client++)
+	for (i = 0 ; i < sv_nummcast ; i++)
 	{
+		j = sv_mcastlist[i];
+		client = svs.clients + j;
+
 		if (client->state == cs_free || client->state == cs_zombie)
 			continue;
 		if (client->state != cs_spawned && !reliable)
@@ -229,12 +356,11 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 
 		if (mask)
 		{
-			leafnum = CM_PointLeafnum (client->edict->s.origin);
-			cluster = CM_LeafCluster (leafnum);
-			area2 = CM_LeafArea (leafnum);
-			if (!CM_AreasConnected (area1, area2))
+			leaf = &sv_mcastleafs[j];
+			SV_MulticastLocate (leaf, client->edict->s.origin);
+			if (!VIS_TEST(mask, leaf->cluster))
 				continue;
-			if ( mask && (!(mask[cluster>>3] & (1<<(cluster&7)) ) ) )
+			if (!CM_AreasConnected (area1, leaf->area))
 				continue;
 		}
 
@@ -247,6 +373,131 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 	SZ_Clear (&sv.multicast);
 }
 
+/*
+=================
+SV_MulticastBench_f
+
+sv_multicastbench [multicasts] [clients]
+
+Replays the multicast origins of the last frame that had any against
+clients placed on the entity origins, once with a bsp descent per client
+as SV_Multicast used to do and once through the cached client leafs.
+=================
+*/
+void SV_MulticastBench_f (void)
+{
+	static mcastleaf_t	leafs[MAX_CLIENTS];
+	static vec3_t		spots[MAX_CLIENTS];
+	mcastrecord_t	*rec;
+	edict_t		*ent;
+	byte		*mask;
+	int32_t		numcasts, numclients, numrecord;
+	int32_t		i, j, leafnum, cluster, area;
+	int32_t		hits_old, hits_new;
+	uint64_t	start, time_old, time_new;
+	mcastrecord_t	fallback[MAX_MCAST_RECORD];
+
+	if (sv.state != ss_game || !ge)
+	{
+		Com_Printf ("No map running.\n");
+		return;
+	}
+
+	numcasts = (Cmd_Argc() > 1) ? atoi (Cmd_Argv(1)) : 500;
+	numclients = (Cmd_Argc() > 2) ? atoi (Cmd_Argv(2)) : (int32_t)maxclients->value;
+	if (numcasts < 1)
+		numcasts = 1;
+	numclients = max(1, min(numclients, MAX_CLIENTS));
+
+	// clients stand on the entity origins
+	for (i=1, j=0 ; i<ge->num_edicts && j<numclients ; i++)
+	{
+		ent = EDICT_NUM(i);
+		if (!ent->inuse)
+			continue;
+		VectorCopy (ent->s.origin, spots[j]);
+		j++;
+	}
+	if (!j)
+	{
+		Com_Printf ("No entities to place clients on.\n");
+		return;
+	}
+	for (i=j ; i<numclients ; i++)
+		VectorCopy (spots[i % j], spots[i]);
+
+	// without a recorded frame, multicast from the same spots
+	rec = sv_mcastrecord;
+	numrecord = sv_nummcastrecord;
+	if (!numrecord)
+	{
+		for (i=0 ; i<j && i<MAX_MCAST_RECORD ; i++)
+		{
+			VectorCopy (spots[i], fallback[i].origin);
+			fallback[i].to = (i & 1) ? MULTICAST_PHS : MULTICAST_PVS;
+		}
+		rec = fallback;
+		numrecord = i;
+	}
+
+	// one bsp descent per client per multicast
+	hits_old = 0;
+	start = System::Timer::Microseconds();
+	for (i=0 ; i<numcasts ; i++)
+	{
+		leafnum = CM_PointLeafnum (rec[i % numrecord].origin);
+		cluster = CM_LeafCluster (leafnum);
+		area = CM_LeafArea (leafnum);
+		if (rec[i % numrecord].to == MULTICAST_PHS || rec[i % numrecord].to == MULTICAST_PHS_R)
+			mask = CM_ClusterPHS (cluster);
+		else
+			mask = CM_ClusterPVS (cluster);
+
+		for (j=0 ; j<numclients ; j++)
+		{
+			leafnum = CM_PointLeafnum (spots[j]);
+			if (!CM_AreasConnected (area, CM_LeafArea (leafnum)))
+				continue;
+			if (!VIS_TEST(mask, CM_LeafCluster (leafnum)))
+				continue;
+			hits_old++;
+		}
+	}
+	time_old = System::Timer::Microseconds() - start;
+
+	// cached client leafs
+	memset (leafs, 0, sizeof(leafs));
+	hits_new = 0;
+	start = System::Timer::Microseconds();
+	for (i=0 ; i<numcasts ; i++)
+	{
+		leafnum = CM_PointLeafnum (rec[i % numrecord].origin);
+		cluster = CM_LeafCluster (leafnum);
+		area = CM_LeafArea (leafnum);
+		if (rec[i % numrecord].to == MULTICAST_PHS || rec[i % numrecord].to == MULTICAST_PHS_R)
+			mask = CM_ClusterPHS (cluster);
+		else
+			mask = CM_ClusterPVS (cluster);
+
+		for (j=0 ; j<numclients ; j++)
+		{
+			SV_MulticastLocate (&leafs[j], spots[j]);
+			if (!VIS_TEST(mask, leafs[j].cluster))
+				continue;
+			if (!CM_AreasConnected (area, leafs[j].area))
+				continue;
+			hits_new++;
+		}
+	}
+	time_new = System::Timer::Microseconds() - start;
+
+	Com_Printf ("%i multicasts from %i recorded origins, %i clients\n", numcasts, numrecord, numclients);
+	Com_Printf ("  per client lookup: %8.3f ms, %i sends\n", time_old / 1000.0, hits_old);
+	Com_Printf ("  cached lookup:     %8.3f ms, %i sends\n", time_new / 1000.0, hits_new);
+	if (hits_old != hits_new)
+		Com_Printf ("WARNING: recipient counts differ\n");
+}
+
 
 /*  
 ==================
@@ -396,23 +647,41 @@ FRAME UPDATES
 
 /*
 =======================
-SV_SendClientDatagram
+SV_NetchanTransmit
+
+Netchan_Transmit under the profiler
 =======================
 */
-qboolean SV_SendClientDatagram (client_t *client)
+static void SV_NetchanTransmit (netchan_t *chan, int32_t length, byte *data)
 {
-	byte		msg_buf[MAX_MSGLEN];
-	sizebuf_t	msg;
+	uint64_t	start = SV_ProfileBegin ();
 
-	SV_BuildClientFrame (client);
+	Netchan_Transmit (chan, length, data);
+	SV_ProfileEnd (PROF_TRANSMIT, start);
+}
 
-	SZ_Init (&msg, msg_buf, sizeof(msg_buf));
-	msg.allowoverflow = true;
+/*
+=======================
+SV_FlushDatagrams
+=======================
+*/
+static void SV_FlushDatagrams (void)
+{
+	uint64_t	start = SV_ProfileBegin ();
 
-	// send over all the relevant entity_state_t
-	// and the player_state_t
-	SV_WriteFrameToClient (client, &msg);
+	NET_FlushBatch (NS_SERVER);
+	SV_ProfileEnd (PROF_NETFLUSH, start);
+}
+
+/*
+=======================
+SV_TransmitClientDatagram
 
+Appends the multicast datagram to an already written frame and sends it
+=======================
+*/
+qboolean SV_TransmitClientDatagram (client_t *client, sizebuf_t *msg)
+{
 	// copy the accumulated multicast datagram
 	// for this client out to the message
 	// it is necessary for this to be after the WriteEntities
@@ -420,40 +689,122 @@ qboolean SV_SendClientDatagram (client_t *client)
 	if (client->datagram.overflowed)
 		Com_Printf (S_COLOR_YELLOW"WARNING: datagram overflowed for %s\n", client->name);
 	else
-		SZ_Write (&msg, client->datagram.data, client->datagram.cursize);
+		SZ_Write (msg, client->datagram.data, client->datagram.cursize);
 	SZ_Clear (&client->datagram);
 
-	if (msg.overflowed)
+	if (msg->overflowed)
 	{	// must have room left for the packet header
 		Com_Printf (S_COLOR_YELLOW"WARNING: msg overflowed for %s\n", client->name);
-		SZ_Clear (&msg);
+		SV_NetstatsEvent (client, "msgoverflow");
+		SZ_Clear (msg);
 	}
 
+	client->netstats.bytes = msg->cursize;
+	client->netstats.reliable = client->netchan.message.cursize;
+	SV_NetstatsFrame (client);
+
 	// send the datagram
-	Netchan_Transmit (&client->netchan, msg.cursize, msg.data);
+	SV_NetchanTransmit (&client->netchan, msg->cursize, msg->data);
 
 	// record the size for rate estimation
-	client->message_size[sv.framenum % RATE_MESSAGES] = msg.cursize;
+	client->message_size[sv.framenum % RATE_MESSAGES] += msg->cursize;
 
 	return true;
 }
 
 
+/*
+=======================
+SV_SendClientDatagram
+=======================
+*/
+qboolean SV_SendClientDatagram (client_t *client)
+{
+	byte		msg_buf[MAX_MSGLEN];
+	sizebuf_t	msg;
+
+	uint64_t	start;
+
+	start = SV_ProfileBegin ();
+	SV_BuildClientFrame (client);
+	SV_ProfileEnd (PROF_BUILDFRAME, start);
+
+	SZ_Init (&msg, msg_buf, sizeof(msg_buf));
+	msg.allowoverflow = true;
+
+	// send over all the relevant entity_state_t
+	// and the player_state_t
+	start = SV_ProfileBegin ();
+	SV_WriteFrameToClient (client, &msg);
+	SV_ProfileEnd (PROF_WRITEFRAME, start);
+
+	return SV_TransmitClientDatagram (client, &msg);
+}
+
+
 /*
 ==================
-SV_DemoCompleted
+SV_CloseDemo
 ==================
 */
-void SV_DemoCompleted (void)
+void SV_CloseDemo (void)
 {
 	if (sv.demofile)
 	{
 		FS_FCloseFile (sv.demofile);
 		sv.demofile = 0; // clear the file handle
 	}
+	if (sv.demokeys)
+		Z_Free (sv.demokeys);
+	sv.demokeys = NULL;
+	sv.numdemokeys = 0;
+	sv.demoresume = 0;
+	SV_MvdEndPlayback ();
+}
+
+/*
+==================
+SV_DemoCompleted
+==================
+*/
+void SV_DemoCompleted (void)
+{
+	SV_CloseDemo ();
 	SV_Nextserver ();
 }
 
+/*
+==================
+SV_ReadDemoMessage
+
+Returns the length of the next message, -1 at the end of the demo.
+The -1 that ends a keyframe goes back to the stream after it.
+==================
+*/
+static int32_t SV_ReadDemoMessage (byte *msgbuf)
+{
+	int32_t		msglen;
+
+	while (1)
+	{
+		if (FS_FRead (&msglen, 4, 1, sv.demofile) != 4)
+			return -1;
+		msglen = LittleLong (msglen);
+		if (msglen != -1)
+			break;
+		if (!sv.demoresume)
+			return -1;
+		FS_Seek (sv.demofile, sv.demoresume, FS_SEEK_SET);
+		sv.demoresume = 0;
+	}
+
+	if (msglen > MAX_MSGLEN)
+		Com_Error (ERR_DROP, "SV_SendClientMessages: msglen > MAX_MSGLEN");
+	if (FS_FRead (msgbuf, msglen, 1, sv.demofile) != msglen)
+		return -1;
+	return msglen;
+}
+
 
 /*
 =======================
@@ -481,14 +832,141 @@ qboolean SV_RateDrop (client_t *c)
 
 	if (total > c->rate)
 	{
+		// a thinned out frame beats a frozen view
+		if (SV_FrameBudget (c) >= FRAME_MIN_BYTES)
+			return false;
+
+		c->netstats.ratedrops++;
+		SV_NetstatsEvent (c, "ratedrop");
 		c->surpressCount++;
-		c->message_size[sv.framenum % RATE_MESSAGES] = 0;
 		return true;
 	}
 
 	return false;
 }
 
+/*
+=======================
+SV_FrameBudget
+
+Bytes this frame may use, or -1 when frames aren't fitted to the rate.
+Each frame gets its share of the rate plus half of what the frames
+before it left unused, or less by half what they went over, so a
+burst is paid back gradually instead of starving the next frames.
+=======================
+*/
+int32_t SV_FrameBudget (client_t *c)
+{
+	int32_t		total, share, budget;
+	int32_t		i;
+
+	if (!sv_entitypriority->value || c->netchan.remote_address.type == NA_LOOPBACK)
+		return -1;
+
+	total = 0;
+	for (i = 0 ; i < RATE_MESSAGES ; i++)
+		total += c->message_size[i];
+
+	share = c->rate / RATE_MESSAGES;
+	budget = share + (c->rate - share - total) / 2;
+	if (budget > 2 * share)
+		budget = 2 * share;
+	if (budget < 0)
+		budget = 0;
+	return budget;
+}
+
+typedef struct
+{
+	client_t	*client;
+	sizebuf_t	msg;
+} framejob_t;
+
+/*
+=======================
+SV_WriteClientFrameJob
+
+Runs on the worker pool, one call per client
+=======================
+*/
+static void SV_WriteClientFrameJob (int32_t index, void *data)
+{
+	framejob_t	*job = (framejob_t *)data + index;
+	uint64_t	start;
+
+	start = SV_ProfileBegin ();
+	SV_BuildClientFrame (job->client);
+	SV_ProfileEnd (PROF_BUILDFRAME, start);
+
+	start = SV_ProfileBegin ();
+	SV_WriteFrameToClient (job->client, &job->msg);
+	SV_ProfileEnd (PROF_WRITEFRAME, start);
+}
+
+/*
+=======================
+SV_SendClientMessagesThreaded
+
+Same result as the serial loop in SV_SendClientMessages, but frames are
+built and delta compressed on the worker pool first.  Everything that
+touches more than one client stays on this thread and runs in client
+order, so the packets are byte for byte what the serial path sends.
+Returns false without doing anything if the serial path has to be used.
+=======================
+*/
+qboolean SV_SendClientMessagesThreaded (void)
+{
+	int32_t		i;
+	client_t	*c;
+	framejob_t	jobs[MAX_CLIENTS];
+	framejob_t	*slot[MAX_CLIENTS];
+	int32_t		numjobs;
+
+	// dropping an overflowed client runs game code and prints to
+	// everyone else, which changes what later clients would see
+	for (i=0, c = svs.clients ; i<maxclients->value; i++, c++)
+	{
+		if (c->state && c->netchan.message.overflowed)
+			return false;
+	}
+
+	if (!svs.frame_msg_buf)
+		svs.frame_msg_buf = (byte*)Z_TagMalloc (maxclients->value*MAX_MSGLEN, TAG_SERVER);
+
+	// rate dropping only looks at the client's own history
+	numjobs = 0;
+	for (i=0, c = svs.clients ; i<maxclients->value; i++, c++)
+	{
+		slot[i] = NULL;
+		if (c->state != cs_spawned || SV_RateDrop (c))
+			continue;
+
+		slot[i] = &jobs[numjobs++];
+		slot[i]->client = c;
+		SZ_Init (&slot[i]->msg, svs.frame_msg_buf + i*MAX_MSGLEN, MAX_MSGLEN);
+		slot[i]->msg.allowoverflow = true;
+	}
+
+	System::Threads::ParallelFor (numjobs, SV_WriteClientFrameJob, jobs);
+
+	for (i=0, c = svs.clients ; i<maxclients->value; i++, c++)
+	{
+		if (!c->state)
+			continue;
+
+		if (slot[i])
+			SV_TransmitClientDatagram (c, &slot[i]->msg);
+		else if (c->state != cs_spawned)
+		{
+	// just update reliable	if needed
+			if (c->netchan.message.cursize || Game::Engine::GetTick() - c->netchan.last_sent > 1000)
+				SV_NetchanTransmit (&c->netchan, 0, NULL);
+		}
+	}
+
+	return true;
+}
+
 /*
 =======================
 SV_SendClientMessages
@@ -500,7 +978,6 @@ void SV_SendClientMessages (void)
 	client_t	*c;
 	int32_t			msglen;
 	byte		msgbuf[MAX_MSGLEN];
-	int32_t			r;
 
 	msglen = 0;
 
@@ -512,29 +989,40 @@ void SV_SendClientMessages (void)
 		else
 		{
 			// get the next message
-			r = FS_FRead (&msglen, 4, 1, sv.demofile);
-			if (r != 4)
-			{
-				SV_DemoCompleted ();
-				return;
-			}
-			msglen = LittleLong (msglen);
+			msglen = sv.mvd ? SV_MvdDemoMessage (msgbuf) : SV_ReadDemoMessage (msgbuf);
 			if (msglen == -1)
 			{
 				SV_DemoCompleted ();
 				return;
 			}
-			if (msglen > MAX_MSGLEN)
-				Com_Error (ERR_DROP, "SV_SendClientMessages: msglen > MAX_MSGLEN");
-			r = FS_FRead (msgbuf, msglen, 1, sv.demofile);
-			if (r != msglen)
-			{
-				SV_DemoCompleted ();
-				return;
-			}
 		}
 	}
 
+	if (sv_threads->modified)
+	{
+		sv_threads->modified = false;
+		System::Threads::Init ((sv_threads->value > 0) ? min(sv_threads->value, 64) : 0);
+	}
+
+	if (sv.state != ss_cinematic && sv.state != ss_demo && sv.state != ss_pic)
+		SV_PrepClientFrames ();
+
+	// every datagram of the frame goes out in one batch at the end
+	NET_BeginBatch (NS_SERVER);
+
+	// resend late download chunks, new ones go out as the acks come in
+	for (i=0, c = svs.clients ; i<maxclients->value; i++, c++)
+	{
+		if (c->dlwindow)
+			SV_SendDownloadChunks (c);
+	}
+
+	if (sv.state == ss_game && System::Threads::Workers() && SV_SendClientMessagesThreaded ())
+	{
+		SV_FlushDatagrams ();
+		return;
+	}
+
 	// send a message to each connected client
 	for (i=0, c = svs.clients ; i<maxclients->value; i++, c++)
 	{
@@ -546,6 +1034,7 @@ void SV_SendClientMessages (void)
 		{
 			SZ_Clear (&c->netchan.message);
 			SZ_Clear (&c->datagram);
+			SV_NetstatsEvent (c, "overflow");
 			SV_BroadcastPrintf (PRINT_HIGH, "%s overflowed\n", c->name);
 			SV_DropClient (c);
 		}
@@ -554,7 +1043,7 @@ void SV_SendClientMessages (void)
 			|| sv.state == ss_demo 
 			|| sv.state == ss_pic
 			)
-			Netchan_Transmit (&c->netchan, msglen, msgbuf);
+			SV_NetchanTransmit (&c->netchan, msglen, msgbuf);
 		else if (c->state == cs_spawned)
 		{
 			// don't overrun bandwidth
@@ -567,8 +1056,10 @@ void SV_SendClientMessages (void)
 		{
 	// just update reliable	if needed
 			if (c->netchan.message.cursize || Game::Engine::GetTick() - c->netchan.last_sent > 1000)
-				Netchan_Transmit (&c->netchan, 0, NULL);
+				SV_NetchanTransmit (&c->netchan, 0, NULL);
 		}
 	}
+
+	SV_FlushDatagrams ();
 }
 
@@ -41,10 +41,15 @@ static void SV_BeginDemoserver (void)
 {
 	char		name[MAX_OSPATH];
 
+	SV_CloseDemo ();
+
 	Com_sprintf (name, sizeof(name), "demos/%s", sv.name);
-	FS_FOpenFile (name, &sv.demofile, FS_READ);
+	sv.demosize = FS_FOpenFile (name, &sv.demofile, FS_READ);
 	if (!sv.demofile)
 		Com_Error (ERR_DROP, "Couldn't open %s\n", name);
+	sv.demobase = FS_Tell (sv.demofile);
+
+	SV_MvdBeginPlayback ();
 }
 
 /*
@@ -313,6 +318,13 @@ void SV_NextDownload_f (void)
 	if (!sv_client->download)
 		return;
 
+	// a windowed download has no use for nextdl, the client is giving up on it
+	if (sv_client->dlwindow)
+	{
+		SV_EndDownload (sv_client);
+		return;
+	}
+
 	r = sv_client->downloadsize - sv_client->downloadcount;
 	if (r > 1024)
 		r = 1024;
@@ -323,8 +335,9 @@ void SV_NextDownload_f (void)
 	sv_client->downloadcount += r;
 	size = sv_client->downloadsize;
 	if (!size)
-		size = 1;
-	percent = sv_client->downloadcount*100/size;
+		percent = 100;	// an empty file is done on its first message
+	else
+		percent = sv_client->downloadcount*100/size;
 	MSG_WriteByte (&sv_client->netchan.message, percent);
 	SZ_Write (&sv_client->netchan.message,
 		sv_client->download + sv_client->downloadcount - r, r);
@@ -332,8 +345,7 @@ void SV_NextDownload_f (void)
 	if (sv_client->downloadcount != sv_client->downloadsize)
 		return;
 
-	FS_FreeFile (sv_client->download);
-	sv_client->download = NULL;
+	SV_EndDownload (sv_client);
 }
 
 /*
@@ -440,24 +452,15 @@ void SV_BeginDownload_f(void)
 		return;
 	}
 
-	if (sv_client->download)
-		FS_FreeFile (sv_client->download);
+	SV_EndDownload (sv_client);
 
-	sv_client->downloadsize = FS_LoadFile (name, (void **)&sv_client->download);
-	sv_client->downloadcount = offset;
-
-	if (offset > sv_client->downloadsize)
-		sv_client->downloadcount = sv_client->downloadsize;
+	sv_client->downloadfile = SV_OpenDownloadFile (name);
 
 	// ZOID- special check for maps, if it came from a pak file, don't allow download  
-	if (!sv_client->download || (strncmp(name, "maps/", 5) == 0 && file_from_pak))
+	if (!sv_client->downloadfile || (strncmp(name, "maps/", 5) == 0 && sv_client->downloadfile->frompak))
 	{
 		Com_DPrintf ("Couldn't download %s to %s\n", name, sv_client->name);
-		if (sv_client->download)
-		{
-			FS_FreeFile (sv_client->download);
-			sv_client->download = NULL;
-		}
+		SV_EndDownload (sv_client);
 
 		MSG_WriteByte (&sv_client->netchan.message, svc_download);
 		MSG_WriteShort (&sv_client->netchan.message, -1);
@@ -465,7 +468,18 @@ void SV_BeginDownload_f(void)
 		return;
 	}
 
-	SV_NextDownload_f ();
+	sv_client->download = sv_client->downloadfile->data;
+	sv_client->downloadsize = sv_client->downloadfile->size;
+	sv_client->downloadcount = offset;
+
+	if (offset > sv_client->downloadsize)
+		sv_client->downloadcount = sv_client->downloadsize;
+
+	// newer clients can take the file as windowed datagrams
+	if (Cmd_Argc() > 3 && !Q_strcasecmp (Cmd_Argv(3), "window"))
+		SV_BeginWindowedDownload (sv_client);
+	else
+		SV_NextDownload_f ();
 	Com_DPrintf ("Downloading %s to %s\n", name, sv_client->name);
 }
 
@@ -686,27 +700,74 @@ void SV_ClientThink (client_t *cl, usercmd_t *cmd)
 #define	MAX_STRINGCMDS	8
 /*
 ===================
-SV_ExecuteClientMessage
+SV_ReadPacketString
+
+MSG_ReadString into the packet's own text, it may run on any thread
+===================
+*/
+static int32_t SV_ReadPacketString (sizebuf_t *msg, clientpacket_t *packet, int32_t *textsize)
+{
+	int32_t		l, c, start;
+
+	start = *textsize;
+	l = 0;
+	do
+	{
+		c = MSG_ReadChar (msg);
+		if (c == -1 || c == 0)
+			break;
+		packet->text[start+l] = c;
+		l++;
+	} while (l < 2047);
 
-The current net_message is parsed for the given client
+	packet->text[start+l] = 0;
+	*textsize = start + l + 1;
+
+	return start;
+}
+
+/*
+===================
+SV_AddPacketCommand
+
+Commands past the list are ignored and the parse goes on.  The last slot
+is kept for a PACKET_* failure, so a packet that fills the list and then
+turns out malformed still gets its client dropped.
 ===================
 */
-void SV_ExecuteClientMessage (client_t *cl)
+static void SV_AddPacketCommand (clientpacket_t *packet, int32_t type, int32_t text)
 {
-	int32_t		c;
-	char	*s;
+	if (packet->numcmds == MAX_PACKET_COMMANDS
+		|| (packet->numcmds == MAX_PACKET_COMMANDS-1 && type >= 0))
+		return;
+	packet->cmds[packet->numcmds].type = type;
+	packet->cmds[packet->numcmds].text = text;
+	packet->numcmds++;
+}
+
+/*
+===================
+SV_ParseClientMessage
 
+Decodes a queued packet into its command list without touching the
+client, so every queued packet can be parsed at once on the worker pool.
+The checksum uses the sequence the packet arrived with.
+===================
+*/
+void SV_ParseClientMessage (clientpacket_t *packet)
+{
+	sizebuf_t	msg;
 	usercmd_t	nullcmd;
-	usercmd_t	oldest, oldcmd, newcmd;
-	int32_t		net_drop;
+	int32_t		c, text, textsize;
 	int32_t		stringCmdCount;
-	int32_t		checksum, calculatedChecksum;
 	int32_t		checksumIndex;
 	qboolean	move_issued;
-	int32_t		lastframe;
 
-	sv_client = cl;
-	sv_player = sv_client->edict;
+	SZ_Init (&msg, packet->data, packet->length);
+	msg.cursize = packet->length;
+
+	packet->numcmds = 0;
+	textsize = 0;
 
 	// only allow one move command
 	move_issued = false;
@@ -714,30 +775,28 @@ void SV_ExecuteClientMessage (client_t *cl)
 
 	while (1)
 	{
-		if (net_message.readcount > net_message.cursize)
+		if (msg.readcount > msg.cursize)
 		{
-			Com_Printf ("SV_ReadClientMessage: badread\n");
-			SV_DropClient (cl);
+			SV_AddPacketCommand (packet, PACKET_BADREAD, 0);
 			return;
-		}	
+		}
 
-		c = MSG_ReadByte (&net_message);
+		c = MSG_ReadByte (&msg);
 		if (c == -1)
 			break;
-				
+
 		switch (c)
 		{
 		default:
-			Com_Printf ("SV_ReadClientMessage: unknown command char\n");
-			SV_DropClient (cl);
+			SV_AddPacketCommand (packet, PACKET_BADCOMMAND, 0);
 			return;
-						
+
 		case clc_nop:
 			break;
 
 		case clc_userinfo:
-			strncpy (cl->userinfo, MSG_ReadString (&net_message), sizeof(cl->userinfo)-1);
-			SV_UserinfoChanged (cl);
+			text = SV_ReadPacketString (&msg, packet, &textsize);
+			SV_AddPacketCommand (packet, clc_userinfo, text);
 			break;
 
 		case clc_move:
@@ -745,22 +804,91 @@ void SV_ExecuteClientMessage (client_t *cl)
 				return;		// someone is trying to cheat...
 
 			move_issued = true;
-			checksumIndex = net_message.readcount;
-			checksum = MSG_ReadByte (&net_message);
-			lastframe = MSG_ReadLong (&net_message);
-			if (lastframe != cl->lastframe) {
-				cl->lastframe = lastframe;
+			checksumIndex = msg.readcount;
+			packet->checksum = MSG_ReadByte (&msg);
+			packet->lastframe = MSG_ReadLong (&msg);
+
+			memset (&nullcmd, 0, sizeof(nullcmd));
+			MSG_ReadDeltaUsercmd (&msg, &nullcmd, &packet->oldest);
+			MSG_ReadDeltaUsercmd (&msg, &packet->oldest, &packet->oldcmd);
+			MSG_ReadDeltaUsercmd (&msg, &packet->oldcmd, &packet->newcmd);
+
+			packet->calculatedChecksum = COM_BlockSequenceCRCByte (
+				msg.data + checksumIndex + 1,
+				msg.readcount - checksumIndex - 1,
+				packet->sequence);
+
+			SV_AddPacketCommand (packet, clc_move, 0);
+			break;
+
+		case clc_stringcmd:	
+			text = SV_ReadPacketString (&msg, packet, &textsize);
+
+			// malicious users may try using too many string commands
+			if (++stringCmdCount < MAX_STRINGCMDS)
+			{
+				SV_AddPacketCommand (packet, clc_stringcmd, text);
+			}
+			break;
+
+		case clc_downloadack:
+			// left in the packet data, text is its offset there
+			text = msg.readcount;
+			MSG_ReadLong (&msg);
+			c = MSG_ReadByte (&msg);
+			if (c > 0)
+				msg.readcount += c;		// past the end is caught as a badread
+			SV_AddPacketCommand (packet, clc_downloadack, text);
+			break;
+		}
+	}
+}
+
+/*
+===================
+SV_ExecuteClientMessage
+
+Runs the commands SV_ParseClientMessage read out of a packet
+===================
+*/
+void SV_ExecuteClientMessage (clientpacket_t *packet)
+{
+	client_t	*cl = packet->client;
+	packetcmd_t	*cmd;
+	int32_t		i;
+	int32_t		net_drop;
+
+	sv_client = cl;
+	sv_player = sv_client->edict;
+
+	for (i=0, cmd=packet->cmds ; i<packet->numcmds ; i++, cmd++)
+	{
+		switch (cmd->type)
+		{
+		case PACKET_BADREAD:
+			Com_Printf ("SV_ReadClientMessage: badread\n");
+			SV_DropClient (cl);
+			return;
+
+		case PACKET_BADCOMMAND:
+			Com_Printf ("SV_ReadClientMessage: unknown command char\n");
+			SV_DropClient (cl);
+			return;
+
+		case clc_userinfo:
+			strncpy (cl->userinfo, packet->text + cmd->text, sizeof(cl->userinfo)-1);
+			SV_UserinfoChanged (cl);
+			break;
+
+		case clc_move:
+			if (packet->lastframe != cl->lastframe) {
+				cl->lastframe = packet->lastframe;
 				if (cl->lastframe > 0) {
 					cl->frame_latency[cl->lastframe&(LATENCY_COUNTS-1)] = 
 						svs.realtime - cl->frames[cl->lastframe & UPDATE_MASK].senttime;
 				}
 			}
 
-			memset (&nullcmd, 0, sizeof(nullcmd));
-			MSG_ReadDeltaUsercmd (&net_message, &nullcmd, &oldest);
-			MSG_ReadDeltaUsercmd (&net_message, &oldest, &oldcmd);
-			MSG_ReadDeltaUsercmd (&net_message, &oldcmd, &newcmd);
-
 			if ( cl->state != cs_spawned )
 			{
 				cl->lastframe = -1;
@@ -768,22 +896,17 @@ void SV_ExecuteClientMessage (client_t *cl)
 			}
 
 			// if the checksum fails, ignore the rest of the packet
-			calculatedChecksum = COM_BlockSequenceCRCByte (
-				net_message.data + checksumIndex + 1,
-				net_message.readcount - checksumIndex - 1,
-				cl->netchan.incoming_sequence);
-
-			if (calculatedChecksum != checksum)
+			if (packet->calculatedChecksum != packet->checksum)
 			{
 				Com_DPrintf ("Failed command checksum for %s (%d != %d)/%d\n", 
-					cl->name, calculatedChecksum, checksum, 
-					cl->netchan.incoming_sequence);
+					cl->name, packet->calculatedChecksum, packet->checksum, 
+					packet->sequence);
 				return;
 			}
 
 			if (!sv_paused->value)
 			{
-				net_drop = cl->netchan.dropped;
+				net_drop = packet->dropped;
 				if (net_drop < 20)
 				{
 
@@ -797,28 +920,28 @@ void SV_ExecuteClientMessage (client_t *cl)
 						net_drop--;
 					}
 					if (net_drop > 1)
-						SV_ClientThink (cl, &oldest);
+						SV_ClientThink (cl, &packet->oldest);
 
 					if (net_drop > 0)
-						SV_ClientThink (cl, &oldcmd);
+						SV_ClientThink (cl, &packet->oldcmd);
 
 				}
-				SV_ClientThink (cl, &newcmd);
+				SV_ClientThink (cl, &packet->newcmd);
 			}
 
-			cl->lastcmd = newcmd;
+			cl->lastcmd = packet->newcmd;
 			break;
 
 		case clc_stringcmd:	
-			s = MSG_ReadString (&net_message);
-
-			// malicious users may try using too many string commands
-			if (++stringCmdCount < MAX_STRINGCMDS)
-				SV_ExecuteUserCommand (s);
+			SV_ExecuteUserCommand (packet->text + cmd->text);
 
 			if (cl->state == cs_zombie)
 				return;	// disconnect command
 			break;
+
+		case clc_downloadack:
+			SV_DownloadAck (cl, packet->data + cmd->text, packet->length - cmd->text);
+			break;
 		}
 	}
 }
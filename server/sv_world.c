@@ -19,6 +19,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // world.c -- world query functions
 
+#include "../../Source/SystemThreads.h"
+#include "../../Source/SystemTimer.h"
+
 #include "server.h"
 
 /*
@@ -44,21 +47,85 @@ typedef struct areanode_s
 	struct areanode_s	*children[2];
 	link_t	trigger_edicts;
 	link_t	solid_edicts;
+
+	vec3_t	mins, maxs;		// space covered by the node
+	int32_t	numedicts;		// links since the last count, unlinks are not seen
+	int32_t	splitcount;		// numedicts that makes a leaf count and try to split
 } areanode_t;
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	32
+/*
+The tree starts as a uniform subdivision of the world down to leafs about
+AREA_LEAF_SIZE across, then any leaf that fills up with more than
+AREA_SPLIT_EDICTS edicts is split at their median, so crowded rooms get
+deep branches and empty space stays shallow.  An edict always sits in
+the deepest node its box fits wholly inside, which is all SV_AreaEdicts
+relies on, so the result sets do not depend on the shape of the tree.
+*/
+#define	AREA_DEPTH			4		// minimum depth of the uniform part, the old fixed tree
+#define	AREA_MAX_DEPTH		8		// at most 256 uniform leafs, the rest is left for splits
+#define	AREA_NODES			2048
+#define	AREA_LEAF_SIZE		1024
+#define	AREA_MIN_SIZE		128		// leafs narrower than this on every axis never split
+#define	AREA_SPLIT_EDICTS	24
 
 static areanode_t  sv_areanodes[AREA_NODES];
 static int32_t         sv_numareanodes;
+static qboolean		sv_areasplit;		// false builds the old fixed tree, for sv_areabench
 
-static const float   *area_mins, *area_maxs;
-static edict_t **area_list;
-static int32_t     area_count, area_maxcount;
-static int32_t     area_type;
+// one SV_AreaEdicts walk, kept off the globals so batched traces
+// can query from the worker threads
+typedef struct
+{
+	const float	*mins, *maxs;
+	edict_t		**list;
+	int32_t		count, maxcount;
+	int32_t		type;
+} areaquery_t;
 
 static int32_t SV_HullForEntity( const edict_t *ent );
 
+// cluster index, see SV_LinkEdictClusters
+static link_t	*sv_clusterlists;			// [sv_numclusterlists]
+static int32_t	sv_numclusterlists;
+static link_t	sv_headnode_edicts;			// num_clusters == -1, checked by headnode
+static link_t	*sv_clusterlinks;			// [max_edicts*MAX_ENT_CLUSTERS]
+
+#define	NUM_FROM_CLUSTERLINK(l) ((int32_t)(((l) - sv_clusterlinks) / MAX_ENT_CLUSTERS))
+
+
+/*
+The game repeats identical traces within a frame: visible() checks, bottom
+probes and step tests.  With sv_tracecache set SV_Trace remembers what it
+returned until the frame ends or anything is linked or unlinked, and the
+world part alone until the frame ends.
+*/
+#define	TRACE_MEMO_SIZE		1024		// direct mapped, power of two
+
+typedef struct
+{
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	edict_t		*passedict;
+	int32_t		contentmask;
+} tracekey_t;
+
+typedef struct
+{
+	tracekey_t	key;
+	uint32_t	framestamp;		// world is good while this matches sv_memoframe
+	uint32_t	linkstamp;		// trace is good while this matches sv_memolinks too
+	trace_t		world;
+	trace_t		trace;
+} tracememo_t;
+
+static tracememo_t	sv_tracememo[TRACE_MEMO_SIZE];
+static uint32_t		sv_memoframe = 1;
+static uint32_t		sv_memolinks = 1;
+
+int32_t		c_memo_lookups, c_memo_hits, c_memo_worldhits;	// for showtrace
+
+// any change to the area tree can change a trace against entities
+#define	SV_TraceMemoChanged()	(sv_memolinks++)
 
 // ClearLink is used for new headnodes
 inline void ClearLink(link_t *l)
@@ -80,6 +147,30 @@ inline void InsertLinkBefore(link_t *l, link_t *before)
 	l->next->prev = l;
 }
 
+/*
+===============
+SV_AllocAreaNode
+===============
+*/
+static areanode_t *SV_AllocAreaNode (const vec3_t mins, const vec3_t maxs)
+{
+	areanode_t	*anode;
+
+	anode = &sv_areanodes[sv_numareanodes];
+	sv_numareanodes++;
+
+	ClearLink (&anode->trigger_edicts);
+	ClearLink (&anode->solid_edicts);
+	anode->axis = -1;
+	anode->children[0] = anode->children[1] = NULL;
+	VectorCopy (mins, anode->mins);
+	VectorCopy (maxs, anode->maxs);
+	anode->numedicts = 0;
+	anode->splitcount = AREA_SPLIT_EDICTS;
+
+	return anode;
+}
+
 /*
 ===============
 SV_CreateAreaNode
@@ -93,18 +184,9 @@ static areanode_t *SV_CreateAreaNode( int32_t depth, const vec3_t mins, const ve
 	vec3_t		size;
 	vec3_t		mins1, maxs1, mins2, maxs2;
 
-	anode = &sv_areanodes[sv_numareanodes];
-	sv_numareanodes++;
-
-	ClearLink (&anode->trigger_edicts);
-	ClearLink (&anode->solid_edicts);
-	
-	if (depth == AREA_DEPTH)
-	{
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
+	anode = SV_AllocAreaNode (mins, maxs);
+	if (!depth)
 		return anode;
-	}
 	
 	VectorSubtract (maxs, mins, size);
 	if (size[0] > size[1])
@@ -120,23 +202,169 @@ static areanode_t *SV_CreateAreaNode( int32_t depth, const vec3_t mins, const ve
 	
 	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
 	
-	anode->children[0] = SV_CreateAreaNode (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateAreaNode (depth+1, mins1, maxs1);
+	anode->children[0] = SV_CreateAreaNode (depth-1, mins2, maxs2);
+	anode->children[1] = SV_CreateAreaNode (depth-1, mins1, maxs1);
 
 	return anode;
 }
 
 /*
 ===============
-SV_ClearWorld
+SV_AreaTreeDepth
 
+Levels of uniform subdivision that bring the world down to leafs of
+about AREA_LEAF_SIZE, each level halving the longer horizontal axis
 ===============
 */
-void SV_ClearWorld (void)
+static int32_t SV_AreaTreeDepth (const vec3_t mins, const vec3_t maxs)
+{
+	float		x, y;
+	int32_t		depth;
+
+	x = maxs[0] - mins[0];
+	y = maxs[1] - mins[1];
+	for (depth=0 ; depth<AREA_MAX_DEPTH ; depth++)
+	{
+		if (depth >= AREA_DEPTH && x <= AREA_LEAF_SIZE && y <= AREA_LEAF_SIZE)
+			break;
+		if (x > y)
+			x *= 0.5;
+		else
+			y *= 0.5;
+	}
+	return depth;
+}
+
+/*
+===============
+SV_BuildAreaTree
+===============
+*/
+static void SV_BuildAreaTree (const vec3_t mins, const vec3_t maxs, qboolean adaptive)
 {
 	memset (sv_areanodes, 0, sizeof(sv_areanodes));
 	sv_numareanodes = 0;
-	SV_CreateAreaNode (0, sv.models[1]->mins, sv.models[1]->maxs);
+	sv_areasplit = adaptive;
+	SV_CreateAreaNode (adaptive ? SV_AreaTreeDepth (mins, maxs) : AREA_DEPTH, mins, maxs);
+}
+
+/*
+===============
+SV_ClearWorld
+
+===============
+*/
+void SV_ClearWorld (void)
+{
+	int32_t		i;
+
+	SV_BuildAreaTree (sv.models[1]->mins, sv.models[1]->maxs, true);
+	SV_TraceMemoFrame ();		// keys hold edicts of the last map
+
+	// the cluster count changes with the map
+	if (sv_clusterlists)
+		Z_Free (sv_clusterlists);
+	if (sv_clusterlinks)
+		Z_Free (sv_clusterlinks);
+
+	sv_numclusterlists = CM_NumClusters ();
+	sv_clusterlists = (link_t*)Z_TagMalloc (sizeof(link_t)*max(sv_numclusterlists, 1), TAG_SERVER);
+	for (i=0 ; i<sv_numclusterlists ; i++)
+		ClearLink (&sv_clusterlists[i]);
+	ClearLink (&sv_headnode_edicts);
+
+	// zeroed, so a NULL prev means the slot is not in any list
+	sv_clusterlinks = (link_t*)Z_TagMalloc (sizeof(link_t)*ge->max_edicts*MAX_ENT_CLUSTERS, TAG_SERVER);
+}
+
+
+/*
+===============
+SV_LinkEdictClusters
+
+Keeps the inverted index from PVS cluster to entities in step with
+clusternums[].  Nothing is removed on unlink or when the game frees an
+edict, because SV_BuildClientFrame still honours whatever clusternums
+are left behind, so the index is only ever a superset and users must
+test the entity itself.
+===============
+*/
+static void SV_LinkEdictClusters (edict_t *ent)
+{
+	link_t		*links;
+	int32_t			i;
+
+	if (!sv_clusterlinks)
+		return;
+
+	// clusters past the map's lists leave holes, so check every slot
+	links = sv_clusterlinks + NUM_FOR_EDICT(ent)*MAX_ENT_CLUSTERS;
+	for (i=0 ; i<MAX_ENT_CLUSTERS ; i++)
+	{
+		if (!links[i].prev)
+			continue;
+		RemoveLink (&links[i]);
+		links[i].prev = links[i].next = NULL;
+	}
+
+	if (ent->num_clusters == -1)
+	{
+		InsertLinkBefore (&links[0], &sv_headnode_edicts);
+		return;
+	}
+
+	for (i=0 ; i<ent->num_clusters ; i++)
+	{
+		if (ent->clusternums[i] >= sv_numclusterlists)
+			continue;
+		InsertLinkBefore (&links[i], &sv_clusterlists[ent->clusternums[i]]);
+	}
+}
+
+
+/*
+===============
+SV_MarkClusterEdicts
+
+Sets the bit in edictbits for every entity indexed under a cluster set
+in visbits, and for every entity that has to be checked by headnode.
+Read only, so any number of client frames can call it at once.
+===============
+*/
+void SV_MarkClusterEdicts (byte *visbits, byte *edictbits)
+{
+	link_t		*l, *start;
+	int32_t			c, e;
+
+	for (c=0 ; c<sv_numclusterlists ; c++)
+	{
+		if (!(c & 511) && !Vis_AnySet (visbits + (c>>3), min(64, (sv_numclusterlists-c+7)>>3)))
+		{
+			c += 511;	// nothing visible in this block of 512
+			continue;
+		}
+		if (!visbits[c>>3])
+		{
+			c |= 7;		// skip the rest of this byte
+			continue;
+		}
+		if (!VIS_TEST(visbits, c))
+			continue;
+
+		start = &sv_clusterlists[c];
+		for (l=start->next ; l != start ; l = l->next)
+		{
+			e = NUM_FROM_CLUSTERLINK(l);
+			VIS_SET(edictbits, e);
+		}
+	}
+
+	start = &sv_headnode_edicts;
+	for (l=start->next ; l != start ; l = l->next)
+	{
+		e = NUM_FROM_CLUSTERLINK(l);
+		VIS_SET(edictbits, e);
+	}
 }
 
 
@@ -150,11 +378,196 @@ void SV_UnlinkEdict (edict_t *ent)
 {
 	if (!ent->area.prev)
 		return;		// not linked in anywhere
+	SV_TraceMemoChanged ();
 	RemoveLink (&ent->area);
 	ent->area.prev = ent->area.next = NULL;
 }
 
 
+/*
+===============
+SV_CountAreaLinks
+===============
+*/
+static int32_t SV_CountAreaLinks (const link_t *list)
+{
+	const link_t	*l;
+	int32_t		count;
+
+	count = 0;
+	for (l=list->next ; l != list ; l = l->next)
+		count++;
+	return count;
+}
+
+/*
+===============
+SV_AreaSplitScore
+
+How many of the leaf's edicts a split at dist would move into the children
+===============
+*/
+static int32_t SV_AreaSplitScore (const areanode_t *node, int32_t axis, float dist)
+{
+	const link_t	*lists[2] = { &node->solid_edicts, &node->trigger_edicts };
+	const link_t	*l;
+	const edict_t	*check;
+	int32_t		i, moved;
+
+	moved = 0;
+	for (i=0 ; i<2 ; i++)
+	{
+		for (l=lists[i]->next ; l != lists[i] ; l = l->next)
+		{
+			check = EDICT_FROM_AREA(l);
+			if (check->absmin[axis] > dist || check->absmax[axis] < dist)
+				moved++;
+		}
+	}
+	return moved;
+}
+
+static int SV_AreaFloatCompare (const void *a, const void *b)
+{
+	float	fa = *(const float *)a;
+	float	fb = *(const float *)b;
+
+	return (fa > fb) - (fa < fb);
+}
+
+/*
+===============
+SV_SplitAreaNode
+
+Turns a crowded leaf into a node with two leaf children, split across its
+longest axis at the median of the edict centers, or at the middle if
+that moves more of them out of the node.  A leaf that can't be split
+usefully waits until it holds twice as many before trying again.
+===============
+*/
+static void SV_SplitAreaNode (areanode_t *node)
+{
+	static float	centers[MAX_EDICTS];
+	areanode_t	*child;
+	link_t		*lists[2] = { &node->solid_edicts, &node->trigger_edicts };
+	link_t		*l, *next;
+	edict_t		*check;
+	vec3_t		size, mins, maxs;
+	float		dist, mid;
+	int32_t		i, axis, count, moved;
+
+	count = SV_CountAreaLinks (&node->solid_edicts) + SV_CountAreaLinks (&node->trigger_edicts);
+	node->numedicts = count;
+	if (count <= AREA_SPLIT_EDICTS)
+		return;		// it was mostly unlinks
+
+	node->splitcount = count * 2;
+	if (sv_numareanodes + 2 > AREA_NODES)
+		return;
+
+	VectorSubtract (node->maxs, node->mins, size);
+	axis = (size[0] >= size[1]) ? 0 : 1;
+	if (size[2] > size[axis])
+		axis = 2;
+	if (size[axis] < AREA_MIN_SIZE)
+		return;
+
+	count = 0;
+	for (i=0 ; i<2 ; i++)
+	{
+		for (l=lists[i]->next ; l != lists[i] ; l = l->next)
+		{
+			check = EDICT_FROM_AREA(l);
+			centers[count++] = 0.5 * (check->absmin[axis] + check->absmax[axis]);
+		}
+	}
+	qsort (centers, count, sizeof(centers[0]), SV_AreaFloatCompare);
+
+	// keep both children at least half of AREA_MIN_SIZE wide
+	dist = centers[count/2];
+	if (dist < node->mins[axis] + AREA_MIN_SIZE/2)
+		dist = node->mins[axis] + AREA_MIN_SIZE/2;
+	if (dist > node->maxs[axis] - AREA_MIN_SIZE/2)
+		dist = node->maxs[axis] - AREA_MIN_SIZE/2;
+
+	mid = 0.5 * (node->mins[axis] + node->maxs[axis]);
+	moved = SV_AreaSplitScore (node, axis, dist);
+	if (SV_AreaSplitScore (node, axis, mid) > moved)
+	{
+		dist = mid;
+		moved = SV_AreaSplitScore (node, axis, mid);
+	}
+	if (moved < count/2)
+		return;		// most of them would straddle the plane anyway
+
+	node->axis = axis;
+	node->dist = dist;
+
+	VectorCopy (node->mins, mins);
+	VectorCopy (node->maxs, maxs);
+	mins[axis] = dist;
+	node->children[0] = SV_AllocAreaNode (mins, node->maxs);
+	maxs[axis] = dist;
+	node->children[1] = SV_AllocAreaNode (node->mins, maxs);
+
+	// move everything that fits on one side, the same test SV_LinkAreaEdict uses
+	node->numedicts = 0;
+	for (i=0 ; i<2 ; i++)
+	{
+		for (l=lists[i]->next ; l != lists[i] ; l = next)
+		{
+			next = l->next;
+			check = EDICT_FROM_AREA(l);
+			if (check->absmin[axis] > dist)
+				child = node->children[0];
+			else if (check->absmax[axis] < dist)
+				child = node->children[1];
+			else
+				continue;
+			RemoveLink (l);
+			InsertLinkBefore (l, i ? &child->trigger_edicts : &child->solid_edicts);
+			child->numedicts++;
+		}
+	}
+}
+
+/*
+===============
+SV_LinkAreaEdict
+
+Links ent into the deepest area node its box fits inside
+===============
+*/
+static void SV_LinkAreaEdict (edict_t *ent)
+{
+	areanode_t	*node;
+
+// find the first node that the ent's box crosses
+	node = sv_areanodes;
+	while (1)
+	{
+		if (node->axis == -1)
+			break;
+		if (ent->absmin[node->axis] > node->dist)
+			node = node->children[0];
+		else if (ent->absmax[node->axis] < node->dist)
+			node = node->children[1];
+		else
+			break;		// crosses the node
+	}
+	
+	// link it in	
+	if (ent->solid == SOLID_TRIGGER)
+		InsertLinkBefore (&ent->area, &node->trigger_edicts);
+	else
+		InsertLinkBefore (&ent->area, &node->solid_edicts);
+	SV_TraceMemoChanged ();
+
+	if (node->axis == -1 && ++node->numedicts > node->splitcount && sv_areasplit)
+		SV_SplitAreaNode (node);
+}
+
+
 /*
 ===============
 SV_LinkEdict
@@ -164,7 +577,6 @@ SV_LinkEdict
 #define MAX_TOTAL_ENT_LEAFS		128
 void SV_LinkEdict (edict_t *ent)
 {
-	areanode_t	*node;
 	int32_t			leafs[MAX_TOTAL_ENT_LEAFS];
 	int32_t			clusters[MAX_TOTAL_ENT_LEAFS];
 	int32_t			num_leafs;
@@ -311,6 +723,7 @@ void SV_LinkEdict (edict_t *ent)
 			}
 		}
 	}
+	SV_LinkEdictClusters (ent);
 
 	// if first time, make sure old_origin is valid
 	if (!ent->linkcount)
@@ -322,26 +735,7 @@ void SV_LinkEdict (edict_t *ent)
 	if (ent->solid == SOLID_NOT)
 		return;
 
-// find the first node that the ent's box crosses
-	node = sv_areanodes;
-	while (1)
-	{
-		if (node->axis == -1)
-			break;
-		if (ent->absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if (ent->absmax[node->axis] < node->dist)
-			node = node->children[1];
-		else
-			break;		// crosses the node
-	}
-	
-	// link it in	
-	if (ent->solid == SOLID_TRIGGER)
-		InsertLinkBefore (&ent->area, &node->trigger_edicts);
-	else
-		InsertLinkBefore (&ent->area, &node->solid_edicts);
-
+	SV_LinkAreaEdict (ent);
 }
 
 
@@ -351,16 +745,13 @@ SV_AreaEdicts_r
 
 ====================
 */
-void SV_AreaEdicts_r (areanode_t *node)
+static void SV_AreaEdicts_r (areaquery_t *query, areanode_t *node)
 {
 	link_t		*l, *next, *start;
 	edict_t		*check;
-	int32_t			count;
-
-	count = 0;
 
 	// touch linked edicts
-	if (area_type == AREA_SOLID)
+	if (query->type == AREA_SOLID)
 		start = &node->solid_edicts;
 	else
 		start = &node->trigger_edicts;
@@ -372,52 +763,57 @@ void SV_AreaEdicts_r (areanode_t *node)
 
 		if (check->solid == SOLID_NOT)
 			continue;		// deactivated
-		if (check->absmin[0] > area_maxs[0]
-		|| check->absmin[1] > area_maxs[1]
-		|| check->absmin[2] > area_maxs[2]
-		|| check->absmax[0] < area_mins[0]
-		|| check->absmax[1] < area_mins[1]
-		|| check->absmax[2] < area_mins[2])
+		if (check->absmin[0] > query->maxs[0]
+		|| check->absmin[1] > query->maxs[1]
+		|| check->absmin[2] > query->maxs[2]
+		|| check->absmax[0] < query->mins[0]
+		|| check->absmax[1] < query->mins[1]
+		|| check->absmax[2] < query->mins[2])
 			continue;		// not touching
 
-		if (area_count == area_maxcount)
+		if (query->count == query->maxcount)
 		{
 			Com_Printf ("SV_AreaEdicts: MAXCOUNT\n");
 			return;
 		}
 
-		area_list[area_count] = check;
-		area_count++;
+		query->list[query->count] = check;
+		query->count++;
 	}
 	
 	if (node->axis == -1)
 		return;		// terminal node
 
 	// recurse down both sides
-	if ( area_maxs[node->axis] > node->dist )
-		SV_AreaEdicts_r ( node->children[0] );
-	if ( area_mins[node->axis] < node->dist )
-		SV_AreaEdicts_r ( node->children[1] );
+	if ( query->maxs[node->axis] > node->dist )
+		SV_AreaEdicts_r ( query, node->children[0] );
+	if ( query->mins[node->axis] < node->dist )
+		SV_AreaEdicts_r ( query, node->children[1] );
 }
 
 /*
 ================
 SV_AreaEdicts
+
+Only reads the area nodes, so any thread may call it while nothing
+is being linked
 ================
 */
 int32_t SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list,
 	int32_t maxcount, int32_t areatype)
 {
-	area_mins = mins;
-	area_maxs = maxs;
-	area_list = list;
-	area_count = 0;
-	area_maxcount = maxcount;
-	area_type = areatype;
+	areaquery_t	query;
+
+	query.mins = mins;
+	query.maxs = maxs;
+	query.list = list;
+	query.count = 0;
+	query.maxcount = maxcount;
+	query.type = areatype;
 
-	SV_AreaEdicts_r (sv_areanodes);
+	SV_AreaEdicts_r (&query, sv_areanodes);
 
-	return area_count;
+	return query.count;
 }
 
 
@@ -510,21 +906,21 @@ static int32_t SV_HullForEntity( const edict_t *ent )
 
 /*
 ====================
-SV_ClipMoveToEntities
+SV_ClipMoveToTouchList
 
+The list may hold edicts outside the move's bounds, those are skipped
+with the same test SV_AreaEdicts uses, so a list gathered for a whole
+batch of moves gives each one the result of its own query
 ====================
 */
-void SV_ClipMoveToEntities ( moveclip_t *clip )
+static void SV_ClipMoveToTouchList ( moveclip_t *clip, edict_t **touchlist, int32_t num )
 {
-	int32_t			i, num;
-	edict_t		*touchlist[MAX_EDICTS], *touch;
+	int32_t			i;
+	edict_t		*touch;
 	trace_t		trace;
 	int32_t			headnode;
 	float		*angles;
 
-	num = SV_AreaEdicts (clip->boxmins, clip->boxmaxs, touchlist
-		, MAX_EDICTS, AREA_SOLID);
-
 	// be careful, it is possible to have an entity in this
 	// list removed before we get to it (killtriggered)
 	for (i=0 ; i<num ; i++)
@@ -532,6 +928,13 @@ void SV_ClipMoveToEntities ( moveclip_t *clip )
 		touch = touchlist[i];
 		if (touch->solid == SOLID_NOT)
 			continue;
+		if (touch->absmin[0] > clip->boxmaxs[0]
+		|| touch->absmin[1] > clip->boxmaxs[1]
+		|| touch->absmin[2] > clip->boxmaxs[2]
+		|| touch->absmax[0] < clip->boxmins[0]
+		|| touch->absmax[1] < clip->boxmins[1]
+		|| touch->absmax[2] < clip->boxmins[2])
+			continue;
 		if (touch == clip->passedict)
 			continue;
 		if (clip->trace.allsolid)
@@ -580,6 +983,23 @@ void SV_ClipMoveToEntities ( moveclip_t *clip )
 	}
 }
 
+/*
+====================
+SV_ClipMoveToEntities
+
+====================
+*/
+void SV_ClipMoveToEntities ( moveclip_t *clip )
+{
+	int32_t			num;
+	edict_t		*touchlist[MAX_EDICTS];
+
+	num = SV_AreaEdicts (clip->boxmins, clip->boxmaxs, touchlist
+		, MAX_EDICTS, AREA_SOLID);
+
+	SV_ClipMoveToTouchList (clip, touchlist, num);
+}
+
 
 /*
 ==================
@@ -611,6 +1031,59 @@ boxmaxs[0] = boxmaxs[1] = boxmaxs[2] = 9999;
 #endif
 }
 
+/*
+==================
+SV_TraceMemoFrame
+==================
+*/
+void SV_TraceMemoFrame (void)
+{
+	sv_memoframe++;
+	SV_TraceMemoChanged ();
+}
+
+/*
+==================
+SV_TraceMemoFind
+
+Returns the memo slot for the trace, claiming it with a stale stamp
+when it holds some other trace
+==================
+*/
+static tracememo_t *SV_TraceMemoFind (const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end,
+	edict_t *passedict, int32_t contentmask)
+{
+	tracekey_t	key;
+	tracememo_t	*memo;
+	const uint32_t	*words;
+	uint32_t	hash;
+	int32_t		i;
+
+	memset (&key, 0, sizeof(key));		// no stray padding in the compare
+	VectorCopy (start, key.start);
+	VectorCopy (end, key.end);
+	VectorCopy (mins, key.mins);
+	VectorCopy (maxs, key.maxs);
+	key.passedict = passedict;
+	key.contentmask = contentmask;
+
+	// FNV-1a over the whole key
+	words = (const uint32_t *)&key;
+	hash = 2166136261u;
+	for (i=0 ; i<(int32_t)(sizeof(key)/4) ; i++)
+		hash = (hash ^ words[i]) * 16777619u;
+
+	c_memo_lookups++;
+	memo = &sv_tracememo[(hash ^ (hash >> 16)) & (TRACE_MEMO_SIZE-1)];
+	if (memcmp (&memo->key, &key, sizeof(key)))
+	{
+		memo->key = key;
+		memo->framestamp = 0;
+		memo->linkstamp = 0;
+	}
+	return memo;
+}
+
 /*
 ==================
 SV_Trace
@@ -624,19 +1097,55 @@ Passedict and edicts owned by passedict are explicitly not checked.
 trace_t SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *passedict, int32_t contentmask)
 {
 	moveclip_t	clip;
+	tracememo_t	*memo;
+	qboolean	knownworld;
 
 	if (!mins)
 		mins = vec3_origin;
 	if (!maxs)
 		maxs = vec3_origin;
 
+	memo = NULL;
+	knownworld = false;
+	if (sv_tracecache->value)
+	{
+		memo = SV_TraceMemoFind (start, mins, maxs, end, passedict, contentmask);
+		if (memo->framestamp == sv_memoframe)
+		{
+			if (memo->linkstamp == sv_memolinks)
+			{
+				c_memo_hits++;
+				return memo->trace;
+			}
+			c_memo_worldhits++;
+			knownworld = true;
+		}
+	}
+
 	memset ( &clip, 0, sizeof ( moveclip_t ) );
 
 	// clip to world
-	clip.trace = CM_BoxTrace (start, end, mins, maxs, 0, contentmask);
-	clip.trace.ent = ge->edicts;
+	if (knownworld)
+		clip.trace = memo->world;
+	else
+	{
+		clip.trace = CM_BoxTrace (start, end, mins, maxs, 0, contentmask);
+		clip.trace.ent = ge->edicts;
+		if (memo)
+		{
+			memo->world = clip.trace;
+			memo->framestamp = sv_memoframe;
+		}
+	}
 	if (clip.trace.fraction == 0)
+	{
+		if (memo)
+		{
+			memo->trace = clip.trace;
+			memo->linkstamp = sv_memolinks;
+		}
 		return clip.trace;		// blocked by the world
+	}
 
 	clip.contentmask = contentmask;
 	clip.start = start;
@@ -654,6 +1163,259 @@ trace_t SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *p
 	// clip to other solid entities
 	SV_ClipMoveToEntities ( &clip );
 
+	if (memo)
+	{
+		memo->trace = clip.trace;
+		memo->linkstamp = sv_memolinks;
+	}
 	return clip.trace;
 }
 
+typedef struct
+{
+	tracejob_t	*jobs;
+	int32_t		count;
+} tracebatch_t;
+
+/*
+==================
+SV_TraceBatchJob
+
+Clips one group of up to TRACE_BATCH jobs to the world and then to the
+entities found by a single area query around the whole group
+==================
+*/
+static void SV_TraceBatchJob (int32_t index, void *data)
+{
+	tracebatch_t	*batch = (tracebatch_t *)data;
+	tracejob_t	*jobs, *job;
+	moveclip_t	clip;
+	edict_t		*touchlist[MAX_EDICTS];
+	vec3_t		mins, maxs;
+	int32_t		i, j, count, num;
+	qboolean	any;
+
+	jobs = batch->jobs + index * TRACE_BATCH;
+	count = min(batch->count - index * TRACE_BATCH, TRACE_BATCH);
+
+	// clip to world
+	CM_BoxTraceBatch (jobs, count, 0);
+
+	// bounds around every move that still has to be clipped
+	any = false;
+	for (i=0 ; i<count ; i++)
+	{
+		job = &jobs[i];
+		job->trace.ent = ge->edicts;
+		if (job->trace.fraction == 0)
+			continue;		// blocked by the world
+
+		SV_TraceBounds (job->start, job->mins, job->maxs, job->end, clip.boxmins, clip.boxmaxs);
+		if (!any)
+		{
+			VectorCopy (clip.boxmins, mins);
+			VectorCopy (clip.boxmaxs, maxs);
+			any = true;
+			continue;
+		}
+		for (j=0 ; j<3 ; j++)
+		{
+			mins[j] = min(mins[j], clip.boxmins[j]);
+			maxs[j] = max(maxs[j], clip.boxmaxs[j]);
+		}
+	}
+	if (!any)
+		return;
+
+	// clip to other solid entities
+	num = SV_AreaEdicts (mins, maxs, touchlist, MAX_EDICTS, AREA_SOLID);
+	if (!num)
+		return;
+
+	for (i=0 ; i<count ; i++)
+	{
+		job = &jobs[i];
+		if (job->trace.fraction == 0)
+			continue;
+
+		clip.trace = job->trace;
+		clip.contentmask = job->contentmask;
+		clip.start = job->start;
+		clip.end = job->end;
+		clip.mins = job->mins;
+		clip.maxs = job->maxs;
+		clip.passedict = (edict_t *)job->passent;
+		VectorCopy (job->mins, clip.mins2);
+		VectorCopy (job->maxs, clip.maxs2);
+		SV_TraceBounds (job->start, clip.mins2, clip.maxs2, job->end, clip.boxmins, clip.boxmaxs);
+
+		SV_ClipMoveToTouchList (&clip, touchlist, num);
+		job->trace = clip.trace;
+	}
+}
+
+/*
+==================
+SV_TraceBatch
+
+Same results as calling SV_Trace on every job in turn.  Groups of
+TRACE_BATCH jobs share their world traversal and area query, and the
+groups are spread across the sv_threads workers.
+==================
+*/
+void SV_TraceBatch (tracejob_t *jobs, int32_t count)
+{
+	tracebatch_t	batch;
+	int32_t		i;
+
+	if (count <= 0)
+		return;
+
+	for (i=0 ; i<count ; i++)
+	{
+		if (!jobs[i].mins)
+			jobs[i].mins = vec3_origin;
+		if (!jobs[i].maxs)
+			jobs[i].maxs = vec3_origin;
+	}
+
+	batch.jobs = jobs;
+	batch.count = count;
+	System::Threads::ParallelFor ((count + TRACE_BATCH - 1) / TRACE_BATCH, SV_TraceBatchJob, &batch);
+}
+
+
+
+/*
+=================
+SV_AreaBench_f
+
+sv_areabench [edicts] [queries]
+
+Packs a dense field of stand-in edicts into the middle of the world and
+runs the same box queries against the old fixed tree and the adaptive
+one, checking that both return the same edicts.  The area tree of the
+running map is put back afterwards.
+=================
+*/
+void SV_AreaBench_f (void)
+{
+	static areanode_t	saved[AREA_NODES];
+	static edict_t		*list[MAX_EDICTS];
+	edict_t		*fakes, *check;
+	vec3_t		worldmins, worldmaxs, center, move;
+	vec3_t		*qmins, *qmaxs;
+	int32_t		numedicts, numqueries, savednum;
+	int32_t		i, j, pass, num, fullest;
+	int32_t		results[2], nodes[2], deepest[2];
+	uint32_t	hash[2];
+	uint64_t	start, elapsed[2];
+	float		side;
+	qboolean	savedsplit;
+
+	numedicts = (Cmd_Argc() > 1) ? atoi (Cmd_Argv(1)) : 2000;
+	numqueries = (Cmd_Argc() > 2) ? atoi (Cmd_Argv(2)) : 20000;
+	numedicts = max(1, min(numedicts, MAX_EDICTS));
+	numqueries = max(1, numqueries);
+
+	if (sv.state == ss_game && sv.models[1])
+	{
+		VectorCopy (sv.models[1]->mins, worldmins);
+		VectorCopy (sv.models[1]->maxs, worldmaxs);
+	}
+	else
+	{
+		VectorSet (worldmins, -4096, -4096, -4096);
+		VectorSet (worldmaxs, 4096, 4096, 4096);
+	}
+	for (i=0 ; i<3 ; i++)
+		center[i] = 0.5 * (worldmins[i] + worldmaxs[i]);
+
+	// monster sized boxes about one box apart, every fifth a larger trigger
+	side = sqrt ((float)numedicts) * 48;
+	fakes = (edict_t *)Z_Malloc (sizeof(edict_t) * numedicts);
+	memset (fakes, 0, sizeof(edict_t) * numedicts);
+	for (i=0 ; i<numedicts ; i++)
+	{
+		check = &fakes[i];
+		check->inuse = true;
+		check->solid = (i % 5 == 4) ? SOLID_TRIGGER : SOLID_BBOX;
+		check->s.origin[0] = center[0] + crand() * side * 0.5;
+		check->s.origin[1] = center[1] + crand() * side * 0.5;
+		check->s.origin[2] = center[2] + crand() * 128;
+		VectorSet (check->mins, -16, -16, -24);
+		VectorSet (check->maxs, 16, 16, 32);
+		if (check->solid == SOLID_TRIGGER)
+		{
+			VectorScale (check->mins, 2, check->mins);
+			VectorScale (check->maxs, 2, check->maxs);
+		}
+		VectorAdd (check->s.origin, check->mins, check->absmin);
+		VectorAdd (check->s.origin, check->maxs, check->absmax);
+	}
+
+	// player sized moves of up to 256 units through the field
+	qmins = (vec3_t *)Z_Malloc (sizeof(vec3_t) * numqueries * 2);
+	qmaxs = qmins + numqueries;
+	for (i=0 ; i<numqueries ; i++)
+	{
+		check = &fakes[rand() % numedicts];
+		for (j=0 ; j<3 ; j++)
+			move[j] = crand() * 256;
+		for (j=0 ; j<3 ; j++)
+		{
+			qmins[i][j] = check->s.origin[j] + min(move[j], 0) - 17;
+			qmaxs[i][j] = check->s.origin[j] + max(move[j], 0) + 17;
+		}
+	}
+
+	memcpy (saved, sv_areanodes, sizeof(saved));
+	savednum = sv_numareanodes;
+	savedsplit = sv_areasplit;
+
+	for (pass=0 ; pass<2 ; pass++)
+	{
+		SV_BuildAreaTree (worldmins, worldmaxs, pass == 1);
+		for (i=0 ; i<numedicts ; i++)
+		{
+			fakes[i].area.prev = fakes[i].area.next = NULL;
+			SV_LinkAreaEdict (&fakes[i]);
+		}
+
+		results[pass] = 0;
+		hash[pass] = 0;
+		start = System::Timer::Microseconds();
+		for (i=0 ; i<numqueries ; i++)
+		{
+			num = SV_AreaEdicts (qmins[i], qmaxs[i], list, MAX_EDICTS, (i & 1) ? AREA_TRIGGERS : AREA_SOLID);
+			results[pass] += num;
+			// order free, the trees may list the same edicts differently
+			for (j=0 ; j<num ; j++)
+				hash[pass] += ((uint32_t)(list[j] - fakes) + 1) * 2654435761u ^ (uint32_t)i;
+		}
+		elapsed[pass] = System::Timer::Microseconds() - start;
+
+		nodes[pass] = sv_numareanodes;
+		deepest[pass] = 0;
+		for (i=0 ; i<sv_numareanodes ; i++)
+		{
+			fullest = SV_CountAreaLinks (&sv_areanodes[i].solid_edicts) + SV_CountAreaLinks (&sv_areanodes[i].trigger_edicts);
+			deepest[pass] = max(deepest[pass], fullest);
+		}
+	}
+
+	memcpy (sv_areanodes, saved, sizeof(saved));
+	sv_numareanodes = savednum;
+	sv_areasplit = savedsplit;
+
+	Z_Free (qmins);
+	Z_Free (fakes);
+
+	Com_Printf ("%i edicts in a %.0f unit square, %i queries\n", numedicts, side, numqueries);
+	Com_Printf ("  fixed tree:    %8.3f ms, %4i nodes, fullest node %4i, %i results\n",
+		elapsed[0] / 1000.0, nodes[0], deepest[0], results[0]);
+	Com_Printf ("  adaptive tree: %8.3f ms, %4i nodes, fullest node %4i, %i results\n",
+		elapsed[1] / 1000.0, nodes[1], deepest[1], results[1]);
+	if (results[0] != results[1] || hash[0] != hash[1])
+		Com_Printf ("WARNING: result sets differ\n");
+}